@@ -6,7 +6,7 @@
 	*
 	* @author        Martin Latter
 	* @copyright     Martin Latter, 17/07/2023
-	* @version       0.01
+	* @version       0.06
 	* @license       GNU GPL version 3.0 (GPL v3); https://www.gnu.org/licenses/gpl-3.0.html
 	* @link          https://github.com/Tinram/MySQL.git
 	*
@@ -188,3 +188,402 @@ int msSleep(unsigned int ms)
 
 	return nanosleep(&req, &rem);
 }
+
+
+/**
+	* Monotonic clock for interval measurement, unaffected by wall-clock adjustments.
+	*
+	* @return  double, seconds
+*/
+
+double monotonicTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+
+/**
+	* Run a monitoring query and store its result, timing both phases.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   char* pSQL, SQL statement
+	* @return  MYSQL_RES*, NULL on error or for statements without a result set
+*/
+
+MYSQL_RES* monQuery(MYSQL* pConn, char const* pSQL)
+{
+	MYSQL_RES* pResult = NULL;
+	double dStart = monotonicTime();
+
+	pTickStats->iTickQueries++;
+
+	int iError = mysql_query(pConn, pSQL);
+	double dSent = monotonicTime();
+
+	if (iError == 0)
+	{
+		pResult = mysql_store_result(pConn);
+	}
+
+	pTickStats->dTickQuery += dSent - dStart;
+	pTickStats->dTickFetch += monotonicTime() - dSent;
+
+	return pResult;
+}
+
+
+/**
+	* Run a monitoring query and stream its result (mysql_use_result): rows are read from the network
+	* as they are fetched, so client memory does not grow with the result size.
+	* Fetch with monFetchRow(), and fetch every row before the next query on the connection.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   char* pSQL, SQL statement
+	* @return  MYSQL_RES*, NULL on error or for statements without a result set
+*/
+
+MYSQL_RES* monQueryStream(MYSQL* pConn, char const* pSQL)
+{
+	MYSQL_RES* pResult = NULL;
+	double dStart = monotonicTime();
+
+	pTickStats->iTickQueries++;
+
+	if (mysql_query(pConn, pSQL) == 0)
+	{
+		pResult = mysql_use_result(pConn);
+	}
+
+	pTickStats->dTickQuery += monotonicTime() - dStart;
+
+	return pResult;
+}
+
+
+/**
+	* Fetch a row of a streamed result, timed as fetch.
+	*
+	* @param   MYSQL_RES* pResult, result from monQueryStream()
+	* @return  MYSQL_ROW, NULL at the end of the result or on error (check mysql_errno)
+*/
+
+MYSQL_ROW monFetchRow(MYSQL_RES* pResult)
+{
+	double dStart = monotonicTime();
+	MYSQL_ROW row = mysql_fetch_row(pResult);
+
+	pTickStats->dTickFetch += monotonicTime() - dStart;
+
+	return row;
+}
+
+
+/**
+	* Execute a prepared monitoring statement, timed as query.
+	* Rows are streamed by monStmtFetch() (no mysql_stmt_store_result).
+	*
+	* @param   MYSQL_STMT* pStmt, prepared statement
+	* @return  integer, 0 on success
+*/
+
+int monStmtExecute(MYSQL_STMT* pStmt)
+{
+	double dStart = monotonicTime();
+
+	pTickStats->iTickQueries++;
+
+	int iResult = mysql_stmt_execute(pStmt);
+
+	pTickStats->dTickQuery += monotonicTime() - dStart;
+
+	return iResult;
+}
+
+
+/**
+	* Fetch a row of a prepared statement into its bound buffers, timed as fetch.
+	*
+	* @param   MYSQL_STMT* pStmt, executed statement
+	* @return  integer, mysql_stmt_fetch() status
+*/
+
+int monStmtFetch(MYSQL_STMT* pStmt)
+{
+	double dStart = monotonicTime();
+
+	int iResult = mysql_stmt_fetch(pStmt);
+
+	pTickStats->dTickFetch += monotonicTime() - dStart;
+
+	return iResult;
+}
+
+
+/**
+	* Start a monitoring tick.
+	*
+	* @return  void
+*/
+
+void monTickStart(void)
+{
+	monStats.iTickQueries = 0;
+	monStats.dTickQuery = 0;
+	monStats.dTickFetch = 0;
+	monStats.dTickStart = monotonicTime();
+}
+
+
+/**
+	* Close a monitoring tick (call before sleeping): time not spent in queries is render.
+	*
+	* @return  void
+*/
+
+void monTickEnd(void)
+{
+	double dRender = monotonicTime() - monStats.dTickStart - monStats.dTickQuery - monStats.dTickFetch;
+
+	if (dRender < 0)
+	{
+		dRender = 0;
+	}
+
+	monStats.iLastQueries = monStats.iTickQueries;
+	monStats.dLastQuery = monStats.dTickQuery;
+	monStats.dLastFetch = monStats.dTickFetch;
+	monStats.dLastRender = dRender;
+
+	monStats.iTicks++;
+	monStats.iQueries += monStats.iTickQueries;
+	monStats.dQuery += monStats.dTickQuery;
+	monStats.dFetch += monStats.dTickFetch;
+	monStats.dRender += dRender;
+}
+
+
+/**
+	* Add query figures collected on other threads (see pTickStats) to the tick just closed.
+	* Their time overlapped the tick instead of being part of it, so render time is unchanged.
+	*
+	* @param   unsigned int iQueries, queries
+	* @param   double dQuery, secs sending and executing
+	* @param   double dFetch, secs reading results
+	* @return  void
+*/
+
+void monTickAdd(unsigned int iQueries, double dQuery, double dFetch)
+{
+	monStats.iLastQueries += iQueries;
+	monStats.dLastQuery += dQuery;
+	monStats.dLastFetch += dFetch;
+
+	monStats.iQueries += iQueries;
+	monStats.dQuery += dQuery;
+	monStats.dFetch += dFetch;
+}
+
+
+/**
+	* Sample server-side statement time and bytes sent for this connection's thread.
+	* Cumulative values: the first sample is the baseline, later samples give per-tick averages.
+	* Taken at most every MON_SAMPLE_INTERVAL secs while the footer is shown, or when forced.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   unsigned int iForce, 1 to sample regardless of footer and interval
+	* @return  void
+*/
+
+void monSample(MYSQL* pConn, unsigned int iForce)
+{
+	double dNow = monotonicTime();
+
+	if (monStats.iServer == 2 || ( ! iForce && monStats.iServer != 0 && ( ! monStats.iFooter || dNow < monStats.dNextSample)))
+	{
+		return;
+	}
+
+	monStats.dNextSample = dNow + MON_SAMPLE_INTERVAL;
+
+	MYSQL_RES* pResult = monQuery(pConn, "\
+		SELECT \
+			(SELECT SUM(SUM_TIMER_WAIT) FROM performance_schema.events_statements_summary_by_thread_by_event_name WHERE THREAD_ID = (SELECT THREAD_ID FROM performance_schema.threads WHERE PROCESSLIST_ID = CONNECTION_ID())), \
+			(SELECT VARIABLE_VALUE FROM performance_schema.session_status WHERE VARIABLE_NAME = 'Bytes_sent') \
+	");
+	MYSQL_ROW row;
+
+	if (pResult == NULL || (row = mysql_fetch_row(pResult)) == NULL || row[0] == NULL || row[1] == NULL)
+	{
+		/* No p_s access: stop asking, unless the connection itself failed (client-side errors start at CR_MIN_ERROR). */
+		if (mysql_errno(pConn) < CR_MIN_ERROR)
+		{
+			monStats.iServer = 2;
+		}
+
+		mysql_free_result(pResult);
+		return;
+	}
+
+	monStats.iPrevTimer = monStats.iTimer;
+	monStats.iPrevBytes = monStats.iBytes;
+	monStats.iPrevTicks = monStats.iSampleTicks;
+	monStats.iTimer = strtoull(row[0], NULL, 10);
+	monStats.iBytes = strtoull(row[1], NULL, 10);
+	monStats.iSampleTicks = monStats.iTicks;
+
+	if (monStats.iServer == 0)
+	{
+		monStats.iBaseTimer = monStats.iTimer;
+		monStats.iBaseBytes = monStats.iBytes;
+		monStats.iBaseTicks = monStats.iTicks;
+		monStats.iPrevTimer = monStats.iTimer;
+		monStats.iPrevBytes = monStats.iBytes;
+		monStats.iPrevTicks = monStats.iTicks;
+		monStats.iServer = 1;
+	}
+
+	mysql_free_result(pResult);
+}
+
+
+/**
+	* Overhead footer line: previous tick client-side, server-side averaged between the last two samples.
+	*
+	* @param   MonStats* pStats, figures to show (monStats, or a copy taken by a collector thread)
+	* @param   int iRow, screen row
+	* @return  void
+*/
+
+void monFooter(MonStats const* pStats, int iRow)
+{
+	if ( ! pStats->iFooter)
+	{
+		return;
+	}
+
+	attron(A_REVERSE);
+	mvprintw(iRow, 0, " mon: %u q/tick  query %.2fms  fetch %.2fms  render %.2fms", pStats->iLastQueries, pStats->dLastQuery * 1000, pStats->dLastFetch * 1000, pStats->dLastRender * 1000);
+
+	uint64_t iTicks = pStats->iSampleTicks - pStats->iPrevTicks;
+
+	if (pStats->iServer == 1 && iTicks > 0)
+	{
+		printw("  server %.0fus/tick  rx %.1fKB/tick ", (double) (pStats->iTimer - pStats->iPrevTimer) / 1e6 / iTicks, (double) (pStats->iBytes - pStats->iPrevBytes) / 1024 / iTicks);
+	}
+	else
+	{
+		printw("  server %s ", (pStats->iServer == 2 ? "n/a (no p_s access)" : "sampling"));
+	}
+
+	attroff(A_REVERSE);
+}
+
+
+/**
+	* Print overhead totals on exit (after endwin()).
+	*
+	* @param   char* pName, application name
+	* @return  void
+*/
+
+void monSummary(char const* pName)
+{
+	if (monStats.iTicks == 0)
+	{
+		return;
+	}
+
+	double dTicks = (double) monStats.iTicks;
+
+	fprintf(stdout, "\n%s overhead: %" PRIu64 " ticks, %.1f queries/tick\n", pName, monStats.iTicks, (double) monStats.iQueries / dTicks);
+	fprintf(stdout, "  client: %.2fms/tick (query %.2fms, fetch %.2fms, render %.2fms)\n", (monStats.dQuery + monStats.dFetch + monStats.dRender) * 1000 / dTicks, monStats.dQuery * 1000 / dTicks, monStats.dFetch * 1000 / dTicks, monStats.dRender * 1000 / dTicks);
+
+	uint64_t iTicks = monStats.iSampleTicks - monStats.iBaseTicks;
+
+	if (monStats.iServer == 1 && iTicks > 0)
+	{
+		fprintf(stdout, "  server: %.0fus/tick, %.1fKB received/tick\n\n", (double) (monStats.iTimer - monStats.iBaseTimer) / 1e6 / iTicks, (double) (monStats.iBytes - monStats.iBaseBytes) / 1024 / iTicks);
+	}
+	else
+	{
+		fprintf(stdout, "  server: n/a\n\n");
+	}
+}
+
+
+/**
+	* Initialise a panel's adaptive interval.
+	*
+	* @param   Cadence* pCad, pointer to cadence
+	* @param   double dBase, normal interval (secs)
+	* @return  void
+*/
+
+void cadenceInit(Cadence* pCad, double dBase)
+{
+	pCad->dBase = dBase;
+	pCad->dInterval = dBase;
+	pCad->dNext = 0;
+	pCad->dLatency = 0;
+	pCad->dShare = CADENCE_LATENCY_SHARE;
+}
+
+
+/**
+	* Whether a panel should be queried this tick.
+	* A tenth of the base interval is allowed for tick jitter.
+	*
+	* @param   Cadence* pCad, pointer to cadence
+	* @param   double dNow, monotonic time (secs)
+	* @return  unsigned integer
+*/
+
+unsigned int cadenceDue(Cadence const* pCad, double dNow)
+{
+	return (dNow + pCad->dBase * 0.1 >= pCad->dNext);
+}
+
+
+/**
+	* Schedule a panel after it was queried.
+	* The interval doubles (up to CADENCE_MAX_FACTOR x base) while the server is under stress or the panel's smoothed
+	* latency exceeds its latency share (default CADENCE_LATENCY_SHARE) of the base interval, and halves back towards base once latency falls below half that.
+	*
+	* @param   Cadence* pCad, pointer to cadence
+	* @param   double dNow, monotonic time (secs)
+	* @param   double dLatency, time the panel's queries took (secs)
+	* @param   unsigned int iStress, 1 if a server stress threshold is crossed
+	* @return  void
+*/
+
+void cadenceUpdate(Cadence* pCad, double dNow, double dLatency, unsigned int iStress)
+{
+	double dLimit = pCad->dBase * pCad->dShare;
+
+	pCad->dLatency = (pCad->dLatency == 0) ? dLatency : 0.7 * pCad->dLatency + 0.3 * dLatency;
+
+	if (iStress || pCad->dLatency > dLimit)
+	{
+		pCad->dInterval *= 2;
+
+		if (pCad->dInterval > pCad->dBase * CADENCE_MAX_FACTOR)
+		{
+			pCad->dInterval = pCad->dBase * CADENCE_MAX_FACTOR;
+		}
+	}
+	else if (pCad->dLatency < dLimit / 2 && pCad->dInterval > pCad->dBase)
+	{
+		pCad->dInterval /= 2;
+
+		if (pCad->dInterval < pCad->dBase)
+		{
+			pCad->dInterval = pCad->dBase;
+		}
+	}
+
+	pCad->dNext = dNow + pCad->dInterval;
+}
@@ -6,14 +6,16 @@
 	*
 	* @author        Martin Latter
 	* @copyright     Martin Latter, 17/07/2023
-	* @version       0.01
+	* @version       0.07
 	* @license       GNU GPL version 3.0 (GPL v3); https://www.gnu.org/licenses/gpl-3.0.html
 	* @link          https://github.com/Tinram/MySQL.git
 	*
 */
 
 
+#include <inttypes.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,10 +23,62 @@
 #include <unistd.h>
 
 #include <curses.h>
+#include <errmsg.h>
 #include <getopt.h>
 #include <mysql.h>
 
 
+#define MON_SAMPLE_INTERVAL 5 /* Secs between server-side overhead samples. */
+#define CADENCE_LATENCY_SHARE 0.1 /* Back off once a panel's queries take more than this share of its base interval. */
+#define CADENCE_FAST_SHARE 0.5 /* Dedicated sampling thread at an explicitly short interval. */
+#define CADENCE_MAX_FACTOR 16
+
+/*
+	* Monitoring overhead of the tool itself.
+	* Client side: every query timed in its send/execute (mysql_query) and fetch (mysql_store_result, or each row when streamed) phases,
+	* the rest of the tick counted as render.
+	* Server side: statement time and bytes sent for the tool's own thread, sampled from performance_schema.
+*/
+typedef struct
+{
+	unsigned int iTickQueries;
+	double dTickStart;
+	double dTickQuery;
+	double dTickFetch;
+	unsigned int iLastQueries; /* Previous complete tick. */
+	double dLastQuery;
+	double dLastFetch;
+	double dLastRender;
+	uint64_t iTicks;
+	uint64_t iQueries;
+	double dQuery;
+	double dFetch;
+	double dRender;
+	unsigned int iServer; /* 0: not sampled yet, 1: available, 2: unavailable */
+	uint64_t iBaseTimer; /* First sample: picoseconds, bytes, ticks. */
+	uint64_t iBaseBytes;
+	uint64_t iBaseTicks;
+	uint64_t iPrevTimer; /* Previous sample. */
+	uint64_t iPrevBytes;
+	uint64_t iPrevTicks;
+	uint64_t iTimer; /* Latest sample. */
+	uint64_t iBytes;
+	uint64_t iSampleTicks;
+	double dNextSample;
+	unsigned int iFooter;
+} MonStats;
+
+/* Adaptive refresh interval of one panel (a group of queries). */
+typedef struct
+{
+	double dBase; /* Secs. */
+	double dInterval; /* Current effective interval. */
+	double dNext; /* Monotonic time the panel is next due. */
+	double dLatency; /* Smoothed query latency, secs. */
+	double dShare; /* Share of the base interval the queries may take before backing off. */
+} Cadence;
+
+
 void signalHandler(int iSig);
 void assignHostname(MYSQL* pConn, char* const aHN, unsigned int iHLen);
 void identifyMySQLVersion(MYSQL* pConn, char* const aV, char* const pMaria, unsigned int* pM, unsigned int* pV8, unsigned int iVLen);
@@ -32,6 +86,21 @@ void identifyAuroraVersion(MYSQL* pConn, char* const aAV, char* const aASID, uns
 void checkPerfSchema(MYSQL* pConn, unsigned int* pPS);
 void replaceChar(char* const aSQL, char const cOrg, char const cRep);
 int msSleep(unsigned int ms);
+double monotonicTime(void);
+MYSQL_RES* monQuery(MYSQL* pConn, char const* pSQL);
+MYSQL_RES* monQueryStream(MYSQL* pConn, char const* pSQL);
+MYSQL_ROW monFetchRow(MYSQL_RES* pResult);
+int monStmtExecute(MYSQL_STMT* pStmt);
+int monStmtFetch(MYSQL_STMT* pStmt);
+void monTickStart(void);
+void monTickEnd(void);
+void monTickAdd(unsigned int iQueries, double dQuery, double dFetch);
+void monSample(MYSQL* pConn, unsigned int iForce);
+void monFooter(MonStats const* pStats, int iRow);
+void monSummary(char const* pName);
+void cadenceInit(Cadence* pCad, double dBase);
+unsigned int cadenceDue(Cadence const* pCad, double dNow);
+void cadenceUpdate(Cadence* pCad, double dNow, double dLatency, unsigned int iStress);
 unsigned int options(int iArgCount, char* const aArgV[]);
 void menu(char* const pFName);
 
@@ -45,3 +114,6 @@ char* const pRoot = "root";
 
 unsigned int iSigCaught = 0;
 unsigned int iPort = 3306;
+
+MonStats monStats;
+__thread MonStats* pTickStats = &monStats; /* Where this thread's query timings go: a worker thread with its own connection may point it at its own figures. */
@@ -5,36 +5,362 @@
 	*
 	* @author        Martin Latter
 	* @copyright     Martin Latter, 06/07/2022
-	* @version       0.28 (from mysqltrxmon)
+	* @version       0.35 (from mysqltrxmon)
 	* @license       GNU GPL version 3.0 (GPL v3); https://www.gnu.org/licenses/gpl-3.0.html
 	* @link          https://github.com/Tinram/MySQL.git
 	*
 	* Compile:
 	* (Linux GCC x64)
 	*                Required dependencies: libmysqlclient-dev, libncurses5-dev
-	*                gcc mysqllockmon.c $(mysql_config --cflags) $(mysql_config --libs) -o mysqllockmon -I../mysql_include/ -lncurses -Ofast -Wall -Wextra -Wuninitialized -Wunused -Werror -std=gnu99 -s
+	*                gcc mysqllockmon.c $(mysql_config --cflags) $(mysql_config --libs) -o mysqllockmon -I../mysql_include/ -lncurses -pthread -Ofast -Wall -Wextra -Wuninitialized -Wunused -Werror -std=gnu99 -s
 	*
 	* Usage:
 	*                ./mysqllockmon --help
-	*                ./mysqllockmon -u <username> [-h <host>] [-t <time (ms)>] [-p <port>]
+	*                ./mysqllockmon -u <username> [-h <host>] [-t <time (ms)>] [-p <port>] [-w]
 */
 
 
 #include <mysql_utils.h>
 #include <mysql_utils.c>
 
+#include <pthread.h>
+
 
 #define APP_NAME "MySQLLockMon"
-#define MB_VERSION "0.28"
+#define MB_VERSION "0.35"
+
+#define GRAPH_NONE UINT32_MAX
+#define GRAPH_QUERY_LEN 160
+#define GRAPH_WAITERS 5 /* Direct waiters listed under each root blocker. */
+#define GRAPH_CYCLE_SHOWN 8 /* Cycle members printed before eliding. */
+#define GRAPH_INNODB 1
+#define GRAPH_MDL 2
+#define SOURCE_JOIN 0 /* Row lock waits: data_lock_waits joined client-side. */
+#define SOURCE_SYS 1 /* Row lock waits: sys.innodb_lock_waits. */
+#define ROW_WAITS_TAG "/* row waits */ " /* Marks the row lock wait statements in the statement history. */
+#define POOL_VIEWS 4 /* Worker connections: one per view. */
+#define POOL_POLL_MS 20 /* UI wait for keys or a finished round. */
+#define HEAT_ENTRIES 1024 /* Table, index and lock mode combinations tracked. */
+#define HEAT_SLOTS 2048 /* Hash slots, power of 2. */
+#define HEAT_HALF_LIFE 300.0 /* Secs for the decayed figures to halve. */
+#define HEAT_COLD 0.05 /* Decayed waits under which an idle combination may be evicted. */
+#define HEAT_BAR 10
+#define SESSION_STALE 64 /* Refreshes a cached session may go unreferenced before it is dropped. */
+#define SESSION_MIN_CAP 64
+
+
+typedef enum
+{
+	TRANSACTIONS,
+	INNODB_LOCK_WAITS,
+	TABLE_LOCK_WAITS,
+	METADATA_LOCKS,
+	CONTENTION_HEATMAP
+} LockType;
+
+
+/* A session in the wait-for graph, keyed by processlist id. */
+typedef struct
+{
+	uint64_t iPid;
+	uint32_t iOutStart; /* Blockers: aOut[iOutStart .. iOutStart + iOut). */
+	uint32_t iOut;
+	uint32_t iInStart; /* Direct waiters: aIn[iInStart .. iInStart + iIn). */
+	uint32_t iIn;
+	uint32_t iParent; /* Blocker it is listed under in the collapsed tree. */
+	uint32_t iTree; /* Transitive waiters in its subtree. */
+	uint32_t iMark;
+	uint32_t iWalk; /* Cycle search: node the walk started from. */
+	uint32_t iNext; /* Cycle search: blocker the walk followed. */
+	uint32_t iCycle; /* Cycle number + 1, 0 if not in a cycle. */
+	unsigned int iWaitSecs;
+	unsigned int iKind; /* GRAPH_INNODB | GRAPH_MDL: the kinds of lock it waits on. */
+	char aObject[96]; /* What it waits on (first edge seen). */
+	char aAge[16]; /* Transaction age, as a blocker. */
+	char aQuery[GRAPH_QUERY_LEN];
+} GraphNode;
+
+typedef struct
+{
+	uint32_t iWaiter;
+	uint32_t iBlocker;
+} GraphEdge;
+
+/*
+	* Waiter -> blocker graph of InnoDB row lock and metadata lock waits, rebuilt each tick.
+	* Buffers are kept between ticks and only grow.
+*/
+typedef struct
+{
+	GraphNode* aNodes;
+	GraphEdge* aEdges;
+	uint32_t* aNodeSlots; /* pid -> node index + 1 */
+	uint32_t* aEdgeSlots; /* (waiter, blocker) -> edge index + 1 */
+	uint32_t* aOut;
+	uint32_t* aIn;
+	uint32_t* aOrder; /* Work queue. */
+	uint64_t* aRank; /* Roots, after graphBuild(): transitive waiters << 32 | node, descending. */
+	uint32_t iCap; /* Edge capacity; nodes <= 2 * edges. */
+	uint32_t iSlots;
+	uint32_t iNodes;
+	uint32_t iEdges;
+	uint32_t iRowEdges;
+	uint32_t iMDLEdges;
+	uint32_t iRoots;
+	uint32_t iCycles;
+	uint32_t iWaiting;
+	unsigned int iSource; /* SOURCE_JOIN or SOURCE_SYS: where its row lock waits came from. */
+} LockGraph;
+
+/* An engine transaction referenced by data_lock_waits. */
+typedef struct
+{
+	uint64_t iTrxId;
+	MYSQL_ROW trx; /* INNODB_TRX: trx id, pid, wait secs, trx age, query; NULL if it ended meanwhile. */
+	MYSQL_ROW lock; /* data_locks: trx id, object of the lock it waits for. */
+	char const* pLockId; /* data_lock_waits: the lock it waits for, NULL if not waiting. */
+} TrxRef;
+
+/* Client-side hash join of data_lock_waits with INNODB_TRX and data_locks, keyed by engine transaction id. */
+typedef struct
+{
+	TrxRef* aRefs;
+	uint32_t* aSlots; /* trx id -> ref index + 1 */
+	MYSQL_ROW* aWaits; /* data_lock_waits rows. */
+	char* pSQL; /* IN list statement. */
+	size_t iSQLCap;
+	uint32_t iCap; /* Wait rows; refs <= 2 * waits. */
+	uint32_t iSlots;
+	uint32_t iRefs;
+	uint32_t iWaits;
+} WaitJoin;
+
+/* Cost of the row lock wait queries of one source, per refresh. */
+typedef struct
+{
+	uint64_t iTicks;
+	double dClient; /* Secs: round trips and result transfer. */
+	double dLastClient;
+	uint64_t iServerTicks;
+	uint64_t iServer; /* Picoseconds: TIMER_WAIT from the statement history. */
+	uint64_t iLastServer;
+} SourceCost;
+
+/* Row lock contention on one table, index and lock mode, as observed in the lock wait graphs. */
+typedef struct
+{
+	char aObject[96]; /* schema.table index mode, as in GraphNode, without backticks. */
+	uint64_t iHash;
+	uint64_t iWaits; /* Whole session: waits seen, wait secs (waiters x time between samples), most waiters at once. */
+	double dWaitSecs;
+	uint32_t iMaxWaiters;
+	uint32_t iWaiters; /* Latest sample. */
+	double dHeatWaits; /* Decayed with HEAT_HALF_LIFE. */
+	double dHeatSecs;
+	double dHeatMax;
+} HeatEntry;
+
+/* A row lock wait of the previous sample: waiter pid and object, and how long it had waited. */
+typedef struct
+{
+	uint64_t iKey;
+	unsigned int iSecs;
+} HeatWait;
 
+/* Rolling aggregation of row lock waits per table, index and lock mode. */
+typedef struct
+{
+	HeatEntry* aEntries;
+	uint32_t* aSlots; /* hash -> entry index + 1 */
+	uint64_t* aRank; /* Decayed wait ms << 32 | entry, hottest first. */
+	HeatWait* aPrev; /* Waits of the previous sample, by key. */
+	HeatWait* aCur;
+	uint32_t iEntries;
+	uint32_t iPrev;
+	uint32_t iWaitCap;
+	uint64_t iSamples;
+	uint64_t iEvicted;
+	uint64_t iUntracked; /* Waits skipped: every tracked combination still hot. */
+	double dLast; /* Monotonic time of the latest sample. */
+	char aSince[16];
+} HeatMap;
+
+/* A metadata lock owner. THREAD_IDs are not reused, so its processlist identity never changes. */
+typedef struct
+{
+	uint64_t iThreadId;
+	uint64_t iPid; /* 0 for a background thread. */
+	uint64_t iSeen; /* Last refresh that referenced it. */
+	char aUser[33];
+	char aHost[64];
+	char aQuery[GRAPH_QUERY_LEN]; /* Statement running at this refresh, empty if none (re-read every refresh). */
+} SessionInfo;
+
+/* Client-side cache of metadata lock owners by THREAD_ID: only new ids are looked up. */
+typedef struct
+{
+	SessionInfo* aEntries;
+	uint32_t* aSlots; /* thread id -> entry index + 1 */
+	uint32_t* aRefs; /* Entries referenced by the current result. */
+	uint32_t* aNew; /* Of which first seen now. */
+	char* pSQL; /* IN list statement. */
+	size_t iSQLCap;
+	uint32_t iCap;
+	uint32_t iSlots;
+	uint32_t iEntries;
+	uint32_t iRefCap;
+	uint64_t iRefreshes;
+	uint64_t iReferenced; /* Owners referenced over all refreshes, and those looked up. */
+	uint64_t iLookedUp;
+} SessionCache;
+
+/* The owners referenced by one metadata locks result, by thread id. */
+typedef struct
+{
+	SessionInfo* aSessions;
+	uint32_t iSessions;
+	uint32_t iCap;
+} SessionSet;
 
-void displayTransactions(MYSQL* pConn, int* pRow);
-void displayInnoDB(MYSQL* pConn, int* pRow);
-void displayTableLockWaits(MYSQL* pConn, int* pRow, unsigned int* pMDL);
-void displayMetadata(MYSQL* pConn, int* pRow, unsigned int* pMDL, unsigned int* pV8);
+/* Settings of one collection, fixed when it starts. */
+typedef struct
+{
+	uint64_t iRound; /* Consecutive collections of the lock wait graph differ by 1. */
+	unsigned int iMDL;
+	unsigned int iV8;
+	unsigned int iSysView;
+	unsigned int iFooter;
+} RoundParams;
+
+/* All four views from one round, collected concurrently. */
+typedef struct
+{
+	RoundParams round;
+	char aTime[16]; /* Wall clock at the start of the round. */
+	double dStart; /* Monotonic. */
+	double dElapsed; /* Secs until the slowest view was in. */
+	unsigned int iAccess; /* INNODB_TRX readable. */
+	char aTrx[24];
+	char aHll[24];
+	MYSQL_RES* aResults[POOL_VIEWS]; /* By LockType; the lock wait graph is built into graph instead. */
+	LockGraph graph;
+	SourceCost aCost[2]; /* Row lock wait source costs, as of this round. */
+	SessionSet sessions; /* Metadata lock owners. */
+	unsigned int iQueries; /* The workers' query figures for the round. */
+	double dQuery;
+	double dFetch;
+} LockSnapshot;
+
+/* A worker thread: its own connection, one view. */
+typedef struct
+{
+	pthread_t tThread;
+	MYSQL* pConn;
+	LockType view_t;
+	WaitJoin join; /* Lock wait graph worker only. */
+	SessionCache cache; /* Metadata locks worker only. */
+	MonStats stats; /* Its query timings, through pTickStats. */
+	unsigned int iRunning;
+} PoolWorker;
+
+/*
+	* Worker pool: the UI thread starts a round into the snapshot it is not showing,
+	* each worker collects its view, and the last one in completes the round.
+*/
+typedef struct
+{
+	PoolWorker aWorkers[POOL_VIEWS];
+	LockSnapshot aSnaps[2];
+	LockSnapshot* pFilling; /* Round in progress, NULL when idle. Set and cleared by the UI thread, under mLock. */
+	pthread_mutex_t mLock;
+	pthread_cond_t cStart;
+	uint64_t iRound; /* Rounds started. */
+	unsigned int iPending; /* Workers still collecting. */
+	unsigned int iStop;
+	unsigned int iInit;
+} LockPool;
+
+
+
+MYSQL_RES* queryTransactions(MYSQL* pConn);
+void displayTransactions(MYSQL_RES* result_q, int* pRow, LockGraph const* pGraph);
+void collectGraph(MYSQL* pConn, LockGraph* pGraph, WaitJoin* pJoin, RoundParams const* pRound);
+void displayInnoDB(LockGraph const* pGraph, SourceCost const* aCost, int* pRow, RoundParams const* pRound);
+void displayRoot(LockGraph const* pGraph, uint32_t iRoot, int* pRow);
+MYSQL_RES* queryTableLockWaits(MYSQL* pConn);
+void displayTableLockWaits(MYSQL_RES* result_q, int* pRow, unsigned int* pMDL);
+MYSQL_RES* queryMetadata(MYSQL* pConn, unsigned int iV8);
+void displayMetadata(MYSQL_RES* result_q, SessionSet const* pSessions, int* pRow, unsigned int* pMDL, unsigned int* pV8);
+void checkMDL(MYSQL* pConn, unsigned int* pMDL);
+unsigned int sessionReserve(SessionCache* pCache, uint32_t iRows);
+void sessionRehash(SessionCache* pCache, unsigned int iPrune);
+uint32_t sessionEntry(SessionCache const* pCache, uint64_t iThreadId);
+void sessionResolve(MYSQL* pConn, SessionCache* pCache, MYSQL_RES* pResult, unsigned int iCol, SessionSet* pSet);
+MYSQL_RES* sessionQuery(MYSQL* pConn, SessionCache* pCache, char const* pHead, size_t iHeadLen, uint32_t const* aEntries, uint32_t iCount);
+int sessionCompare(void const* pA, void const* pB);
+SessionInfo const* sessionFind(SessionSet const* pSet, uint64_t iThreadId);
+void sessionCacheFree(SessionCache* pCache);
+void sessionSummary(SessionCache const* pCache);
+unsigned int graphReserve(LockGraph* pGraph, uint32_t iEdges);
+void graphFree(LockGraph* pGraph);
+uint32_t graphHash(uint64_t iKey);
+uint32_t graphNode(LockGraph* pGraph, uint64_t iPid);
+uint32_t graphFind(LockGraph const* pGraph, uint64_t iPid);
+char const* graphKind(unsigned int iKind);
+void graphAddRow(LockGraph* pGraph, MYSQL_ROW row, unsigned int iKind);
+void graphBuild(LockGraph* pGraph);
+uint32_t graphStuckBlocker(LockGraph const* pGraph, uint32_t iNode);
+int rankCompare(void const* pA, void const* pB);
+void graphText(char* const aDest, char const* pSrc, size_t iSize);
+unsigned int joinReserve(WaitJoin* pJoin, uint32_t iWaits);
+void joinFree(WaitJoin* pJoin);
+TrxRef* joinRef(WaitJoin* pJoin, char const* pTrxId, unsigned int iInsert);
+MYSQL_RES* joinQuery(MYSQL* pConn, WaitJoin* pJoin, char const* pHead, size_t iLen, unsigned int iLocks);
+void joinWaits(MYSQL* pConn, WaitJoin* pJoin, MYSQL_RES* pWaits, LockGraph* pGraph);
+void sourceCost(MYSQL* pConn, unsigned int iSource, double dClient, RoundParams const* pRound);
+void sourceSummary(void);
+unsigned int heatInit(HeatMap* pHeat);
+void heatFree(HeatMap* pHeat);
+double heatDecay(double dSecs);
+uint64_t heatHash(char const* pObject);
+uint32_t heatEntry(HeatMap* pHeat, char const* pObject, uint64_t* pHash);
+void heatEvict(HeatMap* pHeat);
+void heatSample(HeatMap* pHeat, LockGraph const* pGraph, double dNow, double dMaxStep);
+int heatWaitCompare(void const* pA, void const* pB);
+void heatSplit(HeatEntry const* pEntry, char* const aTable, size_t iSize, char const** pIndex, char const** pMode);
+void displayHeatmap(HeatMap const* pHeat, int* pRow);
+void heatExport(HeatMap const* pHeat);
+unsigned int poolStart(LockPool* pPool);
+void poolStop(LockPool* pPool);
+void poolRound(LockPool* pPool, RoundParams const* pRound);
+LockSnapshot* poolCollected(LockPool* pPool);
+void* workerThread(void* pArg);
+void collectView(PoolWorker* pWorker, LockSnapshot* pSnap);
+void snapshotClear(LockSnapshot* pSnap);
+MYSQL_RES* snapshotResult(LockSnapshot* pSnap, LockType view_t);
 
 
 unsigned int iTime = 250; // millisecs
+unsigned int iWorkers = 0; /* 1: collect all views concurrently on worker connections. */
+
+Cadence cadView;
+
+LockGraph lockGraph;
+
+WaitJoin waitJoin;
+
+SourceCost aSourceCost[2];
+unsigned int iSysView = 0; /* 8.0: 1 to read row lock waits from the sys view instead. */
+unsigned int iHistory = 0; /* Statement history: 0 not read yet, 1 available, 2 unavailable. */
+uint64_t iHistoryEvent = 0; /* Last EVENT_ID read from the history. */
+uint64_t iHistoryTick = 0;
+
+LockPool lockPool;
+
+HeatMap heatMap;
+
+SessionCache sessionCache;
+SessionSet sessionSet;
 
 
 int main(int iArgCount, char* const aArgV[])
@@ -47,16 +373,10 @@ int main(int iArgCount, char* const aArgV[])
 		return EXIT_FAILURE;
 	}
 
-	typedef enum
-	{
-		TRANSACTIONS,
-		INNODB_LOCK_WAITS,
-		TABLE_LOCK_WAITS,
-		METADATA_LOCKS
-	} LockType;
-
 	MYSQL* pConn;
 	LockType displayChoice_t = TRANSACTIONS;
+	LockSnapshot* pCur = NULL; /* Worker pool: snapshot on screen. */
+	RoundParams round;
 	char* const pMaria = "MariaDB";
 	char aHostname[50];
 	char aVersion[7];
@@ -71,6 +391,9 @@ int main(int iArgCount, char* const aArgV[])
 	unsigned int iAurora = 0;
 	unsigned int iAccess = 0;
 	unsigned int iMDL = 0;
+	unsigned int iNew = 0;
+
+	memset(&round, 0, sizeof(RoundParams));
 
 	if (signal(SIGINT, signalHandler) == SIG_ERR)
 	{
@@ -147,12 +470,116 @@ int main(int iArgCount, char* const aArgV[])
 	init_pair(5, COLOR_BLUE, COLOR_BLACK);
 	curs_set(0);
 
+	cadenceInit(&cadView, (double) iTime / 1000);
+
+	heatInit(&heatMap);
+
+	if (iWorkers && ! poolStart(&lockPool))
+	{
+		poolStop(&lockPool);
+		endwin();
+		fprintf(stderr, "\nCannot open the worker connections.\n\n");
+		mysql_close(pConn);
+		return EXIT_FAILURE;
+	}
+
 	while ( ! iSigCaught)
 	{
+		/* The following works around ncurses loop peculiarities. */
+
+		iKey = getch();
+
+		if (iKey == KEY_UP)
+		{
+			displayChoice_t = TRANSACTIONS;
+		}
+		else if (iKey == KEY_DOWN)
+		{
+			displayChoice_t = INNODB_LOCK_WAITS;
+		}
+		else if (iKey == KEY_LEFT)
+		{
+			displayChoice_t = TABLE_LOCK_WAITS;
+		}
+		else if (iKey == KEY_RIGHT)
+		{
+			displayChoice_t = METADATA_LOCKS;
+		}
+		else if (iKey == 'h')
+		{
+			displayChoice_t = CONTENTION_HEATMAP;
+		}
+		else if (iKey == 'f')
+		{
+			monStats.iFooter = ! monStats.iFooter;
+		}
+		else if (iKey == 's')
+		{
+			iSysView = ! iSysView;
+		}
+
+		round.iMDL = iMDL;
+		round.iV8 = iV8;
+		round.iSysView = iSysView;
+		round.iFooter = monStats.iFooter;
+
+		if (iWorkers)
+		{
+			/* Views are drawn from the latest complete snapshot: a key redraws at once, a finished round replaces it. */
+			LockSnapshot* pDone = poolCollected(&lockPool);
+
+			if (pDone != NULL)
+			{
+				pCur = pDone;
+			}
+
+			if (lockPool.pFilling == NULL && cadenceDue(&cadView, monotonicTime()))
+			{
+				if (iMDL != 1 && iPS == 1)
+				{
+					checkMDL(pConn, &iMDL);
+					round.iMDL = iMDL;
+				}
+
+				poolRound(&lockPool, &round);
+			}
+
+			if (pDone == NULL && iKey == ERR)
+			{
+				msSleep(POOL_POLL_MS);
+				continue;
+			}
+
+			iNew = (pDone != NULL);
+
+			if (iNew)
+			{
+				/* Every round's graph feeds the heatmap, whichever view is shown. */
+				heatSample(&heatMap, &pCur->graph, pCur->dStart, cadView.dInterval);
+			}
+		}
+		else if (iKey == ERR && ! cadenceDue(&cadView, monotonicTime()))
+		{
+			/* Backed off: keep the last screen until due, unless a key asks for a redraw. */
+			msSleep(iTime);
+			continue;
+		}
+
+		monTickStart();
+
+		monSample(pConn, 0);
+
 		clear();
 		iRow = 1;
 
 		mvprintw(iRow, 1, APP_NAME);
+		mvprintw(iRow, 20, "interval: %.0fms%s", cadView.dInterval * 1000, (cadView.dInterval > cadView.dBase ? " (backed off)" : ""));
+
+		if (pCur != NULL)
+		{
+			mvprintw(iRow, 60, "snapshot: %s, collected in %.1fms on %u connections", pCur->aTime, pCur->dElapsed * 1000, POOL_VIEWS);
+		}
+
 		iRow += 2;
 
 		attron(A_BOLD);
@@ -175,66 +602,44 @@ int main(int iArgCount, char* const aArgV[])
 			mvprintw(iRow += 1, 1, "%s (au: %s)", aVersion, aAuroraVersion);
 		}
 
-		/* TRX at InnoDB layer. */
-		mysql_query(pConn, "SELECT COUNT(*) FROM information_schema.INNODB_TRX"); /* Includes RUNNING, LOCK WAIT, ROLLING BACK, COMMITTING */
-		MYSQL_RES* result_acttr = mysql_store_result(pConn);
-
-		if (mysql_errno(pConn) == 0)
+		if (iWorkers)
 		{
-			iAccess = 1;
-			MYSQL_ROW row_acttr = mysql_fetch_row(result_acttr);
-			attrset(COLOR_PAIR(4));
-			mvprintw(iRow += 2, 1, "trx: %s", row_acttr[0]);
-
-			/* History List Length */
-			mysql_query(pConn, "SELECT COUNT FROM information_schema.INNODB_METRICS WHERE NAME = 'trx_rseg_history_len'");
-			MYSQL_RES* result_hll = mysql_store_result(pConn);
-			MYSQL_ROW row_hll = mysql_fetch_row(result_hll);
-			mvprintw(iRow += 1, 1, "hll: %s", row_hll[0]);
-			attrset(A_NORMAL);
-			mysql_free_result(result_hll);
+			if (pCur != NULL && pCur->iAccess == 1)
+			{
+				iAccess = 1;
+				attrset(COLOR_PAIR(4));
+				mvprintw(iRow += 2, 1, "trx: %s", pCur->aTrx);
+				mvprintw(iRow += 1, 1, "hll: %s", pCur->aHll);
+				attrset(A_NORMAL);
+			}
+		}
+		else
+		{
+			/* TRX at InnoDB layer. */
+			MYSQL_RES* result_acttr = monQuery(pConn, "SELECT COUNT(*) FROM information_schema.INNODB_TRX"); /* Includes RUNNING, LOCK WAIT, ROLLING BACK, COMMITTING */
 
-			if (iMDL != 1 && iPS == 1)
+			if (mysql_errno(pConn) == 0)
 			{
-				mysql_query(pConn, "SELECT ENABLED FROM performance_schema.setup_instruments WHERE NAME = 'wait/lock/metadata/sql/mdl'");
-				MYSQL_RES* result_mdl = mysql_store_result(pConn);
-				MYSQL_ROW row_mdl = mysql_fetch_row(result_mdl);
-				mysql_free_result(result_mdl);
+				iAccess = 1;
+				MYSQL_ROW row_acttr = mysql_fetch_row(result_acttr);
+				attrset(COLOR_PAIR(4));
+				mvprintw(iRow += 2, 1, "trx: %s", row_acttr[0]);
+
+				/* History List Length */
+				MYSQL_RES* result_hll = monQuery(pConn, "SELECT COUNT FROM information_schema.INNODB_METRICS WHERE NAME = 'trx_rseg_history_len'");
+				MYSQL_ROW row_hll = mysql_fetch_row(result_hll);
+				mvprintw(iRow += 1, 1, "hll: %s", row_hll[0]);
+				attrset(A_NORMAL);
+				mysql_free_result(result_hll);
 
-				if (strstr(row_mdl[0], "YES") != NULL)
+				if (iMDL != 1 && iPS == 1)
 				{
-					iMDL = 1;
-				}
-				else
-				{
-					/* Attempt UPDATE of p_s instrumentation for versions 5.x, to avoid manually updating. */
-					mysql_query(pConn, "UPDATE performance_schema.setup_instruments SET ENABLED = 'YES' WHERE NAME = 'wait/lock/metadata/sql/mdl'");
+					checkMDL(pConn, &iMDL);
+					round.iMDL = iMDL;
 				}
 			}
-		}
 
-		mysql_free_result(result_acttr);
-
-
-		/* The following works around ncurses loop peculiarities. */
-
-		iKey = getch();
-
-		if (iKey == KEY_UP)
-		{
-			displayChoice_t = TRANSACTIONS;
-		}
-		else if (iKey == KEY_DOWN)
-		{
-			displayChoice_t = INNODB_LOCK_WAITS;
-		}
-		else if (iKey == KEY_LEFT)
-		{
-			displayChoice_t = TABLE_LOCK_WAITS;
-		}
-		else if (iKey == KEY_RIGHT)
-		{
-			displayChoice_t = METADATA_LOCKS;
+			mysql_free_result(result_acttr);
 		}
 
 
@@ -244,41 +649,129 @@ int main(int iArgCount, char* const aArgV[])
 			mvprintw(iRow += 2, 1, "performance schema disabled");
 			attrset(A_NORMAL);
 		}
+		else if (iWorkers && pCur == NULL)
+		{
+			mvprintw(iRow += 2, 1, "collecting ...");
+		}
 		else if (iAccess == 0)
 		{
 			attrset(A_BOLD | COLOR_PAIR(4));
 			mvprintw(iRow += 2, 1, "no user privilege access");
 			attrset(A_NORMAL);
 		}
+		else if (iWorkers)
+		{
+			/* Every view from the same round; the transactions view is annotated from its lock wait graph. */
+			if (displayChoice_t == TRANSACTIONS)
+			{
+				displayTransactions(snapshotResult(pCur, TRANSACTIONS), &iRow, &pCur->graph);
+			}
+			else if (displayChoice_t == INNODB_LOCK_WAITS)
+			{
+				displayInnoDB(&pCur->graph, pCur->aCost, &iRow, &pCur->round);
+			}
+			else if (displayChoice_t == TABLE_LOCK_WAITS)
+			{
+				displayTableLockWaits(snapshotResult(pCur, TABLE_LOCK_WAITS), &iRow, &pCur->round.iMDL);
+			}
+			else if (displayChoice_t == METADATA_LOCKS)
+			{
+				displayMetadata(snapshotResult(pCur, METADATA_LOCKS), &pCur->sessions, &iRow, &pCur->round.iMDL, &pCur->round.iV8);
+			}
+			else if (displayChoice_t == CONTENTION_HEATMAP)
+			{
+				displayHeatmap(&heatMap, &iRow);
+			}
+		}
 		else
 		{
+			/* The lock wait graph feeds the heatmap every refresh, whichever view is shown (its cost stretches cadView). */
+			round.iRound = monStats.iTicks;
+			collectGraph(pConn, &lockGraph, &waitJoin, &round);
+			heatSample(&heatMap, &lockGraph, monotonicTime(), cadView.dInterval);
+
 			if (displayChoice_t == TRANSACTIONS)
 			{
-				displayTransactions(pConn, &iRow);
+				MYSQL_RES* result_q = queryTransactions(pConn);
+				displayTransactions(result_q, &iRow, NULL);
+				mysql_free_result(result_q);
 			}
 			else if (displayChoice_t == INNODB_LOCK_WAITS)
 			{
-				displayInnoDB(pConn, &iRow);
+				displayInnoDB(&lockGraph, aSourceCost, &iRow, &round);
 			}
 			else if (displayChoice_t == TABLE_LOCK_WAITS)
 			{
-				displayTableLockWaits(pConn, &iRow, &iMDL);
+				MYSQL_RES* result_q = (iMDL == 1) ? queryTableLockWaits(pConn) : NULL;
+				displayTableLockWaits(result_q, &iRow, &iMDL);
+				mysql_free_result(result_q);
 			}
 			else if (displayChoice_t == METADATA_LOCKS)
 			{
-				displayMetadata(pConn, &iRow, &iMDL, &iV8);
+				MYSQL_RES* result_q = (iMDL == 1) ? queryMetadata(pConn, iV8) : NULL;
+
+				if (result_q != NULL)
+				{
+					sessionResolve(pConn, &sessionCache, result_q, 6, &sessionSet);
+				}
+
+				displayMetadata(result_q, &sessionSet, &iRow, &iMDL, &iV8);
+				mysql_free_result(result_q);
+			}
+			else if (displayChoice_t == CONTENTION_HEATMAP)
+			{
+				displayHeatmap(&heatMap, &iRow);
 			}
 		}
 
+		monFooter(&monStats, LINES - 1);
+
 		refresh();
 
-		msSleep(iTime);
+		monTickEnd();
+
+		if (iWorkers)
+		{
+			if (iNew)
+			{
+				/* The workers' query time overlapped the UI's: counted, but not against render. */
+				monTickAdd(pCur->iQueries, pCur->dQuery, pCur->dFetch);
+
+				/* A round takes as long as its slowest view: stretch the interval while rounds are slow. */
+				cadenceUpdate(&cadView, monotonicTime(), pCur->dElapsed, 0);
+			}
+		}
+		else
+		{
+			/* sys views get expensive as lock counts grow: stretch the interval while queries are slow. */
+			cadenceUpdate(&cadView, monotonicTime(), monStats.dLastQuery + monStats.dLastFetch, 0);
+
+			msSleep(iTime);
+		}
 	}
 
+	monSample(pConn, 1);
+
+	poolStop(&lockPool);
+	graphFree(&lockGraph);
+	joinFree(&waitJoin);
+
 	curs_set(1);
 
 	endwin();
 
+	monSummary(APP_NAME);
+
+	sourceSummary();
+
+	sessionSummary(iWorkers ? &lockPool.aWorkers[METADATA_LOCKS].cache : &sessionCache);
+
+	heatExport(&heatMap);
+	heatFree(&heatMap);
+
+	sessionCacheFree(&sessionCache);
+	free(sessionSet.aSessions);
+
 	mysql_close(pConn);
 
 	return EXIT_SUCCESS;
@@ -286,18 +779,15 @@ int main(int iArgCount, char* const aArgV[])
 
 
 /**
-	* Transactions display.
+	* Transactions query.
 	*
 	* @param   MYSQL* pConn, connection pointer
-	* @param   int* pRow, pointer to iRow
-	* @return  void
+	* @return  MYSQL_RES*, NULL on error
 */
 
-void displayTransactions(MYSQL* pConn, int* pRow)
+MYSQL_RES* queryTransactions(MYSQL* pConn)
 {
-	int iRow = *pRow;
-
-	mysql_query(pConn, "\
+	return monQuery(pConn, "\
 		SELECT \
 			thd.THREAD_ID, thd.PROCESSLIST_ID, stmt.ROWS_EXAMINED, trx.trx_rows_locked, trx.trx_rows_modified, stmt.ROWS_AFFECTED, stmt.CREATED_TMP_DISK_TABLES, trx.trx_tables_locked, stmt.NO_INDEX_USED, ROUND(stmt.TIMER_WAIT/1000000000000, 4), trx.trx_started, TO_SECONDS(NOW()) - TO_SECONDS(trx.trx_started), thd.PROCESSLIST_USER, trx.trx_state, trx.trx_operation_state, stmt.SQL_TEXT \
 		FROM \
@@ -307,8 +797,22 @@ void displayTransactions(MYSQL* pConn, int* pRow)
 		INNER JOIN \
 			performance_schema.events_statements_current stmt USING (THREAD_ID) \
 	");
+}
+
 
-	MYSQL_RES* result_q = mysql_store_result(pConn);
+/**
+	* Transactions display.
+	* With a lock wait graph from the same snapshot, each transaction is annotated with what it waits on and who queues behind it.
+	*
+	* @param   MYSQL_RES* result_q, queryTransactions() result
+	* @param   int* pRow, pointer to iRow
+	* @param   LockGraph* pGraph, lock wait graph collected with result_q, or NULL
+	* @return  void
+*/
+
+void displayTransactions(MYSQL_RES* result_q, int* pRow, LockGraph const* pGraph)
+{
+	int iRow = *pRow;
 	MYSQL_ROW row_res;
 
 	iRow += 3;
@@ -317,7 +821,7 @@ void displayTransactions(MYSQL* pConn, int* pRow)
 	attrset(A_NORMAL);
 	iRow = 12;
 
-	while ((row_res = mysql_fetch_row(result_q)))
+	while (result_q != NULL && (row_res = mysql_fetch_row(result_q)))
 	{
 		if (row_res != NULL)
 		{
@@ -359,6 +863,30 @@ void displayTransactions(MYSQL* pConn, int* pRow)
 			mvprintw(iRow += 2, 1, "%s", row_res[13]);
 			attroff(COLOR_PAIR(5));
 
+			if (pGraph != NULL && row_res[1] != NULL)
+			{
+				uint32_t iNode = graphFind(pGraph, strtoull(row_res[1], NULL, 10));
+
+				if (iNode != GRAPH_NONE)
+				{
+					GraphNode const* pNode = &pGraph->aNodes[iNode];
+
+					attrset(A_BOLD | COLOR_PAIR(4));
+
+					if (pNode->iOut > 0)
+					{
+						mvprintw(iRow, 20, "waits on %" PRIu64 " (%s, %us)", pGraph->aNodes[pGraph->aOut[pNode->iOutStart]].iPid, graphKind(pNode->iKind), pNode->iWaitSecs);
+					}
+
+					if (pNode->iTree > 0)
+					{
+						mvprintw(iRow, 60, "%s: %" PRIu32 " waiting behind it", (pNode->iOut == 0 ? "root blocker" : "blocking"), pNode->iTree);
+					}
+
+					attrset(A_NORMAL);
+				}
+			}
+
 			if (row_res[14] != NULL)
 			{
 				attrset(A_BOLD | COLOR_PAIR(3));
@@ -386,131 +914,352 @@ void displayTransactions(MYSQL* pConn, int* pRow)
 		iRow += 4;
 	}
 
-	mysql_free_result(result_q);
 }
 
 
 /**
-	* InnoDB lock waits display.
+	* Collect the wait-for graph of row lock waits and, when instrumented, metadata lock waits.
+	* On 8.0 row lock waits are read from data_lock_waits and joined here (joinWaits()), or from the sys view ('s').
 	*
 	* @param   MYSQL* pConn, connection pointer
-	* @param   int* pRow, pointer to iRow
+	* @param   LockGraph* pGraph, graph to build
+	* @param   WaitJoin* pJoin, join buffers
+	* @param   RoundParams* pRound, collection settings
 	* @return  void
 */
 
-void displayInnoDB(MYSQL* pConn, int* pRow)
+void collectGraph(MYSQL* pConn, LockGraph* pGraph, WaitJoin* pJoin, RoundParams const* pRound)
 {
-	int iRow = *pRow;
-
-	mysql_query(pConn, "\
-		SELECT \
-			wait_age_secs, locked_table, locked_index, locked_type, waiting_trx_rows_locked, waiting_trx_rows_modified, waiting_query, waiting_lock_mode, blocking_pid, blocking_query, blocking_lock_mode, blocking_trx_age, blocking_trx_rows_locked, blocking_trx_rows_modified, sql_kill_blocking_query \
-		FROM \
-			sys.innodb_lock_waits \
-	");
-
-	MYSQL_RES* result_q = mysql_store_result(pConn);
+	uint32_t iRows = 0;
+	unsigned int iSource = (pRound->iV8 == 1 && ! pRound->iSysView) ? SOURCE_JOIN : SOURCE_SYS;
+	double dStart = pTickStats->dTickQuery + pTickStats->dTickFetch;
+	double dClient;
+	MYSQL_RES* result_q;
+	MYSQL_RES* result_mdl = NULL;
 	MYSQL_ROW row_res;
 
-	iRow += 3;
-	attrset(A_BOLD | COLOR_PAIR(2));
-	mvprintw(iRow, 1, "innodb lock waits");
-	attrset(A_NORMAL);
-	iRow = 12;
+	if (iSource == SOURCE_JOIN)
+	{
+		/* Raw wait pairs only: the sys view joins data_locks and INNODB_TRX twice and formats every row server-side. */
+		result_q = monQuery(pConn, ROW_WAITS_TAG "\
+			SELECT \
+				REQUESTING_ENGINE_TRANSACTION_ID, BLOCKING_ENGINE_TRANSACTION_ID, REQUESTING_ENGINE_LOCK_ID \
+			FROM \
+				performance_schema.data_lock_waits \
+		");
+	}
+	else
+	{
+		/* Same column layout as the MDL source: waiter, blocker, wait secs, object, waiting query, blocking query, blocking trx age. */
+		result_q = monQuery(pConn, ROW_WAITS_TAG "\
+			SELECT \
+				waiting_pid, blocking_pid, wait_age_secs, CONCAT_WS(' ', locked_table, locked_index, waiting_lock_mode), waiting_query, blocking_query, blocking_trx_age \
+			FROM \
+				sys.innodb_lock_waits \
+		");
+	}
 
-	while ((row_res = mysql_fetch_row(result_q)))
+	dClient = pTickStats->dTickQuery + pTickStats->dTickFetch - dStart;
+
+	if (result_q != NULL)
 	{
-		if (row_res != NULL)
-		{
-			mvprintw(iRow, 1, "locked table");
-			iRow++;
-			attrset(A_BOLD | COLOR_PAIR(1));
-			mvprintw(iRow, 1, "%s", row_res[1]);
-			attrset(A_NORMAL);
+		iRows += (uint32_t) mysql_num_rows(result_q);
+	}
 
-			iRow += 2;
-			mvprintw(iRow, 1, "wait/s");
-			mvprintw(iRow, 10, "lkd index");
-			mvprintw(iRow, 24, "lkd type");
-			mvprintw(iRow, 37, "w-lkd");
-			mvprintw(iRow, 47, "w-mod");
-			mvprintw(iRow, 57, "w-mode");
-			mvprintw(iRow, 75, "b-pid");
-			mvprintw(iRow, 85, "b-mode");
-			mvprintw(iRow, 104, "b-lkd");
-			mvprintw(iRow, 113, "b-mod");
-			mvprintw(iRow, 126, "b-time");
+	if (pRound->iMDL == 1)
+	{
+		result_mdl = monQuery(pConn, "\
+			SELECT \
+				waiting_pid, blocking_pid, waiting_query_secs, CONCAT_WS(' ', CONCAT(object_schema, '.', object_name), waiting_lock_type), waiting_query, NULL, NULL \
+			FROM \
+				sys.schema_table_lock_waits \
+		");
 
-			iRow++;
-			attrset(A_BOLD | COLOR_PAIR(1));
+		if (result_mdl != NULL)
+		{
+			iRows += (uint32_t) mysql_num_rows(result_mdl);
+		}
+	}
 
-			mvprintw(iRow, 1, "%s", row_res[0]);
-			mvprintw(iRow, 10, "%s", row_res[2]);
-			mvprintw(iRow, 24, "%s", row_res[3]);
-			mvprintw(iRow, 37, "%s", row_res[4]);
-			mvprintw(iRow, 47, "%s", row_res[5]);
-			mvprintw(iRow, 57, "%s", row_res[7]);
-			mvprintw(iRow, 75, "%s", row_res[8]);
-			mvprintw(iRow, 85, "%s", row_res[10]);
-			mvprintw(iRow, 104, "%s", row_res[12]);
-			mvprintw(iRow, 113, "%s", row_res[13]);
-			mvprintw(iRow, 126, "%s", row_res[11]);
-
-			if (row_res[6] != NULL)
-			{
-				char aQuery[300];
-				unsigned int iQLen = sizeof(aQuery) - 1;
-				strncpy(aQuery, row_res[6], iQLen);
-				aQuery[iQLen] = '\0';
+	if ( ! graphReserve(pGraph, iRows))
+	{
+		mysql_free_result(result_q);
+		mysql_free_result(result_mdl);
+		return;
+	}
 
-				/* Remove LFs. */
-				replaceChar(aQuery, '\n', ' ');
+	pGraph->iSource = iSource;
 
-				attron(COLOR_PAIR(5));
-				mvprintw(iRow += 2, 1, "%s", aQuery);
-				attroff(COLOR_PAIR(5));
+	if (iSource == SOURCE_JOIN)
+	{
+		dStart = pTickStats->dTickQuery + pTickStats->dTickFetch;
+		joinWaits(pConn, pJoin, result_q, pGraph);
+		dClient += pTickStats->dTickQuery + pTickStats->dTickFetch - dStart;
+	}
+	else
+	{
+		while (result_q != NULL && (row_res = mysql_fetch_row(result_q)))
+		{
+			graphAddRow(pGraph, row_res, GRAPH_INNODB);
+		}
+	}
+
+	while (result_mdl != NULL && (row_res = mysql_fetch_row(result_mdl)))
+	{
+		graphAddRow(pGraph, row_res, GRAPH_MDL);
+	}
+
+	mysql_free_result(result_q);
+	mysql_free_result(result_mdl);
+
+	sourceCost(pConn, iSource, dClient, pRound);
+
+	graphBuild(pGraph);
+}
+
+
+/**
+	* InnoDB lock waits display: the wait-for graph.
+	* Root blockers (blocking, not waiting) are ranked by transitive waiters, each listed kill statement first,
+	* then its largest direct waiters; sessions deadlocked across lock types are listed as cycles.
+	*
+	* @param   LockGraph* pGraph, graph from collectGraph()
+	* @param   SourceCost* aCost, cost of each row lock wait source
+	* @param   int* pRow, pointer to iRow
+	* @param   RoundParams* pRound, settings the graph was collected with
+	* @return  void
+*/
+
+void displayInnoDB(LockGraph const* pGraph, SourceCost const* aCost, int* pRow, RoundParams const* pRound)
+{
+	int iRow = *pRow;
+	int iCol;
+	uint32_t i;
+
+	iRow += 3;
+	attrset(A_BOLD | COLOR_PAIR(2));
+	mvprintw(iRow, 1, "lock wait graph");
+	attrset(A_NORMAL);
+
+	if (pGraph->aNodes == NULL)
+	{
+		attrset(A_BOLD | COLOR_PAIR(4));
+		mvprintw(iRow, 20, "out of memory");
+		attrset(A_NORMAL);
+		return;
+	}
+
+	mvprintw(iRow, 20, "waiting: %" PRIu32 "   root blockers: %" PRIu32 "   cycles: %" PRIu32 "   edges: %" PRIu32 " (row %" PRIu32 ", mdl %" PRIu32 ")%s",
+		pGraph->iWaiting, pGraph->iRoots - pGraph->iCycles, pGraph->iCycles, pGraph->iEdges, pGraph->iRowEdges, pGraph->iMDLEdges,
+		(pRound->iMDL == 1 ? "" : "   [mdl not instrumented]"));
+
+	/* Row lock wait source, and the cost per refresh of each source used so far. */
+	mvprintw(iRow + 1, 20, "row waits: %s", (pGraph->iSource == SOURCE_JOIN ? "data_lock_waits, joined here" : "sys.innodb_lock_waits"));
+	iCol = 62;
+
+	for (i = 0; i < 2; i++)
+	{
+		SourceCost const* pCost = &aCost[i];
+
+		if (pCost->iTicks == 0)
+		{
+			continue;
+		}
+
+		mvprintw(iRow + 1, iCol, "%s: %.2fms client", (i == SOURCE_JOIN ? "join" : "sys view"), pCost->dClient * 1000 / pCost->iTicks);
+
+		if (pCost->iServerTicks > 0)
+		{
+			printw(", %.2fms server", (double) pCost->iServer / 1e9 / pCost->iServerTicks);
+		}
+
+		iCol = getcurx(stdscr) + 4;
+	}
+
+	if (pRound->iV8 == 1)
+	{
+		mvprintw(iRow + 1, iCol, "(s: switch)");
+	}
+
+	iRow = 12;
+
+	for (i = 0; i < pGraph->iRoots && iRow < LINES - 4; i++)
+	{
+		displayRoot(pGraph, (uint32_t) (pGraph->aRank[i] & 0xFFFFFFFF), &iRow);
+		iRow += 2;
+	}
+
+	if (i < pGraph->iRoots)
+	{
+		mvprintw(LINES - 3, 1, "... %" PRIu32 " more root blockers", pGraph->iRoots - i);
+	}
+}
+
+
+/**
+	* Print one root blocker (or cycle) of the collapsed wait-for tree: kill statement, blocker, largest direct waiters.
+	*
+	* @param   LockGraph* pGraph, built graph
+	* @param   uint32_t iRoot, root node index
+	* @param   int* pRow, pointer to iRow
+	* @return  void
+*/
+
+void displayRoot(LockGraph const* pGraph, uint32_t iRoot, int* pRow)
+{
+	GraphNode const* pBlocker = &pGraph->aNodes[iRoot];
+	uint32_t aTop[GRAPH_WAITERS];
+	uint32_t iTop = 0;
+	uint32_t iDirect = 0;
+	uint32_t i;
+	uint32_t j;
+	int iRow = *pRow;
+
+	/* Top direct waiters by subtree size: insertion into a short array keeps this linear in the root's waiters. */
+	for (i = 0; i < pBlocker->iIn; i++)
+	{
+		uint32_t iW = pGraph->aIn[pBlocker->iInStart + i];
+
+		if (pGraph->aNodes[iW].iParent != iRoot)
+		{
+			continue; /* Listed under another blocker. */
+		}
+
+		iDirect++;
+
+		for (j = iTop; j > 0 && pGraph->aNodes[aTop[j - 1]].iTree < pGraph->aNodes[iW].iTree; j--)
+		{
+			if (j < GRAPH_WAITERS)
+			{
+				aTop[j] = aTop[j - 1];
 			}
+		}
+
+		if (j < GRAPH_WAITERS)
+		{
+			aTop[j] = iW;
 
-			if (row_res[9] != NULL)
+			if (iTop < GRAPH_WAITERS)
 			{
-				char aQuery[300];
-				unsigned int iQLen = sizeof(aQuery) - 1;
-				strncpy(aQuery, row_res[9], iQLen);
-				aQuery[iQLen] = '\0';
+				iTop++;
+			}
+		}
+	}
 
-				/* Remove LFs. */
-				replaceChar(aQuery, '\n', ' ');
+	attrset(A_BOLD | COLOR_PAIR(4));
+	mvprintw(iRow, 1, "KILL %" PRIu64 ";", pBlocker->iPid);
+	attrset(A_NORMAL);
 
-				attron(COLOR_PAIR(5));
-				mvprintw(iRow += 1, 1, "%s", aQuery);
-				attroff(COLOR_PAIR(5));
+	if (pBlocker->iCycle != 0)
+	{
+		/* Deadlock InnoDB cannot see (row and metadata locks mixed): killing any member breaks it. */
+		uint32_t iNode = iRoot;
+		int iCol = 20;
+
+		attrset(A_BOLD | COLOR_PAIR(4));
+		mvprintw(iRow, iCol, "cycle:");
+		attrset(A_NORMAL);
+		iCol += 7;
+
+		for (i = 0; i < GRAPH_CYCLE_SHOWN; i++)
+		{
+			mvprintw(iRow, iCol, "%" PRIu64 " > ", pGraph->aNodes[iNode].iPid);
+			iCol += snprintf(NULL, 0, "%" PRIu64 " > ", pGraph->aNodes[iNode].iPid);
+			iNode = pGraph->aNodes[iNode].iNext;
+
+			if (iNode == iRoot)
+			{
+				break;
 			}
+		}
+
+		mvprintw(iRow, iCol, "%s", (iNode == iRoot ? "" : "... > "));
+		iCol += (iNode == iRoot ? 0 : 6);
+		mvprintw(iRow, iCol, "%" PRIu64, pBlocker->iPid);
+	}
+
+	iRow++;
+	mvprintw(iRow, 1, "root");
+	mvprintw(iRow, 8, "blocks");
+	mvprintw(iRow, 24, "direct");
+	mvprintw(iRow, 34, "trx age");
+
+	iRow++;
+	attrset(A_BOLD | COLOR_PAIR(1));
+	mvprintw(iRow, 1, "%" PRIu64, pBlocker->iPid);
+	mvprintw(iRow, 8, "%" PRIu32, pBlocker->iTree);
+	mvprintw(iRow, 24, "%" PRIu32, iDirect);
+	mvprintw(iRow, 34, "%s", (pBlocker->aAge[0] != '\0' ? pBlocker->aAge : "-"));
+	attrset(A_NORMAL);
+
+	attron(COLOR_PAIR(5));
+	mvprintw(iRow += 1, 1, "%s", (pBlocker->aQuery[0] != '\0' ? pBlocker->aQuery : "(no statement running: idle in transaction?)"));
+	attroff(COLOR_PAIR(5));
+
+	for (i = 0; i < iTop && iRow < LINES - 3; i++)
+	{
+		GraphNode const* pW = &pGraph->aNodes[aTop[i]];
+
+		iRow++;
+		mvprintw(iRow, 3, "<- %" PRIu64, pW->iPid);
+		mvprintw(iRow, 18, "%us", pW->iWaitSecs);
+		mvprintw(iRow, 26, "%s", graphKind(pW->iKind));
+		attrset(A_BOLD | COLOR_PAIR(1));
+		mvprintw(iRow, 35, "%s", pW->aObject);
+		attrset(A_NORMAL);
 
+		if (pW->iTree > 0)
+		{
+			attrset(A_BOLD | COLOR_PAIR(3));
+			mvprintw(iRow, 100, "+%" PRIu32 " behind", pW->iTree);
 			attrset(A_NORMAL);
-			attron(COLOR_PAIR(5));
-			mvprintw(iRow += 1, 1, "%s", row_res[14]);
-			attroff(COLOR_PAIR(5));
 		}
 
-		iRow += 3;
+		attron(COLOR_PAIR(2));
+		mvprintw(iRow, 116, "%.*s", (COLS > 117 ? COLS - 117 : 0), pW->aQuery);
+		attroff(COLOR_PAIR(2));
 	}
 
-	mysql_free_result(result_q);
+	if (iDirect > iTop)
+	{
+		mvprintw(iRow += 1, 3, "... %" PRIu32 " more direct waiters", iDirect - iTop);
+	}
+
+	*pRow = iRow;
 }
 
 
 /**
-	* Table lock waits display.
+	* Table lock waits query.
 	*
 	* @param   MYSQL* pConn, connection pointer
+	* @return  MYSQL_RES*, NULL on error
+*/
+
+MYSQL_RES* queryTableLockWaits(MYSQL* pConn)
+{
+	return monQuery(pConn, "\
+		SELECT \
+			object_schema, object_name, waiting_account, waiting_lock_type, waiting_lock_duration, waiting_query, waiting_query_secs, waiting_query_rows_affected, waiting_query_rows_examined, blocking_pid, blocking_account, blocking_lock_type, blocking_lock_duration, sql_kill_blocking_query \
+		FROM \
+			sys.schema_table_lock_waits \
+	");
+}
+
+
+/**
+	* Table lock waits display.
+	*
+	* @param   MYSQL_RES* result_q, queryTableLockWaits() result
 	* @param   int* pRow, pointer to iRow
 	* @param   int* pRow, pointer to iMDL
 	* @return  void
 */
 
-void displayTableLockWaits(MYSQL* pConn, int* pRow, unsigned int* pMDL)
+void displayTableLockWaits(MYSQL_RES* result_q, int* pRow, unsigned int* pMDL)
 {
 	int iRow = *pRow;
+	MYSQL_ROW row_res;
 
 	if (*pMDL == 0)
 	{
@@ -520,23 +1269,13 @@ void displayTableLockWaits(MYSQL* pConn, int* pRow, unsigned int* pMDL)
 		return;
 	}
 
-	mysql_query(pConn, "\
-		SELECT \
-			object_schema, object_name, waiting_account, waiting_lock_type, waiting_lock_duration, waiting_query, waiting_query_secs, waiting_query_rows_affected, waiting_query_rows_examined, blocking_pid, blocking_account, blocking_lock_type, blocking_lock_duration, sql_kill_blocking_query \
-		FROM \
-			sys.schema_table_lock_waits \
-	");
-
-	MYSQL_RES* result_q = mysql_store_result(pConn);
-	MYSQL_ROW row_res;
-
 	iRow += 3;
 	attrset(A_BOLD | COLOR_PAIR(2));
 	mvprintw(iRow, 1, "table lock waits");
 	attrset(A_NORMAL);
 	iRow = 12;
 
-	while ((row_res = mysql_fetch_row(result_q)))
+	while (result_q != NULL && (row_res = mysql_fetch_row(result_q)))
 	{
 		if (row_res != NULL)
 		{
@@ -599,23 +1338,74 @@ void displayTableLockWaits(MYSQL* pConn, int* pRow, unsigned int* pMDL)
 
 		iRow += 3;
 	}
+}
 
-	mysql_free_result(result_q);
+
+/**
+	* Metadata locks query.
+	* On 8.0 each owner's row locks are counted server-side, limited to the owners, instead of joining data_locks row for row:
+	* the result has one row per metadata lock, however many row locks its owner holds.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   unsigned int iV8, 1 for MySQL 8.0+
+	* @return  MYSQL_RES*, NULL on error
+*/
+
+MYSQL_RES* queryMetadata(MYSQL* pConn, unsigned int iV8)
+{
+	/* Join on sys.session is simply too expensive: 50 QPS >> 2500+ QPS. Owners are resolved client-side instead (sessionResolve()). */
+
+	if (iV8 != 1) /* v.5.7 */
+	{
+		return monQuery(pConn, "\
+			SELECT \
+				OBJECT_TYPE, OBJECT_SCHEMA, OBJECT_NAME, LOCK_TYPE, LOCK_DURATION, LOCK_STATUS, OWNER_THREAD_ID  \
+			FROM \
+				performance_schema.metadata_locks \
+			WHERE \
+				OBJECT_SCHEMA NOT IN ('information_schema', 'mysql', 'performance_schema') \
+		");
+	}
+	else /* v.8.0+ */
+	{
+		return monQuery(pConn, "\
+			SELECT \
+				ML.OBJECT_TYPE, ML.OBJECT_SCHEMA, ML.OBJECT_NAME, ML.LOCK_TYPE, ML.LOCK_DURATION, ML.LOCK_STATUS, ML.OWNER_THREAD_ID, DL.ROW_LOCKS, DL.ROW_WAITS \
+			FROM \
+				performance_schema.metadata_locks ML \
+			LEFT JOIN \
+				( \
+					SELECT \
+						THREAD_ID, COUNT(*) AS ROW_LOCKS, SUM(LOCK_STATUS = 'WAITING') AS ROW_WAITS \
+					FROM \
+						performance_schema.data_locks \
+					WHERE \
+						THREAD_ID IN (SELECT OWNER_THREAD_ID FROM performance_schema.metadata_locks WHERE OBJECT_SCHEMA NOT IN ('information_schema', 'mysql', 'performance_schema')) \
+					GROUP BY \
+						THREAD_ID \
+				) DL ON DL.THREAD_ID = ML.OWNER_THREAD_ID \
+			WHERE \
+				ML.OBJECT_SCHEMA NOT IN ('information_schema', 'mysql', 'performance_schema') \
+		");
+	}
 }
 
 
 /**
 	* Metadata lock waits display.
 	*
-	* @param   MYSQL* pConn, connection pointer
+	* @param   MYSQL_RES* result_q, queryMetadata() result
+	* @param   SessionSet* pSessions, owners resolved for result_q by sessionResolve()
 	* @param   int* pRow, pointer to iRow
+	* @param   int* pMDL, pointer to iMDL
 	* @param   int* pV8, pointer to iV8
 	* @return  void
 */
 
-void displayMetadata(MYSQL* pConn, int* pRow, unsigned int* pMDL, unsigned int* pV8)
+void displayMetadata(MYSQL_RES* result_q, SessionSet const* pSessions, int* pRow, unsigned int* pMDL, unsigned int* pV8)
 {
 	int iRow = *pRow;
+	MYSQL_ROW row_res;
 
 	if (*pMDL == 0)
 	{
@@ -625,149 +1415,2441 @@ void displayMetadata(MYSQL* pConn, int* pRow, unsigned int* pMDL, unsigned int*
 		return;
 	}
 
-	if (*pV8 != 1) /* v.5.7 */
-	{
-		mysql_query(pConn, "\
-			SELECT \
-				OBJECT_TYPE, OBJECT_SCHEMA, OBJECT_NAME, LOCK_TYPE, LOCK_DURATION, LOCK_STATUS, OWNER_THREAD_ID  \
-			FROM \
-				performance_schema.metadata_locks \
-			WHERE \
-				OBJECT_SCHEMA NOT IN ('information_schema', 'mysql', 'performance_schema') \
-		");
-			/* Join on sys.session is simply too expensive: 50 QPS >> 2500+ QPS */
+	iRow += 3;
+	attrset(A_BOLD | COLOR_PAIR(2));
+	mvprintw(iRow, 1, "metadata locks");
+	attrset(A_NORMAL);
+	iRow = 12;
 
-		MYSQL_RES* result_q = mysql_store_result(pConn);
-		MYSQL_ROW row_res;
+	while (result_q != NULL && (row_res = mysql_fetch_row(result_q)) && iRow < LINES - 3)
+	{
+		SessionInfo const* pInfo = (row_res[6] != NULL) ? sessionFind(pSessions, strtoull(row_res[6], NULL, 10)) : NULL;
 
-		iRow += 3;
-		attrset(A_BOLD | COLOR_PAIR(2));
-		mvprintw(iRow, 1, "metadata locks");
-		attrset(A_NORMAL);
-		iRow = 12;
+		mvprintw(iRow, 1, "db");
+		mvprintw(iRow, 25, "table");
+		mvprintw(iRow, 53, "obj");
+		mvprintw(iRow, 74, "lock type");
+		mvprintw(iRow, 97, "duration");
+		mvprintw(iRow, 117, "status");
+		mvprintw(iRow, 130, "thd");
 
-		while ((row_res = mysql_fetch_row(result_q)))
+		if (*pV8 == 1)
 		{
-			if (row_res != NULL)
-			{
-				mvprintw(iRow, 1, "db");
-				mvprintw(iRow, 25, "table");
-				mvprintw(iRow, 53, "obj");
-				mvprintw(iRow, 74, "lock type");
-				mvprintw(iRow, 97, "duration");
-				mvprintw(iRow, 117, "status");
-				mvprintw(iRow, 130, "id");
+			mvprintw(iRow, 140, "row locks");
+		}
 
-				iRow++;
-				attrset(A_BOLD | COLOR_PAIR(1));
+		iRow++;
+		attrset(A_BOLD | COLOR_PAIR(1));
 
-				mvprintw(iRow, 1, "%s", (row_res[1] != NULL) ? row_res[1] : "-");
-				mvprintw(iRow, 25, "%s", (row_res[2] != NULL) ? row_res[2] : "-");
-				mvprintw(iRow, 53, "%s", row_res[0]);
-				mvprintw(iRow, 74, "%s", row_res[3]);
-				mvprintw(iRow, 97, "%s", row_res[4]);
-				mvprintw(iRow, 117, "%s", row_res[5]);
-				mvprintw(iRow, 130, "%s", row_res[6]);
+		mvprintw(iRow, 1, "%s", (row_res[1] != NULL) ? row_res[1] : "-");
+		mvprintw(iRow, 25, "%s", (row_res[2] != NULL) ? row_res[2] : "-");
+		mvprintw(iRow, 53, "%s", row_res[0]);
+		mvprintw(iRow, 74, "%s", row_res[3]);
+		mvprintw(iRow, 97, "%s", row_res[4]);
+		mvprintw(iRow, 117, "%s", row_res[5]);
+		mvprintw(iRow, 130, "%s", row_res[6]);
 
-				attrset(A_NORMAL);
-			}
+		if (*pV8 == 1)
+		{
+			mvprintw(iRow, 140, "%s", (row_res[7] != NULL) ? row_res[7] : "0");
 
-			iRow += 2;
+			if (row_res[8] != NULL && strcmp(row_res[8], "0") != 0)
+			{
+				attrset(A_BOLD | COLOR_PAIR(4));
+				printw(" (%s waiting)", row_res[8]);
+			}
 		}
 
-		mysql_free_result(result_q);
-	}
-	else /* v.8.0+ */
-	{
-		mysql_query(pConn, "\
-			SELECT \
-				OBJECT_TYPE, ML.OBJECT_SCHEMA, ML.OBJECT_NAME, ML.LOCK_TYPE, DL.LOCK_MODE, DL.LOCK_TYPE, ML.LOCK_DURATION, DL.LOCK_STATUS, ML.OWNER_THREAD_ID \
-			FROM \
-				performance_schema.metadata_locks ML \
-			LEFT JOIN \
-				performance_schema.data_locks DL ON DL.THREAD_ID = ML.OWNER_THREAD_ID \
-			WHERE \
-				ML.OBJECT_SCHEMA NOT IN ('information_schema', 'mysql', 'performance_schema') \
-		");
-
-		MYSQL_RES* result_q = mysql_store_result(pConn);
-		MYSQL_ROW row_res;
-
-		iRow += 3;
-		attrset(A_BOLD | COLOR_PAIR(2));
-		mvprintw(iRow, 1, "metadata locks");
 		attrset(A_NORMAL);
-		iRow = 12;
-
-		while ((row_res = mysql_fetch_row(result_q)))
-		{
-			if (row_res != NULL)
-			{
-				mvprintw(iRow, 1, "db");
-				mvprintw(iRow, 25, "table");
-				mvprintw(iRow, 53, "obj");
-				mvprintw(iRow, 74, "type");
-				mvprintw(iRow, 97, "mode");
-				mvprintw(iRow, 117, "type");
-				mvprintw(iRow, 127, "duration");
-				mvprintw(iRow, 141, "status");
-				mvprintw(iRow, 153, "id");
-
-				iRow++;
-				attrset(A_BOLD | COLOR_PAIR(1));
-
-				mvprintw(iRow, 1, "%s", (row_res[1] != NULL) ? row_res[1] : "-");
-				mvprintw(iRow, 25, "%s", (row_res[2] != NULL) ? row_res[2] : "-");
-				mvprintw(iRow, 53, "%s", row_res[0]);
-				mvprintw(iRow, 74, "%s", row_res[3]);
-				mvprintw(iRow, 97, "%s", (row_res[4] != NULL) ? row_res[4] : "-");
-				mvprintw(iRow, 117, "%s", (row_res[5] != NULL) ? row_res[5] : "-");
-				mvprintw(iRow, 127, "%s", row_res[6]);
-				mvprintw(iRow, 141, "%s", (row_res[7] != NULL) ? row_res[7] : "-");
-				mvprintw(iRow, 153, "%s", row_res[8]);
 
-				attrset(A_NORMAL);
+		if (pInfo != NULL)
+		{
+			attron(COLOR_PAIR(5));
+
+			if (pInfo->iPid != 0)
+			{
+				mvprintw(iRow += 1, 1, "%s@%s  id %" PRIu64, pInfo->aUser, pInfo->aHost, pInfo->iPid);
+			}
+			else
+			{
+				mvprintw(iRow += 1, 1, "background thread");
 			}
 
-			iRow += 2;
+			attroff(COLOR_PAIR(5));
+
+			if (pInfo->aQuery[0] != '\0')
+			{
+				attron(COLOR_PAIR(2));
+				mvprintw(iRow, 53, "%.*s", (COLS > 54 ? COLS - 54 : 0), pInfo->aQuery);
+				attroff(COLOR_PAIR(2));
+			}
 		}
 
-		mysql_free_result(result_q);
+		iRow += 2;
 	}
 }
 
 
 /**
-	* Process command-line switches using getopt()
+	* Check the metadata lock instrumentation, enabling it where the server allows.
 	*
-	* @param   integer iArgCount, number of arguments
-	* @param   char* aArgV, pointer to aArgV
-	* @return  unsigned integer
+	* @param   MYSQL* pConn, connection pointer
+	* @param   unsigned int* pMDL, pointer to iMDL, set to 1 once enabled
+	* @return  void
 */
 
-unsigned int options(int iArgCount, char* const aArgV[])
+void checkMDL(MYSQL* pConn, unsigned int* pMDL)
 {
-	int iOpts = 0;
-	int iOptsIdx = 0;
-	unsigned int iHelp = 0;
+	MYSQL_RES* result_mdl = monQuery(pConn, "SELECT ENABLED FROM performance_schema.setup_instruments WHERE NAME = 'wait/lock/metadata/sql/mdl'");
+	MYSQL_ROW row_mdl = (result_mdl != NULL) ? mysql_fetch_row(result_mdl) : NULL;
 
-	struct option aLongOpts[] =
+	if (row_mdl != NULL && strstr(row_mdl[0], "YES") != NULL)
 	{
-		{"help", no_argument, 0, 'i'},
-		{0, 0, 0, 0}
-	};
-
-	while ((iOpts = getopt_long(iArgCount, aArgV, "ih:u:t:p:", aLongOpts, &iOptsIdx)) != -1)
+		*pMDL = 1;
+	}
+	else
 	{
-		switch (iOpts)
-		{
-			case 'i':
-				iHelp = 1;
-				break;
+		/* Attempt UPDATE of p_s instrumentation for versions 5.x, to avoid manually updating. */
+		monQuery(pConn, "UPDATE performance_schema.setup_instruments SET ENABLED = 'YES' WHERE NAME = 'wait/lock/metadata/sql/mdl'");
+	}
 
-			case 'h':
-				pHost = optarg;
-				break;
+	mysql_free_result(result_mdl);
+}
+
+/**
+	* Make room for the owners of a metadata locks result: drop owners not referenced lately, then grow if needed.
+	*
+	* @param   SessionCache* pCache, cache
+	* @param   uint32_t iRows, result rows (an upper bound on new owners)
+	* @return  unsigned int, 1 on success, 0 if out of memory
+*/
+
+unsigned int sessionReserve(SessionCache* pCache, uint32_t iRows)
+{
+	uint32_t iCap = pCache->iCap;
+
+	if (iRows > pCache->iRefCap)
+	{
+		uint32_t* aRefs = realloc(pCache->aRefs, sizeof(uint32_t) * iRows);
+		uint32_t* aNew;
+
+		if (aRefs == NULL)
+		{
+			return 0;
+		}
+
+		pCache->aRefs = aRefs;
+		aNew = realloc(pCache->aNew, sizeof(uint32_t) * iRows);
+
+		if (aNew == NULL)
+		{
+			return 0;
+		}
+
+		pCache->aNew = aNew;
+		pCache->iRefCap = iRows;
+	}
+
+	if (pCache->iEntries + iRows <= pCache->iCap)
+	{
+		return 1;
+	}
+
+	if (pCache->iEntries > 0)
+	{
+		sessionRehash(pCache, 1);
+	}
+
+	if (pCache->iEntries + iRows > pCache->iCap)
+	{
+		SessionInfo* aEntries;
+		uint32_t* aSlots;
+
+		if (iCap < SESSION_MIN_CAP)
+		{
+			iCap = SESSION_MIN_CAP;
+		}
+
+		while (pCache->iEntries + iRows > iCap)
+		{
+			iCap *= 2;
+		}
+
+		aEntries = realloc(pCache->aEntries, sizeof(SessionInfo) * iCap);
+
+		if (aEntries == NULL)
+		{
+			return 0;
+		}
+
+		pCache->aEntries = aEntries;
+		aSlots = realloc(pCache->aSlots, sizeof(uint32_t) * iCap * 2);
+
+		if (aSlots == NULL)
+		{
+			return 0;
+		}
+
+		pCache->aSlots = aSlots;
+		pCache->iCap = iCap;
+		pCache->iSlots = iCap * 2;
+
+		sessionRehash(pCache, 0);
+	}
+
+	return 1;
+}
+
+
+/**
+	* Rebuild the cache's hash slots, first dropping owners unreferenced for SESSION_STALE refreshes if asked.
+	*
+	* @param   SessionCache* pCache, cache
+	* @param   unsigned int iPrune, 1 to drop stale owners
+	* @return  void
+*/
+
+void sessionRehash(SessionCache* pCache, unsigned int iPrune)
+{
+	uint32_t iMask = pCache->iSlots - 1;
+	uint32_t iKept = 0;
+	uint32_t i;
+
+	for (i = 0; i < pCache->iEntries; i++)
+	{
+		if (iPrune && pCache->aEntries[i].iSeen + SESSION_STALE < pCache->iRefreshes)
+		{
+			continue; /* Most likely disconnected. */
+		}
+
+		if (iKept != i)
+		{
+			pCache->aEntries[iKept] = pCache->aEntries[i];
+		}
+
+		iKept++;
+	}
+
+	pCache->iEntries = iKept;
+	memset(pCache->aSlots, 0, sizeof(uint32_t) * pCache->iSlots);
+
+	for (i = 0; i < iKept; i++)
+	{
+		uint32_t j = graphHash(pCache->aEntries[i].iThreadId) & iMask;
+
+		while (pCache->aSlots[j] != 0)
+		{
+			j = (j + 1) & iMask;
+		}
+
+		pCache->aSlots[j] = i + 1;
+	}
+}
+
+
+/**
+	* Find a cached owner.
+	*
+	* @param   SessionCache* pCache, cache
+	* @param   uint64_t iThreadId, performance_schema THREAD_ID
+	* @return  uint32_t, entry index, GRAPH_NONE if not cached
+*/
+
+uint32_t sessionEntry(SessionCache const* pCache, uint64_t iThreadId)
+{
+	uint32_t iMask = pCache->iSlots - 1;
+	uint32_t i;
+
+	if (pCache->iSlots == 0)
+	{
+		return GRAPH_NONE;
+	}
+
+	for (i = graphHash(iThreadId) & iMask; pCache->aSlots[i] != 0; i = (i + 1) & iMask)
+	{
+		if (pCache->aEntries[pCache->aSlots[i] - 1].iThreadId == iThreadId)
+		{
+			return pCache->aSlots[i] - 1;
+		}
+	}
+
+	return GRAPH_NONE;
+}
+
+
+/**
+	* Resolve the owners of a metadata locks result to user, host, processlist id and statement.
+	* Only thread ids not in the cache are looked up, in one threads query. Statements change, so those of the owners
+	* referenced are read every refresh, in one events_statements_current query by THREAD_ID (its primary key on 8.0).
+	* The result is rewound for display.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   SessionCache* pCache, cache
+	* @param   MYSQL_RES* pResult, queryMetadata() result
+	* @param   unsigned int iCol, OWNER_THREAD_ID column
+	* @param   SessionSet* pSet, set to copies of the owners referenced, by thread id
+	* @return  void
+*/
+
+void sessionResolve(MYSQL* pConn, SessionCache* pCache, MYSQL_RES* pResult, unsigned int iCol, SessionSet* pSet)
+{
+	static char const aHead[] = "\
+		SELECT \
+			THREAD_ID, PROCESSLIST_ID, PROCESSLIST_USER, PROCESSLIST_HOST \
+		FROM \
+			performance_schema.threads \
+		WHERE \
+			THREAD_ID IN (";
+	static char const aStmtHead[] = "\
+		SELECT \
+			THREAD_ID, SQL_TEXT \
+		FROM \
+			performance_schema.events_statements_current \
+		WHERE \
+			THREAD_ID IN (";
+	MYSQL_RES* result_s;
+	uint32_t iRows = (uint32_t) mysql_num_rows(pResult);
+	uint32_t iRefs = 0;
+	uint32_t iNew = 0;
+	uint32_t i;
+	MYSQL_ROW row_res;
+
+	pSet->iSessions = 0;
+	pCache->iRefreshes++;
+
+	if (iRows == 0 || ! sessionReserve(pCache, iRows))
+	{
+		return;
+	}
+
+	while ((row_res = mysql_fetch_row(pResult)))
+	{
+		uint64_t iThreadId;
+		uint32_t iEntry;
+
+		if (row_res[iCol] == NULL)
+		{
+			continue;
+		}
+
+		iThreadId = strtoull(row_res[iCol], NULL, 10);
+		iEntry = sessionEntry(pCache, iThreadId);
+
+		if (iEntry == GRAPH_NONE)
+		{
+			/* New owner: cached now, identity filled in by the lookup below. */
+			uint32_t iMask = pCache->iSlots - 1;
+			uint32_t j = graphHash(iThreadId) & iMask;
+
+			while (pCache->aSlots[j] != 0)
+			{
+				j = (j + 1) & iMask;
+			}
+
+			iEntry = pCache->iEntries++;
+			pCache->aSlots[j] = iEntry + 1;
+			memset(&pCache->aEntries[iEntry], 0, sizeof(SessionInfo));
+			pCache->aEntries[iEntry].iThreadId = iThreadId;
+			pCache->aNew[iNew++] = iEntry;
+		}
+
+		if (pCache->aEntries[iEntry].iSeen != pCache->iRefreshes)
+		{
+			pCache->aEntries[iEntry].iSeen = pCache->iRefreshes;
+			pCache->aRefs[iRefs++] = iEntry;
+		}
+	}
+
+	mysql_data_seek(pResult, 0);
+
+	pCache->iReferenced += iRefs;
+	pCache->iLookedUp += iNew;
+
+	if (iNew > 0)
+	{
+		result_s = sessionQuery(pConn, pCache, aHead, sizeof(aHead) - 1, pCache->aNew, iNew);
+
+		while (result_s != NULL && (row_res = mysql_fetch_row(result_s)))
+		{
+			uint32_t iEntry = (row_res[0] != NULL) ? sessionEntry(pCache, strtoull(row_res[0], NULL, 10)) : GRAPH_NONE;
+			SessionInfo* pInfo;
+
+			if (iEntry == GRAPH_NONE || row_res[1] == NULL)
+			{
+				continue;
+			}
+
+			pInfo = &pCache->aEntries[iEntry];
+			pInfo->iPid = strtoull(row_res[1], NULL, 10);
+			snprintf(pInfo->aUser, sizeof(pInfo->aUser), "%s", (row_res[2] != NULL) ? row_res[2] : "");
+			snprintf(pInfo->aHost, sizeof(pInfo->aHost), "%s", (row_res[3] != NULL) ? row_res[3] : "");
+		}
+
+		mysql_free_result(result_s);
+	}
+
+	/* An owner no longer running a statement (idle in transaction) has no row: cleared first. */
+	for (i = 0; i < iRefs; i++)
+	{
+		pCache->aEntries[pCache->aRefs[i]].aQuery[0] = '\0';
+	}
+
+	result_s = sessionQuery(pConn, pCache, aStmtHead, sizeof(aStmtHead) - 1, pCache->aRefs, iRefs);
+
+	while (result_s != NULL && (row_res = mysql_fetch_row(result_s)))
+	{
+		uint32_t iEntry = (row_res[0] != NULL) ? sessionEntry(pCache, strtoull(row_res[0], NULL, 10)) : GRAPH_NONE;
+
+		/* Nested statements (stored programs) give a thread several rows: the first one is kept. */
+		if (iEntry != GRAPH_NONE && pCache->aEntries[iEntry].aQuery[0] == '\0' && row_res[1] != NULL)
+		{
+			graphText(pCache->aEntries[iEntry].aQuery, row_res[1], sizeof(pCache->aEntries[iEntry].aQuery));
+		}
+	}
+
+	mysql_free_result(result_s);
+
+	if (iRefs > pSet->iCap)
+	{
+		SessionInfo* aSessions = realloc(pSet->aSessions, sizeof(SessionInfo) * iRefs);
+
+		if (aSessions == NULL)
+		{
+			return;
+		}
+
+		pSet->aSessions = aSessions;
+		pSet->iCap = iRefs;
+	}
+
+	for (i = 0; i < iRefs; i++)
+	{
+		pSet->aSessions[i] = pCache->aEntries[pCache->aRefs[i]];
+	}
+
+	pSet->iSessions = iRefs;
+	qsort(pSet->aSessions, iRefs, sizeof(SessionInfo), sessionCompare);
+}
+
+
+/**
+	* Run a query ending in a THREAD_ID IN list of cache entries.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   SessionCache* pCache, cache (its statement buffer is reused)
+	* @param   char* pHead, statement up to the opening parenthesis of the list
+	* @param   size_t iHeadLen, length of pHead
+	* @param   uint32_t* aEntries, cache entry indexes
+	* @param   uint32_t iCount, entries
+	* @return  MYSQL_RES*, NULL if there are none, on allocation failure or on error
+*/
+
+MYSQL_RES* sessionQuery(MYSQL* pConn, SessionCache* pCache, char const* pHead, size_t iHeadLen, uint32_t const* aEntries, uint32_t iCount)
+{
+	size_t iNeed = iHeadLen + (size_t) iCount * 21 + 2;
+	size_t iPos = iHeadLen;
+	uint32_t i;
+
+	if (iCount == 0)
+	{
+		return NULL;
+	}
+
+	if (iNeed > pCache->iSQLCap)
+	{
+		char* pGrown = realloc(pCache->pSQL, iNeed);
+
+		if (pGrown == NULL)
+		{
+			return NULL;
+		}
+
+		pCache->pSQL = pGrown;
+		pCache->iSQLCap = iNeed;
+	}
+
+	memcpy(pCache->pSQL, pHead, iHeadLen);
+
+	for (i = 0; i < iCount; i++)
+	{
+		iPos += (size_t) sprintf(pCache->pSQL + iPos, "%s%" PRIu64, (i > 0 ? "," : ""), pCache->aEntries[aEntries[i]].iThreadId);
+	}
+
+	pCache->pSQL[iPos++] = ')';
+	pCache->pSQL[iPos] = '\0';
+
+	return monQuery(pConn, pCache->pSQL);
+}
+
+
+/**
+	* qsort()/bsearch() comparator of SessionInfo thread ids.
+	*
+	* @param   void* pA, SessionInfo
+	* @param   void* pB, SessionInfo
+	* @return  int, ascending
+*/
+
+int sessionCompare(void const* pA, void const* pB)
+{
+	uint64_t iA = ((SessionInfo const*) pA)->iThreadId;
+	uint64_t iB = ((SessionInfo const*) pB)->iThreadId;
+
+	return (iA > iB) - (iA < iB);
+}
+
+
+/**
+	* Find an owner in a result's set.
+	*
+	* @param   SessionSet* pSet, set from sessionResolve()
+	* @param   uint64_t iThreadId, performance_schema THREAD_ID
+	* @return  SessionInfo*, NULL if not resolved
+*/
+
+SessionInfo const* sessionFind(SessionSet const* pSet, uint64_t iThreadId)
+{
+	SessionInfo key;
+
+	if (pSet == NULL || pSet->iSessions == 0)
+	{
+		return NULL;
+	}
+
+	key.iThreadId = iThreadId;
+
+	return bsearch(&key, pSet->aSessions, pSet->iSessions, sizeof(SessionInfo), sessionCompare);
+}
+
+
+/**
+	* Free the cache buffers; its counters are kept for sessionSummary().
+	*
+	* @param   SessionCache* pCache, cache
+	* @return  void
+*/
+
+void sessionCacheFree(SessionCache* pCache)
+{
+	free(pCache->aEntries);
+	free(pCache->aSlots);
+	free(pCache->aRefs);
+	free(pCache->aNew);
+	free(pCache->pSQL);
+
+	pCache->aEntries = NULL;
+	pCache->aSlots = NULL;
+	pCache->aRefs = NULL;
+	pCache->aNew = NULL;
+	pCache->pSQL = NULL;
+	pCache->iSQLCap = 0;
+	pCache->iCap = 0;
+	pCache->iSlots = 0;
+	pCache->iEntries = 0;
+	pCache->iRefCap = 0;
+}
+
+
+/**
+	* Print the session cache figures on exit.
+	*
+	* @param   SessionCache* pCache, cache
+	* @return  void
+*/
+
+void sessionSummary(SessionCache const* pCache)
+{
+	if (pCache->iReferenced == 0)
+	{
+		return;
+	}
+
+	fprintf(stdout, "  metadata lock owners: %" PRIu64 " referenced over %" PRIu64 " refreshes, %" PRIu64 " looked up (%.1f%% from the session cache)\n\n",
+		pCache->iReferenced, pCache->iRefreshes, pCache->iLookedUp, (1 - (double) pCache->iLookedUp / pCache->iReferenced) * 100);
+}
+
+
+
+/**
+	* Size the graph for up to iEdges edges and empty it.
+	*
+	* @param   LockGraph* pGraph, graph
+	* @param   uint32_t iEdges, edge rows about to be added
+	* @return  unsigned integer, 0 on allocation failure
+*/
+
+unsigned int graphReserve(LockGraph* pGraph, uint32_t iEdges)
+{
+	if (iEdges > pGraph->iCap || pGraph->aNodes == NULL)
+	{
+		uint32_t iCap = (pGraph->iCap > 0) ? pGraph->iCap : 64;
+		uint32_t iSlots = 1;
+
+		while (iCap < iEdges)
+		{
+			iCap *= 2;
+		}
+
+		/* Half-full at most: nodes <= 2 * edges. */
+		while (iSlots < iCap * 4)
+		{
+			iSlots *= 2;
+		}
+
+		graphFree(pGraph);
+
+		pGraph->aNodes = malloc(sizeof(GraphNode) * iCap * 2);
+		pGraph->aEdges = malloc(sizeof(GraphEdge) * iCap);
+		pGraph->aNodeSlots = malloc(sizeof(uint32_t) * iSlots);
+		pGraph->aEdgeSlots = malloc(sizeof(uint32_t) * iSlots);
+		pGraph->aOut = malloc(sizeof(uint32_t) * iCap);
+		pGraph->aIn = malloc(sizeof(uint32_t) * iCap);
+		pGraph->aOrder = malloc(sizeof(uint32_t) * iCap * 2);
+		pGraph->aRank = malloc(sizeof(uint64_t) * iCap * 2);
+
+		if (pGraph->aNodes == NULL || pGraph->aEdges == NULL || pGraph->aNodeSlots == NULL || pGraph->aEdgeSlots == NULL
+			|| pGraph->aOut == NULL || pGraph->aIn == NULL || pGraph->aOrder == NULL || pGraph->aRank == NULL)
+		{
+			graphFree(pGraph);
+			return 0;
+		}
+
+		pGraph->iCap = iCap;
+		pGraph->iSlots = iSlots;
+	}
+
+	memset(pGraph->aNodeSlots, 0, sizeof(uint32_t) * pGraph->iSlots);
+	memset(pGraph->aEdgeSlots, 0, sizeof(uint32_t) * pGraph->iSlots);
+	pGraph->iNodes = 0;
+	pGraph->iEdges = 0;
+	pGraph->iRowEdges = 0;
+	pGraph->iMDLEdges = 0;
+	pGraph->iRoots = 0;
+	pGraph->iCycles = 0;
+	pGraph->iWaiting = 0;
+
+	return 1;
+}
+
+
+/**
+	* Release the graph buffers.
+	*
+	* @param   LockGraph* pGraph, graph
+	* @return  void
+*/
+
+void graphFree(LockGraph* pGraph)
+{
+	free(pGraph->aNodes);
+	free(pGraph->aEdges);
+	free(pGraph->aNodeSlots);
+	free(pGraph->aEdgeSlots);
+	free(pGraph->aOut);
+	free(pGraph->aIn);
+	free(pGraph->aOrder);
+	free(pGraph->aRank);
+	memset(pGraph, 0, sizeof(LockGraph));
+}
+
+
+/**
+	* Mix a 64-bit key into a slot hash (splitmix64 finalizer).
+	*
+	* @param   uint64_t iKey, key
+	* @return  uint32_t
+*/
+
+uint32_t graphHash(uint64_t iKey)
+{
+	iKey ^= iKey >> 30;
+	iKey *= 0xBF58476D1CE4E5B9ULL;
+	iKey ^= iKey >> 27;
+	iKey *= 0x94D049BB133111EBULL;
+	iKey ^= iKey >> 31;
+
+	return (uint32_t) iKey;
+}
+
+
+/**
+	* Find a session's node, adding an empty one if new.
+	*
+	* @param   LockGraph* pGraph, graph
+	* @param   uint64_t iPid, processlist id
+	* @return  uint32_t, node index
+*/
+
+uint32_t graphNode(LockGraph* pGraph, uint64_t iPid)
+{
+	uint32_t iMask = pGraph->iSlots - 1;
+	uint32_t i = graphHash(iPid) & iMask;
+	GraphNode* pNode;
+
+	while (pGraph->aNodeSlots[i] != 0)
+	{
+		if (pGraph->aNodes[pGraph->aNodeSlots[i] - 1].iPid == iPid)
+		{
+			return pGraph->aNodeSlots[i] - 1;
+		}
+
+		i = (i + 1) & iMask;
+	}
+
+	pNode = &pGraph->aNodes[pGraph->iNodes];
+	memset(pNode, 0, sizeof(GraphNode));
+	pNode->iPid = iPid;
+	pNode->iParent = GRAPH_NONE;
+	pNode->iWalk = GRAPH_NONE;
+	pNode->iNext = GRAPH_NONE;
+
+	pGraph->aNodeSlots[i] = ++pGraph->iNodes;
+
+	return pGraph->iNodes - 1;
+}
+
+
+/**
+	* Find a session's node without adding it.
+	*
+	* @param   LockGraph* pGraph, built graph
+	* @param   uint64_t iPid, processlist id
+	* @return  uint32_t, node index, GRAPH_NONE if the session neither waits nor blocks
+*/
+
+uint32_t graphFind(LockGraph const* pGraph, uint64_t iPid)
+{
+	uint32_t iMask = pGraph->iSlots - 1;
+	uint32_t i;
+
+	if (pGraph->aNodes == NULL || pGraph->iNodes == 0)
+	{
+		return GRAPH_NONE;
+	}
+
+	for (i = graphHash(iPid) & iMask; pGraph->aNodeSlots[i] != 0; i = (i + 1) & iMask)
+	{
+		if (pGraph->aNodes[pGraph->aNodeSlots[i] - 1].iPid == iPid)
+		{
+			return pGraph->aNodeSlots[i] - 1;
+		}
+	}
+
+	return GRAPH_NONE;
+}
+
+
+/**
+	* Lock type label of a waiter.
+	*
+	* @param   unsigned int iKind, GRAPH_INNODB and/or GRAPH_MDL
+	* @return  char const*, label
+*/
+
+char const* graphKind(unsigned int iKind)
+{
+	return (iKind == (GRAPH_INNODB | GRAPH_MDL) ? "row+mdl" : (iKind == GRAPH_MDL ? "mdl" : "row"));
+}
+
+
+/**
+	* Add one waiter -> blocker row; repeated pairs (one per lock held) collapse into a single edge.
+	*
+	* @param   LockGraph* pGraph, graph
+	* @param   MYSQL_ROW row, waiter pid, blocker pid, wait secs, object, waiting query, blocking query, blocking trx age
+	* @param   unsigned int iKind, GRAPH_INNODB or GRAPH_MDL
+	* @return  void
+*/
+
+void graphAddRow(LockGraph* pGraph, MYSQL_ROW row, unsigned int iKind)
+{
+	uint64_t iWaiterPid;
+	uint64_t iBlockerPid;
+	uint32_t iWaiter;
+	uint32_t iBlocker;
+	uint32_t iMask = pGraph->iSlots - 1;
+	uint32_t i;
+	unsigned int iSecs;
+	GraphNode* pWaiter;
+	GraphNode* pBlocker;
+
+	if (row[0] == NULL || row[1] == NULL || pGraph->iEdges == pGraph->iCap)
+	{
+		return;
+	}
+
+	iWaiterPid = strtoull(row[0], NULL, 10);
+	iBlockerPid = strtoull(row[1], NULL, 10);
+
+	if (iWaiterPid == iBlockerPid)
+	{
+		return;
+	}
+
+	iWaiter = graphNode(pGraph, iWaiterPid);
+	iBlocker = graphNode(pGraph, iBlockerPid);
+	pWaiter = &pGraph->aNodes[iWaiter];
+	pBlocker = &pGraph->aNodes[iBlocker];
+
+	iSecs = (row[2] != NULL) ? (unsigned int) strtoul(row[2], NULL, 10) : 0;
+
+	if (iSecs > pWaiter->iWaitSecs)
+	{
+		pWaiter->iWaitSecs = iSecs;
+	}
+
+	if (pWaiter->iKind == 0 && row[3] != NULL)
+	{
+		graphText(pWaiter->aObject, row[3], sizeof(pWaiter->aObject));
+	}
+
+	pWaiter->iKind |= iKind;
+
+	if (pWaiter->aQuery[0] == '\0' && row[4] != NULL)
+	{
+		graphText(pWaiter->aQuery, row[4], sizeof(pWaiter->aQuery));
+	}
+
+	if (pBlocker->aQuery[0] == '\0' && row[5] != NULL)
+	{
+		graphText(pBlocker->aQuery, row[5], sizeof(pBlocker->aQuery));
+	}
+
+	if (pBlocker->aAge[0] == '\0' && row[6] != NULL)
+	{
+		graphText(pBlocker->aAge, row[6], sizeof(pBlocker->aAge));
+	}
+
+	i = graphHash(((uint64_t) iWaiter << 32) | iBlocker) & iMask;
+
+	while (pGraph->aEdgeSlots[i] != 0)
+	{
+		GraphEdge const* pEdge = &pGraph->aEdges[pGraph->aEdgeSlots[i] - 1];
+
+		if (pEdge->iWaiter == iWaiter && pEdge->iBlocker == iBlocker)
+		{
+			return;
+		}
+
+		i = (i + 1) & iMask;
+	}
+
+	pGraph->aEdges[pGraph->iEdges].iWaiter = iWaiter;
+	pGraph->aEdges[pGraph->iEdges].iBlocker = iBlocker;
+	pGraph->aEdgeSlots[i] = ++pGraph->iEdges;
+
+	if (iKind == GRAPH_MDL)
+	{
+		pGraph->iMDLEdges++;
+	}
+	else
+	{
+		pGraph->iRowEdges++;
+	}
+}
+
+
+/**
+	* Derive adjacency, cycles, root blockers, the collapsed tree and its subtree sizes.
+	* Every pass visits each node and edge a bounded number of times: O(nodes + edges), plus sorting the roots.
+	*
+	* @param   LockGraph* pGraph, graph
+	* @return  void
+*/
+
+void graphBuild(LockGraph* pGraph)
+{
+	GraphNode* aNodes = pGraph->aNodes;
+	uint32_t iHead = 0;
+	uint32_t iTail = 0;
+	uint32_t iOut = 0;
+	uint32_t iIn = 0;
+	uint32_t i;
+	uint32_t j;
+
+	/* Adjacency in both directions: count, prefix sum, fill. */
+	for (i = 0; i < pGraph->iEdges; i++)
+	{
+		aNodes[pGraph->aEdges[i].iWaiter].iOut++;
+		aNodes[pGraph->aEdges[i].iBlocker].iIn++;
+	}
+
+	for (i = 0; i < pGraph->iNodes; i++)
+	{
+		aNodes[i].iOutStart = iOut;
+		aNodes[i].iInStart = iIn;
+		iOut += aNodes[i].iOut;
+		iIn += aNodes[i].iIn;
+		aNodes[i].iOut = 0;
+		aNodes[i].iIn = 0;
+	}
+
+	for (i = 0; i < pGraph->iEdges; i++)
+	{
+		GraphNode* pW = &aNodes[pGraph->aEdges[i].iWaiter];
+		GraphNode* pB = &aNodes[pGraph->aEdges[i].iBlocker];
+
+		pGraph->aOut[pW->iOutStart + pW->iOut++] = pGraph->aEdges[i].iBlocker;
+		pGraph->aIn[pB->iInStart + pB->iIn++] = pGraph->aEdges[i].iWaiter;
+	}
+
+	/*
+		* Peel sessions that wait on nothing, then each waiter once all its blockers are peeled (iMark counts those left).
+		* Whatever remains is in a cycle or waits on one.
+	*/
+	for (i = 0; i < pGraph->iNodes; i++)
+	{
+		aNodes[i].iMark = aNodes[i].iOut;
+
+		if (aNodes[i].iOut == 0)
+		{
+			pGraph->aOrder[iTail++] = i;
+		}
+		else
+		{
+			pGraph->iWaiting++;
+		}
+	}
+
+	while (iHead < iTail)
+	{
+		GraphNode const* pB = &aNodes[pGraph->aOrder[iHead++]];
+
+		for (j = 0; j < pB->iIn; j++)
+		{
+			uint32_t iW = pGraph->aIn[pB->iInStart + j];
+
+			if (--aNodes[iW].iMark == 0)
+			{
+				pGraph->aOrder[iTail++] = iW;
+			}
+		}
+	}
+
+	/* Roots: blocking while not waiting. */
+	for (i = 0; i < pGraph->iNodes; i++)
+	{
+		if (aNodes[i].iOut == 0 && aNodes[i].iIn > 0)
+		{
+			pGraph->aRank[pGraph->iRoots++] = i;
+		}
+	}
+
+	/*
+		* Cycles: from each unvisited remaining node follow remaining blockers until the walk meets a visited node.
+		* Meeting its own walk closes a new cycle, listed as a root from the node met; an older walk leads into a known one.
+	*/
+	if (iTail < pGraph->iNodes)
+	{
+		for (i = 0; i < pGraph->iNodes; i++)
+		{
+			uint32_t iNode = i;
+
+			if (aNodes[i].iMark == 0 || aNodes[i].iWalk != GRAPH_NONE)
+			{
+				continue;
+			}
+
+			while (aNodes[iNode].iWalk == GRAPH_NONE)
+			{
+				aNodes[iNode].iWalk = i;
+				aNodes[iNode].iNext = graphStuckBlocker(pGraph, iNode);
+				iNode = aNodes[iNode].iNext;
+			}
+
+			if (aNodes[iNode].iWalk == i)
+			{
+				uint32_t iMember = iNode;
+
+				pGraph->iCycles++;
+
+				do
+				{
+					aNodes[iMember].iCycle = pGraph->iCycles;
+					iMember = aNodes[iMember].iNext;
+				}
+				while (iMember != iNode);
+
+				pGraph->aRank[pGraph->iRoots++] = iNode;
+			}
+		}
+	}
+
+	/* Collapsed tree: breadth-first from the roots along waiter edges, each session listed under the first blocker reaching it. */
+	for (i = 0; i < pGraph->iNodes; i++)
+	{
+		aNodes[i].iMark = 0;
+		aNodes[i].iTree = 0;
+	}
+
+	iHead = 0;
+	iTail = 0;
+
+	for (i = 0; i < pGraph->iRoots; i++)
+	{
+		aNodes[pGraph->aRank[i]].iMark = 1;
+		pGraph->aOrder[iTail++] = (uint32_t) pGraph->aRank[i];
+
+		while (iHead < iTail)
+		{
+			uint32_t iB = pGraph->aOrder[iHead++];
+
+			for (j = 0; j < aNodes[iB].iIn; j++)
+			{
+				uint32_t iW = pGraph->aIn[aNodes[iB].iInStart + j];
+
+				if (aNodes[iW].iMark == 0)
+				{
+					aNodes[iW].iMark = 1;
+					aNodes[iW].iParent = iB;
+					pGraph->aOrder[iTail++] = iW;
+				}
+			}
+		}
+	}
+
+	/* Subtree sizes: children precede parents in reverse breadth-first order. */
+	while (iTail > 0)
+	{
+		GraphNode const* pNode = &aNodes[pGraph->aOrder[--iTail]];
+
+		if (pNode->iParent != GRAPH_NONE)
+		{
+			aNodes[pNode->iParent].iTree += pNode->iTree + 1;
+		}
+	}
+
+	for (i = 0; i < pGraph->iRoots; i++)
+	{
+		uint32_t iRoot = (uint32_t) pGraph->aRank[i];
+		pGraph->aRank[i] = ((uint64_t) aNodes[iRoot].iTree << 32) | iRoot;
+	}
+
+	qsort(pGraph->aRank, pGraph->iRoots, sizeof(uint64_t), rankCompare);
+}
+
+
+/**
+	* First blocker of a node that was not peeled, i.e. is itself in or behind a cycle.
+	*
+	* @param   LockGraph* pGraph, graph
+	* @param   uint32_t iNode, node index (not peeled)
+	* @return  uint32_t, node index
+*/
+
+uint32_t graphStuckBlocker(LockGraph const* pGraph, uint32_t iNode)
+{
+	GraphNode const* pNode = &pGraph->aNodes[iNode];
+	uint32_t i;
+
+	for (i = 0; i < pNode->iOut; i++)
+	{
+		uint32_t iB = pGraph->aOut[pNode->iOutStart + i];
+
+		if (pGraph->aNodes[iB].iMark != 0)
+		{
+			return iB;
+		}
+	}
+
+	return iNode; /* Unreachable: a remaining node has a remaining blocker. */
+}
+
+
+/**
+	* qsort() comparator: descending rank keys.
+	*
+	* @param   void* pA, uint64_t key
+	* @param   void* pB, uint64_t key
+	* @return  integer
+*/
+
+int rankCompare(void const* pA, void const* pB)
+{
+	uint64_t iA = *(uint64_t const*) pA;
+	uint64_t iB = *(uint64_t const*) pB;
+
+	return (iA < iB) - (iA > iB);
+}
+
+
+/**
+	* Copy a column into a fixed buffer as a single line.
+	*
+	* @param   char* aDest, buffer
+	* @param   char* pSrc, column text
+	* @param   size_t iSize, buffer size
+	* @return  void
+*/
+
+void graphText(char* const aDest, char const* pSrc, size_t iSize)
+{
+	strncpy(aDest, pSrc, iSize - 1);
+	aDest[iSize - 1] = '\0';
+
+	/* Replace TABs and LFs. */
+	replaceChar(aDest, '\t', ' ');
+	replaceChar(aDest, '\n', ' ');
+}
+
+
+/**
+	* Size the join for up to iWaits data_lock_waits rows and empty it.
+	*
+	* @param   WaitJoin* pJoin, join
+	* @param   uint32_t iWaits, wait rows
+	* @return  unsigned integer, 0 on allocation failure
+*/
+
+unsigned int joinReserve(WaitJoin* pJoin, uint32_t iWaits)
+{
+	if (iWaits > pJoin->iCap || pJoin->aRefs == NULL)
+	{
+		uint32_t iCap = (pJoin->iCap > 0) ? pJoin->iCap : 64;
+		uint32_t iSlots = 1;
+
+		while (iCap < iWaits)
+		{
+			iCap *= 2;
+		}
+
+		/* Half-full at most: refs <= 2 * waits. */
+		while (iSlots < iCap * 4)
+		{
+			iSlots *= 2;
+		}
+
+		free(pJoin->aRefs);
+		free(pJoin->aSlots);
+		free(pJoin->aWaits);
+
+		pJoin->aRefs = malloc(sizeof(TrxRef) * iCap * 2);
+		pJoin->aSlots = malloc(sizeof(uint32_t) * iSlots);
+		pJoin->aWaits = malloc(sizeof(MYSQL_ROW) * iCap);
+		pJoin->iCap = iCap;
+		pJoin->iSlots = iSlots;
+
+		if (pJoin->aRefs == NULL || pJoin->aSlots == NULL || pJoin->aWaits == NULL)
+		{
+			joinFree(pJoin);
+			return 0;
+		}
+	}
+
+	memset(pJoin->aSlots, 0, sizeof(uint32_t) * pJoin->iSlots);
+	pJoin->iRefs = 0;
+	pJoin->iWaits = 0;
+
+	return 1;
+}
+
+
+/**
+	* Release the join buffers.
+	*
+	* @param   WaitJoin* pJoin, join
+	* @return  void
+*/
+
+void joinFree(WaitJoin* pJoin)
+{
+	free(pJoin->aRefs);
+	free(pJoin->aSlots);
+	free(pJoin->aWaits);
+	free(pJoin->pSQL);
+	memset(pJoin, 0, sizeof(WaitJoin));
+}
+
+
+/**
+	* Find an engine transaction, optionally adding it.
+	*
+	* @param   WaitJoin* pJoin, join
+	* @param   char* pTrxId, engine transaction id
+	* @param   unsigned int iInsert, 1 to add if absent
+	* @return  TrxRef*, NULL if absent
+*/
+
+TrxRef* joinRef(WaitJoin* pJoin, char const* pTrxId, unsigned int iInsert)
+{
+	uint64_t iTrxId = strtoull(pTrxId, NULL, 10);
+	uint32_t iMask = pJoin->iSlots - 1;
+	uint32_t i = graphHash(iTrxId) & iMask;
+	TrxRef* pRef;
+
+	while (pJoin->aSlots[i] != 0)
+	{
+		pRef = &pJoin->aRefs[pJoin->aSlots[i] - 1];
+
+		if (pRef->iTrxId == iTrxId)
+		{
+			return pRef;
+		}
+
+		i = (i + 1) & iMask;
+	}
+
+	if ( ! iInsert)
+	{
+		return NULL;
+	}
+
+	pRef = &pJoin->aRefs[pJoin->iRefs];
+	pRef->iTrxId = iTrxId;
+	pRef->trx = NULL;
+	pRef->lock = NULL;
+	pRef->pLockId = NULL;
+
+	pJoin->aSlots[i] = ++pJoin->iRefs;
+
+	return pRef;
+}
+
+
+/**
+	* Run pHead followed by an IN list: every referenced transaction id, or every waiting lock id.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   WaitJoin* pJoin, join
+	* @param   char* pHead, statement up to and including 'IN ('
+	* @param   size_t iLen, length of pHead
+	* @param   unsigned int iLocks, 1 for waiting lock ids, 0 for transaction ids
+	* @return  MYSQL_RES*, NULL on error or for an empty list
+*/
+
+MYSQL_RES* joinQuery(MYSQL* pConn, WaitJoin* pJoin, char const* pHead, size_t iLen, unsigned int iLocks)
+{
+	size_t iNeed = iLen + 2;
+	size_t iPos;
+	uint32_t i;
+	unsigned int iItems = 0;
+
+	for (i = 0; i < pJoin->iRefs; i++)
+	{
+		if ( ! iLocks)
+		{
+			iNeed += 21;
+		}
+		else if (pJoin->aRefs[i].pLockId != NULL)
+		{
+			iNeed += strlen(pJoin->aRefs[i].pLockId) * 2 + 3;
+		}
+	}
+
+	if (iNeed > pJoin->iSQLCap)
+	{
+		char* pGrown = realloc(pJoin->pSQL, iNeed);
+
+		if (pGrown == NULL)
+		{
+			return NULL;
+		}
+
+		pJoin->pSQL = pGrown;
+		pJoin->iSQLCap = iNeed;
+	}
+
+	memcpy(pJoin->pSQL, pHead, iLen);
+	iPos = iLen;
+
+	for (i = 0; i < pJoin->iRefs; i++)
+	{
+		TrxRef const* pRef = &pJoin->aRefs[i];
+
+		if (iLocks && pRef->pLockId == NULL)
+		{
+			continue;
+		}
+
+		if (iItems++ > 0)
+		{
+			pJoin->pSQL[iPos++] = ',';
+		}
+
+		if (iLocks)
+		{
+			pJoin->pSQL[iPos++] = '\'';
+			iPos += mysql_real_escape_string(pConn, pJoin->pSQL + iPos, pRef->pLockId, strlen(pRef->pLockId));
+			pJoin->pSQL[iPos++] = '\'';
+		}
+		else
+		{
+			iPos += (size_t) sprintf(pJoin->pSQL + iPos, "%" PRIu64, pRef->iTrxId);
+		}
+	}
+
+	if (iItems == 0)
+	{
+		return NULL;
+	}
+
+	pJoin->pSQL[iPos++] = ')';
+	pJoin->pSQL[iPos] = '\0';
+
+	return monQuery(pConn, pJoin->pSQL);
+}
+
+
+/**
+	* Join data_lock_waits rows client-side and add them to the graph.
+	* Hash join on engine transaction id: build from the waits, fetch only the referenced INNODB_TRX rows
+	* and the waiting data_locks rows (primary key lookups), then probe once per wait.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   WaitJoin* pJoin, join
+	* @param   MYSQL_RES* pWaits, data_lock_waits: requesting trx id, blocking trx id, requesting lock id
+	* @param   LockGraph* pGraph, graph, reserved for the wait rows
+	* @return  void
+*/
+
+void joinWaits(MYSQL* pConn, WaitJoin* pJoin, MYSQL_RES* pWaits, LockGraph* pGraph)
+{
+	static char const aTrxHead[] = ROW_WAITS_TAG "\
+		SELECT \
+			trx_id, trx_mysql_thread_id, TIMESTAMPDIFF(SECOND, trx_wait_started, NOW()), SEC_TO_TIME(TIMESTAMPDIFF(SECOND, trx_started, NOW())), trx_query \
+		FROM \
+			information_schema.INNODB_TRX \
+		WHERE \
+			trx_id IN (";
+	static char const aLockHead[] = ROW_WAITS_TAG "\
+		SELECT \
+			ENGINE_TRANSACTION_ID, CONCAT_WS(' ', CONCAT(OBJECT_SCHEMA, '.', OBJECT_NAME), INDEX_NAME, LOCK_MODE) \
+		FROM \
+			performance_schema.data_locks \
+		WHERE \
+			ENGINE_LOCK_ID IN (";
+	MYSQL_RES* result_trx;
+	MYSQL_RES* result_lock;
+	MYSQL_ROW row_res;
+	uint32_t i;
+
+	if (pWaits == NULL || ! joinReserve(pJoin, (uint32_t) mysql_num_rows(pWaits)))
+	{
+		return;
+	}
+
+	while ((row_res = mysql_fetch_row(pWaits)) && pJoin->iWaits < pJoin->iCap)
+	{
+		TrxRef* pWaiter;
+
+		if (row_res[0] == NULL || row_res[1] == NULL)
+		{
+			continue;
+		}
+
+		pWaiter = joinRef(pJoin, row_res[0], 1);
+		joinRef(pJoin, row_res[1], 1);
+
+		if (pWaiter->pLockId == NULL)
+		{
+			pWaiter->pLockId = row_res[2];
+		}
+
+		pJoin->aWaits[pJoin->iWaits++] = row_res;
+	}
+
+	if (pJoin->iWaits == 0)
+	{
+		return;
+	}
+
+	result_trx = joinQuery(pConn, pJoin, aTrxHead, sizeof(aTrxHead) - 1, 0);
+
+	while (result_trx != NULL && (row_res = mysql_fetch_row(result_trx)))
+	{
+		TrxRef* pRef = (row_res[0] != NULL) ? joinRef(pJoin, row_res[0], 0) : NULL;
+
+		if (pRef != NULL)
+		{
+			pRef->trx = row_res;
+		}
+	}
+
+	result_lock = joinQuery(pConn, pJoin, aLockHead, sizeof(aLockHead) - 1, 1);
+
+	while (result_lock != NULL && (row_res = mysql_fetch_row(result_lock)))
+	{
+		TrxRef* pRef = (row_res[0] != NULL) ? joinRef(pJoin, row_res[0], 0) : NULL;
+
+		if (pRef != NULL)
+		{
+			pRef->lock = row_res;
+		}
+	}
+
+	for (i = 0; i < pJoin->iWaits; i++)
+	{
+		TrxRef const* pWaiter = joinRef(pJoin, pJoin->aWaits[i][0], 0);
+		TrxRef const* pBlocker = joinRef(pJoin, pJoin->aWaits[i][1], 0);
+		char* aRow[7];
+
+		/* Either side may have finished between the queries. */
+		if (pWaiter->trx == NULL || pBlocker->trx == NULL)
+		{
+			continue;
+		}
+
+		aRow[0] = pWaiter->trx[1];
+		aRow[1] = pBlocker->trx[1];
+		aRow[2] = pWaiter->trx[2];
+		aRow[3] = (pWaiter->lock != NULL) ? pWaiter->lock[1] : NULL;
+		aRow[4] = pWaiter->trx[4];
+		aRow[5] = pBlocker->trx[4];
+		aRow[6] = pBlocker->trx[3];
+
+		graphAddRow(pGraph, aRow, GRAPH_INNODB);
+	}
+
+	mysql_free_result(result_trx);
+	mysql_free_result(result_lock);
+}
+
+
+/**
+	* Account the row lock wait queries of this refresh to their source.
+	* While the overhead line is shown, also read their server time from the connection's statement history:
+	* only statements tagged ROW_WAITS_TAG since the previous read, counted when that read was the previous refresh.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   unsigned int iSource, SOURCE_JOIN or SOURCE_SYS
+	* @param   double dClient, client-side query and fetch time, secs
+	* @param   RoundParams* pRound, collection settings
+	* @return  void
+*/
+
+void sourceCost(MYSQL* pConn, unsigned int iSource, double dClient, RoundParams const* pRound)
+{
+	SourceCost* pCost = &aSourceCost[iSource];
+	char aSQL[400];
+	MYSQL_RES* result_h;
+	MYSQL_ROW row_h;
+
+	pCost->iTicks++;
+	pCost->dClient += dClient;
+	pCost->dLastClient = dClient;
+
+	if ( ! pRound->iFooter || iHistory == 2)
+	{
+		return;
+	}
+
+	snprintf(aSQL, sizeof(aSQL), "SELECT COUNT(*), SUM(TIMER_WAIT), MAX(EVENT_ID) FROM performance_schema.events_statements_history WHERE THREAD_ID = (SELECT THREAD_ID FROM performance_schema.threads WHERE PROCESSLIST_ID = CONNECTION_ID()) AND EVENT_ID > %" PRIu64 " AND SQL_TEXT LIKE '/* row waits */%%'", iHistoryEvent);
+
+	result_h = monQuery(pConn, aSQL);
+
+	if (result_h == NULL || (row_h = mysql_fetch_row(result_h)) == NULL)
+	{
+		/* No history access: stop asking, unless the connection itself failed. */
+		if (mysql_errno(pConn) < CR_MIN_ERROR)
+		{
+			iHistory = 2;
+		}
+
+		mysql_free_result(result_h);
+		return;
+	}
+
+	if (iHistory == 1 && iHistoryTick + 1 == pRound->iRound && row_h[0] != NULL && strcmp(row_h[0], "0") != 0 && row_h[1] != NULL)
+	{
+		pCost->iLastServer = strtoull(row_h[1], NULL, 10);
+		pCost->iServer += pCost->iLastServer;
+		pCost->iServerTicks++;
+	}
+
+	if (row_h[2] != NULL)
+	{
+		iHistoryEvent = strtoull(row_h[2], NULL, 10);
+	}
+
+	iHistory = 1;
+	iHistoryTick = pRound->iRound;
+
+	mysql_free_result(result_h);
+}
+
+
+/**
+	* Print the cost of each row lock wait source used, and the server time saved by the client-side join.
+	*
+	* @return  void
+*/
+
+void sourceSummary(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		SourceCost const* pCost = &aSourceCost[i];
+
+		if (pCost->iTicks == 0)
+		{
+			continue;
+		}
+
+		fprintf(stdout, "  row lock waits, %s: %.2fms/refresh client", (i == SOURCE_JOIN ? "data_lock_waits join" : "sys.innodb_lock_waits"), pCost->dClient * 1000 / pCost->iTicks);
+
+		if (pCost->iServerTicks > 0)
+		{
+			fprintf(stdout, ", %.2fms/refresh server (%" PRIu64 " refreshes)", (double) pCost->iServer / 1e9 / pCost->iServerTicks, pCost->iServerTicks);
+		}
+
+		fprintf(stdout, "\n");
+	}
+
+	if (aSourceCost[SOURCE_JOIN].iServerTicks > 0 && aSourceCost[SOURCE_SYS].iServerTicks > 0 && aSourceCost[SOURCE_SYS].iServer > 0)
+	{
+		double dJoin = (double) aSourceCost[SOURCE_JOIN].iServer / aSourceCost[SOURCE_JOIN].iServerTicks;
+		double dSys = (double) aSourceCost[SOURCE_SYS].iServer / aSourceCost[SOURCE_SYS].iServerTicks;
+
+		fprintf(stdout, "  server time saved by the join: %.0f%%\n", (1 - dJoin / dSys) * 100);
+	}
+
+	if (aSourceCost[SOURCE_JOIN].iTicks > 0 || aSourceCost[SOURCE_SYS].iTicks > 0)
+	{
+		fprintf(stdout, "\n");
+	}
+}
+
+/**
+	* Allocate the contention heatmap.
+	*
+	* @param   HeatMap* pHeat, heatmap
+	* @return  unsigned int, 1 on success, 0 if out of memory (the heatmap view says so)
+*/
+
+unsigned int heatInit(HeatMap* pHeat)
+{
+	time_t tNow = time(NULL);
+	struct tm tmNow;
+
+	pHeat->aEntries = malloc(sizeof(HeatEntry) * HEAT_ENTRIES);
+	pHeat->aSlots = calloc(HEAT_SLOTS, sizeof(uint32_t));
+	pHeat->aRank = malloc(sizeof(uint64_t) * HEAT_ENTRIES);
+
+	localtime_r(&tNow, &tmNow);
+	strftime(pHeat->aSince, sizeof(pHeat->aSince), "%H:%M:%S", &tmNow);
+
+	if (pHeat->aEntries == NULL || pHeat->aSlots == NULL || pHeat->aRank == NULL)
+	{
+		heatFree(pHeat);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/**
+	* Free the contention heatmap.
+	*
+	* @param   HeatMap* pHeat, heatmap
+	* @return  void
+*/
+
+void heatFree(HeatMap* pHeat)
+{
+	free(pHeat->aEntries);
+	free(pHeat->aSlots);
+	free(pHeat->aRank);
+	free(pHeat->aPrev);
+	free(pHeat->aCur);
+
+	pHeat->aEntries = NULL;
+	pHeat->aSlots = NULL;
+	pHeat->aRank = NULL;
+	pHeat->aPrev = NULL;
+	pHeat->aCur = NULL;
+	pHeat->iEntries = 0;
+	pHeat->iPrev = 0;
+	pHeat->iWaitCap = 0;
+}
+
+
+/**
+	* Decay factor after a number of seconds: 2^(-secs / HEAT_HALF_LIFE), without libm.
+	*
+	* @param   double dSecs, elapsed secs
+	* @return  double, factor in [0, 1]
+*/
+
+double heatDecay(double dSecs)
+{
+	double dFactor = 1;
+	double dHalves = dSecs / HEAT_HALF_LIFE;
+	double dX;
+
+	for ( ; dHalves >= 1; dHalves -= 1)
+	{
+		dFactor *= 0.5;
+
+		if (dFactor < 1e-9)
+		{
+			return 0;
+		}
+	}
+
+	/* e^-x for the remaining 0 <= x < ln 2: the series to x^6 is within 0.02%. */
+	dX = dHalves * 0.6931471805599453;
+
+	return dFactor * (1 - dX * (1 - dX / 2 * (1 - dX / 3 * (1 - dX / 4 * (1 - dX / 5 * (1 - dX / 6))))));
+}
+
+
+/**
+	* FNV-1a hash of a lock object, ignoring backticks (the sys view quotes names, data_locks does not).
+	*
+	* @param   char* pObject, lock object
+	* @return  uint64_t, hash
+*/
+
+uint64_t heatHash(char const* pObject)
+{
+	uint64_t iHash = 14695981039346656037ULL;
+
+	for ( ; *pObject != '\0'; pObject++)
+	{
+		if (*pObject != '`')
+		{
+			iHash = (iHash ^ (unsigned char) *pObject) * 1099511628211ULL;
+		}
+	}
+
+	return iHash;
+}
+
+
+/**
+	* Find a lock object's entry, adding it if new; a full table first evicts idle, cold entries.
+	*
+	* @param   HeatMap* pHeat, heatmap
+	* @param   char* pObject, lock object from the graph
+	* @param   uint64_t* pHash, set to the object's hash
+	* @return  uint32_t, entry index, GRAPH_NONE if the table is full of hot entries
+*/
+
+uint32_t heatEntry(HeatMap* pHeat, char const* pObject, uint64_t* pHash)
+{
+	uint64_t iHash = heatHash(pObject);
+	uint32_t i = (uint32_t) iHash & (HEAT_SLOTS - 1);
+	HeatEntry* pEntry;
+	char* pDest;
+
+	*pHash = iHash;
+
+	while (pHeat->aSlots[i] != 0)
+	{
+		if (pHeat->aEntries[pHeat->aSlots[i] - 1].iHash == iHash)
+		{
+			return pHeat->aSlots[i] - 1;
+		}
+
+		i = (i + 1) & (HEAT_SLOTS - 1);
+	}
+
+	if (pHeat->iEntries == HEAT_ENTRIES)
+	{
+		heatEvict(pHeat);
+
+		if (pHeat->iEntries == HEAT_ENTRIES)
+		{
+			return GRAPH_NONE;
+		}
+
+		/* Slots were rebuilt. */
+		i = (uint32_t) iHash & (HEAT_SLOTS - 1);
+
+		while (pHeat->aSlots[i] != 0)
+		{
+			i = (i + 1) & (HEAT_SLOTS - 1);
+		}
+	}
+
+	pEntry = &pHeat->aEntries[pHeat->iEntries];
+	memset(pEntry, 0, sizeof(HeatEntry));
+	pEntry->iHash = iHash;
+
+	for (pDest = pEntry->aObject; *pObject != '\0' && pDest < pEntry->aObject + sizeof(pEntry->aObject) - 1; pObject++)
+	{
+		if (*pObject != '`')
+		{
+			*pDest++ = *pObject;
+		}
+	}
+
+	*pDest = '\0';
+
+	pHeat->aSlots[i] = ++pHeat->iEntries;
+
+	return pHeat->iEntries - 1;
+}
+
+
+/**
+	* Drop the entries with no waiter in the current sample and decayed waits under HEAT_COLD, then rehash.
+	* Their session totals are lost, and counted as evicted.
+	*
+	* @param   HeatMap* pHeat, heatmap
+	* @return  void
+*/
+
+void heatEvict(HeatMap* pHeat)
+{
+	uint32_t i;
+	uint32_t iKept = 0;
+
+	for (i = 0; i < pHeat->iEntries; i++)
+	{
+		HeatEntry const* pEntry = &pHeat->aEntries[i];
+
+		if (pEntry->iWaiters == 0 && pEntry->dHeatWaits < HEAT_COLD)
+		{
+			pHeat->iEvicted++;
+			continue;
+		}
+
+		if (iKept != i)
+		{
+			pHeat->aEntries[iKept] = *pEntry;
+		}
+
+		iKept++;
+	}
+
+	pHeat->iEntries = iKept;
+	memset(pHeat->aSlots, 0, sizeof(uint32_t) * HEAT_SLOTS);
+
+	for (i = 0; i < iKept; i++)
+	{
+		uint32_t j = (uint32_t) pHeat->aEntries[i].iHash & (HEAT_SLOTS - 1);
+
+		while (pHeat->aSlots[j] != 0)
+		{
+			j = (j + 1) & (HEAT_SLOTS - 1);
+		}
+
+		pHeat->aSlots[j] = i + 1;
+	}
+}
+
+
+/**
+	* Add a lock wait graph's row lock waits to the heatmap.
+	* A wait counts once, when first seen: a waiter on an object it was not waiting on in the previous sample,
+	* or waiting less long than then. Wait secs are waiters x the time since the previous sample, at most dMaxStep,
+	* so waits shorter than the data's one-second resolution still add up.
+	*
+	* @param   HeatMap* pHeat, heatmap
+	* @param   LockGraph* pGraph, built graph
+	* @param   double dNow, monotonic time the graph was collected
+	* @param   double dMaxStep, longest step credited, secs: the refresh interval
+	* @return  void
+*/
+
+void heatSample(HeatMap* pHeat, LockGraph const* pGraph, double dNow, double dMaxStep)
+{
+	double dStep = (pHeat->iSamples > 0) ? dNow - pHeat->dLast : 0;
+	double dDecay = heatDecay(dStep);
+	uint32_t iCur = 0;
+	uint32_t i;
+	HeatWait* pSwap;
+
+	if (pHeat->aEntries == NULL || pGraph->aNodes == NULL)
+	{
+		return;
+	}
+
+	if (pGraph->iNodes > pHeat->iWaitCap)
+	{
+		uint32_t iCap = pGraph->iNodes * 2;
+		HeatWait* aPrev = realloc(pHeat->aPrev, sizeof(HeatWait) * iCap);
+		HeatWait* aCur;
+
+		if (aPrev == NULL)
+		{
+			return;
+		}
+
+		pHeat->aPrev = aPrev;
+		aCur = realloc(pHeat->aCur, sizeof(HeatWait) * iCap);
+
+		if (aCur == NULL)
+		{
+			return;
+		}
+
+		pHeat->aCur = aCur;
+		pHeat->iWaitCap = iCap;
+	}
+
+	if (dStep > dMaxStep)
+	{
+		dStep = dMaxStep;
+	}
+
+	for (i = 0; i < pHeat->iEntries; i++)
+	{
+		HeatEntry* pEntry = &pHeat->aEntries[i];
+
+		pEntry->dHeatWaits *= dDecay;
+		pEntry->dHeatSecs *= dDecay;
+		pEntry->dHeatMax *= dDecay;
+		pEntry->iWaiters = 0;
+	}
+
+	for (i = 0; i < pGraph->iNodes; i++)
+	{
+		GraphNode const* pNode = &pGraph->aNodes[i];
+		HeatWait* pWait = &pHeat->aCur[iCur];
+		HeatWait const* pPrev;
+		uint64_t iHash;
+		uint32_t iEntry;
+
+		if ( ! (pNode->iKind & GRAPH_INNODB) || pNode->aObject[0] == '\0')
+		{
+			continue; /* Blocking only, or a metadata lock wait. */
+		}
+
+		iEntry = heatEntry(pHeat, pNode->aObject, &iHash);
+
+		if (iEntry == GRAPH_NONE)
+		{
+			pHeat->iUntracked++;
+			continue;
+		}
+
+		pHeat->aEntries[iEntry].iWaiters++;
+
+		pWait->iKey = iHash ^ (pNode->iPid * 0x9E3779B97F4A7C15ULL);
+		pWait->iSecs = pNode->iWaitSecs;
+		pPrev = bsearch(pWait, pHeat->aPrev, pHeat->iPrev, sizeof(HeatWait), heatWaitCompare);
+
+		if (pPrev == NULL || pWait->iSecs < pPrev->iSecs)
+		{
+			pHeat->aEntries[iEntry].iWaits++;
+			pHeat->aEntries[iEntry].dHeatWaits += 1;
+		}
+
+		iCur++;
+	}
+
+	pHeat->iSamples++;
+	pHeat->dLast = dNow;
+
+	qsort(pHeat->aCur, iCur, sizeof(HeatWait), heatWaitCompare);
+	pSwap = pHeat->aPrev;
+	pHeat->aPrev = pHeat->aCur;
+	pHeat->aCur = pSwap;
+	pHeat->iPrev = iCur;
+
+	for (i = 0; i < pHeat->iEntries; i++)
+	{
+		HeatEntry* pEntry = &pHeat->aEntries[i];
+		double dMs;
+
+		if (pEntry->iWaiters > 0)
+		{
+			pEntry->dWaitSecs += pEntry->iWaiters * dStep;
+			pEntry->dHeatSecs += pEntry->iWaiters * dStep;
+
+			if (pEntry->iWaiters > pEntry->iMaxWaiters)
+			{
+				pEntry->iMaxWaiters = pEntry->iWaiters;
+			}
+
+			if (pEntry->iWaiters > pEntry->dHeatMax)
+			{
+				pEntry->dHeatMax = pEntry->iWaiters;
+			}
+		}
+
+		/* Rank by decayed wait time; waits only seen once (no step yet) still rank above idle entries. */
+		dMs = pEntry->dHeatSecs * 1000 + pEntry->dHeatWaits;
+		pHeat->aRank[i] = ((uint64_t) (dMs < 4294967295.0 ? dMs : 4294967295.0) << 32) | i;
+	}
+
+	qsort(pHeat->aRank, pHeat->iEntries, sizeof(uint64_t), rankCompare);
+}
+
+
+/**
+	* qsort()/bsearch() comparator of HeatWait keys.
+	*
+	* @param   void* pA, HeatWait
+	* @param   void* pB, HeatWait
+	* @return  int, ascending
+*/
+
+int heatWaitCompare(void const* pA, void const* pB)
+{
+	uint64_t iA = ((HeatWait const*) pA)->iKey;
+	uint64_t iB = ((HeatWait const*) pB)->iKey;
+
+	return (iA > iB) - (iA < iB);
+}
+
+
+/**
+	* Split an entry's object into its table, index and lock mode: CONCAT_WS() leaves out a NULL index.
+	*
+	* @param   HeatEntry* pEntry, entry
+	* @param   char* aTable, buffer, set to schema.table
+	* @param   size_t iSize, buffer size
+	* @param   char** pIndex, set to the index, "" for a table lock
+	* @param   char** pMode, set to the lock mode
+	* @return  void
+*/
+
+void heatSplit(HeatEntry const* pEntry, char* const aTable, size_t iSize, char const** pIndex, char const** pMode)
+{
+	char* pSpace;
+
+	snprintf(aTable, iSize, "%s", pEntry->aObject);
+	*pIndex = "";
+	*pMode = "";
+	pSpace = strrchr(aTable, ' ');
+
+	if (pSpace != NULL)
+	{
+		*pSpace = '\0';
+		*pMode = pSpace + 1;
+		pSpace = strchr(aTable, ' ');
+
+		if (pSpace != NULL)
+		{
+			*pSpace = '\0';
+			*pIndex = pSpace + 1;
+		}
+	}
+}
+
+
+/**
+	* Contention heatmap display: table, index and lock mode combinations, hottest first.
+	*
+	* @param   HeatMap* pHeat, heatmap
+	* @param   int* pRow, pointer to iRow
+	* @return  void
+*/
+
+void displayHeatmap(HeatMap const* pHeat, int* pRow)
+{
+	int iRow = *pRow;
+	uint32_t i;
+	double dTop;
+
+	iRow += 3;
+	attrset(A_BOLD | COLOR_PAIR(2));
+	mvprintw(iRow, 1, "contention heatmap");
+	attrset(A_NORMAL);
+
+	if (pHeat->aEntries == NULL)
+	{
+		attrset(A_BOLD | COLOR_PAIR(4));
+		mvprintw(iRow, 22, "out of memory");
+		attrset(A_NORMAL);
+		return;
+	}
+
+	mvprintw(iRow, 22, "row lock waits since %s: %" PRIu64 " samples, %" PRIu32 " table/index/mode combinations, half-life %.0fs",
+		pHeat->aSince, pHeat->iSamples, pHeat->iEntries, HEAT_HALF_LIFE);
+
+	if (pHeat->iEvicted > 0 || pHeat->iUntracked > 0)
+	{
+		printw("   (evicted %" PRIu64 ", untracked waits %" PRIu64 ")", pHeat->iEvicted, pHeat->iUntracked);
+	}
+
+	iRow = 12;
+
+	if (pHeat->iEntries == 0)
+	{
+		mvprintw(iRow, 1, "no row lock waits seen yet");
+		return;
+	}
+
+	mvprintw(iRow, 1, "heat");
+	mvprintw(iRow, 14, "table");
+	mvprintw(iRow, 50, "index");
+	mvprintw(iRow, 72, "mode");
+	mvprintw(iRow, 94, "now");
+	mvprintw(iRow, 101, "waits");
+	mvprintw(iRow, 111, "wait s");
+	mvprintw(iRow, 122, "max");
+	mvprintw(iRow, 130, "session: waits");
+	mvprintw(iRow, 146, "wait s");
+	mvprintw(iRow, 156, "max");
+
+	dTop = pHeat->aEntries[pHeat->aRank[0] & 0xFFFFFFFF].dHeatSecs;
+
+	for (i = 0; i < pHeat->iEntries && iRow < LINES - 4; i++)
+	{
+		HeatEntry const* pEntry = &pHeat->aEntries[pHeat->aRank[i] & 0xFFFFFFFF];
+		double dShare = (dTop > 0) ? pEntry->dHeatSecs / dTop : 0;
+		int iBar = (int) (dShare * HEAT_BAR + 0.5);
+		char aTable[96];
+		char const* pIndex;
+		char const* pMode;
+
+		heatSplit(pEntry, aTable, sizeof(aTable), &pIndex, &pMode);
+
+		iRow++;
+
+		attrset(A_BOLD | COLOR_PAIR(dShare >= 0.5 ? 4 : (dShare >= 0.1 ? 2 : 5)));
+		mvprintw(iRow, 1, "%.*s", iBar, "##########");
+		attrset(A_NORMAL);
+
+		attrset(A_BOLD | COLOR_PAIR(1));
+		mvprintw(iRow, 14, "%.35s", aTable);
+		mvprintw(iRow, 50, "%.21s", (pIndex[0] != '\0' ? pIndex : "-"));
+		mvprintw(iRow, 72, "%.21s", pMode);
+		attrset(A_NORMAL);
+
+		mvprintw(iRow, 94, "%" PRIu32, pEntry->iWaiters);
+		mvprintw(iRow, 101, "%.1f", pEntry->dHeatWaits);
+		mvprintw(iRow, 111, "%.1f", pEntry->dHeatSecs);
+		mvprintw(iRow, 122, "%.1f", pEntry->dHeatMax);
+		mvprintw(iRow, 139, "%" PRIu64, pEntry->iWaits);
+		mvprintw(iRow, 146, "%.1f", pEntry->dWaitSecs);
+		mvprintw(iRow, 156, "%" PRIu32, pEntry->iMaxWaiters);
+	}
+
+	if (i < pHeat->iEntries)
+	{
+		mvprintw(LINES - 3, 1, "... %" PRIu32 " more combinations", pHeat->iEntries - i);
+	}
+}
+
+
+/**
+	* Write the heatmap, hottest first, to a CSV file in the working directory.
+	*
+	* @param   HeatMap* pHeat, heatmap
+	* @return  void
+*/
+
+void heatExport(HeatMap const* pHeat)
+{
+	char aPath[64];
+	char aStamp[20];
+	time_t tNow = time(NULL);
+	struct tm tmNow;
+	FILE* fp;
+	uint32_t i;
+
+	if (pHeat->aEntries == NULL || pHeat->iEntries == 0)
+	{
+		return;
+	}
+
+	localtime_r(&tNow, &tmNow);
+	strftime(aStamp, sizeof(aStamp), "%Y%m%d-%H%M%S", &tmNow);
+	snprintf(aPath, sizeof(aPath), "mysqllockmon-heatmap-%s.csv", aStamp);
+
+	fp = fopen(aPath, "w");
+
+	if (fp == NULL)
+	{
+		fprintf(stderr, "  heatmap: cannot write %s\n\n", aPath);
+		return;
+	}
+
+	fprintf(fp, "schema,table,index,lock_mode,waits,wait_secs,max_waiters,decayed_waits,decayed_wait_secs,decayed_max_waiters\n");
+
+	for (i = 0; i < pHeat->iEntries; i++)
+	{
+		HeatEntry const* pEntry = &pHeat->aEntries[pHeat->aRank[i] & 0xFFFFFFFF];
+		char aTable[96];
+		char const* pSchema = "";
+		char const* pTable = aTable;
+		char const* pIndex;
+		char const* pMode;
+		char* pSplit;
+
+		heatSplit(pEntry, aTable, sizeof(aTable), &pIndex, &pMode);
+		pSplit = strchr(aTable, '.');
+
+		if (pSplit != NULL)
+		{
+			*pSplit = '\0';
+			pSchema = aTable;
+			pTable = pSplit + 1;
+		}
+
+		fprintf(fp, "\"%s\",\"%s\",\"%s\",\"%s\",%" PRIu64 ",%.3f,%" PRIu32 ",%.3f,%.3f,%.3f\n",
+			pSchema, pTable, pIndex, pMode, pEntry->iWaits, pEntry->dWaitSecs, pEntry->iMaxWaiters, pEntry->dHeatWaits, pEntry->dHeatSecs, pEntry->dHeatMax);
+	}
+
+	fclose(fp);
+
+	fprintf(stdout, "  heatmap: %" PRIu32 " table/index/mode combinations over %" PRIu64 " samples written to %s\n\n", pHeat->iEntries, pHeat->iSamples, aPath);
+}
+
+
+/**
+	* Open one connection and start one worker thread per view.
+	*
+	* @param   LockPool* pPool, pool
+	* @return  unsigned int, 1 on success, 0 if a connection or thread failed (poolStop() cleans up)
+*/
+
+unsigned int poolStart(LockPool* pPool)
+{
+	unsigned int i;
+
+	pthread_mutex_init(&pPool->mLock, NULL);
+	pthread_cond_init(&pPool->cStart, NULL);
+	pPool->iInit = 1;
+
+	for (i = 0; i < POOL_VIEWS; i++)
+	{
+		PoolWorker* pWorker = &pPool->aWorkers[i];
+
+		pWorker->view_t = (LockType) i;
+		pWorker->pConn = mysql_init(NULL);
+
+		if (pWorker->pConn == NULL)
+		{
+			return 0;
+		}
+
+		mysql_options4(pWorker->pConn, MYSQL_OPT_CONNECT_ATTR_ADD, "program_name", APP_NAME);
+
+		if (mysql_real_connect(pWorker->pConn, pHost, pUser, pPassword, NULL, iPort, NULL, 0) == NULL)
+		{
+			return 0;
+		}
+
+		if (pthread_create(&pWorker->tThread, NULL, workerThread, pWorker) != 0)
+		{
+			return 0;
+		}
+
+		pWorker->iRunning = 1;
+	}
+
+	return 1;
+}
+
+
+/**
+	* Stop the workers (each finishes its current view first), close their connections, free the snapshots.
+	*
+	* @param   LockPool* pPool, pool
+	* @return  void
+*/
+
+void poolStop(LockPool* pPool)
+{
+	unsigned int i;
+
+	if ( ! pPool->iInit)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&pPool->mLock);
+	pPool->iStop = 1;
+	pthread_cond_broadcast(&pPool->cStart);
+	pthread_mutex_unlock(&pPool->mLock);
+
+	for (i = 0; i < POOL_VIEWS; i++)
+	{
+		PoolWorker* pWorker = &pPool->aWorkers[i];
+
+		if (pWorker->iRunning)
+		{
+			pthread_join(pWorker->tThread, NULL);
+			pWorker->iRunning = 0;
+		}
+
+		if (pWorker->pConn != NULL)
+		{
+			mysql_close(pWorker->pConn);
+			pWorker->pConn = NULL;
+		}
+
+		joinFree(&pWorker->join);
+		sessionCacheFree(&pWorker->cache);
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		snapshotClear(&pPool->aSnaps[i]);
+		graphFree(&pPool->aSnaps[i].graph);
+		free(pPool->aSnaps[i].sessions.aSessions);
+		pPool->aSnaps[i].sessions.aSessions = NULL;
+		pPool->aSnaps[i].sessions.iCap = 0;
+	}
+
+	pthread_cond_destroy(&pPool->cStart);
+	pthread_mutex_destroy(&pPool->mLock);
+	pPool->iInit = 0;
+}
+
+
+/**
+	* Start a round: every worker collects its view into the snapshot not on screen.
+	* Only called when no round is in progress.
+	*
+	* @param   LockPool* pPool, pool
+	* @param   RoundParams* pRound, settings for this round
+	* @return  void
+*/
+
+void poolRound(LockPool* pPool, RoundParams const* pRound)
+{
+	LockSnapshot* pSnap = &pPool->aSnaps[pPool->iRound & 1];
+	time_t tNow = time(NULL);
+	struct tm tmNow;
+
+	snapshotClear(pSnap);
+
+	pSnap->round = *pRound;
+	pSnap->round.iRound = pPool->iRound;
+	localtime_r(&tNow, &tmNow);
+	strftime(pSnap->aTime, sizeof(pSnap->aTime), "%H:%M:%S", &tmNow);
+	pSnap->dStart = monotonicTime();
+	pSnap->dElapsed = 0;
+	pSnap->iAccess = 0;
+	pSnap->iQueries = 0;
+	pSnap->dQuery = 0;
+	pSnap->dFetch = 0;
+
+	pthread_mutex_lock(&pPool->mLock);
+	pPool->iPending = POOL_VIEWS;
+	pPool->pFilling = pSnap;
+	pPool->iRound++;
+	pthread_cond_broadcast(&pPool->cStart);
+	pthread_mutex_unlock(&pPool->mLock);
+}
+
+
+/**
+	* Hand over the round in progress once every worker is done.
+	*
+	* @param   LockPool* pPool, pool
+	* @return  LockSnapshot*, completed snapshot, NULL if none completed since the last call
+*/
+
+LockSnapshot* poolCollected(LockPool* pPool)
+{
+	LockSnapshot* pDone = NULL;
+
+	if (pPool->pFilling == NULL)
+	{
+		return NULL;
+	}
+
+	pthread_mutex_lock(&pPool->mLock);
+
+	if (pPool->iPending == 0)
+	{
+		pDone = pPool->pFilling;
+		pPool->pFilling = NULL;
+	}
+
+	pthread_mutex_unlock(&pPool->mLock);
+
+	return pDone;
+}
+
+
+/**
+	* Worker thread: collect its view once per round on its own connection.
+	*
+	* @param   void* pArg, PoolWorker*
+	* @return  void*, NULL
+*/
+
+void* workerThread(void* pArg)
+{
+	PoolWorker* pWorker = (PoolWorker*) pArg;
+	LockPool* pPool = &lockPool;
+	LockSnapshot* pSnap;
+	uint64_t iDone = 0;
+	sigset_t sigMask;
+
+	/* SIGINT belongs to the UI thread. */
+	sigemptyset(&sigMask);
+	sigaddset(&sigMask, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &sigMask, NULL);
+
+	mysql_thread_init();
+
+	pTickStats = &pWorker->stats;
+
+	pthread_mutex_lock(&pPool->mLock);
+
+	while (1)
+	{
+		while ( ! pPool->iStop && pPool->iRound == iDone)
+		{
+			pthread_cond_wait(&pPool->cStart, &pPool->mLock);
+		}
+
+		if (pPool->iStop)
+		{
+			break;
+		}
+
+		iDone = pPool->iRound;
+		pSnap = pPool->pFilling;
+		pthread_mutex_unlock(&pPool->mLock);
+
+		pWorker->stats.iTickQueries = 0;
+		pWorker->stats.dTickQuery = 0;
+		pWorker->stats.dTickFetch = 0;
+
+		collectView(pWorker, pSnap);
+
+		pthread_mutex_lock(&pPool->mLock);
+
+		pSnap->iQueries += pWorker->stats.iTickQueries;
+		pSnap->dQuery += pWorker->stats.dTickQuery;
+		pSnap->dFetch += pWorker->stats.dTickFetch;
+
+		if (--pPool->iPending == 0)
+		{
+			pSnap->dElapsed = monotonicTime() - pSnap->dStart;
+		}
+	}
+
+	pthread_mutex_unlock(&pPool->mLock);
+
+	mysql_thread_end();
+
+	return NULL;
+}
+
+
+/**
+	* Collect one view into a snapshot.
+	*
+	* @param   PoolWorker* pWorker, worker
+	* @param   LockSnapshot* pSnap, snapshot being filled
+	* @return  void
+*/
+
+void collectView(PoolWorker* pWorker, LockSnapshot* pSnap)
+{
+	MYSQL* pConn = pWorker->pConn;
+
+	if (pWorker->view_t == TRANSACTIONS)
+	{
+		/* TRX at InnoDB layer, and History List Length. */
+		MYSQL_RES* result_acttr = monQuery(pConn, "SELECT COUNT(*) FROM information_schema.INNODB_TRX");
+		MYSQL_ROW row_acttr = (result_acttr != NULL) ? mysql_fetch_row(result_acttr) : NULL;
+
+		if (mysql_errno(pConn) == 0 && row_acttr != NULL)
+		{
+			MYSQL_RES* result_hll = monQuery(pConn, "SELECT COUNT FROM information_schema.INNODB_METRICS WHERE NAME = 'trx_rseg_history_len'");
+			MYSQL_ROW row_hll = (result_hll != NULL) ? mysql_fetch_row(result_hll) : NULL;
+
+			pSnap->iAccess = 1;
+			snprintf(pSnap->aTrx, sizeof(pSnap->aTrx), "%s", row_acttr[0]);
+			snprintf(pSnap->aHll, sizeof(pSnap->aHll), "%s", (row_hll != NULL) ? row_hll[0] : "-");
+			mysql_free_result(result_hll);
+
+			pSnap->aResults[TRANSACTIONS] = queryTransactions(pConn);
+		}
+
+		mysql_free_result(result_acttr);
+	}
+	else if (pWorker->view_t == INNODB_LOCK_WAITS)
+	{
+		/* This worker is the only caller of collectGraph() and sourceCost() while the pool runs. */
+		collectGraph(pConn, &pSnap->graph, &pWorker->join, &pSnap->round);
+		memcpy(pSnap->aCost, aSourceCost, sizeof(aSourceCost));
+	}
+	else if (pWorker->view_t == TABLE_LOCK_WAITS && pSnap->round.iMDL == 1)
+	{
+		pSnap->aResults[TABLE_LOCK_WAITS] = queryTableLockWaits(pConn);
+	}
+	else if (pWorker->view_t == METADATA_LOCKS && pSnap->round.iMDL == 1)
+	{
+		pSnap->aResults[METADATA_LOCKS] = queryMetadata(pConn, pSnap->round.iV8);
+
+		if (pSnap->aResults[METADATA_LOCKS] != NULL)
+		{
+			sessionResolve(pConn, &pWorker->cache, pSnap->aResults[METADATA_LOCKS], 6, &pSnap->sessions);
+		}
+	}
+}
+
+
+/**
+	* Free a snapshot's results; its graph and session buffers are kept for reuse.
+	*
+	* @param   LockSnapshot* pSnap, snapshot
+	* @return  void
+*/
+
+void snapshotClear(LockSnapshot* pSnap)
+{
+	unsigned int i;
+
+	for (i = 0; i < POOL_VIEWS; i++)
+	{
+		mysql_free_result(pSnap->aResults[i]);
+		pSnap->aResults[i] = NULL;
+	}
+
+	pSnap->sessions.iSessions = 0;
+}
+
+
+/**
+	* A view's result from a snapshot, rewound: the same snapshot is drawn again on every key.
+	*
+	* @param   LockSnapshot* pSnap, snapshot
+	* @param   LockType view_t, view
+	* @return  MYSQL_RES*, NULL if not collected
+*/
+
+MYSQL_RES* snapshotResult(LockSnapshot* pSnap, LockType view_t)
+{
+	MYSQL_RES* pResult = pSnap->aResults[view_t];
+
+	if (pResult != NULL)
+	{
+		mysql_data_seek(pResult, 0);
+	}
+
+	return pResult;
+}
+
+
+/**
+	* Process command-line switches using getopt()
+	*
+	* @param   integer iArgCount, number of arguments
+	* @param   char* aArgV, pointer to aArgV
+	* @return  unsigned integer
+*/
+
+unsigned int options(int iArgCount, char* const aArgV[])
+{
+	int iOpts = 0;
+	int iOptsIdx = 0;
+	unsigned int iHelp = 0;
+
+	struct option aLongOpts[] =
+	{
+		{"help", no_argument, 0, 'i'},
+		{0, 0, 0, 0}
+	};
+
+	while ((iOpts = getopt_long(iArgCount, aArgV, "ih:u:t:p:w", aLongOpts, &iOptsIdx)) != -1)
+	{
+		switch (iOpts)
+		{
+			case 'i':
+				iHelp = 1;
+				break;
+
+			case 'h':
+				pHost = optarg;
+				break;
 
 			case 'u':
 				pUser = optarg;
@@ -783,6 +3865,10 @@ unsigned int options(int iArgCount, char* const aArgV[])
 				iPort = (unsigned int) atoi(optarg);
 				break;
 
+			case 'w':
+				iWorkers = 1;
+				break;
+
 			case '?':
 
 				if (optopt == 'h' || optopt == 'u' || optopt == 't' || optopt == 'p')
@@ -839,5 +3925,5 @@ void menu(char* const pFName)
 {
 	fprintf(stdout, "\n%s v.%s\nby Tinram", APP_NAME, MB_VERSION);
 	fprintf(stdout, "\n\nUsage:\n");
-	fprintf(stdout, "\t%s -u <user> [-h <host>] [-t <time (ms)>] [-p <port>]\n\n", pFName);
+	fprintf(stdout, "\t%s -u <user> [-h <host>] [-t <time (ms)>] [-p <port>] [-w]\n\n", pFName);
 }
@@ -7,27 +7,507 @@
 	*
 	* @author        Martin Latter
 	* @copyright     Martin Latter, 06/11/2020
-	* @version       0.34
+	* @version       0.43
 	* @license       GNU GPL version 3.0 (GPL v3); https://www.gnu.org/licenses/gpl-3.0.html
 	* @link          https://github.com/Tinram/MySQL.git
 	*
 	* Compile:
 	* (Linux GCC x64)
 	*                Required dependencies: libmysqlclient-dev, libncurses5-dev
-	*                gcc mysqlmon.c $(mysql_config --cflags) $(mysql_config --libs) -o mysqlmon -I../mysql_include/ -lncurses -Ofast -Wall -Wextra -Wuninitialized -Wunused -Werror -std=gnu99 -s
+	*                gcc mysqlmon.c $(mysql_config --cflags) $(mysql_config --libs) -o mysqlmon -I../mysql_include/ -lncurses -pthread -Ofast -Wall -Wextra -Wuninitialized -Wunused -Werror -std=gnu99 -s
 	*
 	* Usage:
 	*                ./mysqlmon --help
-	*                ./mysqlmon -u <username> [-h <host>] [-p <port>]
+	*                ./mysqlmon -u <username> [-h <host>] [-p <port>] [-d] [-m <history mins>] [-w <stats window secs>]
+	*                                         [--lock-threshold <locks>] [--lock-interval <secs>] [--stress-threads <n>]
+	*                ./mysqlmon -u <username> [-h <host>] [-p <port>] --export <http port> [--export-interval <ms>]
+	*                ./mysqlmon -u <username> -H <host[:port],host[:port],...|@hostfile>
+	*                ./mysqlmon -u <username> [-h <host>] --record <file>
+	*                ./mysqlmon --replay <file>
 */
 
 
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
 #include <mysql_utils.h>
 #include <mysql_utils.c>
 
 
 #define APP_NAME "MySQLMon"
-#define MB_VERSION "0.34"
+#define MB_VERSION "0.43"
+
+#define EXPORT_BUF_LEN 16384
+#define EXPORT_CLIENTS 16 /* Scrapes read at once; more wait in the listen backlog. */
+#define EXPORT_REQUEST_LEN 1024
+#define EXPORT_IO_MS 500 /* A scrape's request line must arrive, and its response be taken, within this long. */
+#define PROBE_INTERVAL 60 /* Secs between capability probes and static variable reads. */
+#define FLEET_MAX 128
+#define FLEET_CONNECT_TIMEOUT 3 /* Secs a fleet host may take to accept a connection. */
+#define FLEET_READ_TIMEOUT 5 /* Secs a fleet host may take to answer its query. */
+#define SPARK_WIDTH 30
+#define HIST_COLUMN 34
+#define RECORD_MAGIC "MYSQLMON"
+#define RECORD_FORMAT 1
+#define RECORD_NAME_LEN 40
+#define RECORD_UNSEEN UINT64_MAX
+
+/* Non-blocking client API: libmysqlclient 8.0.16+ (not MariaDB Connector/C). */
+#if defined(MYSQL_VERSION_ID) && MYSQL_VERSION_ID >= 80016 && ! defined(MARIADB_BASE_VERSION)
+	#define FLEET_NONBLOCKING 1
+#else
+	#define FLEET_NONBLOCKING 0
+#endif
+
+
+/* Snapshot slots: one per server value displayed. */
+typedef enum
+{
+	S_THREADS_CONNECTED,
+	S_ABORTED_CONNECTS,
+	S_ABORTED_CLIENTS,
+	S_MAX_USED_CONNECTIONS,
+	S_CONN_ERRORS_MAX_CONN,
+	S_THREADS_RUNNING,
+	S_THREADS_CACHED,
+	S_THREADS_CREATED,
+	S_TMP_TABLES,
+	S_TMP_DISK_TABLES,
+	S_SORT_MERGE_PASSES,
+	S_ROW_LOCK_TIME,
+	S_ROW_LOCK_TIME_AVG,
+	S_ROW_LOCK_TIME_MAX,
+	S_ROW_LOCK_WAITS,
+	S_ROW_LOCK_CURRENT_WAITS,
+	S_ROWS_READ,
+	S_ROWS_INSERTED,
+	S_ROWS_UPDATED,
+	S_ROWS_DELETED,
+	S_QUERIES,
+	S_BP_PAGES_DATA,
+	S_BP_PAGES_TOTAL,
+	S_PAGES_READ,
+	S_BP_READ_REQUESTS,
+	S_UPTIME,
+	S_MAX_CONNECTIONS,
+	S_THREAD_CACHE_SIZE,
+	S_BP_SIZE,
+	S_HLL,
+	S_LOCK_TIMEOUTS,
+	S_DEADLOCKS,
+	S_TRX_MYSQL,
+	S_TRX_INNODB,
+	S_TRX_LOCK_WAITS,
+	S_LOCKS_TABLE,
+	S_LOCKS_RECORD,
+	S_COUNT
+} Slot;
+
+/* Origin of a slot's value. */
+typedef enum
+{
+	SRC_STATUS,
+	SRC_VARIABLE,
+	SRC_METRIC
+} Source;
+
+typedef struct
+{
+	char const* pName;
+	Slot iSlot;
+	Source iSource;
+} SlotName;
+
+typedef struct
+{
+	uint64_t aValue[S_COUNT];
+	unsigned char aSeen[S_COUNT];
+	double dTime; /* CLOCK_MONOTONIC seconds at collection. */
+} Snapshot;
+
+typedef struct
+{
+	Slot iSlot;
+	char const* pName;
+	char const* pType;
+	char const* pHelp;
+	unsigned int iDivisor;
+} ExportMetric;
+
+/* Metric history columns. */
+typedef enum
+{
+	H_THREADS_CONNECTED,
+	H_THREADS_RUNNING,
+	H_TMP_TABLES,
+	H_TMP_DISK_TABLES,
+	H_SORT_MERGE_PASSES,
+	H_TRX_INNODB,
+	H_TRX_LOCK_WAITS,
+	H_HLL,
+	H_ROW_LOCK_CURRENT_WAITS,
+	H_DEADLOCKS,
+	H_READS,
+	H_INSERTS,
+	H_UPDATES,
+	H_DELETES,
+	H_QPS,
+	H_COUNT
+} HistColumn;
+
+typedef struct
+{
+	HistColumn iColumn;
+	Slot iSlot;
+	unsigned int iRate; /* 1: per-second rate of a counter, 0: gauge */
+} HistSource;
+
+/*
+	* Fixed-size ring buffer of samples, struct-of-arrays: one contiguous column per metric,
+	* so window scans walk memory sequentially. Allocated once at startup.
+*/
+typedef struct
+{
+	unsigned int iCapacity;
+	unsigned int iHead; /* Next write position. */
+	unsigned int iCount;
+	double* aTime;
+	float* aCol[H_COUNT];
+	float* aScratch; /* Percentile workspace. */
+} History;
+
+/* Fleet host state machine. */
+typedef enum
+{
+	FS_DOWN,
+	FS_CONNECT,
+	FS_IDLE,
+	FS_QUERY,
+	FS_STORE
+} FleetState;
+
+typedef struct
+{
+	char aHost[128];
+	unsigned int iPort;
+	MYSQL* pConn;
+	FleetState iState;
+	unsigned int iQueryLevel; /* 0: p_s + INNODB_METRICS, 1: p_s only, 2: SHOW GLOBAL STATUS */
+	double dQueryStart;
+	double dLatency;
+	double dRetry;
+	Snapshot snapCur;
+	Snapshot snapPrev;
+	Snapshot snapNext;
+	char aError[64];
+} FleetHost;
+
+typedef struct
+{
+	unsigned int iPSAccess;
+	unsigned int iISAccess;
+	unsigned int iV8;
+	unsigned int iMaria;
+	unsigned int iStatusFallback;
+	double dNextProbe; /* Monotonic time the probes are next due, 0: immediately. */
+	Snapshot snapStatic; /* Cached system variables. */
+} Capabilities;
+
+/* Exporter response: refreshed by the collection thread every iExportInterval, copied out by the HTTP loop. */
+typedef struct
+{
+	MYSQL* pConn; /* Collection thread only (re-established if lost). */
+	Capabilities* pCaps;
+	char const* pInstance;
+	pthread_mutex_t lock;
+	char aResponse[EXPORT_BUF_LEN]; /* Under lock. */
+	size_t iResponseLen;
+	unsigned int iStop;
+} ExportCache;
+
+/* A scrape whose request is still being read. */
+typedef struct
+{
+	int iFd; /* -1 for a free slot. */
+	double dDeadline; /* Monotonic. */
+	size_t iLen;
+	char aRequest[EXPORT_REQUEST_LEN];
+} ExportClient;
+
+/* Recording schema entry. */
+typedef struct
+{
+	Slot iSlot;
+	char const* pName;
+	unsigned int iConstant; /* 1: stored once in the file header, not per record */
+} RecordField;
+
+/*
+	* Recording file layout (host byte order):
+	* RecordHeader, iFields x RecordEntry, then fixed-length records of
+	* uint64 wall-clock ms followed by one uint64 per non-constant entry, in entry order.
+*/
+typedef struct
+{
+	char aMagic[8];
+	uint32_t iFormat;
+	uint32_t iFields;
+	uint32_t iRecordLen;
+	uint32_t iCaps; /* bit 0: p_s access, 1: I_S access, 2: v8, 3: MariaDB */
+	char aHost[64];
+	char aVersion[32];
+} RecordHeader;
+
+typedef struct
+{
+	char aName[RECORD_NAME_LEN];
+	uint32_t iConstant;
+	uint32_t iReserved;
+	uint64_t iValue; /* Constant entries only. */
+} RecordEntry;
+
+/* Memory-mapped recording opened for replay. */
+typedef struct
+{
+	unsigned char const* pData;
+	size_t iLen;
+	unsigned char const* pRecords;
+	size_t iRecords;
+	uint32_t iRecordLen;
+	uint32_t iValues;
+	Slot aValueSlot[S_COUNT]; /* Slot of each per-record value, S_COUNT when unknown to this build. */
+	Snapshot snapBase; /* Constants. */
+	Capabilities caps;
+	char aHost[65];
+	char aVersion[33];
+} Replay;
+
+
+void buildSnapshotSQL(void);
+int compareSlotName(void const* pKey, void const* pEntry);
+unsigned int decodeRows(MYSQL_RES* pResult, Snapshot* pSnap);
+void storeSlot(Snapshot* pSnap, Slot iSlot, char const* pValue);
+unsigned int collectSnapshot(MYSQL* pConn, Snapshot* pSnap, Capabilities* pCaps);
+void probeCapabilities(MYSQL* pConn, Capabilities* pCaps);
+void collectTransactions(MYSQL* pConn, Snapshot* pSnap, Capabilities* pCaps);
+void carrySlots(Snapshot* pSnap, unsigned int iFetched);
+void collectLocks(MYSQL* pConn, char const* pSQL, Snapshot* pSnap, unsigned int iStress);
+double counterRate(Snapshot const* pCur, Snapshot const* pPrev, Slot iSlot);
+void displaySnapshot(Snapshot const* pCur, Snapshot const* pPrev, Capabilities const* pCaps, History* pHist);
+unsigned int historyInit(History* pHist, unsigned int iCapacity);
+void historyFree(History* pHist);
+void historyPush(History* pHist, Snapshot const* pCur, Snapshot const* pPrev);
+float selectNth(float* aVals, unsigned int iLen, unsigned int iNth);
+void drawHistory(History* pHist, HistColumn iColumn);
+MYSQL* connectServer(void);
+size_t renderOpenMetrics(Snapshot const* pSnap, unsigned int iUp, double dCollect, char const* pInstance, char* pBuf, size_t iBufLen);
+unsigned int bodyPrintf(char* pBuf, size_t iBufLen, size_t* pLen, char const* pFormat, ...) __attribute__((format(printf, 4, 5)));
+int runExporter(MYSQL* pConn, Capabilities* pCaps, char const* pInstance);
+void exportRefresh(ExportCache* pCache);
+void* exportThread(void* pArg);
+void exportRespond(ExportCache* pCache, ExportClient* pClient);
+void resetSnapshot(Snapshot* pSnap);
+unsigned int parseFleet(char const* pList);
+void fleetFail(FleetHost* pFH, double dNow);
+void fleetComplete(FleetHost* pFH, MYSQL_RES* pResult, double dNow);
+unsigned int fleetStep(FleetHost* pFH, double dNow);
+void displayFleet(void);
+int runFleet(void);
+char const* slotText(Snapshot const* pSnap, Slot iSlot, uint64_t iDivisor, char* aBuf, size_t iBufLen);
+int recordOpen(char const* pFile, char const* pHostname, char const* pVersion, Capabilities const* pCaps, Snapshot const* pSnap);
+unsigned int recordSnapshot(int iFd, Snapshot const* pSnap);
+unsigned int replayOpen(char const* pFile, Replay* pRep);
+double replayTime(Replay const* pRep, size_t iIdx);
+void replayLoad(Replay const* pRep, size_t iIdx, Snapshot* pSnap);
+size_t replaySeek(Replay const* pRep, double dTime);
+void replayHistory(Replay const* pRep, History* pHist, size_t iIdx);
+int runReplay(void);
+
+
+/*
+	* Name-to-slot lookup table.
+	* Kept sorted case-insensitively by name: performance_schema, SHOW and INNODB_METRICS return differing case.
+*/
+SlotName const aSlotNames[] =
+{
+	{"Aborted_clients", S_ABORTED_CLIENTS, SRC_STATUS},
+	{"Aborted_connects", S_ABORTED_CONNECTS, SRC_STATUS},
+	{"Connection_errors_max_connections", S_CONN_ERRORS_MAX_CONN, SRC_STATUS},
+	{"Created_tmp_disk_tables", S_TMP_DISK_TABLES, SRC_STATUS},
+	{"Created_tmp_tables", S_TMP_TABLES, SRC_STATUS},
+	{"Innodb_buffer_pool_pages_data", S_BP_PAGES_DATA, SRC_STATUS},
+	{"Innodb_buffer_pool_pages_total", S_BP_PAGES_TOTAL, SRC_STATUS},
+	{"Innodb_buffer_pool_read_requests", S_BP_READ_REQUESTS, SRC_STATUS},
+	{"innodb_buffer_pool_size", S_BP_SIZE, SRC_VARIABLE},
+	{"Innodb_pages_read", S_PAGES_READ, SRC_STATUS},
+	{"Innodb_row_lock_current_waits", S_ROW_LOCK_CURRENT_WAITS, SRC_STATUS},
+	{"Innodb_row_lock_time", S_ROW_LOCK_TIME, SRC_STATUS},
+	{"Innodb_row_lock_time_avg", S_ROW_LOCK_TIME_AVG, SRC_STATUS},
+	{"Innodb_row_lock_time_max", S_ROW_LOCK_TIME_MAX, SRC_STATUS},
+	{"Innodb_row_lock_waits", S_ROW_LOCK_WAITS, SRC_STATUS},
+	{"Innodb_rows_deleted", S_ROWS_DELETED, SRC_STATUS},
+	{"Innodb_rows_inserted", S_ROWS_INSERTED, SRC_STATUS},
+	{"Innodb_rows_read", S_ROWS_READ, SRC_STATUS},
+	{"Innodb_rows_updated", S_ROWS_UPDATED, SRC_STATUS},
+	{"lock_deadlocks", S_DEADLOCKS, SRC_METRIC},
+	{"lock_timeouts", S_LOCK_TIMEOUTS, SRC_METRIC},
+	{"max_connections", S_MAX_CONNECTIONS, SRC_VARIABLE},
+	{"Max_used_connections", S_MAX_USED_CONNECTIONS, SRC_STATUS},
+	{"Queries", S_QUERIES, SRC_STATUS}, /* Total queries, not connection questions. */
+	{"Sort_merge_passes", S_SORT_MERGE_PASSES, SRC_STATUS},
+	{"thread_cache_size", S_THREAD_CACHE_SIZE, SRC_VARIABLE},
+	{"Threads_cached", S_THREADS_CACHED, SRC_STATUS},
+	{"Threads_connected", S_THREADS_CONNECTED, SRC_STATUS},
+	{"Threads_created", S_THREADS_CREATED, SRC_STATUS},
+	{"Threads_running", S_THREADS_RUNNING, SRC_STATUS},
+	{"trx_rseg_history_len", S_HLL, SRC_METRIC},
+	{"Uptime", S_UPTIME, SRC_STATUS}
+};
+
+unsigned int const iSlotNames = sizeof(aSlotNames) / sizeof(aSlotNames[0]);
+
+/* History column sources. */
+HistSource const aHistSources[H_COUNT] =
+{
+	{H_THREADS_CONNECTED, S_THREADS_CONNECTED, 0},
+	{H_THREADS_RUNNING, S_THREADS_RUNNING, 0},
+	{H_TMP_TABLES, S_TMP_TABLES, 1},
+	{H_TMP_DISK_TABLES, S_TMP_DISK_TABLES, 1},
+	{H_SORT_MERGE_PASSES, S_SORT_MERGE_PASSES, 1},
+	{H_TRX_INNODB, S_TRX_INNODB, 0},
+	{H_TRX_LOCK_WAITS, S_TRX_LOCK_WAITS, 0},
+	{H_HLL, S_HLL, 0},
+	{H_ROW_LOCK_CURRENT_WAITS, S_ROW_LOCK_CURRENT_WAITS, 0},
+	{H_DEADLOCKS, S_DEADLOCKS, 1},
+	{H_READS, S_ROWS_READ, 1},
+	{H_INSERTS, S_ROWS_INSERTED, 1},
+	{H_UPDATES, S_ROWS_UPDATED, 1},
+	{H_DELETES, S_ROWS_DELETED, 1},
+	{H_QPS, S_QUERIES, 1}
+};
+
+/*
+	* Recording schema: per-tick values are those behind the sparklines plus Uptime, everything else
+	* replays as '-'. Keeps records at 136 bytes (~80MB per week at 1 Hz). Append-only: never reorder.
+*/
+RecordField const aRecordFields[] =
+{
+	{S_UPTIME, "Uptime", 0},
+	{S_THREADS_CONNECTED, "Threads_connected", 0},
+	{S_THREADS_RUNNING, "Threads_running", 0},
+	{S_TMP_TABLES, "Created_tmp_tables", 0},
+	{S_TMP_DISK_TABLES, "Created_tmp_disk_tables", 0},
+	{S_SORT_MERGE_PASSES, "Sort_merge_passes", 0},
+	{S_ROW_LOCK_CURRENT_WAITS, "Innodb_row_lock_current_waits", 0},
+	{S_ROWS_READ, "Innodb_rows_read", 0},
+	{S_ROWS_INSERTED, "Innodb_rows_inserted", 0},
+	{S_ROWS_UPDATED, "Innodb_rows_updated", 0},
+	{S_ROWS_DELETED, "Innodb_rows_deleted", 0},
+	{S_QUERIES, "Queries", 0},
+	{S_HLL, "trx_rseg_history_len", 0},
+	{S_DEADLOCKS, "lock_deadlocks", 0},
+	{S_TRX_INNODB, "trx_innodb", 0},
+	{S_TRX_LOCK_WAITS, "trx_lock_waits", 0},
+	{S_MAX_CONNECTIONS, "max_connections", 1},
+	{S_THREAD_CACHE_SIZE, "thread_cache_size", 1},
+	{S_BP_SIZE, "innodb_buffer_pool_size", 1},
+	{S_BP_PAGES_TOTAL, "Innodb_buffer_pool_pages_total", 1}
+};
+
+unsigned int const iRecordFields = sizeof(aRecordFields) / sizeof(aRecordFields[0]);
+
+/* Sparkline ramp, lowest to highest. */
+char const aSparkRamp[] = " _.-=+*#";
+
+/* Exporter metric set: OpenMetrics counters are suffixed _total on output. */
+ExportMetric const aExportMetrics[] =
+{
+	{S_THREADS_CONNECTED, "mysqlmon_threads_connected", "gauge", "Currently open connections.", 1},
+	{S_THREADS_RUNNING, "mysqlmon_threads_running", "gauge", "Threads not sleeping.", 1},
+	{S_THREADS_CACHED, "mysqlmon_threads_cached", "gauge", "Threads in the thread cache.", 1},
+	{S_THREADS_CREATED, "mysqlmon_threads_created", "counter", "Threads created to handle connections.", 1},
+	{S_MAX_USED_CONNECTIONS, "mysqlmon_max_used_connections", "gauge", "Connection high-water mark since startup.", 1},
+	{S_MAX_CONNECTIONS, "mysqlmon_max_connections", "gauge", "Configured max_connections.", 1},
+	{S_THREAD_CACHE_SIZE, "mysqlmon_thread_cache_size", "gauge", "Configured thread_cache_size.", 1},
+	{S_ABORTED_CONNECTS, "mysqlmon_aborted_connects", "counter", "Failed connection attempts.", 1},
+	{S_ABORTED_CLIENTS, "mysqlmon_aborted_clients", "counter", "Connections aborted without proper close.", 1},
+	{S_CONN_ERRORS_MAX_CONN, "mysqlmon_connection_errors_max_connections", "counter", "Connections refused by max_connections.", 1},
+	{S_QUERIES, "mysqlmon_queries", "counter", "Statements executed by the server.", 1},
+	{S_TMP_TABLES, "mysqlmon_created_tmp_tables", "counter", "Internal temporary tables created.", 1},
+	{S_TMP_DISK_TABLES, "mysqlmon_created_tmp_disk_tables", "counter", "Internal on-disk temporary tables created.", 1},
+	{S_SORT_MERGE_PASSES, "mysqlmon_sort_merge_passes", "counter", "Sort merge passes.", 1},
+	{S_ROWS_READ, "mysqlmon_innodb_rows_read", "counter", "InnoDB rows read.", 1},
+	{S_ROWS_INSERTED, "mysqlmon_innodb_rows_inserted", "counter", "InnoDB rows inserted.", 1},
+	{S_ROWS_UPDATED, "mysqlmon_innodb_rows_updated", "counter", "InnoDB rows updated.", 1},
+	{S_ROWS_DELETED, "mysqlmon_innodb_rows_deleted", "counter", "InnoDB rows deleted.", 1},
+	{S_ROW_LOCK_TIME, "mysqlmon_innodb_row_lock_time_seconds", "counter", "Time spent acquiring InnoDB row locks.", 1000},
+	{S_ROW_LOCK_WAITS, "mysqlmon_innodb_row_lock_waits", "counter", "InnoDB row lock waits.", 1},
+	{S_ROW_LOCK_CURRENT_WAITS, "mysqlmon_innodb_row_lock_current_waits", "gauge", "InnoDB row locks currently waited for.", 1},
+	{S_LOCK_TIMEOUTS, "mysqlmon_innodb_lock_timeouts", "counter", "InnoDB lock wait timeouts.", 1},
+	{S_DEADLOCKS, "mysqlmon_innodb_deadlocks", "counter", "InnoDB deadlocks.", 1},
+	{S_HLL, "mysqlmon_innodb_history_list_length", "gauge", "InnoDB undo history list length.", 1},
+	{S_TRX_MYSQL, "mysqlmon_trx_mysql_long", "gauge", "Active transactions over 1s at the server layer.", 1},
+	{S_TRX_INNODB, "mysqlmon_innodb_trx", "gauge", "Transactions in INNODB_TRX.", 1},
+	{S_TRX_LOCK_WAITS, "mysqlmon_innodb_trx_lock_waits", "gauge", "Transactions in LOCK WAIT state.", 1},
+	{S_LOCKS_TABLE, "mysqlmon_innodb_table_locks", "gauge", "InnoDB table locks held.", 1},
+	{S_LOCKS_RECORD, "mysqlmon_innodb_record_locks", "gauge", "InnoDB record locks held.", 1},
+	{S_BP_SIZE, "mysqlmon_innodb_buffer_pool_size_bytes", "gauge", "Configured buffer pool size.", 1},
+	{S_BP_PAGES_DATA, "mysqlmon_innodb_buffer_pool_pages_data", "gauge", "Buffer pool pages containing data.", 1},
+	{S_BP_PAGES_TOTAL, "mysqlmon_innodb_buffer_pool_pages_total", "gauge", "Buffer pool pages.", 1},
+	{S_PAGES_READ, "mysqlmon_innodb_pages_read", "counter", "Pages read from disk.", 1},
+	{S_BP_READ_REQUESTS, "mysqlmon_innodb_buffer_pool_read_requests", "counter", "Buffer pool logical read requests.", 1},
+	{S_UPTIME, "mysqlmon_uptime_seconds", "gauge", "Server uptime.", 1}
+};
+
+unsigned int const iExportMetrics = sizeof(aExportMetrics) / sizeof(aExportMetrics[0]);
+
+/* Snapshot SQL, generated from aSlotNames at startup. */
+char aStatusSQL[2048];
+char aShowStatusSQL[2048];
+char aVariablesSQL[512];
+char aShowVariablesSQL[512];
+char aMetricsSQL[512];
+
+unsigned int iDebug = 0;
+unsigned int iExportPort = 0;
+unsigned int iExportInterval = 1000; // millisecs, minimum age of cached exporter snapshot
+unsigned int iLockThreshold = 10000;
+unsigned int iLockInterval = 10; // secs, lock count cadence above iLockThreshold
+unsigned int iLocksThrottled = 0;
+uint64_t aLockCounts[2] = {0, 0}; // TABLE, RECORD
+double dNextLockCount = 0;
+unsigned int iStressThreads = 32; // Threads_running at which expensive panels back off, 0: latency only
+
+/* Adaptive panel intervals: counters and metrics stay at the 1s tick. */
+Cadence cadTrx;
+Cadence cadLocks;
+Snapshot snapCarry;
+
+/* Fleet mode: one round-trip per host per tick. */
+char const* const aFleetSQL[] =
+{
+	"SELECT VARIABLE_NAME, VARIABLE_VALUE FROM performance_schema.global_status WHERE VARIABLE_NAME IN ('Queries','Threads_running','Threads_connected','Innodb_row_lock_current_waits','Uptime') UNION ALL SELECT NAME, COUNT FROM information_schema.INNODB_METRICS WHERE NAME = 'trx_rseg_history_len'",
+	"SELECT VARIABLE_NAME, VARIABLE_VALUE FROM performance_schema.global_status WHERE VARIABLE_NAME IN ('Queries','Threads_running','Threads_connected','Innodb_row_lock_current_waits','Uptime')",
+	"SHOW GLOBAL STATUS WHERE Variable_name IN ('Queries','Threads_running','Threads_connected','Innodb_row_lock_current_waits','Uptime')"
+};
+
+unsigned int iHistoryMins = 10;
+unsigned int iStatsWindow = 60; // secs
+
+char const* pRecordFile = NULL;
+char const* pReplayFile = NULL;
+
+FleetHost* aFleet = NULL;
+unsigned int iFleetCount = 0;
+char const* pFleetList = NULL;
 
 
 int main(int iArgCount, char* const aArgV[])
@@ -46,34 +526,18 @@ int main(int iArgCount, char* const aArgV[])
 	char aVersion[7];
 	char aAuroraVersion[9];
 	char aAuroraServerId[50];
-	int iDiff = 0;
 	unsigned int iMenu = options(iArgCount, aArgV);
-	unsigned int iPSAccess = 0;
-	unsigned int iISAccess = 0;
-	unsigned int iV8 = 0;
-	unsigned int iMaria = 0;
 	unsigned int iAurora = 0;
 	unsigned int iReadOnly = 0;
-	unsigned int iOldTmpTables = 0;
-	unsigned int iTmpTables = 0;
-	unsigned int iOldTmpDiskTables = 0;
-	unsigned int iTmpDiskTables = 0;
-	unsigned int iOldSMPasses = 0;
-	unsigned int iSMPasses = 0;
-	unsigned int iDeadlocks = 0;
-	unsigned int iOldDeadlocks = 0;
-	unsigned int iOldReads = 0;
-	unsigned int iReads = 0;
-	unsigned int iOldInserts = 0;
-	unsigned int iInserts = 0;
-	unsigned int iOldUpdates = 0;
-	unsigned int iUpdates = 0;
-	unsigned int iOldDeletes = 0;
-	unsigned int iDeletes = 0;
-	unsigned int iOldQueries = 0;
-	unsigned int iQueries = 0;
-
-	if (signal(SIGINT, signalHandler) == SIG_ERR)
+	double dRestart = -1;
+	Capabilities caps = {0};
+	Snapshot snapCur;
+	Snapshot snapPrev;
+	History hist;
+	int iRecordFd = -1;
+	unsigned int iRecordOK = 1;
+
+	if (signal(SIGINT, signalHandler) == SIG_ERR || signal(SIGTERM, signalHandler) == SIG_ERR)
 	{
 		fprintf(stderr, "Signal function registration failed!\n");
 		return EXIT_FAILURE;
@@ -83,35 +547,29 @@ int main(int iArgCount, char* const aArgV[])
 	{
 		return EXIT_FAILURE;
 	}
-	else
-	{
-		pPassword = getpass("password: "); /* Obsolete fn, use termios.h in future. */
-	}
 
-	pConn = mysql_init(NULL);
+	/* Panels start at the 1s tick and back off from there. */
+	cadenceInit(&cadTrx, 1);
+	cadenceInit(&cadLocks, 1);
 
-	if (pConn == NULL)
+	if (pReplayFile != NULL)
 	{
-		fprintf(stderr, "\nCannot initialise MySQL connector.\n\n");
-		return EXIT_FAILURE;
+		return runReplay();
+	}
+	else
+	{
+		pPassword = getpass("password: "); /* Obsolete fn, use termios.h in future. */
 	}
 
-	mysql_options4(pConn, MYSQL_OPT_CONNECT_ATTR_ADD, "program_name", APP_NAME);
-
-	if (mysql_real_connect(pConn, pHost, pUser, pPassword, NULL, iPort, NULL, 0) == NULL)
+	if (pFleetList != NULL)
 	{
-		fprintf(stderr, "\nCannot connect to MySQL server.\n(Error: %s)\n\n", mysql_error(pConn));
-		return EXIT_FAILURE;
+		return runFleet();
 	}
 
-	initscr();
+	pConn = connectServer();
 
-	/* Check for ncurses colour support. */
-	if (has_colors() == FALSE)
+	if (pConn == NULL)
 	{
-		endwin();
-		fprintf(stderr, "\nThis terminal does not support colours.\n\n");
-		mysql_close(pConn);
 		return EXIT_FAILURE;
 	}
 
@@ -119,7 +577,7 @@ int main(int iArgCount, char* const aArgV[])
 	assignHostname(pConn, aHostname, sizeof(aHostname) - 1);
 
 	/* Identify MySQL version | MariaDB (which does not natively possess sys schema). */
-	identifyMySQLVersion(pConn, aVersion, pMaria, &iMaria, &iV8, sizeof(aVersion) - 1);
+	identifyMySQLVersion(pConn, aVersion, pMaria, &caps.iMaria, &caps.iV8, sizeof(aVersion) - 1);
 
 	/* Identify Aurora version, if applicable. */
 	identifyAuroraVersion(pConn, aAuroraVersion, aAuroraServerId, &iAurora, sizeof(aAuroraVersion) - 1, sizeof(aAuroraServerId) - 1);
@@ -131,21 +589,98 @@ int main(int iArgCount, char* const aArgV[])
 	iReadOnly = (unsigned int) atoi(row_read_only[0]);
 	mysql_free_result(result_read_only);
 
-	/* QPS counter initial value: reset from total (adding others would create significant code bloat). */
-	mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Queries'"); /* Total queries, not connection questions. */
-	MYSQL_RES* result_queries = mysql_store_result(pConn);
-	MYSQL_ROW row_queries = mysql_fetch_row(result_queries);
-	iOldQueries = (unsigned int) atoi(row_queries[1]);
-	mysql_free_result(result_queries);
+	buildSnapshotSQL();
+
+	/* Headless exporter: no ncurses. */
+	if (iExportPort != 0)
+	{
+		return runExporter(pConn, &caps, (iAurora == 0 ? aHostname : aAuroraServerId));
+	}
+
+	/* 1 Hz samples: memory is fixed here for the lifetime of the process. */
+	if (historyInit(&hist, iHistoryMins * 60) == 0)
+	{
+		fprintf(stderr, "\nCannot allocate metric history.\n\n");
+		mysql_close(pConn);
+		return EXIT_FAILURE;
+	}
+
+	/* Initial snapshot: counter deltas start from current totals. */
+	collectSnapshot(pConn, &snapPrev, &caps);
+
+	if (pRecordFile != NULL)
+	{
+		iRecordFd = recordOpen(pRecordFile, (iAurora == 0 ? aHostname : aAuroraServerId), aVersion, &caps, &snapPrev);
+
+		if (iRecordFd < 0)
+		{
+			historyFree(&hist);
+			mysql_close(pConn);
+			return EXIT_FAILURE;
+		}
+	}
+
+	initscr();
+
+	/* Check for ncurses colour support. */
+	if (has_colors() == FALSE)
+	{
+		endwin();
+		fprintf(stderr, "\nThis terminal does not support colours.\n\n");
+		historyFree(&hist);
+		mysql_close(pConn);
+		return EXIT_FAILURE;
+	}
 
 	/* Set ncurses colours. */
 	start_color();
 	init_color(COLOR_BLACK, 0, 0, 0); // for Gnome
 	init_pair(1, COLOR_GREEN, COLOR_BLACK);
 	curs_set(0);
+	noecho();
+	nodelay(stdscr, TRUE);
 
 	while ( ! iSigCaught)
 	{
+		double dTickStart = monotonicTime();
+
+		monTickStart();
+
+		unsigned int iCollected = collectSnapshot(pConn, &snapCur, &caps);
+		char aCollectError[128] = "status counters not returned";
+
+		/* Copied before monSample() issues its own query. */
+		if (iCollected == 0 && mysql_errno(pConn) != 0)
+		{
+			snprintf(aCollectError, sizeof(aCollectError), "%s", mysql_error(pConn));
+		}
+
+		monSample(pConn, 0);
+
+		if (getch() == 'f')
+		{
+			monStats.iFooter = ! monStats.iFooter;
+		}
+
+		/* A failed collection is shown as such: its zeroed counters are kept out of the history and the recording. */
+		if (iCollected == 1 && iRecordFd >= 0)
+		{
+			iRecordOK = recordSnapshot(iRecordFd, &snapCur);
+		}
+
+		/* No baseline yet (the initial snapshot failed): deltas start from this one. */
+		if (iCollected == 1 && ! snapPrev.aSeen[S_UPTIME])
+		{
+			snapPrev = snapCur;
+		}
+
+		/* Uptime going backwards means the server restarted between snapshots: rebase all counters. */
+		if (snapCur.aSeen[S_UPTIME] && snapPrev.aSeen[S_UPTIME] && snapCur.aValue[S_UPTIME] < snapPrev.aValue[S_UPTIME])
+		{
+			dRestart = snapCur.dTime;
+			snapPrev = snapCur;
+		}
+
 		clear();
 
 		attrset(A_BOLD);
@@ -159,7 +694,7 @@ int main(int iArgCount, char* const aArgV[])
 		}
 		attrset(A_NORMAL);
 
-		if (iMaria == 0)
+		if (caps.iMaria == 0)
 		{
 			if (iAurora == 0)
 			{
@@ -176,330 +711,77 @@ int main(int iArgCount, char* const aArgV[])
 		}
 		printw("\n");
 
-		mysql_query(pConn, "SHOW STATUS WHERE Variable_name = 'Threads_connected'");
-		MYSQL_RES* result_tc = mysql_store_result(pConn);
-		MYSQL_ROW row_tc = mysql_fetch_row(result_tc);
-		attrset(A_BOLD | COLOR_PAIR(1));
-		printw(" threads connected: %s\n", row_tc[1]);
-		attrset(A_NORMAL);
-		mysql_free_result(result_tc);
-
-		mysql_query(pConn, "SHOW STATUS WHERE Variable_name = 'Aborted_connects'");
-		MYSQL_RES* result_acon = mysql_store_result(pConn);
-		MYSQL_ROW row_acon = mysql_fetch_row(result_acon);
-		printw(" aborted connects: %s\n", row_acon[1]);
-		mysql_free_result(result_acon);
-
-		mysql_query(pConn, "SHOW STATUS WHERE Variable_name = 'Aborted_clients'");
-		MYSQL_RES* result_acl = mysql_store_result(pConn);
-		MYSQL_ROW row_acl = mysql_fetch_row(result_acl);
-		printw(" aborted clients: %s\n\n", row_acl[1]);
-		mysql_free_result(result_acl);
-
-		mysql_query(pConn, "SHOW STATUS WHERE Variable_name = 'Max_used_connections'");
-		MYSQL_RES* result_muc = mysql_store_result(pConn);
-		MYSQL_ROW row_muc = mysql_fetch_row(result_muc);
-		attrset(A_BOLD | COLOR_PAIR(1));
-		printw(" max used connections: %s\n", row_muc[1]);
-		attrset(A_NORMAL);
-		mysql_free_result(result_muc);
-
-		mysql_query(pConn, "SELECT @@max_connections");
-		MYSQL_RES* result_mc = mysql_store_result(pConn);
-		MYSQL_ROW row_mc = mysql_fetch_row(result_mc);
-		printw(" max connections: %s\n", row_mc[0]);
-		mysql_free_result(result_mc);
-
-		mysql_query(pConn, "SHOW STATUS WHERE Variable_name = 'Connection_errors_max_connections'");
-		MYSQL_RES* result_cem = mysql_store_result(pConn);
-		MYSQL_ROW row_cem = mysql_fetch_row(result_cem);
-		printw(" max conns exceeded: %s\n\n", row_cem[1]);
-		mysql_free_result(result_cem);
-
-		mysql_query(pConn, "SHOW STATUS WHERE Variable_name = 'Threads_running'");
-		MYSQL_RES* result_tr = mysql_store_result(pConn);
-		MYSQL_ROW row_tr = mysql_fetch_row(result_tr);
-		attrset(A_BOLD | COLOR_PAIR(1));
-		printw(" threads running: %s\n", row_tr[1]);
-		attrset(A_NORMAL);
-		mysql_free_result(result_tr);
-
-		mysql_query(pConn, "SELECT @@thread_cache_size");
-		MYSQL_RES* result_tcs = mysql_store_result(pConn);
-		MYSQL_ROW row_tcs = mysql_fetch_row(result_tcs);
-		printw(" thread cache size: %s\n", row_tcs[0]);
-		mysql_free_result(result_tcs);
-
-		mysql_query(pConn, "SHOW STATUS WHERE Variable_name = 'Threads_cached'");
-		MYSQL_RES* result_tca = mysql_store_result(pConn);
-		MYSQL_ROW row_tca = mysql_fetch_row(result_tca);
-		printw(" threads cached: %s\n", row_tca[1]);
-		mysql_free_result(result_tca);
-
-		mysql_query(pConn, "SHOW STATUS WHERE Variable_name = 'Threads_created'");
-		MYSQL_RES* result_tcr = mysql_store_result(pConn);
-		MYSQL_ROW row_tcr = mysql_fetch_row(result_tcr);
-		printw(" threads created: %s\n\n", row_tcr[1]);
-		mysql_free_result(result_tcr);
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Created_tmp_tables'");
-		MYSQL_RES* result_ctt = mysql_store_result(pConn);
-		MYSQL_ROW row_ctt = mysql_fetch_row(result_ctt);
-		iTmpTables = (unsigned int) atoi(row_ctt[1]);
-		iDiff = iTmpTables - iOldTmpTables;
-		if (iDiff < 0) {iDiff = 0;}
-		iOldTmpTables = iTmpTables;
-		printw(" tmp tables: %i\n", iDiff);
-		mysql_free_result(result_ctt);
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Created_tmp_disk_tables'");
-		MYSQL_RES* result_ctdt = mysql_store_result(pConn);
-		MYSQL_ROW row_ctdt = mysql_fetch_row(result_ctdt);
-		iTmpDiskTables = (unsigned int) atoi(row_ctdt[1]);
-		iDiff = iTmpDiskTables - iOldTmpDiskTables;
-		if (iDiff < 0) {iDiff = 0;}
-		iOldTmpDiskTables = iTmpDiskTables;
-		printw(" tmp disk tables: %i\n", iDiff);
-		mysql_free_result(result_ctdt);
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Sort_merge_passes'");
-		MYSQL_RES* result_smp = mysql_store_result(pConn);
-		MYSQL_ROW row_smp = mysql_fetch_row(result_smp);
-		iSMPasses = (unsigned int) atoi(row_smp[1]);
-		iDiff = iSMPasses - iOldSMPasses;
-		if (iDiff < 0) {iDiff = 0;}
-		iOldSMPasses = iSMPasses;
-		printw(" sort merge passes: %i\n\n", iDiff);
-		mysql_free_result(result_smp);
-
-		/* P_S test and TRX at MySQL layer. */
-		mysql_query(pConn, "SELECT COUNT(*) FROM performance_schema.events_transactions_current WHERE state = 'ACTIVE' AND timer_wait > 1000000000000 * 1");
-			/* Requires performance_schema setup_consumers.events_transactions_current and setup_instruments.transaction to be enabled. */
-		MYSQL_RES* result_trx1 = mysql_store_result(pConn);
-		if (mysql_errno(pConn) == 0)
-		{
-			iPSAccess = 1;
-		}
-		if (iPSAccess == 1)
-		{
-			MYSQL_ROW row_trx1 = mysql_fetch_row(result_trx1);
-			printw(" trx (mysql): %s\n", row_trx1[0]);
-		}
-		mysql_free_result(result_trx1);
-
-		/* I_S test. */
-		mysql_query(pConn, "SELECT trx_id FROM information_schema.INNODB_TRX LIMIT 1");
-		MYSQL_RES* result_istest = mysql_store_result(pConn);
-		if (mysql_errno(pConn) == 0)
-		{
-			iISAccess = 1;
-		}
-		mysql_free_result(result_istest);
-
-		if (iISAccess == 1)
-		{
-			/* TRX at InnoDB layer. */
-			mysql_query(pConn, "SELECT COUNT(*) FROM information_schema.INNODB_TRX"); /* Includes all trx_state: RUNNING, LOCK WAIT, ROLLING BACK, COMMITTING */
-			MYSQL_RES* result_trx2 = mysql_store_result(pConn);
-			MYSQL_ROW row_trx2 = mysql_fetch_row(result_trx2);
-			printw(" trx (innodb):");
-			attrset(A_BOLD | COLOR_PAIR(1));
-			printw(" %s\n", row_trx2[0]);
-			attrset(A_NORMAL);
-			mysql_free_result(result_trx2);
-
-			/* TRX Lock Waits */
-			mysql_query(pConn, "SELECT COUNT(*) FROM information_schema.INNODB_TRX WHERE trx_state = 'LOCK WAIT'");
-			MYSQL_RES* result_trxlk = mysql_store_result(pConn);
-			MYSQL_ROW row_trxlk = mysql_fetch_row(result_trxlk);
-			printw(" trx locks: %s\n", row_trxlk[0]);
-			mysql_free_result(result_trxlk);
-
-			/* History List Length */
-			mysql_query(pConn, "SELECT COUNT FROM information_schema.INNODB_METRICS WHERE name = 'trx_rseg_history_len'");
-			MYSQL_RES* result_hll = mysql_store_result(pConn);
-			MYSQL_ROW row_hll = mysql_fetch_row(result_hll);
-			attrset(A_BOLD | COLOR_PAIR(1));
-			printw(" history list length: %s\n\n", row_hll[0]);
+		if (dRestart >= 0 && snapCur.dTime - dRestart < 10)
+		{
+			attrset(A_BOLD);
+			printw(" server restart detected: counters rebased\n\n");
 			attrset(A_NORMAL);
-			mysql_free_result(result_hll);
-		}
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Innodb_row_lock_time'");
-		MYSQL_RES* result_irlt = mysql_store_result(pConn);
-		MYSQL_ROW row_irlt = mysql_fetch_row(result_irlt);
-		unsigned int irlt = (((unsigned int) atoi(row_irlt[1])) / 1000);
-		printw(" row lock time: %us\n", irlt);
-		mysql_free_result(result_irlt);
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Innodb_row_lock_time_avg'");
-		MYSQL_RES* result_irlta = mysql_store_result(pConn);
-		MYSQL_ROW row_irlta = mysql_fetch_row(result_irlta);
-		printw(" row lock time avg: %sms\n", row_irlta[1]);
-		mysql_free_result(result_irlta);
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Innodb_row_lock_time_max'");
-		MYSQL_RES* result_irltm = mysql_store_result(pConn);
-		MYSQL_ROW row_irltm = mysql_fetch_row(result_irltm);
-		unsigned int irltm = (((unsigned int) atoi(row_irltm[1])) / 1000);
-		printw(" row lock time max: %us\n", irltm);
-		mysql_free_result(result_irltm);
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Innodb_row_lock_waits'");
-		MYSQL_RES* result_irlw = mysql_store_result(pConn);
-		MYSQL_ROW row_irlw = mysql_fetch_row(result_irlw);
-		printw(" row lock waits: %s\n", row_irlw[1]);
-		mysql_free_result(result_irlw);
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Innodb_row_lock_current_waits'");
-		MYSQL_RES* result_irlcw = mysql_store_result(pConn);
-		MYSQL_ROW row_irlcw = mysql_fetch_row(result_irlcw);
-		printw(" row lock current waits: %s\n", row_irlcw[1]);
-		mysql_free_result(result_irlcw);
-
-		if (iISAccess == 1)
-		{
-			mysql_query(pConn, "SELECT COUNT FROM information_schema.INNODB_METRICS WHERE NAME = 'lock_timeouts'");
-			MYSQL_RES* result_lto = mysql_store_result(pConn);
-			MYSQL_ROW row_lto = mysql_fetch_row(result_lto);
-			printw(" lock timeouts: %s\n", row_lto[0]);
-			mysql_free_result(result_lto);
-
-			if (iV8 != 1 || iMaria == 1)
-			{
-				mysql_query(pConn, "SELECT COUNT(*) FROM information_schema.INNODB_LOCKS WHERE LOCK_TYPE = 'TABLE'");
-				MYSQL_RES* result_tablelocks = mysql_store_result(pConn);
-				MYSQL_ROW table_locks = mysql_fetch_row(result_tablelocks);
-				mysql_free_result(result_tablelocks);
-
-				mysql_query(pConn, "SELECT COUNT(*) FROM information_schema.INNODB_LOCKS WHERE LOCK_TYPE = 'RECORD'");
-				MYSQL_RES* result_recordlocks = mysql_store_result(pConn);
-				MYSQL_ROW record_locks = mysql_fetch_row(result_recordlocks);
-				mysql_free_result(result_recordlocks);
-
-				printw(" locks: tab: %s rec: %s\n", table_locks[0], record_locks[0]);
-			}
-			else
-			{
-				if (iPSAccess == 1)
-				{
-					mysql_query(pConn, "SELECT COUNT(*) FROM performance_schema.data_locks WHERE LOCK_TYPE = 'TABLE'");
-					MYSQL_RES* result_tablelocks = mysql_store_result(pConn);
-					MYSQL_ROW table_locks = mysql_fetch_row(result_tablelocks);
-					mysql_free_result(result_tablelocks);
+		}
 
-					mysql_query(pConn, "SELECT COUNT(*) FROM performance_schema.data_locks WHERE LOCK_TYPE = 'RECORD'");
-					MYSQL_RES* result_recordlocks = mysql_store_result(pConn);
-					MYSQL_ROW record_locks = mysql_fetch_row(result_recordlocks);
-					mysql_free_result(result_recordlocks);
+		if (iCollected == 1)
+		{
+			historyPush(&hist, &snapCur, &snapPrev);
 
-					printw(" locks: tab: %s rec: %s\n", table_locks[0], record_locks[0]);
-				}
-			}
+			displaySnapshot(&snapCur, &snapPrev, &caps, &hist);
+		}
+		else
+		{
+			attrset(A_BOLD);
+			printw(" collection failed: %s\n\n", aCollectError);
+			attrset(A_NORMAL);
+		}
 
-			mysql_query(pConn, "SELECT COUNT FROM information_schema.INNODB_METRICS WHERE NAME = 'lock_deadlocks'");
-			MYSQL_RES* result_dl = mysql_store_result(pConn);
-			MYSQL_ROW row_dl = mysql_fetch_row(result_dl);
-			iDeadlocks = (unsigned int) atoi(row_dl[0]);
-			iDiff = iDeadlocks - iOldDeadlocks;
-			if (iDiff < 0) {iDiff = 0;}
-			iOldDeadlocks = iDeadlocks;
-			printw(" deadlocks: %i\n", iDiff);
-			mysql_free_result(result_dl);
-		}
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Innodb_rows_read'");
-		MYSQL_RES* result_irr = mysql_store_result(pConn);
-		MYSQL_ROW row_irr = mysql_fetch_row(result_irr);
-		iReads = (unsigned int) atoi(row_irr[1]);
-		iDiff = iReads - iOldReads;
-		if (iDiff < 0) {iDiff = 0;}
-		iOldReads = iReads;
-		printw("\n reads: %i\n", iDiff);
-		mysql_free_result(result_irr);
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Innodb_rows_inserted'");
-		MYSQL_RES* result_iri = mysql_store_result(pConn);
-		MYSQL_ROW row_iri = mysql_fetch_row(result_iri);
-		iInserts = (unsigned int) atoi(row_iri[1]);
-		iDiff = iInserts - iOldInserts;
-		if (iDiff < 0) {iDiff = 0;}
-		iOldInserts = iInserts;
-		printw(" inserts: %i\n", iDiff);
-		mysql_free_result(result_iri);
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Innodb_rows_updated'");
-		MYSQL_RES* result_iru = mysql_store_result(pConn);
-		MYSQL_ROW row_iru = mysql_fetch_row(result_iru);
-		iUpdates = (unsigned int) atoi(row_iru[1]);
-		iDiff = iUpdates - iOldUpdates;
-		if (iDiff < 0) {iDiff = 0;}
-		iOldUpdates = iUpdates;
-		printw(" updates: %i\n", iDiff);
-		mysql_free_result(result_iru);
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Innodb_rows_deleted'");
-		MYSQL_RES* result_ird = mysql_store_result(pConn);
-		MYSQL_ROW row_ird = mysql_fetch_row(result_ird);
-		iDeletes = (unsigned int) atoi(row_ird[1]);
-		iDiff = iDeletes - iOldDeletes;
-		if (iDiff < 0) {iDiff = 0;}
-		iOldDeletes = iDeletes;
-		printw(" deletes: %i\n\n", iDiff);
-		mysql_free_result(result_ird);
-
-		mysql_query(pConn, "SHOW GLOBAL STATUS WHERE Variable_name = 'Queries'"); /* Total queries, not conn questions. */
-		MYSQL_RES* result_queries2 = mysql_store_result(pConn);
-		MYSQL_ROW row_queries2 = mysql_fetch_row(result_queries2);
-		iQueries = (unsigned int) atoi(row_queries2[1]);
-		/* In tests, close to Innotop's QPS. */
-		iDiff = iQueries - iOldQueries;
-		if (iDiff < 0) {iDiff = 0;}
-		iOldQueries = iQueries;
-		attrset(A_BOLD | COLOR_PAIR(1));
-		printw(" QPS: %i\n\n", iDiff);
-		attrset(A_NORMAL);
-		mysql_free_result(result_queries2);
+		double dLockInterval = (iLocksThrottled && iLockInterval > cadLocks.dInterval) ? iLockInterval : cadLocks.dInterval;
 
-		mysql_query(pConn, "SELECT ROUND(@@innodb_buffer_pool_size / 1024 / 1024 / 1024, 2)");
-		MYSQL_RES* result_bps = mysql_store_result(pConn);
-		MYSQL_ROW row_bps = mysql_fetch_row(result_bps);
-		printw(" BP: %sGB\n", row_bps[0]);
-		mysql_free_result(result_bps);
+		printw(" interval: counters 1s  trx %.0fs  locks %.0fs%s\n", cadTrx.dInterval, dLockInterval, ((cadTrx.dInterval > 1 || dLockInterval > 1) ? "  (backed off)" : ""));
 
-		if (iPSAccess == 1)
+		if (iRecordOK == 0)
 		{
-			mysql_query(pConn, "SELECT ROUND(100 * (SELECT Variable_value FROM performance_schema.global_status WHERE Variable_name = 'Innodb_buffer_pool_pages_data') / (SELECT Variable_value FROM performance_schema.global_status WHERE Variable_name = 'Innodb_buffer_pool_pages_total'), 2)");
-			MYSQL_RES* result_bpf = mysql_store_result(pConn);
-			MYSQL_ROW row_bpf = mysql_fetch_row(result_bpf);
-			printw(" BP pct fill: %s%%\n", row_bpf[0]);
-			mysql_free_result(result_bpf);
+			attrset(A_BOLD);
+			printw(" recording: write to %s failed\n", pRecordFile);
+			attrset(A_NORMAL);
 		}
 
-		if (iPSAccess == 1 && iMaria == 0) /* Block sys access to MariaDB. */
+		if (iDebug == 1)
 		{
-			mysql_query(pConn, "SELECT ROUND(100 - (100 * (SELECT Variable_value FROM sys.metrics WHERE Variable_name = 'Innodb_pages_read') / (SELECT Variable_value FROM sys.metrics WHERE Variable_name = 'Innodb_buffer_pool_read_requests')), 2)");
-			MYSQL_RES* result_bphr = mysql_store_result(pConn);
-			MYSQL_ROW row_bphr = mysql_fetch_row(result_bphr);
-			printw(" BP hit rate: %s%%\n", row_bphr[0]);
-			mysql_free_result(result_bphr);
-
-			mysql_query(pConn, "SELECT ROUND((Variable_value / 3600), 2) FROM sys.metrics WHERE Variable_name = 'uptime'");
-			MYSQL_RES* result_ut = mysql_store_result(pConn);
-			MYSQL_ROW row_ut = mysql_fetch_row(result_ut);
-			printw(" uptime: %s hrs\n\n", row_ut[0]);
-			mysql_free_result(result_ut);
+			printw(" round-trips/tick: %u (%s)\n", monStats.iTickQueries, (caps.iStatusFallback == 0 ? "p_s snapshot" : "SHOW fallback"));
 		}
 
+		monFooter(&monStats, LINES - 1);
+
 		refresh();
 
-		sleep(1);
+		monTickEnd();
+
+		if (iCollected == 1)
+		{
+			snapPrev = snapCur;
+		}
+
+		/* Sleep for the remainder of the tick, so collection latency does not stretch the interval. */
+		double dElapsed = monotonicTime() - dTickStart;
+
+		if (dElapsed < 1.0)
+		{
+			msSleep((unsigned int) ((1.0 - dElapsed) * 1000));
+		}
 	}
 
+	monSample(pConn, 1);
+
 	curs_set(1);
 
 	endwin();
 
+	monSummary(APP_NAME);
+
+	historyFree(&hist);
+
+	if (iRecordFd >= 0)
+	{
+		close(iRecordFd);
+	}
+
 	mysql_close(pConn);
 
 	return EXIT_SUCCESS;
@@ -507,48 +789,2308 @@ int main(int iArgCount, char* const aArgV[])
 
 
 /**
-	* Process command-line switches using getopt()
+	* Generate the batched snapshot queries from the slot lookup table.
 	*
-	* @param   int iArgCount, number of arguments
-	* @param   char* aArgV, pointer to aArgV
-	* @return  unsigned integer
+	* @return  void
 */
 
-unsigned int options(int iArgCount, char* const aArgV[])
+void buildSnapshotSQL(void)
 {
-	int iOpts = 0;
-	int iOptsIdx = 0;
-	unsigned int iHelp = 0;
+	char aStatusList[1536] = "";
+	char aVariableList[256] = "";
+	char aMetricList[256] = "";
+	unsigned int i;
 
-	struct option aLongOpts[] =
+	for (i = 0; i < iSlotNames; i++)
 	{
-		{"help", no_argument, 0, 'i'},
-		{0, 0, 0, 0}
-	};
+		char* pList = NULL;
+		size_t iListLen = 0;
+
+		if (aSlotNames[i].iSource == SRC_STATUS)
+		{
+			pList = aStatusList;
+			iListLen = sizeof(aStatusList);
+		}
+		else if (aSlotNames[i].iSource == SRC_VARIABLE)
+		{
+			pList = aVariableList;
+			iListLen = sizeof(aVariableList);
+		}
+		else if (aSlotNames[i].iSource == SRC_METRIC)
+		{
+			pList = aMetricList;
+			iListLen = sizeof(aMetricList);
+		}
+		else
+		{
+			continue;
+		}
+
+		size_t iUsed = strlen(pList);
+		snprintf(pList + iUsed, iListLen - iUsed, "%s'%s'", (iUsed == 0 ? "" : ","), aSlotNames[i].pName);
+	}
+
+	/* One round-trip for every status counter; system variables are cached, see probeCapabilities(). */
+	snprintf(aStatusSQL, sizeof(aStatusSQL), "SELECT VARIABLE_NAME, VARIABLE_VALUE FROM performance_schema.global_status WHERE VARIABLE_NAME IN (%s)", aStatusList);
+	snprintf(aVariablesSQL, sizeof(aVariablesSQL), "SELECT VARIABLE_NAME, VARIABLE_VALUE FROM performance_schema.global_variables WHERE VARIABLE_NAME IN (%s)", aVariableList);
+
+	/* Fallback for servers without the performance_schema status tables (MariaDB, p_s disabled). */
+	snprintf(aShowStatusSQL, sizeof(aShowStatusSQL), "SHOW GLOBAL STATUS WHERE Variable_name IN (%s)", aStatusList);
+	snprintf(aShowVariablesSQL, sizeof(aShowVariablesSQL), "SHOW GLOBAL VARIABLES WHERE Variable_name IN (%s)", aVariableList);
+
+	snprintf(aMetricsSQL, sizeof(aMetricsSQL), "SELECT NAME, COUNT FROM information_schema.INNODB_METRICS WHERE NAME IN (%s)", aMetricList);
+}
+
+
+/**
+	* bsearch() comparator for the slot lookup table.
+	*
+	* @param   void* pKey, variable name
+	* @param   void* pEntry, SlotName entry
+	* @return  signed integer
+*/
+
+int compareSlotName(void const* pKey, void const* pEntry)
+{
+	return strcasecmp((char const*) pKey, ((SlotName const*) pEntry)->pName);
+}
+
+
+/**
+	* Decode name/value rows into snapshot slots.
+	*
+	* @param   MYSQL_RES* pResult, two-column result set
+	* @param   Snapshot* pSnap, pointer to snapshot
+	* @return  unsigned integer, number of slots filled
+*/
+
+unsigned int decodeRows(MYSQL_RES* pResult, Snapshot* pSnap)
+{
+	MYSQL_ROW row;
+	unsigned int iFilled = 0;
 
-	while ((iOpts = getopt_long(iArgCount, aArgV, "ih:w:u:p:", aLongOpts, &iOptsIdx)) != -1)
+	if (pResult == NULL)
 	{
-		switch (iOpts)
+		return 0;
+	}
+
+	while ((row = mysql_fetch_row(pResult)))
+	{
+		if (row[0] == NULL || row[1] == NULL)
 		{
-			case 'i':
-				iHelp = 1;
-				break;
+			continue;
+		}
 
-			case 'h':
-				pHost = optarg;
-				break;
+		SlotName const* pEntry = bsearch(row[0], aSlotNames, iSlotNames, sizeof(aSlotNames[0]), compareSlotName);
 
-			case 'u':
-				pUser = optarg;
-				break;
+		if (pEntry != NULL)
+		{
+			storeSlot(pSnap, pEntry->iSlot, row[1]);
+			iFilled++;
+		}
+	}
 
-			case 'p':
-				iPort = (unsigned int) atoi(optarg);
+	return iFilled;
+}
+
+
+/**
+	* Parse a value into a snapshot slot.
+	*
+	* @param   Snapshot* pSnap, pointer to snapshot
+	* @param   Slot iSlot, slot
+	* @param   char* pValue, value string
+	* @return  void
+*/
+
+void storeSlot(Snapshot* pSnap, Slot iSlot, char const* pValue)
+{
+	pSnap->aValue[iSlot] = strtoull(pValue, NULL, 10);
+	pSnap->aSeen[iSlot] = 1;
+}
+
+
+/**
+	* Clear all slots and timestamp the snapshot.
+	*
+	* @param   Snapshot* pSnap, pointer to snapshot
+	* @return  void
+*/
+
+void resetSnapshot(Snapshot* pSnap)
+{
+	memset(pSnap->aValue, 0, sizeof(pSnap->aValue));
+	memset(pSnap->aSeen, 0, sizeof(pSnap->aSeen));
+	pSnap->dTime = monotonicTime();
+}
+
+
+/**
+	* Collect one snapshot of all displayed values.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   Snapshot* pSnap, pointer to snapshot
+	* @param   Capabilities* pCaps, pointer to server capabilities
+	* @return  unsigned integer, 1 if status counters were retrieved
+*/
+
+unsigned int collectSnapshot(MYSQL* pConn, Snapshot* pSnap, Capabilities* pCaps)
+{
+	MYSQL_RES* pResult;
+	unsigned int i;
+
+	resetSnapshot(pSnap);
+
+	/* Status counters and system variables. */
+	if (pCaps->iStatusFallback == 0)
+	{
+		pResult = monQuery(pConn, aStatusSQL);
+
+		if (mysql_errno(pConn) >= CR_MIN_ERROR)
+		{
+			/* Connection lost: not a reason to give up on p_s. Re-probe once it is back. */
+			mysql_free_result(pResult);
+			pCaps->dNextProbe = 0;
+			return 0;
+		}
+
+		if (pResult == NULL || decodeRows(pResult, pSnap) == 0)
+		{
+			pCaps->iStatusFallback = 1;
+		}
+
+		mysql_free_result(pResult);
+	}
+
+	if (pCaps->iStatusFallback == 1)
+	{
+		pResult = monQuery(pConn, aShowStatusSQL);
+		decodeRows(pResult, pSnap);
+		mysql_free_result(pResult);
+	}
+
+	if ( ! pSnap->aSeen[S_UPTIME])
+	{
+		return 0;
+	}
+
+	if (pSnap->dTime >= pCaps->dNextProbe)
+	{
+		probeCapabilities(pConn, pCaps);
+	}
+
+	for (i = 0; i < S_COUNT; i++)
+	{
+		if (pCaps->snapStatic.aSeen[i])
+		{
+			pSnap->aValue[i] = pCaps->snapStatic.aValue[i];
+			pSnap->aSeen[i] = 1;
+		}
+	}
+
+	unsigned int iStress = (iStressThreads > 0 && pSnap->aValue[S_THREADS_RUNNING] >= iStressThreads);
+
+	/* Transaction panel: backs off under stress, last values carried over in between. */
+	if ( ! cadenceDue(&cadTrx, pSnap->dTime))
+	{
+		carrySlots(pSnap, 0);
+	}
+	else
+	{
+		double dPanelStart = monotonicTime();
+
+		collectTransactions(pConn, pSnap, pCaps);
+
+		cadenceUpdate(&cadTrx, monotonicTime(), monotonicTime() - dPanelStart, iStress);
+		carrySlots(pSnap, 1);
+	}
+
+	if (pCaps->iISAccess == 1)
+	{
+		/* History list length, lock timeouts and deadlocks in one round-trip. */
+		pResult = monQuery(pConn, aMetricsSQL);
+		decodeRows(pResult, pSnap);
+		mysql_free_result(pResult);
+
+		char const* pLocks = NULL;
+
+		if (pCaps->iV8 != 1 || pCaps->iMaria == 1)
+		{
+			pLocks = "SELECT LOCK_TYPE, COUNT(*) FROM information_schema.INNODB_LOCKS GROUP BY LOCK_TYPE";
+		}
+		else if (pCaps->iPSAccess == 1)
+		{
+			pLocks = "SELECT LOCK_TYPE, COUNT(*) FROM performance_schema.data_locks GROUP BY LOCK_TYPE";
+		}
+
+		if (pLocks != NULL)
+		{
+			collectLocks(pConn, pLocks, pSnap, iStress);
+		}
+	}
+
+	return 1;
+}
+
+
+/**
+	* Transaction counts: MySQL layer (p_s) and InnoDB layer (I_S).
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   Snapshot* pSnap, pointer to snapshot
+	* @param   Capabilities* pCaps, pointer to server capabilities
+	* @return  void
+*/
+
+void collectTransactions(MYSQL* pConn, Snapshot* pSnap, Capabilities* pCaps)
+{
+	MYSQL_RES* pResult;
+	MYSQL_ROW row;
+
+	/* TRX at MySQL layer. */
+	if (pCaps->iPSAccess == 1)
+	{
+		pResult = monQuery(pConn, "SELECT COUNT(*) FROM performance_schema.events_transactions_current WHERE state = 'ACTIVE' AND timer_wait > 1000000000000 * 1");
+
+		if (pResult != NULL && (row = mysql_fetch_row(pResult)) != NULL)
+		{
+			storeSlot(pSnap, S_TRX_MYSQL, row[0]);
+		}
+		else if (mysql_errno(pConn) != 0)
+		{
+			/* Privileges or consumers changed: re-probe next tick. */
+			pCaps->dNextProbe = 0;
+		}
+
+		mysql_free_result(pResult);
+	}
+
+	if (pCaps->iISAccess == 1)
+	{
+		/* TRX at InnoDB layer (all trx_state: RUNNING, LOCK WAIT, ROLLING BACK, COMMITTING) and lock waits, in one scan. */
+		pResult = monQuery(pConn, "SELECT COUNT(*), COALESCE(SUM(trx_state = 'LOCK WAIT'), 0) FROM information_schema.INNODB_TRX");
+
+		if (pResult != NULL && (row = mysql_fetch_row(pResult)) != NULL && row[0] != NULL && row[1] != NULL)
+		{
+			storeSlot(pSnap, S_TRX_INNODB, row[0]);
+			storeSlot(pSnap, S_TRX_LOCK_WAITS, row[1]);
+		}
+		else if (mysql_errno(pConn) != 0)
+		{
+			pCaps->dNextProbe = 0;
+		}
+
+		mysql_free_result(pResult);
+	}
+}
+
+
+/**
+	* Save the transaction panel's slots after a fetch, or restore them on a tick the panel is skipped.
+	*
+	* @param   Snapshot* pSnap, pointer to snapshot
+	* @param   unsigned int iFetched, 1: save, 0: restore
+	* @return  void
+*/
+
+void carrySlots(Snapshot* pSnap, unsigned int iFetched)
+{
+	static Slot const aTrxSlots[] = {S_TRX_MYSQL, S_TRX_INNODB, S_TRX_LOCK_WAITS};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(aTrxSlots) / sizeof(aTrxSlots[0]); i++)
+	{
+		Slot iSlot = aTrxSlots[i];
+
+		if (iFetched)
+		{
+			snapCarry.aValue[iSlot] = pSnap->aValue[iSlot];
+			snapCarry.aSeen[iSlot] = pSnap->aSeen[iSlot];
+		}
+		else
+		{
+			pSnap->aValue[iSlot] = snapCarry.aValue[iSlot];
+			pSnap->aSeen[iSlot] = snapCarry.aSeen[iSlot];
+		}
+	}
+}
+
+
+/**
+	* Table and record lock counts in one scan of the lock table.
+	* Above iLockThreshold locks the scan itself is costly for the server, so it drops to every iLockInterval seconds
+	* and the last counts are reused in between. The panel's adaptive cadence applies on top.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   char* pSQL, LOCK_TYPE / COUNT(*) aggregate query
+	* @param   Snapshot* pSnap, pointer to snapshot
+	* @param   unsigned int iStress, 1 if the server is under stress
+	* @return  void
+*/
+
+void collectLocks(MYSQL* pConn, char const* pSQL, Snapshot* pSnap, unsigned int iStress)
+{
+	MYSQL_RES* pResult;
+	MYSQL_ROW row;
+
+	if (pSnap->dTime >= dNextLockCount && cadenceDue(&cadLocks, pSnap->dTime))
+	{
+		double dPanelStart = monotonicTime();
+
+		pResult = monQuery(pConn, pSQL);
+
+		cadenceUpdate(&cadLocks, monotonicTime(), monotonicTime() - dPanelStart, iStress);
+
+		if (pResult != NULL)
+		{
+			aLockCounts[0] = 0;
+			aLockCounts[1] = 0;
+
+			while ((row = mysql_fetch_row(pResult)) != NULL)
+			{
+				if (row[0] != NULL && row[1] != NULL)
+				{
+					if (strcmp(row[0], "TABLE") == 0)
+					{
+						aLockCounts[0] = strtoull(row[1], NULL, 10);
+					}
+					else if (strcmp(row[0], "RECORD") == 0)
+					{
+						aLockCounts[1] = strtoull(row[1], NULL, 10);
+					}
+				}
+			}
+
+			mysql_free_result(pResult);
+
+			iLocksThrottled = (aLockCounts[0] + aLockCounts[1] > iLockThreshold);
+			dNextLockCount = iLocksThrottled ? pSnap->dTime + iLockInterval : 0;
+		}
+		else
+		{
+			dNextLockCount = 0;
+			return;
+		}
+	}
+
+	pSnap->aValue[S_LOCKS_TABLE] = aLockCounts[0];
+	pSnap->aValue[S_LOCKS_RECORD] = aLockCounts[1];
+	pSnap->aSeen[S_LOCKS_TABLE] = 1;
+	pSnap->aSeen[S_LOCKS_RECORD] = 1;
+}
+
+
+/**
+	* Probe p_s / I_S access and re-read the system variables.
+	* Run at startup, then every PROBE_INTERVAL seconds or after a query error.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   Capabilities* pCaps, pointer to server capabilities
+	* @return  void
+*/
+
+void probeCapabilities(MYSQL* pConn, Capabilities* pCaps)
+{
+	MYSQL_RES* pResult;
+
+	pResult = monQuery(pConn, (pCaps->iStatusFallback == 0 ? aVariablesSQL : aShowVariablesSQL));
+
+	if (pResult != NULL)
+	{
+		resetSnapshot(&pCaps->snapStatic);
+		decodeRows(pResult, &pCaps->snapStatic);
+		mysql_free_result(pResult);
+	}
+
+	/* P_S test. */
+	pResult = monQuery(pConn, "SELECT 1 FROM performance_schema.events_transactions_current LIMIT 1");
+		/* Requires performance_schema setup_consumers.events_transactions_current and setup_instruments.transaction to be enabled. */
+	pCaps->iPSAccess = (mysql_errno(pConn) == 0);
+	mysql_free_result(pResult);
+
+	/* I_S test. */
+	pResult = monQuery(pConn, "SELECT trx_id FROM information_schema.INNODB_TRX LIMIT 1");
+	pCaps->iISAccess = (mysql_errno(pConn) == 0);
+	mysql_free_result(pResult);
+
+	pCaps->dNextProbe = monotonicTime() + PROBE_INTERVAL;
+}
+
+
+/**
+	* Per-second rate of a counter between two snapshots.
+	*
+	* @param   Snapshot* pCur, current snapshot
+	* @param   Snapshot* pPrev, previous snapshot
+	* @param   Slot iSlot, counter slot
+	* @return  double
+*/
+
+double counterRate(Snapshot const* pCur, Snapshot const* pPrev, Slot iSlot)
+{
+	double dElapsed = pCur->dTime - pPrev->dTime;
+
+	if ( ! pCur->aSeen[iSlot] || ! pPrev->aSeen[iSlot] || dElapsed <= 0)
+	{
+		return 0;
+	}
+
+	/* Counters only go backwards on restart, which is caught via Uptime before rates are taken. */
+	if (pCur->aValue[iSlot] < pPrev->aValue[iSlot])
+	{
+		return 0;
+	}
+
+	return (double) (pCur->aValue[iSlot] - pPrev->aValue[iSlot]) / dElapsed;
+}
+
+
+/**
+	* Display snapshot values and rates.
+	*
+	* @param   Snapshot* pCur, current snapshot
+	* @param   Snapshot* pPrev, previous snapshot
+	* @param   Capabilities* pCaps, pointer to server capabilities
+	* @param   History* pHist, pointer to metric history
+	* @return  void
+*/
+
+void displaySnapshot(Snapshot const* pCur, Snapshot const* pPrev, Capabilities const* pCaps, History* pHist)
+{
+	char aBuf[24];
+
+	attrset(A_BOLD | COLOR_PAIR(1));
+	printw(" threads connected: %" PRIu64, pCur->aValue[S_THREADS_CONNECTED]);
+	attrset(A_NORMAL);
+	drawHistory(pHist, H_THREADS_CONNECTED);
+	printw("\n");
+	printw(" aborted connects: %s\n", slotText(pCur, S_ABORTED_CONNECTS, 1, aBuf, sizeof(aBuf)));
+	printw(" aborted clients: %s\n\n", slotText(pCur, S_ABORTED_CLIENTS, 1, aBuf, sizeof(aBuf)));
+
+	attrset(A_BOLD | COLOR_PAIR(1));
+	printw(" max used connections: %s\n", slotText(pCur, S_MAX_USED_CONNECTIONS, 1, aBuf, sizeof(aBuf)));
+	attrset(A_NORMAL);
+	printw(" max connections: %s\n", slotText(pCur, S_MAX_CONNECTIONS, 1, aBuf, sizeof(aBuf)));
+	printw(" max conns exceeded: %s\n\n", slotText(pCur, S_CONN_ERRORS_MAX_CONN, 1, aBuf, sizeof(aBuf)));
+
+	attrset(A_BOLD | COLOR_PAIR(1));
+	printw(" threads running: %" PRIu64, pCur->aValue[S_THREADS_RUNNING]);
+	attrset(A_NORMAL);
+	drawHistory(pHist, H_THREADS_RUNNING);
+	printw("\n");
+	printw(" thread cache size: %s\n", slotText(pCur, S_THREAD_CACHE_SIZE, 1, aBuf, sizeof(aBuf)));
+	printw(" threads cached: %s\n", slotText(pCur, S_THREADS_CACHED, 1, aBuf, sizeof(aBuf)));
+	printw(" threads created: %s\n\n", slotText(pCur, S_THREADS_CREATED, 1, aBuf, sizeof(aBuf)));
+
+	printw(" tmp tables/s: %.1f", counterRate(pCur, pPrev, S_TMP_TABLES));
+	drawHistory(pHist, H_TMP_TABLES);
+	printw("\n tmp disk tables/s: %.1f", counterRate(pCur, pPrev, S_TMP_DISK_TABLES));
+	drawHistory(pHist, H_TMP_DISK_TABLES);
+	printw("\n sort merge passes/s: %.1f", counterRate(pCur, pPrev, S_SORT_MERGE_PASSES));
+	drawHistory(pHist, H_SORT_MERGE_PASSES);
+	printw("\n\n");
+
+	if (pCaps->iPSAccess == 1)
+	{
+		printw(" trx (mysql): %s\n", slotText(pCur, S_TRX_MYSQL, 1, aBuf, sizeof(aBuf)));
+	}
+
+	if (pCaps->iISAccess == 1)
+	{
+		printw(" trx (innodb):");
+		attrset(A_BOLD | COLOR_PAIR(1));
+		printw(" %" PRIu64, pCur->aValue[S_TRX_INNODB]);
+		attrset(A_NORMAL);
+		drawHistory(pHist, H_TRX_INNODB);
+		printw("\n trx locks: %" PRIu64, pCur->aValue[S_TRX_LOCK_WAITS]);
+		drawHistory(pHist, H_TRX_LOCK_WAITS);
+		printw("\n");
+		attrset(A_BOLD | COLOR_PAIR(1));
+		printw(" history list length: %" PRIu64, pCur->aValue[S_HLL]);
+		attrset(A_NORMAL);
+		drawHistory(pHist, H_HLL);
+		printw("\n\n");
+	}
+
+	printw(" row lock time: %ss\n", slotText(pCur, S_ROW_LOCK_TIME, 1000, aBuf, sizeof(aBuf)));
+	printw(" row lock time avg: %sms\n", slotText(pCur, S_ROW_LOCK_TIME_AVG, 1, aBuf, sizeof(aBuf)));
+	printw(" row lock time max: %ss\n", slotText(pCur, S_ROW_LOCK_TIME_MAX, 1000, aBuf, sizeof(aBuf)));
+	printw(" row lock waits: %s\n", slotText(pCur, S_ROW_LOCK_WAITS, 1, aBuf, sizeof(aBuf)));
+	printw(" row lock current waits: %" PRIu64, pCur->aValue[S_ROW_LOCK_CURRENT_WAITS]);
+	drawHistory(pHist, H_ROW_LOCK_CURRENT_WAITS);
+	printw("\n");
+
+	if (pCaps->iISAccess == 1)
+	{
+		printw(" lock timeouts: %s\n", slotText(pCur, S_LOCK_TIMEOUTS, 1, aBuf, sizeof(aBuf)));
+
+		if (pCur->aSeen[S_LOCKS_TABLE])
+		{
+			printw(" locks: tab: %" PRIu64 " rec: %" PRIu64 "%s\n", pCur->aValue[S_LOCKS_TABLE], pCur->aValue[S_LOCKS_RECORD], (iLocksThrottled ? " (slow cadence)" : ""));
+		}
+
+		printw(" deadlocks/s: %.1f", counterRate(pCur, pPrev, S_DEADLOCKS));
+		drawHistory(pHist, H_DEADLOCKS);
+		printw("\n");
+	}
+
+	printw("\n reads/s: %.0f", counterRate(pCur, pPrev, S_ROWS_READ));
+	drawHistory(pHist, H_READS);
+	printw("\n inserts/s: %.0f", counterRate(pCur, pPrev, S_ROWS_INSERTED));
+	drawHistory(pHist, H_INSERTS);
+	printw("\n updates/s: %.0f", counterRate(pCur, pPrev, S_ROWS_UPDATED));
+	drawHistory(pHist, H_UPDATES);
+	printw("\n deletes/s: %.0f", counterRate(pCur, pPrev, S_ROWS_DELETED));
+	drawHistory(pHist, H_DELETES);
+	printw("\n\n");
+
+	/* In tests, close to Innotop's QPS. */
+	attrset(A_BOLD | COLOR_PAIR(1));
+	printw(" QPS: %.0f", counterRate(pCur, pPrev, S_QUERIES));
+	attrset(A_NORMAL);
+	drawHistory(pHist, H_QPS);
+	printw("\n\n");
+
+	printw(" BP: %.2fGB\n", (double) pCur->aValue[S_BP_SIZE] / 1024 / 1024 / 1024);
+
+	if (pCur->aSeen[S_BP_PAGES_DATA] && pCur->aValue[S_BP_PAGES_TOTAL] > 0)
+	{
+		printw(" BP pct fill: %.2f%%\n", 100.0 * pCur->aValue[S_BP_PAGES_DATA] / pCur->aValue[S_BP_PAGES_TOTAL]);
+	}
+
+	if (pCur->aSeen[S_PAGES_READ] && pCur->aValue[S_BP_READ_REQUESTS] > 0)
+	{
+		printw(" BP hit rate: %.2f%%\n", 100 - (100.0 * pCur->aValue[S_PAGES_READ] / pCur->aValue[S_BP_READ_REQUESTS]));
+	}
+
+	printw(" uptime: %.2f hrs\n\n", (double) pCur->aValue[S_UPTIME] / 3600);
+}
+
+
+/**
+	* Allocate the metric history: a single block, never resized.
+	*
+	* @param   History* pHist, pointer to history
+	* @param   unsigned int iCapacity, samples per column
+	* @return  unsigned integer, 0 on allocation failure
+*/
+
+unsigned int historyInit(History* pHist, unsigned int iCapacity)
+{
+	unsigned int i;
+
+	if (iCapacity < SPARK_WIDTH)
+	{
+		iCapacity = SPARK_WIDTH;
+	}
+
+	pHist->iCapacity = iCapacity;
+	pHist->iHead = 0;
+	pHist->iCount = 0;
+	pHist->aTime = malloc(iCapacity * (sizeof(double) + (H_COUNT + 1) * sizeof(float)));
+
+	if (pHist->aTime == NULL)
+	{
+		return 0;
+	}
+
+	float* pBlock = (float*) (pHist->aTime + iCapacity);
+
+	for (i = 0; i < H_COUNT; i++)
+	{
+		pHist->aCol[i] = pBlock + (size_t) i * iCapacity;
+	}
+
+	pHist->aScratch = pBlock + (size_t) H_COUNT * iCapacity;
+
+	return 1;
+}
+
+
+/**
+	* Release the metric history.
+	*
+	* @param   History* pHist, pointer to history
+	* @return  void
+*/
+
+void historyFree(History* pHist)
+{
+	free(pHist->aTime);
+	pHist->aTime = NULL;
+}
+
+
+/**
+	* Append one sample per column, overwriting the oldest once full.
+	*
+	* @param   History* pHist, pointer to history
+	* @param   Snapshot* pCur, current snapshot
+	* @param   Snapshot* pPrev, previous snapshot
+	* @return  void
+*/
+
+void historyPush(History* pHist, Snapshot const* pCur, Snapshot const* pPrev)
+{
+	unsigned int i;
+	unsigned int iPos = pHist->iHead;
+
+	pHist->aTime[iPos] = pCur->dTime;
+
+	for (i = 0; i < H_COUNT; i++)
+	{
+		HistSource const* pSrc = &aHistSources[i];
+		pHist->aCol[pSrc->iColumn][iPos] = (float) (pSrc->iRate ? counterRate(pCur, pPrev, pSrc->iSlot) : (double) pCur->aValue[pSrc->iSlot]);
+	}
+
+	pHist->iHead = (iPos + 1) % pHist->iCapacity;
+
+	if (pHist->iCount < pHist->iCapacity)
+	{
+		pHist->iCount++;
+	}
+}
+
+
+/**
+	* Quickselect: value that would sit at index iNth if aVals were sorted (reorders aVals).
+	*
+	* @param   float* aVals, values
+	* @param   unsigned int iLen, number of values
+	* @param   unsigned int iNth, index wanted
+	* @return  float
+*/
+
+float selectNth(float* aVals, unsigned int iLen, unsigned int iNth)
+{
+	unsigned int iLo = 0;
+	unsigned int iHi = iLen - 1;
+
+	while (iLo < iHi)
+	{
+		float fPivot = aVals[(iLo + iHi) / 2];
+		unsigned int i = iLo;
+		unsigned int j = iHi;
+
+		while (i <= j)
+		{
+			while (aVals[i] < fPivot) {i++;}
+			while (aVals[j] > fPivot) {j--;}
+
+			if (i <= j)
+			{
+				float fTmp = aVals[i];
+				aVals[i] = aVals[j];
+				aVals[j] = fTmp;
+				i++;
+				if (j == 0) {break;}
+				j--;
+			}
+		}
+
+		if (iNth <= j)
+		{
+			iHi = j;
+		}
+		else if (iNth >= i)
+		{
+			iLo = i;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	return aVals[iNth];
+}
+
+
+/**
+	* Draw a sparkline and min/avg/p95/max of the stats window on the current line.
+	*
+	* @param   History* pHist, pointer to history
+	* @param   HistColumn iColumn, metric column
+	* @return  void
+*/
+
+void drawHistory(History* pHist, HistColumn iColumn)
+{
+	char aSpark[SPARK_WIDTH + 1];
+	float const* aCol = pHist->aCol[iColumn];
+	unsigned int iWindow = (iStatsWindow < pHist->iCount) ? iStatsWindow : pHist->iCount;
+	unsigned int iRampMax = sizeof(aSparkRamp) - 2;
+	unsigned int i;
+	int iY;
+	int iX;
+	float fMin;
+	float fMax;
+	double dSum = 0;
+
+	if (iWindow == 0)
+	{
+		return;
+	}
+
+	/* Oldest sample of the window. */
+	unsigned int iStart = (pHist->iHead + pHist->iCapacity - iWindow) % pHist->iCapacity;
+
+	fMin = fMax = aCol[iStart];
+
+	for (i = 0; i < iWindow; i++)
+	{
+		float fVal = aCol[(iStart + i) % pHist->iCapacity];
+		pHist->aScratch[i] = fVal;
+		dSum += fVal;
+		if (fVal < fMin) {fMin = fVal;}
+		if (fVal > fMax) {fMax = fVal;}
+	}
+
+	/* Sparkline: window split into SPARK_WIDTH buckets, each drawn at its peak. */
+	unsigned int iBuckets = (iWindow < SPARK_WIDTH) ? iWindow : SPARK_WIDTH;
+
+	for (i = 0; i < iBuckets; i++)
+	{
+		unsigned int iFrom = i * iWindow / iBuckets;
+		unsigned int iTo = (i + 1) * iWindow / iBuckets;
+		float fPeak = pHist->aScratch[iFrom];
+		unsigned int j;
+
+		for (j = iFrom + 1; j < iTo; j++)
+		{
+			if (pHist->aScratch[j] > fPeak) {fPeak = pHist->aScratch[j];}
+		}
+
+		unsigned int iLevel = (fMax > fMin) ? (unsigned int) ((fPeak - fMin) / (fMax - fMin) * iRampMax + 0.5f) : 0;
+		aSpark[i] = aSparkRamp[iLevel];
+	}
+
+	aSpark[iBuckets] = '\0';
+
+	float fP95 = selectNth(pHist->aScratch, iWindow, (iWindow * 95 - 1) / 100);
+	int iPrec = (fMax < 100) ? 1 : 0;
+
+	getyx(stdscr, iY, iX);
+	(void) iX;
+
+	attron(COLOR_PAIR(1));
+	mvprintw(iY, HIST_COLUMN, "%-*s min %.*f avg %.*f p95 %.*f max %.*f", SPARK_WIDTH, aSpark, iPrec, (double) fMin, iPrec, dSum / iWindow, iPrec, (double) fP95, iPrec, (double) fMax);
+	attroff(COLOR_PAIR(1));
+}
+
+
+/**
+	* Format a slot value for display, '-' when the value was not collected.
+	*
+	* @param   Snapshot* pSnap, pointer to snapshot
+	* @param   Slot iSlot, slot
+	* @param   uint64_t iDivisor, unit divisor
+	* @param   char* aBuf, output buffer
+	* @param   size_t iBufLen, buffer length
+	* @return  char*
+*/
+
+char const* slotText(Snapshot const* pSnap, Slot iSlot, uint64_t iDivisor, char* aBuf, size_t iBufLen)
+{
+	if ( ! pSnap->aSeen[iSlot])
+	{
+		return "-";
+	}
+
+	snprintf(aBuf, iBufLen, "%" PRIu64, pSnap->aValue[iSlot] / iDivisor);
+
+	return aBuf;
+}
+
+
+/**
+	* Open a recording file for appending, writing the header and schema if new.
+	* An existing file must carry the same schema; a partial trailing record is cut off.
+	*
+	* @param   char* pFile, recording filename
+	* @param   char* pHostname, server name for the header
+	* @param   char* pVersion, server version for the header
+	* @param   Capabilities* pCaps, pointer to server capabilities
+	* @param   Snapshot* pSnap, snapshot supplying constant values
+	* @return  integer, file descriptor or -1
+*/
+
+int recordOpen(char const* pFile, char const* pHostname, char const* pVersion, Capabilities const* pCaps, Snapshot const* pSnap)
+{
+	RecordHeader header;
+	RecordEntry aEntries[S_COUNT];
+	size_t iHeaderLen = sizeof(header) + iRecordFields * sizeof(RecordEntry);
+	unsigned int iValues = 0;
+	unsigned int i;
+	struct stat st;
+
+	int iFd = open(pFile, O_RDWR | O_CREAT | O_APPEND, 0644);
+
+	if (iFd < 0 || fstat(iFd, &st) != 0)
+	{
+		fprintf(stderr, "\nCannot open recording file %s\n\n", pFile);
+		if (iFd >= 0) {close(iFd);}
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memset(aEntries, 0, sizeof(aEntries));
+
+	for (i = 0; i < iRecordFields; i++)
+	{
+		strncpy(aEntries[i].aName, aRecordFields[i].pName, RECORD_NAME_LEN - 1);
+		aEntries[i].iConstant = aRecordFields[i].iConstant;
+
+		if (aRecordFields[i].iConstant)
+		{
+			aEntries[i].iValue = pSnap->aValue[aRecordFields[i].iSlot];
+		}
+		else
+		{
+			iValues++;
+		}
+	}
+
+	memcpy(header.aMagic, RECORD_MAGIC, sizeof(header.aMagic));
+	header.iFormat = RECORD_FORMAT;
+	header.iFields = iRecordFields;
+	header.iRecordLen = (uint32_t) ((1 + iValues) * sizeof(uint64_t));
+	header.iCaps = (pCaps->iPSAccess ? 1 : 0) | (pCaps->iISAccess ? 2 : 0) | (pCaps->iV8 ? 4 : 0) | (pCaps->iMaria ? 8 : 0);
+	strncpy(header.aHost, pHostname, sizeof(header.aHost) - 1);
+	strncpy(header.aVersion, pVersion, sizeof(header.aVersion) - 1);
+
+	if (st.st_size == 0)
+	{
+		if (write(iFd, &header, sizeof(header)) != (ssize_t) sizeof(header) || write(iFd, aEntries, iRecordFields * sizeof(RecordEntry)) != (ssize_t) (iRecordFields * sizeof(RecordEntry)))
+		{
+			fprintf(stderr, "\nCannot write recording header to %s\n\n", pFile);
+			close(iFd);
+			return -1;
+		}
+
+		return iFd;
+	}
+
+	/* Appending: schema must match, entry by entry. */
+	RecordHeader existing;
+	RecordEntry entry;
+	unsigned int iMatch = ((size_t) st.st_size >= iHeaderLen && pread(iFd, &existing, sizeof(existing), 0) == (ssize_t) sizeof(existing));
+
+	iMatch = iMatch && memcmp(existing.aMagic, RECORD_MAGIC, sizeof(existing.aMagic)) == 0 && existing.iFormat == RECORD_FORMAT && existing.iFields == iRecordFields && existing.iRecordLen == header.iRecordLen;
+
+	for (i = 0; iMatch && i < iRecordFields; i++)
+	{
+		iMatch = pread(iFd, &entry, sizeof(entry), (off_t) (sizeof(existing) + i * sizeof(entry))) == (ssize_t) sizeof(entry) && strncmp(entry.aName, aEntries[i].aName, RECORD_NAME_LEN) == 0;
+	}
+
+	if ( ! iMatch)
+	{
+		fprintf(stderr, "\n%s is not a recording with this version's schema.\n\n", pFile);
+		close(iFd);
+		return -1;
+	}
+
+	size_t iTail = ((size_t) st.st_size - iHeaderLen) % header.iRecordLen;
+
+	if (iTail != 0 && ftruncate(iFd, st.st_size - (off_t) iTail) != 0)
+	{
+		fprintf(stderr, "\nCannot truncate partial record in %s\n\n", pFile);
+		close(iFd);
+		return -1;
+	}
+
+	return iFd;
+}
+
+
+/**
+	* Append one snapshot to the recording: a single write() of one fixed-length record.
+	*
+	* @param   int iFd, recording file descriptor
+	* @param   Snapshot* pSnap, pointer to snapshot
+	* @return  unsigned integer, 1 on success
+*/
+
+unsigned int recordSnapshot(int iFd, Snapshot const* pSnap)
+{
+	uint64_t aRecord[S_COUNT + 1];
+	unsigned int iValues = 0;
+	unsigned int i;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	aRecord[iValues++] = (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+
+	for (i = 0; i < iRecordFields; i++)
+	{
+		if ( ! aRecordFields[i].iConstant)
+		{
+			Slot iSlot = aRecordFields[i].iSlot;
+			aRecord[iValues++] = pSnap->aSeen[iSlot] ? pSnap->aValue[iSlot] : RECORD_UNSEEN;
+		}
+	}
+
+	size_t iLen = iValues * sizeof(uint64_t);
+
+	return (write(iFd, aRecord, iLen) == (ssize_t) iLen);
+}
+
+
+/**
+	* Memory-map a recording and map its schema back onto snapshot slots.
+	*
+	* @param   char* pFile, recording filename
+	* @param   Replay* pRep, pointer to replay state
+	* @return  unsigned integer, 1 on success
+*/
+
+unsigned int replayOpen(char const* pFile, Replay* pRep)
+{
+	RecordHeader header;
+	struct stat st;
+	unsigned int i;
+	unsigned int j;
+
+	memset(pRep, 0, sizeof(Replay));
+
+	int iFd = open(pFile, O_RDONLY);
+
+	if (iFd < 0 || fstat(iFd, &st) != 0 || (size_t) st.st_size < sizeof(header))
+	{
+		fprintf(stderr, "\nCannot read recording %s\n\n", pFile);
+		if (iFd >= 0) {close(iFd);}
+		return 0;
+	}
+
+	void* pMap = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, iFd, 0);
+	close(iFd);
+
+	if (pMap == MAP_FAILED)
+	{
+		fprintf(stderr, "\nCannot map recording %s\n\n", pFile);
+		return 0;
+	}
+
+	pRep->pData = pMap;
+	pRep->iLen = (size_t) st.st_size;
+
+	memcpy(&header, pRep->pData, sizeof(header));
+
+	size_t iHeaderLen = sizeof(header) + (size_t) header.iFields * sizeof(RecordEntry);
+
+	if (memcmp(header.aMagic, RECORD_MAGIC, sizeof(header.aMagic)) != 0 || header.iFormat != RECORD_FORMAT || header.iFields > S_COUNT || header.iRecordLen < sizeof(uint64_t) || pRep->iLen < iHeaderLen)
+	{
+		fprintf(stderr, "\n%s is not a %s recording.\n\n", pFile, APP_NAME);
+		munmap(pMap, pRep->iLen);
+		return 0;
+	}
+
+	pRep->pRecords = pRep->pData + iHeaderLen;
+	pRep->iRecordLen = header.iRecordLen;
+	pRep->iRecords = (pRep->iLen - iHeaderLen) / header.iRecordLen;
+	pRep->caps.iPSAccess = (header.iCaps & 1) ? 1 : 0;
+	pRep->caps.iISAccess = (header.iCaps & 2) ? 1 : 0;
+	pRep->caps.iV8 = (header.iCaps & 4) ? 1 : 0;
+	pRep->caps.iMaria = (header.iCaps & 8) ? 1 : 0;
+	memcpy(pRep->aHost, header.aHost, sizeof(header.aHost));
+	memcpy(pRep->aVersion, header.aVersion, sizeof(header.aVersion));
+
+	/* Entries named by a build that this one does not know are skipped. */
+	for (i = 0; i < header.iFields; i++)
+	{
+		RecordEntry entry;
+		Slot iSlot = S_COUNT;
+
+		memcpy(&entry, pRep->pData + sizeof(header) + i * sizeof(entry), sizeof(entry));
+		entry.aName[RECORD_NAME_LEN - 1] = '\0';
+
+		for (j = 0; j < iRecordFields; j++)
+		{
+			if (strcmp(entry.aName, aRecordFields[j].pName) == 0)
+			{
+				iSlot = aRecordFields[j].iSlot;
+				break;
+			}
+		}
+
+		if (entry.iConstant)
+		{
+			if (iSlot != S_COUNT)
+			{
+				pRep->snapBase.aValue[iSlot] = entry.iValue;
+				pRep->snapBase.aSeen[iSlot] = 1;
+			}
+		}
+		else
+		{
+			pRep->aValueSlot[pRep->iValues++] = iSlot;
+		}
+	}
+
+	if ((1 + pRep->iValues) * sizeof(uint64_t) != pRep->iRecordLen)
+	{
+		fprintf(stderr, "\n%s has an inconsistent schema.\n\n", pFile);
+		munmap(pMap, pRep->iLen);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/**
+	* Wall-clock time of a record.
+	*
+	* @param   Replay* pRep, pointer to replay state
+	* @param   size_t iIdx, record index
+	* @return  double, seconds since the epoch
+*/
+
+double replayTime(Replay const* pRep, size_t iIdx)
+{
+	uint64_t iMs;
+
+	memcpy(&iMs, pRep->pRecords + iIdx * pRep->iRecordLen, sizeof(iMs));
+
+	return (double) iMs / 1000;
+}
+
+
+/**
+	* Rebuild a snapshot from a record.
+	*
+	* @param   Replay* pRep, pointer to replay state
+	* @param   size_t iIdx, record index
+	* @param   Snapshot* pSnap, pointer to snapshot
+	* @return  void
+*/
+
+void replayLoad(Replay const* pRep, size_t iIdx, Snapshot* pSnap)
+{
+	uint64_t aRecord[S_COUNT + 1];
+	unsigned int i;
+
+	memcpy(aRecord, pRep->pRecords + iIdx * pRep->iRecordLen, pRep->iRecordLen);
+
+	*pSnap = pRep->snapBase;
+	pSnap->dTime = (double) aRecord[0] / 1000;
+
+	for (i = 0; i < pRep->iValues; i++)
+	{
+		Slot iSlot = pRep->aValueSlot[i];
+
+		if (iSlot != S_COUNT && aRecord[i + 1] != RECORD_UNSEEN)
+		{
+			pSnap->aValue[iSlot] = aRecord[i + 1];
+			pSnap->aSeen[iSlot] = 1;
+		}
+	}
+}
+
+
+/**
+	* Binary search for the last record at or before a time.
+	*
+	* @param   Replay* pRep, pointer to replay state
+	* @param   double dTime, seconds since the epoch
+	* @return  size_t, record index
+*/
+
+size_t replaySeek(Replay const* pRep, double dTime)
+{
+	size_t iLo = 0;
+	size_t iHi = pRep->iRecords;
+
+	while (iLo < iHi)
+	{
+		size_t iMid = iLo + (iHi - iLo) / 2;
+
+		if (replayTime(pRep, iMid) <= dTime)
+		{
+			iLo = iMid + 1;
+		}
+		else
+		{
+			iHi = iMid;
+		}
+	}
+
+	return (iLo == 0) ? 0 : iLo - 1;
+}
+
+
+/**
+	* Refill the metric history with the records leading up to a position.
+	*
+	* @param   Replay* pRep, pointer to replay state
+	* @param   History* pHist, pointer to history
+	* @param   size_t iIdx, record index
+	* @return  void
+*/
+
+void replayHistory(Replay const* pRep, History* pHist, size_t iIdx)
+{
+	Snapshot snapCur;
+	Snapshot snapPrev;
+	size_t i = (iIdx >= pHist->iCapacity) ? iIdx - pHist->iCapacity + 1 : 0;
+
+	pHist->iHead = 0;
+	pHist->iCount = 0;
+
+	replayLoad(pRep, (i == 0) ? 0 : i - 1, &snapPrev);
+
+	for ( ; i <= iIdx; i++)
+	{
+		replayLoad(pRep, i, &snapCur);
+		historyPush(pHist, &snapCur, &snapPrev);
+		snapPrev = snapCur;
+	}
+}
+
+
+/**
+	* Offline replay of a recording in the monitor display.
+	*
+	* @return  integer, exit status
+*/
+
+int runReplay(void)
+{
+	Replay rep;
+	History hist;
+	Snapshot snapCur;
+	Snapshot snapPrev;
+	size_t iPos = 0;
+	unsigned int iPaused = 0;
+	double dSpeed = 1;
+
+	if (replayOpen(pReplayFile, &rep) == 0)
+	{
+		return EXIT_FAILURE;
+	}
+
+	if (rep.iRecords == 0)
+	{
+		fprintf(stderr, "\n%s holds no records.\n\n", pReplayFile);
+		munmap((void*) rep.pData, rep.iLen);
+		return EXIT_FAILURE;
+	}
+
+	if (historyInit(&hist, iHistoryMins * 60) == 0)
+	{
+		fprintf(stderr, "\nCannot allocate metric history.\n\n");
+		munmap((void*) rep.pData, rep.iLen);
+		return EXIT_FAILURE;
+	}
+
+	initscr();
+
+	if (has_colors() == FALSE)
+	{
+		endwin();
+		fprintf(stderr, "\nThis terminal does not support colours.\n\n");
+		historyFree(&hist);
+		munmap((void*) rep.pData, rep.iLen);
+		return EXIT_FAILURE;
+	}
+
+	start_color();
+	init_color(COLOR_BLACK, 0, 0, 0);
+	init_pair(1, COLOR_GREEN, COLOR_BLACK);
+	curs_set(0);
+	noecho();
+	cbreak();
+	keypad(stdscr, TRUE);
+	timeout(100);
+
+	double dClock = replayTime(&rep, 0);
+	double dLast = monotonicTime();
+
+	replayHistory(&rep, &hist, 0);
+
+	while ( ! iSigCaught)
+	{
+		int iKey = getch();
+		double dNow = monotonicTime();
+		double dFirst = replayTime(&rep, 0);
+		double dEnd = replayTime(&rep, rep.iRecords - 1);
+		unsigned int iJump = 0;
+
+		if ( ! iPaused)
+		{
+			dClock += (dNow - dLast) * dSpeed;
+		}
+
+		dLast = dNow;
+
+		switch (iKey)
+		{
+			case 'q':
+				iSigCaught = 1;
+				break;
+
+			case ' ':
+				iPaused = ! iPaused;
+				break;
+
+			case '+':
+				if (dSpeed < 4096) {dSpeed *= 2;}
+				break;
+
+			case '-':
+				if (dSpeed > 1) {dSpeed /= 2;}
+				break;
+
+			case KEY_RIGHT:
+				dClock += 60;
+				break;
+
+			case KEY_LEFT:
+				dClock -= 60;
+				iJump = 1;
+				break;
+
+			case KEY_NPAGE:
+				dClock += 3600;
+				iJump = 1;
+				break;
+
+			case KEY_PPAGE:
+				dClock -= 3600;
+				iJump = 1;
+				break;
+
+			case KEY_HOME:
+				dClock = dFirst;
+				iJump = 1;
+				break;
+
+			case KEY_END:
+				dClock = dEnd;
+				iJump = 1;
+				break;
+
+			case '.':
+				iPaused = 1;
+				if (iPos + 1 < rep.iRecords) {dClock = replayTime(&rep, iPos + 1);}
+				break;
+
+			case ',':
+				iPaused = 1;
+				if (iPos > 0) {dClock = replayTime(&rep, iPos - 1);}
+				iJump = 1;
+				break;
+
+			default:
+				break;
+		}
+
+		if (dClock < dFirst) {dClock = dFirst;}
+
+		if (dClock > dEnd)
+		{
+			dClock = dEnd;
+			iPaused = 1;
+		}
+
+		if (iJump)
+		{
+			iPos = replaySeek(&rep, dClock);
+			replayHistory(&rep, &hist, iPos);
+		}
+		else
+		{
+			/* Play forward: every record passed feeds the history. */
+			while (iPos + 1 < rep.iRecords && replayTime(&rep, iPos + 1) <= dClock)
+			{
+				iPos++;
+				replayLoad(&rep, iPos - 1, &snapPrev);
+				replayLoad(&rep, iPos, &snapCur);
+				historyPush(&hist, &snapCur, &snapPrev);
+			}
+		}
+
+		replayLoad(&rep, iPos, &snapCur);
+		replayLoad(&rep, (iPos == 0) ? 0 : iPos - 1, &snapPrev);
+
+		char aStamp[24];
+		time_t tRecord = (time_t) snapCur.dTime;
+		strftime(aStamp, sizeof(aStamp), "%Y-%m-%d %H:%M:%S", localtime(&tRecord));
+
+		erase();
+
+		attrset(A_BOLD);
+		printw("\n %s (replay)\n", rep.aHost);
+		attrset(A_NORMAL);
+		printw(" %s%s\n", (rep.caps.iMaria ? "MariaDB " : ""), rep.aVersion);
+		printw(" %s  [%zu/%zu]  x%.0f%s\n\n", aStamp, iPos + 1, rep.iRecords, dSpeed, (iPaused ? "  paused" : ""));
+
+		displaySnapshot(&snapCur, &snapPrev, &rep.caps, &hist);
+
+		printw(" space: pause  +/-: speed  left/right: 1 min  pgup/pgdn: 1 hr  ,/.: step  home/end  q: quit\n");
+
+		refresh();
+	}
+
+	curs_set(1);
+
+	endwin();
+
+	historyFree(&hist);
+
+	munmap((void*) rep.pData, rep.iLen);
+
+	return EXIT_SUCCESS;
+}
+
+
+/**
+	* Connect to the server with the command-line credentials.
+	*
+	* @return  MYSQL*, NULL on failure
+*/
+
+MYSQL* connectServer(void)
+{
+	MYSQL* pConn = mysql_init(NULL);
+
+	if (pConn == NULL)
+	{
+		fprintf(stderr, "\nCannot initialise MySQL connector.\n\n");
+		return NULL;
+	}
+
+	mysql_options4(pConn, MYSQL_OPT_CONNECT_ATTR_ADD, "program_name", APP_NAME);
+
+	if (mysql_real_connect(pConn, pHost, pUser, pPassword, NULL, iPort, NULL, 0) == NULL)
+	{
+		fprintf(stderr, "\nCannot connect to MySQL server.\n(Error: %s)\n\n", mysql_error(pConn));
+		mysql_close(pConn);
+		return NULL;
+	}
+
+	return pConn;
+}
+
+
+/**
+	* Render a complete HTTP response carrying the snapshot as OpenMetrics text.
+	* A body that would not fit is not sent cut short (without its # EOF): a 500 response is rendered instead.
+	*
+	* @param   Snapshot* pSnap, snapshot
+	* @param   unsigned int iUp, 1 if the last collection succeeded
+	* @param   double dCollect, collection duration (secs)
+	* @param   char* pInstance, server hostname
+	* @param   char* pBuf, output buffer
+	* @param   size_t iBufLen, size of pBuf
+	* @return  size_t, response length
+*/
+
+size_t renderOpenMetrics(Snapshot const* pSnap, unsigned int iUp, double dCollect, char const* pInstance, char* pBuf, size_t iBufLen)
+{
+	char aBody[EXPORT_BUF_LEN - 256];
+	size_t iLen = 0;
+	unsigned int iFits = 1;
+	unsigned int i;
+
+	iFits &= bodyPrintf(aBody, sizeof(aBody), &iLen, "# TYPE mysqlmon_up gauge\n# HELP mysqlmon_up Whether the last collection succeeded.\nmysqlmon_up %u\n", iUp);
+	iFits &= bodyPrintf(aBody, sizeof(aBody), &iLen, "# TYPE mysqlmon_server info\nmysqlmon_server_info{hostname=\"%s\"} 1\n", pInstance);
+	iFits &= bodyPrintf(aBody, sizeof(aBody), &iLen, "# TYPE mysqlmon_collect_duration_seconds gauge\nmysqlmon_collect_duration_seconds %.6f\n", dCollect);
+
+	for (i = 0; iUp == 1 && i < iExportMetrics && iFits; i++)
+	{
+		ExportMetric const* pM = &aExportMetrics[i];
+		unsigned int iCounter = (pM->pType[0] == 'c');
+
+		if ( ! pSnap->aSeen[pM->iSlot])
+		{
+			continue;
+		}
+
+		iFits &= bodyPrintf(aBody, sizeof(aBody), &iLen, "# TYPE %s %s\n# HELP %s %s\n", pM->pName, pM->pType, pM->pName, pM->pHelp);
+
+		if (pM->iDivisor == 1)
+		{
+			iFits &= bodyPrintf(aBody, sizeof(aBody), &iLen, "%s%s %" PRIu64 "\n", pM->pName, (iCounter ? "_total" : ""), pSnap->aValue[pM->iSlot]);
+		}
+		else
+		{
+			iFits &= bodyPrintf(aBody, sizeof(aBody), &iLen, "%s%s %.3f\n", pM->pName, (iCounter ? "_total" : ""), (double) pSnap->aValue[pM->iSlot] / pM->iDivisor);
+		}
+	}
+
+	iFits &= bodyPrintf(aBody, sizeof(aBody), &iLen, "# EOF\n");
+
+	if ( ! iFits)
+	{
+		return (size_t) snprintf
+		(
+			pBuf, iBufLen,
+			"HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s",
+			sizeof("metrics exceed the response buffer\n") - 1, "metrics exceed the response buffer\n"
+		);
+	}
+
+	return (size_t) snprintf
+	(
+		pBuf, iBufLen,
+		"HTTP/1.1 200 OK\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s",
+		iLen, aBody
+	);
+}
+
+
+/**
+	* Append formatted text to a buffer, unless it would not fit: a full buffer is left as it was.
+	*
+	* @param   char* pBuf, buffer
+	* @param   size_t iBufLen, size of pBuf
+	* @param   size_t* pLen, length used so far (advanced on success)
+	* @param   char* pFormat, printf format
+	* @return  unsigned integer, 0 if the text did not fit
+*/
+
+unsigned int bodyPrintf(char* pBuf, size_t iBufLen, size_t* pLen, char const* pFormat, ...)
+{
+	va_list args;
+	int iWritten;
+
+	if (*pLen >= iBufLen)
+	{
+		return 0;
+	}
+
+	va_start(args, pFormat);
+	iWritten = vsnprintf(pBuf + *pLen, iBufLen - *pLen, pFormat, args);
+	va_end(args);
+
+	if (iWritten < 0 || (size_t) iWritten >= iBufLen - *pLen)
+	{
+		pBuf[*pLen] = '\0';
+		return 0;
+	}
+
+	*pLen += (size_t) iWritten;
+
+	return 1;
+}
+
+
+/**
+	* Headless exporter: serve the cached response over HTTP.
+	* A collection thread refreshes it every iExportInterval, so concurrent scrapers do not multiply server load
+	* and a scrape never waits on the server. Requests are read without blocking, each within EXPORT_IO_MS.
+	* Owns the connection from here on (it may be re-established), and closes it on exit.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   Capabilities* pCaps, pointer to server capabilities
+	* @param   char* pInstance, server hostname
+	* @return  signed integer, exit status
+*/
+
+int runExporter(MYSQL* pConn, Capabilities* pCaps, char const* pInstance)
+{
+	static ExportCache cache;
+	ExportClient aClients[EXPORT_CLIENTS];
+	struct pollfd aPoll[EXPORT_CLIENTS + 1];
+	pthread_t tCollect;
+	int iOpt = 1;
+	int iListen;
+	struct sockaddr_in addr;
+	unsigned int i;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	cache.pConn = pConn;
+	cache.pCaps = pCaps;
+	cache.pInstance = pInstance;
+	pthread_mutex_init(&cache.lock, NULL);
+
+	/* The first response, before listening: no scrape waits for it. */
+	exportRefresh(&cache);
+
+	iListen = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (iListen < 0)
+	{
+		fprintf(stderr, "\nCannot create exporter socket.\n\n");
+		mysql_close(cache.pConn);
+		return EXIT_FAILURE;
+	}
+
+	setsockopt(iListen, SOL_SOCKET, SO_REUSEADDR, &iOpt, sizeof(iOpt));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons((uint16_t) iExportPort);
+
+	if (bind(iListen, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(iListen, 16) != 0)
+	{
+		fprintf(stderr, "\nCannot listen on 127.0.0.1:%u.\n\n", iExportPort);
+		close(iListen);
+		mysql_close(cache.pConn);
+		return EXIT_FAILURE;
+	}
+
+	if (pthread_create(&tCollect, NULL, exportThread, &cache) != 0)
+	{
+		fprintf(stderr, "\nCannot start the exporter collection thread.\n\n");
+		close(iListen);
+		mysql_close(cache.pConn);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stdout, "%s exporting on http://127.0.0.1:%u/metrics\n", APP_NAME, iExportPort);
+	fflush(stdout);
+
+	for (i = 0; i < EXPORT_CLIENTS; i++)
+	{
+		aClients[i].iFd = -1;
+	}
+
+	while ( ! iSigCaught)
+	{
+		double dNow;
+
+		/* Free slots have fd -1, which poll() skips. */
+		aPoll[0].fd = iListen;
+		aPoll[0].events = POLLIN;
+
+		for (i = 0; i < EXPORT_CLIENTS; i++)
+		{
+			aPoll[i + 1].fd = aClients[i].iFd;
+			aPoll[i + 1].events = POLLIN;
+			aPoll[i + 1].revents = 0;
+		}
+
+		if (poll(aPoll, EXPORT_CLIENTS + 1, 100) < 0)
+		{
+			continue; /* EINTR: recheck iSigCaught. */
+		}
+
+		dNow = monotonicTime();
+
+		if (aPoll[0].revents & POLLIN)
+		{
+			int iClient = accept(iListen, NULL, NULL);
+
+			i = 0;
+
+			while (i < EXPORT_CLIENTS && aClients[i].iFd >= 0)
+			{
+				i++;
+			}
+
+			/* Every slot still reading: shed the scrape rather than queue it behind slow ones. */
+			if (iClient >= 0 && (i == EXPORT_CLIENTS || fcntl(iClient, F_SETFL, O_NONBLOCK) != 0))
+			{
+				close(iClient);
+			}
+			else if (iClient >= 0)
+			{
+				aClients[i].iFd = iClient;
+				aClients[i].dDeadline = dNow + (double) EXPORT_IO_MS / 1000;
+				aClients[i].iLen = 0;
+			}
+		}
+
+		for (i = 0; i < EXPORT_CLIENTS; i++)
+		{
+			ExportClient* pClient = &aClients[i];
+
+			if (pClient->iFd < 0)
+			{
+				continue;
+			}
+
+			if (aPoll[i + 1].fd == pClient->iFd && aPoll[i + 1].revents != 0)
+			{
+				ssize_t iRead = recv(pClient->iFd, pClient->aRequest + pClient->iLen, sizeof(pClient->aRequest) - 1 - pClient->iLen, 0);
+
+				if (iRead > 0)
+				{
+					pClient->iLen += (size_t) iRead;
+					pClient->aRequest[pClient->iLen] = '\0';
+
+					/* The request line is all that is needed. */
+					if (strchr(pClient->aRequest, '\n') != NULL || pClient->iLen == sizeof(pClient->aRequest) - 1)
+					{
+						exportRespond(&cache, pClient);
+						continue;
+					}
+				}
+				else if (iRead == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				{
+					close(pClient->iFd);
+					pClient->iFd = -1;
+					continue;
+				}
+			}
+
+			if (dNow > pClient->dDeadline)
+			{
+				close(pClient->iFd);
+				pClient->iFd = -1;
+			}
+		}
+	}
+
+	for (i = 0; i < EXPORT_CLIENTS; i++)
+	{
+		if (aClients[i].iFd >= 0)
+		{
+			close(aClients[i].iFd);
+		}
+	}
+
+	close(iListen);
+
+	__atomic_store_n(&cache.iStop, 1, __ATOMIC_RELEASE);
+	pthread_join(tCollect, NULL);
+	pthread_mutex_destroy(&cache.lock);
+
+	mysql_close(cache.pConn);
+
+	return EXIT_SUCCESS;
+}
+
+
+/**
+	* Collect a snapshot and replace the cached response with it.
+	*
+	* @param   ExportCache* pCache, cache
+	* @return  void
+*/
+
+void exportRefresh(ExportCache* pCache)
+{
+	static char aRender[EXPORT_BUF_LEN]; /* One refresh at a time: before the thread starts, then in it. */
+	static Snapshot snap;
+	double dStart = monotonicTime();
+	unsigned int iUp = collectSnapshot(pCache->pConn, &snap, pCache->pCaps);
+	size_t iLen;
+
+	if (iUp == 0 && mysql_ping(pCache->pConn) != 0)
+	{
+		/* Keep the one long-lived connection: re-establish it for the next refresh. */
+		MYSQL* pNew = connectServer();
+
+		if (pNew != NULL)
+		{
+			mysql_close(pCache->pConn);
+			pCache->pConn = pNew;
+		}
+	}
+
+	iLen = renderOpenMetrics(&snap, iUp, monotonicTime() - dStart, pCache->pInstance, aRender, sizeof(aRender));
+
+	if (iLen >= sizeof(aRender))
+	{
+		iLen = sizeof(aRender) - 1;
+	}
+
+	pthread_mutex_lock(&pCache->lock);
+	memcpy(pCache->aResponse, aRender, iLen);
+	pCache->iResponseLen = iLen;
+	pthread_mutex_unlock(&pCache->lock);
+}
+
+
+/**
+	* Exporter collection thread: refresh the cached response every iExportInterval (from the start of each refresh).
+	*
+	* @param   void* pArg, ExportCache*
+	* @return  void*, NULL
+*/
+
+void* exportThread(void* pArg)
+{
+	ExportCache* pCache = (ExportCache*) pArg;
+	sigset_t sigSet;
+
+	/* SIGINT and SIGTERM are for the HTTP loop: keep them from interrupting client library calls here. */
+	sigemptyset(&sigSet);
+	sigaddset(&sigSet, SIGINT);
+	sigaddset(&sigSet, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+
+	mysql_thread_init();
+
+	while ( ! __atomic_load_n(&pCache->iStop, __ATOMIC_ACQUIRE))
+	{
+		double dNext = monotonicTime() + (double) iExportInterval / 1000;
+		double dWait;
+
+		exportRefresh(pCache);
+
+		/* Stay responsive to stop. */
+		while ( ! __atomic_load_n(&pCache->iStop, __ATOMIC_ACQUIRE) && (dWait = dNext - monotonicTime()) > 0)
+		{
+			msSleep((dWait < 0.1) ? (unsigned int) (dWait * 1000) + 1 : 100);
+		}
+	}
+
+	mysql_thread_end();
+
+	return NULL;
+}
+
+
+/**
+	* Answer a scrape from the cached response and close it.
+	*
+	* @param   ExportCache* pCache, cache
+	* @param   ExportClient* pClient, scrape with its request line read
+	* @return  void
+*/
+
+void exportRespond(ExportCache* pCache, ExportClient* pClient)
+{
+	static char aSend[EXPORT_BUF_LEN]; /* HTTP loop only. */
+	static char const aNotFound[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	struct timeval tvSend = {0, EXPORT_IO_MS * 1000};
+	size_t iLen;
+
+	/* Exactly /metrics, with or without a query string. */
+	if (strncmp(pClient->aRequest, "GET /metrics", 12) == 0 && (pClient->aRequest[12] == ' ' || pClient->aRequest[12] == '?'))
+	{
+		pthread_mutex_lock(&pCache->lock);
+		iLen = pCache->iResponseLen;
+		memcpy(aSend, pCache->aResponse, iLen);
+		pthread_mutex_unlock(&pCache->lock);
+	}
+	else
+	{
+		iLen = sizeof(aNotFound) - 1;
+		memcpy(aSend, aNotFound, iLen);
+	}
+
+	/* Blocking again for the response, with a send timeout: it normally fits the socket buffer at once. */
+	fcntl(pClient->iFd, F_SETFL, 0);
+	setsockopt(pClient->iFd, SOL_SOCKET, SO_SNDTIMEO, &tvSend, sizeof(tvSend));
+	send(pClient->iFd, aSend, iLen, 0);
+
+	close(pClient->iFd);
+	pClient->iFd = -1;
+}
+
+
+/**
+	* Parse the fleet host list: comma-separated host[:port], or @file with one host[:port] per line.
+	*
+	* @param   char* pList, host list
+	* @return  unsigned integer, number of hosts
+*/
+
+unsigned int parseFleet(char const* pList)
+{
+	char aBuf[8192];
+	char* pSave = NULL;
+	char* pTok;
+
+	if (pList[0] == '@')
+	{
+		FILE* fh = fopen(pList + 1, "r");
+
+		if (fh == NULL)
+		{
+			fprintf(stderr, "\nCannot read host file %s.\n\n", pList + 1);
+			return 0;
+		}
+
+		size_t iRead = fread(aBuf, 1, sizeof(aBuf) - 1, fh);
+		aBuf[iRead] = '\0';
+		int iMore = fgetc(fh);
+		fclose(fh);
+
+		if (iMore != EOF)
+		{
+			fprintf(stderr, "\nHost file %s is longer than %zu bytes.\n\n", pList + 1, sizeof(aBuf) - 1);
+			return 0;
+		}
+	}
+	else
+	{
+		if (strlen(pList) >= sizeof(aBuf))
+		{
+			fprintf(stderr, "\nFleet list is longer than %zu bytes.\n\n", sizeof(aBuf) - 1);
+			return 0;
+		}
+
+		strcpy(aBuf, pList);
+	}
+
+	aFleet = calloc(FLEET_MAX, sizeof(FleetHost));
+
+	if (aFleet == NULL)
+	{
+		return 0;
+	}
+
+	for (pTok = strtok_r(aBuf, ", \t\r\n", &pSave); pTok != NULL; pTok = strtok_r(NULL, ", \t\r\n", &pSave))
+	{
+		if (iFleetCount == FLEET_MAX)
+		{
+			fprintf(stderr, "\nFleet list has more than %d hosts.\n\n", FLEET_MAX);
+			return 0;
+		}
+
+		FleetHost* pFH = &aFleet[iFleetCount];
+		char* pColon = strrchr(pTok, ':');
+
+		pFH->iPort = iPort;
+
+		if (pColon != NULL)
+		{
+			*pColon = '\0';
+			pFH->iPort = (unsigned int) atoi(pColon + 1);
+		}
+
+		strncpy(pFH->aHost, pTok, sizeof(pFH->aHost) - 1);
+		pFH->iState = FS_DOWN;
+		iFleetCount++;
+	}
+
+	if (iFleetCount == 0)
+	{
+		fprintf(stderr, "\nNo hosts in fleet list.\n\n");
+	}
+
+	return iFleetCount;
+}
+
+
+/**
+	* Mark a fleet host down and schedule a reconnect.
+	*
+	* @param   FleetHost* pFH, host
+	* @param   double dNow, monotonic time
+	* @return  void
+*/
+
+void fleetFail(FleetHost* pFH, double dNow)
+{
+	if (pFH->pConn != NULL)
+	{
+		strncpy(pFH->aError, mysql_error(pFH->pConn), sizeof(pFH->aError) - 1);
+		mysql_close(pFH->pConn);
+		pFH->pConn = NULL;
+	}
+
+	pFH->iState = FS_DOWN;
+	pFH->dRetry = dNow + 5;
+}
+
+
+/**
+	* Decode a completed fleet result.
+	*
+	* @param   FleetHost* pFH, host
+	* @param   MYSQL_RES* pResult, result set
+	* @param   double dNow, monotonic time
+	* @return  void
+*/
+
+void fleetComplete(FleetHost* pFH, MYSQL_RES* pResult, double dNow)
+{
+	decodeRows(pResult, &pFH->snapNext);
+	mysql_free_result(pResult);
+
+	pFH->snapNext.dTime = pFH->dQueryStart;
+	pFH->dLatency = dNow - pFH->dQueryStart;
+	pFH->aError[0] = '\0';
+
+	/* Restart: rebase so rates are not computed across it. */
+	if (pFH->snapCur.aValue[S_UPTIME] > pFH->snapNext.aValue[S_UPTIME])
+	{
+		pFH->snapCur = pFH->snapNext;
+	}
+
+	pFH->snapPrev = pFH->snapCur;
+	pFH->snapCur = pFH->snapNext;
+	pFH->iState = FS_IDLE;
+}
+
+
+/**
+	* Advance one fleet host's state machine without blocking.
+	*
+	* @param   FleetHost* pFH, host
+	* @param   double dNow, monotonic time
+	* @return  unsigned integer, 1 while the host still has work in flight
+*/
+
+unsigned int fleetStep(FleetHost* pFH, double dNow)
+{
+	char const* pSQL = aFleetSQL[pFH->iQueryLevel];
+	MYSQL_RES* pResult = NULL;
+
+	#if FLEET_NONBLOCKING
+		enum net_async_status iStatus;
+
+		/* The non-blocking calls do not apply the socket timeouts: a blackholed host would stay in flight forever. */
+		if (pFH->iState != FS_DOWN && pFH->iState != FS_IDLE && dNow - pFH->dQueryStart > (pFH->iState == FS_CONNECT ? FLEET_CONNECT_TIMEOUT : FLEET_READ_TIMEOUT))
+		{
+			fleetFail(pFH, dNow);
+			snprintf(pFH->aError, sizeof(pFH->aError), "timed out");
+			return 0;
+		}
+
+		switch (pFH->iState)
+		{
+			case FS_CONNECT:
+				iStatus = mysql_real_connect_nonblocking(pFH->pConn, pFH->aHost, pUser, pPassword, NULL, pFH->iPort, NULL, 0);
+				if (iStatus == NET_ASYNC_NOT_READY) {return 1;}
+				if (iStatus == NET_ASYNC_ERROR) {fleetFail(pFH, dNow); return 0;}
+				pFH->iState = FS_QUERY;
+				resetSnapshot(&pFH->snapNext);
+				pFH->dQueryStart = dNow;
+				return 1;
+
+			case FS_QUERY:
+				iStatus = mysql_real_query_nonblocking(pFH->pConn, pSQL, (unsigned long) strlen(pSQL));
+				if (iStatus == NET_ASYNC_NOT_READY) {return 1;}
+				if (iStatus == NET_ASYNC_ERROR)
+				{
+					if (mysql_errno(pFH->pConn) < CR_MIN_ERROR && pFH->iQueryLevel < 2)
+					{
+						pFH->iQueryLevel++; /* Privilege or schema missing: degrade the query, retry next tick. */
+						pFH->iState = FS_IDLE;
+						return 0;
+					}
+					fleetFail(pFH, dNow);
+					return 0;
+				}
+				pFH->iState = FS_STORE;
+				return 1;
+
+			case FS_STORE:
+				iStatus = mysql_store_result_nonblocking(pFH->pConn, &pResult);
+				if (iStatus == NET_ASYNC_NOT_READY) {return 1;}
+				if (iStatus == NET_ASYNC_ERROR) {fleetFail(pFH, dNow); return 0;}
+				fleetComplete(pFH, pResult, dNow);
+				return 0;
+
+			default:
+				return 0;
+		}
+	#else
+		/* Blocking fallback: hosts are polled serially. */
+		if (pFH->iState == FS_CONNECT)
+		{
+			if (mysql_real_connect(pFH->pConn, pFH->aHost, pUser, pPassword, NULL, pFH->iPort, NULL, 0) == NULL)
+			{
+				fleetFail(pFH, dNow);
+				return 0;
+			}
+
+			pFH->iState = FS_QUERY;
+			resetSnapshot(&pFH->snapNext);
+			pFH->dQueryStart = dNow;
+		}
+
+		if (pFH->iState == FS_QUERY)
+		{
+			if (mysql_query(pFH->pConn, pSQL) != 0)
+			{
+				if (mysql_errno(pFH->pConn) < CR_MIN_ERROR && pFH->iQueryLevel < 2)
+				{
+					pFH->iQueryLevel++;
+					pFH->iState = FS_IDLE;
+					return 0;
+				}
+				fleetFail(pFH, dNow);
+				return 0;
+			}
+
+			pResult = mysql_store_result(pFH->pConn);
+			fleetComplete(pFH, pResult, monotonicTime());
+		}
+
+		return 0;
+	#endif
+}
+
+
+/**
+	* Display one row per fleet host.
+	*
+	* @return  void
+*/
+
+void displayFleet(void)
+{
+	unsigned int i;
+	unsigned int iUp = 0;
+	double dSlowest = 0;
+
+	erase();
+
+	attrset(A_BOLD);
+	mvprintw(1, 1, "%s fleet", APP_NAME);
+	mvprintw(3, 1, "%-40s %10s %8s %8s %10s %8s %9s  %s", "host", "QPS", "running", "conns", "HLL", "lk waits", "latency", "status");
+	attrset(A_NORMAL);
+
+	for (i = 0; i < iFleetCount; i++)
+	{
+		FleetHost const* pFH = &aFleet[i];
+		Snapshot const* pCur = &pFH->snapCur;
+		int iRow = 4 + (int) i;
+
+		if (pFH->iState == FS_DOWN || ! pCur->aSeen[S_UPTIME])
+		{
+			attrset(COLOR_PAIR(2));
+			mvprintw(iRow, 1, "%-40.40s %10s %8s %8s %10s %8s %9s  %s", pFH->aHost, "-", "-", "-", "-", "-", "-", (pFH->iState == FS_DOWN ? (pFH->aError[0] != '\0' ? pFH->aError : "down") : "connecting"));
+			attrset(A_NORMAL);
+			continue;
+		}
+
+		iUp++;
+
+		if (pFH->dLatency > dSlowest)
+		{
+			dSlowest = pFH->dLatency;
+		}
+
+		mvprintw(iRow, 1, "%-40.40s", pFH->aHost);
+		attrset(A_BOLD | COLOR_PAIR(1));
+		mvprintw(iRow, 42, "%10.0f", counterRate(pCur, &pFH->snapPrev, S_QUERIES));
+		attrset(A_NORMAL);
+		mvprintw(iRow, 53, "%8" PRIu64, pCur->aValue[S_THREADS_RUNNING]);
+		mvprintw(iRow, 62, "%8" PRIu64, pCur->aValue[S_THREADS_CONNECTED]);
+
+		if (pCur->aSeen[S_HLL])
+		{
+			mvprintw(iRow, 71, "%10" PRIu64, pCur->aValue[S_HLL]);
+		}
+		else
+		{
+			mvprintw(iRow, 71, "%10s", "-");
+		}
+
+		mvprintw(iRow, 82, "%8" PRIu64, pCur->aValue[S_ROW_LOCK_CURRENT_WAITS]);
+		mvprintw(iRow, 91, "%7.1fms", pFH->dLatency * 1000);
+		mvprintw(iRow, 102, "%s", (pFH->iState == FS_IDLE ? "ok" : "slow"));
+	}
+
+	mvprintw(5 + (int) iFleetCount, 1, "%u/%u hosts up, slowest %.1fms (%s)", iUp, iFleetCount, dSlowest * 1000, (FLEET_NONBLOCKING ? "non-blocking" : "serial"));
+
+	refresh();
+}
+
+
+/**
+	* Fleet mode: poll every host concurrently in one event loop, once per second.
+	* A tick takes as long as the slowest host; hosts still in flight at the next tick carry on.
+	*
+	* @return  signed integer, exit status
+*/
+
+int runFleet(void)
+{
+	unsigned int i;
+	unsigned int iConnectTimeout = FLEET_CONNECT_TIMEOUT;
+	unsigned int iReadTimeout = FLEET_READ_TIMEOUT;
+
+	if (parseFleet(pFleetList) == 0)
+	{
+		return EXIT_FAILURE;
+	}
+
+	initscr();
+
+	if (has_colors() == FALSE)
+	{
+		endwin();
+		fprintf(stderr, "\nThis terminal does not support colours.\n\n");
+		return EXIT_FAILURE;
+	}
+
+	start_color();
+	init_color(COLOR_BLACK, 0, 0, 0); // for Gnome
+	init_pair(1, COLOR_GREEN, COLOR_BLACK);
+	init_pair(2, COLOR_RED, COLOR_BLACK);
+	curs_set(0);
+
+	while ( ! iSigCaught)
+	{
+		double dTickStart = monotonicTime();
+		unsigned int iBusy = 1;
+
+		/* Start a query on every idle host, (re)connect any host due a retry. */
+		for (i = 0; i < iFleetCount; i++)
+		{
+			FleetHost* pFH = &aFleet[i];
+
+			if (pFH->iState == FS_IDLE)
+			{
+				resetSnapshot(&pFH->snapNext);
+				pFH->dQueryStart = dTickStart;
+				pFH->iState = FS_QUERY;
+			}
+			else if (pFH->iState == FS_DOWN && dTickStart >= pFH->dRetry)
+			{
+				pFH->pConn = mysql_init(NULL);
+
+				if (pFH->pConn == NULL)
+				{
+					continue;
+				}
+
+				mysql_options4(pFH->pConn, MYSQL_OPT_CONNECT_ATTR_ADD, "program_name", APP_NAME);
+				mysql_options(pFH->pConn, MYSQL_OPT_CONNECT_TIMEOUT, &iConnectTimeout);
+				mysql_options(pFH->pConn, MYSQL_OPT_READ_TIMEOUT, &iReadTimeout);
+				mysql_options(pFH->pConn, MYSQL_OPT_WRITE_TIMEOUT, &iReadTimeout);
+				pFH->dQueryStart = dTickStart;
+				pFH->iState = FS_CONNECT;
+			}
+		}
+
+		/* Event loop: drive all hosts until each completes or the tick runs out. */
+		while (iBusy && ! iSigCaught && monotonicTime() - dTickStart < 0.95)
+		{
+			double dNow = monotonicTime();
+			iBusy = 0;
+
+			for (i = 0; i < iFleetCount; i++)
+			{
+				iBusy |= fleetStep(&aFleet[i], dNow);
+			}
+
+			if (iBusy)
+			{
+				msSleep(1);
+			}
+		}
+
+		displayFleet();
+
+		double dElapsed = monotonicTime() - dTickStart;
+
+		if (dElapsed < 1.0)
+		{
+			msSleep((unsigned int) ((1.0 - dElapsed) * 1000));
+		}
+	}
+
+	curs_set(1);
+
+	endwin();
+
+	for (i = 0; i < iFleetCount; i++)
+	{
+		if (aFleet[i].pConn != NULL)
+		{
+			mysql_close(aFleet[i].pConn);
+		}
+	}
+
+	free(aFleet);
+
+	return EXIT_SUCCESS;
+}
+
+
+/**
+	* Process command-line switches using getopt()
+	*
+	* @param   int iArgCount, number of arguments
+	* @param   char* aArgV, pointer to aArgV
+	* @return  unsigned integer
+*/
+
+unsigned int options(int iArgCount, char* const aArgV[])
+{
+	int iOpts = 0;
+	int iOptsIdx = 0;
+	unsigned int iHelp = 0;
+
+	struct option aLongOpts[] =
+	{
+		{"help", no_argument, 0, 'i'},
+		{"export", required_argument, 0, 'e'},
+		{"export-interval", required_argument, 0, 'E'},
+		{"record", required_argument, 0, 'r'},
+		{"replay", required_argument, 0, 'R'},
+		{"lock-threshold", required_argument, 0, 'T'},
+		{"lock-interval", required_argument, 0, 'I'},
+		{"stress-threads", required_argument, 0, 'S'},
+		{0, 0, 0, 0}
+	};
+
+	while ((iOpts = getopt_long(iArgCount, aArgV, "ih:w:u:p:dH:m:", aLongOpts, &iOptsIdx)) != -1)
+	{
+		switch (iOpts)
+		{
+			case 'i':
+				iHelp = 1;
+				break;
+
+			case 'h':
+				pHost = optarg;
+				break;
+
+			case 'u':
+				pUser = optarg;
+				break;
+
+			case 'p':
+				iPort = (unsigned int) atoi(optarg);
+				break;
+
+			case 'd':
+				iDebug = 1;
+				break;
+
+			case 'H':
+				pFleetList = optarg;
+				break;
+
+			case 'm':
+				iHistoryMins = (unsigned int) atoi(optarg);
+				if (iHistoryMins < 1) {iHistoryMins = 1;}
+				if (iHistoryMins > 1440) {iHistoryMins = 1440;}
+				break;
+
+			case 'w':
+				iStatsWindow = (unsigned int) atoi(optarg);
+				if (iStatsWindow < 2) {iStatsWindow = 2;}
+				break;
+
+			case 'e':
+				iExportPort = (unsigned int) atoi(optarg);
+				break;
+
+			case 'E':
+				iExportInterval = (unsigned int) atoi(optarg);
+				if (iExportInterval < 100) {iExportInterval = 100;}
+				break;
+
+			case 'r':
+				pRecordFile = optarg;
+				break;
+
+			case 'R':
+				pReplayFile = optarg;
+				break;
+
+			case 'T':
+				iLockThreshold = (unsigned int) atoi(optarg);
+				break;
+
+			case 'I':
+				iLockInterval = (unsigned int) atoi(optarg);
+				if (iLockInterval < 1) {iLockInterval = 1;}
+				break;
+
+			case 'S':
+				iStressThreads = (unsigned int) atoi(optarg);
 				break;
 
 			case '?':
 
-				if (optopt == 'h' || optopt == 'w' || optopt == 'u' || optopt == 'p')
+				if (optopt == 'h' || optopt == 'w' || optopt == 'u' || optopt == 'p' || optopt == 'e' || optopt == 'E' || optopt == 'H' || optopt == 'm' || optopt == 'r' || optopt == 'R' || optopt == 'T' || optopt == 'I' || optopt == 'S')
 				{
 					fprintf(stderr, "\nMissing switch arguments.\n\n");
 				}
@@ -574,7 +3116,7 @@ unsigned int options(int iArgCount, char* const aArgV[])
 		menu(aArgV[0]);
 		return 0;
 	}
-	else if (pUser == NULL)
+	else if (pUser == NULL && pReplayFile == NULL)
 	{
 		fprintf(stderr, "\n%s: use '%s -h' for help\n\n", APP_NAME, aArgV[0]);
 		return 0;
@@ -602,5 +3144,20 @@ void menu(char* const pFName)
 {
 	fprintf(stdout, "\n%s v.%s\nby Tinram", APP_NAME, MB_VERSION);
 	fprintf(stdout, "\n\nUsage:\n");
-	fprintf(stdout, "\t%s -u <user> [-h <host>] [-p <port>]\n\n", pFName);
+	fprintf(stdout, "\t%s -u <user> [-h <host>] [-p <port>] [-d] [-m <history mins>] [-w <stats window secs>]\n\n", pFName);
+	fprintf(stdout, "\t%s -u <user> [-h <host>] [-p <port>] --export <http port> [--export-interval <ms>]\n\n", pFName);
+	fprintf(stdout, "\t%s -u <user> -H <host[:port],host[:port],...|@hostfile>\n\n", pFName);
+	fprintf(stdout, "\t%s -u <user> [-h <host>] [-p <port>] --record <file>\n\n", pFName);
+	fprintf(stdout, "\t%s --replay <file>\n\n", pFName);
+	fprintf(stdout, "\t-d\t\t\tdebug line: round-trips per tick\n");
+	fprintf(stdout, "\t-m\t\t\tminutes of metric history kept (default 10)\n");
+	fprintf(stdout, "\t-w\t\t\tsparkline and min/avg/p95/max window (secs, default 60)\n");
+	fprintf(stdout, "\t-H\t\t\tfleet view: poll all hosts concurrently, one row per host\n");
+	fprintf(stdout, "\t--export\t\theadless OpenMetrics exporter on 127.0.0.1:<http port>/metrics\n");
+	fprintf(stdout, "\t--export-interval\tminimum age of cached exporter snapshot (ms, default 1000)\n");
+	fprintf(stdout, "\t--record\t\tappend each snapshot to a binary recording file\n");
+	fprintf(stdout, "\t--replay\t\tbrowse a recording offline (no server connection)\n");
+	fprintf(stdout, "\t--lock-threshold\tlock count above which locks are counted less often (default 10000)\n");
+	fprintf(stdout, "\t--lock-interval\t\tsecs between lock counts above the threshold (default 10)\n");
+	fprintf(stdout, "\t--stress-threads\tThreads_running at which trx and lock queries back off (default 32, 0: off)\n\n");
 }
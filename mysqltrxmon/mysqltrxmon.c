@@ -5,33 +5,463 @@
 	*
 	* @author        Martin Latter
 	* @copyright     Martin Latter, 03/05/2022
-	* @version       0.35
+	* @version       0.47
 	* @license       GNU GPL version 3.0 (GPL v3); https://www.gnu.org/licenses/gpl-3.0.html
 	* @link          https://github.com/Tinram/MySQL.git
 	*
 	* Compile:
 	* (Linux GCC x64)
-	*                Required dependencies: libmysqlclient-dev, libncurses5-dev
-	*                gcc mysqltrxmon.c $(mysql_config --cflags) $(mysql_config --libs) -o mysqltrxmon -I../mysql_include/ -lncurses -Ofast -Wall -Wextra -Wuninitialized -Wunused -Werror -std=gnu99 -s
+	*                Required dependencies: libmysqlclient-dev, libncurses5-dev, zlib1g-dev
+	*                gcc mysqltrxmon.c $(mysql_config --cflags) $(mysql_config --libs) -o mysqltrxmon -I../mysql_include/ -lncurses -pthread -lz -Ofast -Wall -Wextra -Wuninitialized -Wunused -Werror -std=gnu99 -s
 	*
 	* Usage:
 	*                ./mysqltrxmon --help
-	*                ./mysqltrxmon -u <username> [-h <host>] [-f <logfile>] [-t <time (ms)>] [-p <port>]
+	*                ./mysqltrxmon -u <username> [-h <host>] [-f <logfile> [-e | -b] [-z] [--rotate-size <MB>] [--rotate-time <mins>]] [-t <time (ms)>] [-p <port>]
+	*                             [--min-age <secs>] [--match-user <user>] [--match-program <name>] [--match-state <state>] [--min-locked <rows>]
 */
 
 
 #include <mysql_utils.h>
 #include <mysql_utils.c>
 
+#include <pthread.h>
+#include <stdarg.h>
+#include <zlib.h>
+
+#include "trxlog.h"
+
 
 #define APP_NAME "MySQLTrxMon"
-#define MB_VERSION "0.35"
+#define MB_VERSION "0.47"
+
+#define TRX_TABLE_MIN 64 /* Initial tracker slots, power of 2. */
+#define TRX_NUM_LEN 21
+#define TRX_NAME_LEN 65
+#define TRX_STMT_LEN 300
+#define TRX_COLUMNS 19 /* Columns of the transaction query. */
+#define TRX_FILTERS 6 /* Bound parameters at most: the filters and the LIMIT window. */
+#define TRX_FIELD_MIN 64 /* Initial result buffers, grown on truncation. */
+#define TRX_SQL_MIN 4096
+#define TRX_ERROR_LEN 256
+#define SESSION_TABLE_MIN 256 /* Initial session cache slots, power of 2. */
+#define SESSION_ATTR_LEN 256
+#define SESSION_IDLE_SECS 60 /* Sessions without a transaction for this long are evicted. */
+#define SESSION_FILL_IDS 256 /* PROCESSLIST_IDs per metadata query. */
+#define CAPTURE_PER_TICK 2 /* Deep captures per sample at most, the rest wait for the next. */
+#define CAPTURE_LOCK_ROWS 100 /* Individual locks written per capture (all are summarised). */
+#define CAPTURE_ROWS_MAX 1000 /* Rows written per section. */
+#define FRAME_MS 50 /* UI key poll and redraw period. */
+#define LIST_TOP 9 /* First screen line of the transaction list. */
+#define SNAP_POOL 4 /* Snapshots in circulation, power of 2 (queue capacity). */
+#define SNAP_TOP 64 /* Transactions kept per snapshot for display: a window of the list around its position. */
+#define SNAP_BACK 16 /* Of those, kept above the list position (scrolling up without waiting for a sample). */
+#define SNAP_ROW_TEXT 1536 /* Text per kept row: 18 fields of up to TRX_NAME_LEN, the rest (366 bytes or more) for the statement. */
+#define SNAP_NULL SIZE_MAX
+#define LOG_BUFFERS 4 /* Bounded log memory: LOG_BUFFERS x LOG_BUF_LEN. */
+#define LOG_BUF_LEN (256 * 1024)
+#define LOG_FLUSH_SECS 1 /* Hand a part-filled buffer to the writer after this long. */
+#define LOG_SAMPLE_HEADER "#sample|seq|time|query_ms|fetch_ms|trx|interval_ms|complete\n" /* Sample records follow their rows. */
+#define BIN_DICT_SLOTS 2048 /* Dictionary hash slots, power of 2, 2 x TRXLOG_MAX_DICT. */
+#define BIN_BLOCK_MAX (sizeof(TrxLogBlock) + TRXLOG_MAX_DICT_BYTES + TL_STRINGS * (TRXLOG_MAX_STRING + 4) + 8 + TRXLOG_MAX_ROWS * (TL_NUMERIC * 8 + TL_STRINGS * 4) + 8 + TRXLOG_MAX_SAMPLES * sizeof(TrxLogSample))
+
+
+/* MYSQL_BIND flags: bool from MySQL 8.0, my_bool before it and in MariaDB. */
+#if defined(MARIADB_PACKAGE_VERSION) || defined(MARIADB_BASE_VERSION) || MYSQL_VERSION_ID < 80000
+	typedef my_bool BindFlag;
+#else
+	typedef bool BindFlag;
+#endif
+
+/* The transaction join as a prepared statement: filters bound once, rows fetched as text into buffers that only grow. */
+typedef struct
+{
+	MYSQL_STMT* pStmt;
+	MYSQL_BIND aParams[TRX_FILTERS];
+	unsigned int iParams;
+	MYSQL_BIND aResult[TRX_COLUMNS];
+	char* aBufs[TRX_COLUMNS];
+	unsigned long aLens[TRX_COLUMNS];
+	BindFlag aNull[TRX_COLUMNS];
+	BindFlag aTruncated[TRX_COLUMNS];
+	char* aRow[TRX_COLUMNS]; /* MYSQL_ROW view of the current row. */
+	unsigned int aWindow[2]; /* LIMIT offset and row count, when the server applies the window. */
+	unsigned int iWindowed;
+	MYSQL_STMT* pCount; /* Rows the windowed query would return without its LIMIT. */
+	MYSQL_BIND countResult;
+	unsigned long long iCounted;
+	char aError[TRX_ERROR_LEN]; /* Why the statement could not be prepared. */
+} TrxQuery;
+
+/* One live transaction, tracked across snapshots by trx_id. */
+typedef struct
+{
+	char aTrxId[TRX_NUM_LEN];
+	char aThread[TRX_NUM_LEN];
+	char aProcess[TRX_NUM_LEN];
+	char aStarted[TRX_NUM_LEN];
+	char aSecs[TRX_NUM_LEN];
+	char aUser[TRX_NAME_LEN];
+	char aProgram[TRX_NAME_LEN];
+	char aState[TRX_NAME_LEN];
+	char aOpState[TRX_NAME_LEN];
+	char aStmt[TRX_STMT_LEN];
+	uint64_t iEventId; /* events_statements_current.EVENT_ID: a new statement even when the text repeats. */
+	uint64_t iLocked;
+	uint64_t iModified;
+	uint64_t iPeakLocked;
+	uint64_t iPeakModified;
+	double dFirstSeen; /* Wall clock. */
+	double dLastSeen;
+	uint32_t iHash;
+	unsigned int iGeneration; /* Snapshot last seen in. */
+	unsigned int iMatched; /* Has passed the filters: only then is the lifecycle logged. */
+	unsigned int iUsed;
+} TrxEntry;
+
+/* Open addressing, linear probing, backward-shift deletion (no tombstones). */
+typedef struct
+{
+	TrxEntry* aSlots;
+	unsigned int iSize;
+	unsigned int iCount;
+	unsigned int iGeneration;
+} TrxTable;
+
+/* Session metadata: fixed for the life of a connection, so read once rather than joined every tick. */
+typedef struct
+{
+	uint64_t iProcess; /* PROCESSLIST_ID */
+	char aUser[TRX_NAME_LEN];
+	char aProgram[SESSION_ATTR_LEN];
+	unsigned int iUserNull;
+	unsigned int iProgramNull;
+	unsigned int iPending; /* Seen, metadata not fetched yet. */
+	double dLastSeen; /* Wall clock. */
+	unsigned int iUsed;
+} SessionEntry;
+
+/* Keyed by PROCESSLIST_ID, same scheme as TrxTable. */
+typedef struct
+{
+	SessionEntry* aSlots;
+	unsigned int iSize;
+	unsigned int iCount;
+	double dLastSweep;
+} SessionCache;
+
+/* Rows held back while their sessions' metadata is fetched (new connections only). */
+typedef struct
+{
+	size_t* aOffsets; /* iRows * TRX_COLUMNS offsets into pText, SNAP_NULL for SQL NULL. */
+	char* pText;
+	unsigned int iRows;
+	unsigned int iRowCap;
+	size_t iTextLen;
+	size_t iTextCap;
+	char* aRow[TRX_COLUMNS];
+} RowStore;
+
+/* A transaction over a capture threshold: queued while the sample streams, captured after it. */
+typedef struct
+{
+	char aTrxId[TRX_NUM_LEN];
+	char aThread[TRX_NUM_LEN];
+	char aProcess[TRX_NUM_LEN];
+	char aStarted[TRX_NUM_LEN];
+	char aUser[TRX_NAME_LEN];
+	char aProgram[TRX_NAME_LEN];
+	char aState[TRX_NAME_LEN];
+	uint64_t iSecs;
+	uint64_t iLocked;
+} CaptureJob;
+
+typedef struct
+{
+	TrxTable captured; /* Transactions captured once already, forgotten when they end. */
+	CaptureJob aJobs[CAPTURE_PER_TICK];
+	unsigned int iJobs;
+	unsigned int iWritten;
+	unsigned int iFailed;
+} Capture;
+
+/* One sample, copied out of the client library so it can cross threads. */
+/* List order: longest-running first is trx_started ascending, trx_id breaking ties. Unlike the duration, it holds between samples. */
+typedef struct
+{
+	uint64_t iStarted; /* trx_started, secs. */
+	uint64_t iTrxId;
+} TrxKey;
+
+/* Every streamed row's list order in the last sample, sorted (collector thread): a list position becomes a key to keep rows from. */
+typedef struct
+{
+	TrxKey* aKeys;
+	unsigned int iCount;
+	unsigned int iCap;
+} TrxOrder;
+
+typedef struct
+{
+	uint64_t iSeq;
+	double dTime; /* Wall clock. */
+	char aTime[32]; /* dTime as logged. */
+	double dInterval; /* Sampling interval in effect. */
+	double dQuery; /* Client-side time in this sample's queries. */
+	double dFetch; /* Client-side time reading their results. */
+	unsigned int iAccess; /* INNODB_TRX readable. */
+	unsigned int iTracked;
+	unsigned int iSessions;
+	unsigned int iCaptures;
+	unsigned int iCaptureFailed;
+	char aTrx[TRX_NUM_LEN];
+	char aLockWaits[TRX_NUM_LEN];
+	char aHll[TRX_NUM_LEN];
+	unsigned int iRows; /* Rows kept, at most SNAP_TOP. */
+	unsigned int iFirst; /* List position of the first row kept. */
+	unsigned int iListed; /* Rows the list reaches: all of those passing the filters. */
+	unsigned int iComplete; /* Every row streamed (no LIMIT, no error), so the totals cover all transactions. */
+	uint64_t iTotal; /* Rows streamed that pass the program filter. */
+	uint64_t iTotalLocked;
+	uint64_t iTotalModified;
+	TrxKey aKey[SNAP_TOP]; /* List order of the row in each slot. */
+	unsigned int aRank[SNAP_TOP]; /* Slots: max-heap on aKey while streaming (root: the last kept), then in list order. */
+	size_t* aOffsets; /* SNAP_TOP * TRX_COLUMNS offsets into pText, SNAP_NULL for SQL NULL. */
+	char* pText; /* SNAP_TOP * SNAP_ROW_TEXT, a fixed region per slot. */
+	MonStats monStats; /* Collector's overhead figures at the end of this sample. */
+	uint64_t iLogDropped;
+} TrxSnapshot;
+
+/* Lock-free single-producer, single-consumer ring of snapshot pointers. */
+typedef struct
+{
+	TrxSnapshot* aItems[SNAP_POOL];
+	unsigned int iHead; /* Written by the consumer only. */
+	unsigned int iTail; /* Written by the producer only. */
+} SnapQueue;
+
+/*
+	* Asynchronous log writer.
+	* The producer formats records into its active buffer and hands full buffers to the writer thread,
+	* which does all file I/O (rotation, gzip). With no free buffer left, records are dropped and counted:
+	* the sampling path never waits on the disk.
+*/
+typedef struct
+{
+	char* aBufs[LOG_BUFFERS];
+	size_t aLens[LOG_BUFFERS];
+	unsigned int aPending[LOG_BUFFERS]; /* FIFO of buffers awaiting write. */
+	unsigned int iPendHead;
+	unsigned int iPendCount;
+	unsigned int aFree[LOG_BUFFERS]; /* Stack of empty buffers. */
+	unsigned int iFreeCount;
+	int iActive; /* Producer's buffer, -1 if none. */
+	double dActiveStart;
+	uint64_t iRecords; /* Producer side. */
+	uint64_t iDropped;
+	pthread_mutex_t mLock;
+	pthread_cond_t cReady;
+	pthread_t tWriter;
+	unsigned int iStop;
+	char const* pPath; /* Writer side. */
+	void const* pHeader;
+	size_t iHeaderLen;
+	unsigned int iGzip;
+	FILE* fp;
+	gzFile gz;
+	uint64_t iFileBytes; /* Uncompressed bytes in the current file. */
+	double dFileStart;
+	uint64_t iRotateBytes; /* 0: no size rotation. */
+	double dRotateSecs; /* 0: no time rotation. */
+	unsigned int iRotations;
+	unsigned int iErrors;
+} LogWriter;
+
+/* Binary log block under construction (collector thread), see trxlog.h. */
+typedef struct
+{
+	uint64_t aNumeric[TL_NUMERIC][TRXLOG_MAX_ROWS];
+	uint32_t aStrings[TL_STRINGS][TRXLOG_MAX_ROWS];
+	uint32_t aSlots[BIN_DICT_SLOTS]; /* Dictionary index + 1, 0 for empty. */
+	uint32_t aDictHash[TRXLOG_MAX_DICT];
+	uint32_t aDictOffset[TRXLOG_MAX_DICT]; /* Offset of the length prefix in aDict. */
+	char aDict[TRXLOG_MAX_DICT_BYTES + TL_STRINGS * (TRXLOG_MAX_STRING + 4)]; /* Room for one more row once over the limit. */
+	size_t iDictLen;
+	uint32_t iDict;
+	uint32_t iRows;
+	TrxLogSample aSamples[TRXLOG_MAX_SAMPLES];
+	uint32_t iSamples;
+	double dStart;
+	char aBlock[BIN_BLOCK_MAX];
+} BinLog;
+
+/* Transaction list position (UI thread): kept on a trx_id as the order changes between samples. */
+typedef struct
+{
+	unsigned int iTop; /* List position of the first transaction drawn. */
+	unsigned int iPage; /* Transactions drawn in full last time. */
+	char aTrxId[TRX_NUM_LEN]; /* trx_id of iTop. */
+} ListView;
+
+/* Collector thread state: full snapshots flow to the UI, displayed ones flow back. */
+typedef struct
+{
+	MYSQL* pConn;
+	TrxQuery* pQuery;
+	LogWriter* pLog;
+	TrxSnapshot* pWork;
+	SnapQueue qFull;
+	SnapQueue qFree;
+	uint64_t iSeq; /* Last sample's sequence number. */
+	unsigned int iWant; /* List position the snapshots are to keep from (written by the UI thread). */
+	unsigned int iStop;
+} Collector;
+
 
 
-void displayTRXStats(MYSQL* pConn, int* pRow);
+void* collectorThread(void* pArg);
+void collectSample(MYSQL* pConn, TrxQuery* pQuery, LogWriter* pLog, TrxSnapshot* pSnap, unsigned int iWant);
+void collectRow(TrxSnapshot* pSnap, MYSQL_ROW row, LogWriter* pLog, TrxKey const* pFloor);
+unsigned int trxMatch(MYSQL_ROW row);
+unsigned int drawTransactions(TrxSnapshot const* pSnap, unsigned int iTop, int iY, int iBottom);
+void drawField(int iY, int iX, char const* pText);
+void drawText(int iY, int iX, char const* pFormat, ...) __attribute__((format(printf, 3, 4)));
+unsigned int snapshotInit(TrxSnapshot* pSnap);
+void snapshotFree(TrxSnapshot* pSnap);
+void snapshotOffer(TrxSnapshot* pSnap, MYSQL_ROW row, TrxKey const* pKey, TrxKey const* pFloor);
+void snapshotSift(TrxSnapshot* pSnap, unsigned int iSlot, TrxKey const* pKey, unsigned int iSize);
+void snapshotCopyRow(TrxSnapshot* pSnap, unsigned int iSlot, MYSQL_ROW row);
+void snapshotFinish(TrxSnapshot* pSnap);
+void snapshotRow(TrxSnapshot const* pSnap, unsigned int iRow, char const** aRow);
+unsigned int queuePush(SnapQueue* pQueue, TrxSnapshot* pSnap);
+TrxSnapshot* queuePop(SnapQueue* pQueue);
+void sleepSecs(double dSecs);
+int trxKeyCompare(void const* pA, void const* pB);
+void trxOrderAdd(TrxOrder* pOrder, TrxKey const* pKey);
+unsigned int listKeys(ListView* pView, unsigned int iListed);
+void listFollow(ListView* pView, TrxSnapshot const* pSnap);
+void listAnchor(ListView* pView, TrxSnapshot const* pSnap);
+double wallTime(void);
+void formatTime(double dTime, char* pBuf, size_t iLen);
+void copyField(char* pDest, char const* pSrc, size_t iLen);
+unsigned int trxQueryPrepare(TrxQuery* pQuery, MYSQL* pConn, unsigned int iLimit);
+void trxQueryFilter(TrxQuery* pQuery, char* pSQL, size_t iSize, char const* pClause, enum enum_field_types iType, void* pValue, unsigned long iLen);
+MYSQL_ROW trxQueryFetch(TrxQuery* pQuery);
+void trxQueryFree(TrxQuery* pQuery);
+uint32_t sessionHash(uint64_t iProcess);
+unsigned int sessionCacheInit(SessionCache* pCache, unsigned int iSize);
+void sessionCacheFree(SessionCache* pCache);
+SessionEntry* sessionLookup(SessionCache* pCache, uint64_t iProcess, unsigned int iInsert, unsigned int* pNew);
+void sessionRemove(SessionCache* pCache, unsigned int iHole);
+unsigned int sessionResolve(SessionCache* pCache, MYSQL_ROW row, double dNow);
+void sessionFill(MYSQL* pConn, SessionCache* pCache);
+void sessionFillQuery(MYSQL* pConn, SessionCache* pCache, char const* pSQL);
+void sessionSweep(SessionCache* pCache, double dNow);
+void rowStoreAdd(RowStore* pStore, MYSQL_ROW row);
+MYSQL_ROW rowStoreRow(RowStore* pStore, unsigned int iRow);
+void rowStoreFree(RowStore* pStore);
+void captureCheck(Capture* pCap, MYSQL_ROW row);
+void captureSweep(Capture* pCap);
+void captureRun(MYSQL* pConn, Capture* pCap);
+void captureWrite(MYSQL* pConn, CaptureJob const* pJob, FILE* fp);
+void captureSection(MYSQL* pConn, FILE* fp, char const* pTitle, char const* pSQL);
+unsigned int captureNumeric(char const* pValue);
+uint32_t trxHash(char const* pTrxId);
+unsigned int trxTableInit(TrxTable* pTable, unsigned int iSize);
+void trxTableFree(TrxTable* pTable);
+TrxEntry* trxLookup(TrxTable* pTable, char const* pTrxId, unsigned int* pNew);
+TrxEntry* trxFind(TrxTable* pTable, char const* pTrxId);
+void trxRemove(TrxTable* pTable, unsigned int iHole);
+void trxTrack(TrxTable* pTable, MYSQL_ROW row, LogWriter* pLog, double dNow, uint64_t iSeq, unsigned int iMatch);
+void trxSweep(TrxTable* pTable, LogWriter* pLog, double dNow, uint64_t iSeq, char const* pEvent);
+void trxEvent(LogWriter* pLog, char const* pEvent, TrxEntry const* pTrx, double dNow, uint64_t iSeq);
+unsigned int logOpen(LogWriter* pLog, char const* pPath, void const* pHeader, size_t iHeaderLen);
+void logClose(LogWriter* pLog);
+void logPrintf(LogWriter* pLog, char const* pFormat, ...) __attribute__((format(printf, 2, 3)));
+void logWrite(LogWriter* pLog, void const* pData, size_t iLen, uint64_t iRecords);
+unsigned int logTake(LogWriter* pLog);
+void logSubmit(LogWriter* pLog);
+void logTick(LogWriter* pLog, double dNow);
+void* logWriterThread(void* pArg);
+unsigned int logSinkOpen(LogWriter* pLog);
+void logSinkWrite(LogWriter* pLog, void const* pData, size_t iLen);
+void logSinkClose(LogWriter* pLog);
+void logRotate(LogWriter* pLog);
+void logSample(LogWriter* pLog, TrxSnapshot const* pSnap);
+uint64_t binNumber(char const* pValue);
+uint64_t binCivilSeconds(char const* pDateTime);
+uint32_t binIntern(BinLog* pBin, char const* pValue);
+void binAddRow(BinLog* pBin, LogWriter* pLog, MYSQL_ROW row, double dTime, uint64_t iSeq);
+void binAddSample(BinLog* pBin, LogWriter* pLog, TrxSnapshot const* pSnap);
+void binFlush(BinLog* pBin, LogWriter* pLog);
 
 
 unsigned int iTime = 250; // millisecs
+unsigned int iEvents = 0; /* Log lifecycle events instead of every row of every snapshot. */
+unsigned int iFooterOn = 0; /* Set by the UI thread, read by the collector. */
+unsigned int iGzip = 0;
+unsigned int iBinary = 0;
+unsigned int iRotateMB = 0;
+unsigned int iRotateMins = 0;
+unsigned int iPsThreadId = 0; /* PS_THREAD_ID() available (MySQL 8.0.16+). */
+unsigned int iFilterAge = 0; /* Secs, 0 for no filter. */
+unsigned long long iFilterLocked = 0;
+char* pFilterUser = NULL;
+char* pFilterProgram = NULL;
+char* pFilterState = NULL;
+char aFilterText[320]; /* Filters in effect, for the screen. */
+unsigned int iCaptureAge = 0; /* Secs, 0 for no capture on age. */
+unsigned long long iCaptureLocked = 0;
+char* pCaptureDir = ".";
+
+Cadence cadTrx;
+
+TrxTable trxTable; /* Collector thread only. */
+TrxQuery trxQuery; /* Prepared before the collector starts, then collector thread only. */
+SessionCache sessionCache; /* Collector thread only. */
+RowStore rowsPending; /* Collector thread only. */
+TrxOrder trxOrder; /* Collector thread only. */
+Capture capture; /* Collector thread only. */
+
+Collector collector;
+ListView listView; /* UI thread only. */
+LogWriter logWriter;
+BinLog binLog; /* Collector thread only. */
+
+TrxLogHeader const binHeader = {TRXLOG_MAGIC, TRXLOG_FORMAT, TL_NUMERIC, TL_STRINGS, 0};
+TrxSnapshot aSnapPool[SNAP_POOL];
+
+/* User and program (NULL placeholders here) come from the session cache: the hot query reads INNODB_TRX and the current statements only. */
+char const* const pTrxQuery = "\
+	SELECT \
+		trx.trx_id, stmt.THREAD_ID, trx.trx_mysql_thread_id, stmt.ROWS_EXAMINED, trx.trx_rows_locked, trx.trx_rows_modified, stmt.ROWS_AFFECTED, stmt.CREATED_TMP_DISK_TABLES, trx.trx_tables_locked, stmt.NO_INDEX_USED, ROUND(stmt.TIMER_WAIT/1000000000000, 6), trx.trx_started, TO_SECONDS(NOW()) - TO_SECONDS(trx.trx_started) AS duration, NULL, trx.trx_state, trx.trx_operation_state, stmt.SQL_TEXT, NULL, stmt.EVENT_ID \
+	FROM \
+		information_schema.INNODB_TRX trx \
+";
+
+/* Connection ID to statement thread: a direct index lookup where PS_THREAD_ID() exists, otherwise through threads. */
+char const* const pTrxJoin = "\
+	INNER JOIN \
+		performance_schema.events_statements_current stmt ON stmt.THREAD_ID = PS_THREAD_ID(trx.trx_mysql_thread_id) \
+";
+
+char const* const pTrxJoinThreads = "\
+	INNER JOIN \
+		performance_schema.threads thd ON thd.PROCESSLIST_ID = trx.trx_mysql_thread_id \
+	INNER JOIN \
+		performance_schema.events_statements_current stmt ON stmt.THREAD_ID = thd.THREAD_ID \
+";
+
+/* LEFT JOIN for Aurora 2.10 */
+char const* const pSessionQuery = "\
+	SELECT \
+		thd.PROCESSLIST_ID, thd.PROCESSLIST_USER, sca.ATTR_VALUE \
+	FROM \
+		performance_schema.threads thd \
+	LEFT JOIN \
+		performance_schema.session_connect_attrs sca ON sca.PROCESSLIST_ID = thd.PROCESSLIST_ID AND sca.ATTR_NAME = 'program_name' \
+	WHERE \
+		thd.PROCESSLIST_ID IN \
+";
 
 
 int main(int iArgCount, char* const aArgV[])
@@ -45,23 +475,23 @@ int main(int iArgCount, char* const aArgV[])
 	}
 
 	MYSQL* pConn;
-	FILE* fp = NULL;
+	LogWriter* pLog = NULL;
 	char* const pMaria = "MariaDB";
 	char aHostname[50];
 	char aVersion[7];
 	char aAuroraVersion[9];
 	char aAuroraServerId[50];
 	int iRow = 0;
-	int iCh;
-	int iPadPos = 0;
+	unsigned int i;
+	unsigned int iPool = 1;
+	pthread_t tCollector;
+	TrxSnapshot* pCur = NULL;
+	MonStats monView;
 	unsigned int iMenu = options(iArgCount, aArgV);
 	unsigned int iPS = 0;
-	unsigned int iAccess = 0;
 	unsigned int iV8 = 0;
 	unsigned int iMaria = 0;
 	unsigned int iAurora = 0;
-	unsigned int iPadWidth = 157; // 164 for 13" MacBook
-	unsigned int iPadHeight = 35; // 30-50; fullscreen terminal differs to windowed
 
 	if (signal(SIGINT, signalHandler) == SIG_ERR)
 	{
@@ -105,11 +535,11 @@ int main(int iArgCount, char* const aArgV[])
 		return EXIT_FAILURE;
 	}
 
-	/* Create ncurses pad for screen scrolling. */
-	WINDOW* pPad = newpad(iPadHeight, iPadWidth);
-	keypad(pPad, TRUE);
-	nodelay(pPad, TRUE);
-	scrollok(pPad, TRUE);
+	/* Drawn straight to the screen, sized by the terminal: ncurses handles SIGWINCH and reports KEY_RESIZE. */
+	noecho();
+	cbreak();
+	keypad(stdscr, TRUE);
+	nodelay(stdscr, TRUE);
 
 	/* Assign hostname. */
 	assignHostname(pConn, aHostname, sizeof(aHostname) - 1);
@@ -123,27 +553,30 @@ int main(int iArgCount, char* const aArgV[])
 	/* Check performance schema availability. */
 	checkPerfSchema(pConn, &iPS);
 
-	/* Create logfile header row. */
+	/* Start the log writer: header row in each file. */
 	if (pLogfile != NULL)
 	{
-		fp = fopen(pLogfile, "a");
+		pLog = &logWriter;
+		pLog->iGzip = iGzip;
+		pLog->iRotateBytes = (uint64_t) iRotateMB * 1024 * 1024;
+		pLog->dRotateSecs = (double) iRotateMins * 60;
 
-		if (fp == NULL)
+		if (iEvents && ! trxTableInit(&trxTable, TRX_TABLE_MIN))
 		{
-			fprintf(stderr, "\nExited: cannot write to logfile.\n\n");
+			fprintf(stderr, "\nExited: cannot allocate transaction tracker.\n\n");
 			mysql_close(pConn);
 			return EXIT_FAILURE;
 		}
-		else
-		{
-			fprintf
-			(
-				fp,
-				"%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s\n",
-				"trx", "thd", "ps", "exm", "lock", "mod", "afft", "tmpd", "tlock", "noidx", "wait", "start", "secs", "user", "program", "trxstate", "trxopstate", "query"
-			);
 
-			fflush(fp); /* Output header row immediately. */
+		char const* pHeader = (iEvents ?
+			"event|time|sample|trx|thd|ps|user|program|start|firstseen|lastseen|observed|secs|lock|mod|peaklock|peakmod|trxstate|trxopstate|query\n" LOG_SAMPLE_HEADER :
+			"trx|sample|time|thd|ps|exm|lock|mod|afft|tmpd|tlock|noidx|wait|start|secs|user|program|trxstate|trxopstate|query\n" LOG_SAMPLE_HEADER);
+
+		if ( ! (iBinary ? logOpen(pLog, pLogfile, &binHeader, sizeof(binHeader)) : logOpen(pLog, pLogfile, pHeader, strlen(pHeader))))
+		{
+			fprintf(stderr, "\nExited: cannot write to logfile.\n\n");
+			mysql_close(pConn);
+			return EXIT_FAILURE;
 		}
 	}
 
@@ -157,21 +590,103 @@ int main(int iArgCount, char* const aArgV[])
 	init_pair(5, COLOR_BLUE, COLOR_BLACK);
 	curs_set(0);
 
+	/* Snapshot pool: one held by the collector, the rest cycle through the queues. */
+	for (i = 0; i < SNAP_POOL; i++)
+	{
+		if ( ! snapshotInit(&aSnapPool[i]))
+		{
+			iPool = 0;
+		}
+		else if (i > 0)
+		{
+			queuePush(&collector.qFree, &aSnapPool[i]);
+		}
+	}
+
+	collector.pConn = pConn;
+	collector.pQuery = &trxQuery;
+	collector.pLog = pLog;
+	collector.pWork = &aSnapPool[0];
+
+	/* MySQL 8.0.16+: statements found by connection ID without reading threads. */
+	MYSQL_RES* result_probe = monQuery(pConn, "SELECT PS_THREAD_ID(CONNECTION_ID())");
+	iPsThreadId = (result_probe != NULL && mysql_errno(pConn) == 0);
+	mysql_free_result(result_probe);
+
+	/* Not logging or capturing: the server sorts and returns only the window displayed. A failure is shown on screen. */
+	trxQueryPrepare(&trxQuery, pConn, ((pLog != NULL || iCaptureAge > 0 || iCaptureLocked > 0) ? 0 : SNAP_TOP));
+
+	cadenceInit(&cadTrx, (double) iTime / 1000);
+
+	/* Sub-100ms sampling was asked for explicitly: a tenth of 10ms is less than the join takes on most servers. */
+	if (iTime < 100)
+	{
+		cadTrx.dShare = CADENCE_FAST_SHARE;
+	}
+
+	if ( ! iPool || ! sessionCacheInit(&sessionCache, SESSION_TABLE_MIN) || ! trxTableInit(&capture.captured, TRX_TABLE_MIN) || pthread_create(&tCollector, NULL, collectorThread, &collector) != 0)
+	{
+		endwin();
+		fprintf(stderr, "\nExited: cannot start collector.\n\n");
+		mysql_close(pConn);
+		return EXIT_FAILURE;
+	}
+
+	/* UI thread: render the latest snapshot at frame rate; the collector samples at its own rate. */
 	while ( ! iSigCaught)
 	{
-		clear();
-		wclear(pPad);
+		TrxSnapshot* pNew = NULL;
+		TrxSnapshot* pNext;
+		unsigned int iKey = listKeys(&listView, (pCur != NULL ? pCur->iListed : 0));
+
+		if (iKey && pCur != NULL)
+		{
+			listAnchor(&listView, pCur);
+		}
+
+		while ((pNext = queuePop(&collector.qFull)) != NULL)
+		{
+			if (pNew != NULL)
+			{
+				queuePush(&collector.qFree, pNew); /* Superseded before display (but logged). */
+			}
+
+			pNew = pNext;
+		}
+
+		if (pNew != NULL)
+		{
+			if (pCur != NULL)
+			{
+				queuePush(&collector.qFree, pCur);
+			}
+
+			pCur = pNew;
+			listFollow(&listView, pCur);
+		}
+
+		/* The next sample keeps its rows from a little above the list position. */
+		__atomic_store_n(&collector.iWant, (listView.iTop > SNAP_BACK ? listView.iTop - SNAP_BACK : 0), __ATOMIC_RELAXED);
+
+		if (pCur == NULL || (pNew == NULL && ! iKey))
+		{
+			msSleep(FRAME_MS);
+			continue;
+		}
+
+		/* Not clear(): refresh() then sends only the cells that changed. */
+		erase();
 
 		iRow = 1;
 
 		attron(A_BOLD);
 		if (iAurora == 0)
 		{
-			mvprintw(iRow, 1, "%s", aHostname);
+			drawText(iRow, 1, "%s", aHostname);
 		}
 		else
 		{
-			mvprintw(iRow, 1, "%s", aAuroraServerId);
+			drawText(iRow, 1, "%s", aAuroraServerId);
 		}
 		attroff(A_BOLD);
 
@@ -179,197 +694,175 @@ int main(int iArgCount, char* const aArgV[])
 		{
 			if (iAurora == 0)
 			{
-				mvprintw(iRow += 1, 1, "%s", aVersion);
+				drawText(iRow += 1, 1, "%s", aVersion);
 			}
 			else
 			{
-				mvprintw(iRow += 1, 1, "%s (au: %s)", aVersion, aAuroraVersion);
+				drawText(iRow += 1, 1, "%s (au: %s)", aVersion, aAuroraVersion);
 			}
 		}
 		else
 		{
-			mvprintw(iRow += 1, 1, "%s %s", pMaria, aVersion);
+			drawText(iRow += 1, 1, "%s %s", pMaria, aVersion);
+		}
+
+		drawText(1, 60, "interval: %.0fms%s", pCur->dInterval * 1000, (pCur->dInterval > cadTrx.dBase ? " (backed off)" : ""));
+		drawText(2, 60, "samples: %" PRIu64, pCur->iSeq);
+
+		drawText(1, 100, "sessions cached: %u", pCur->iSessions);
+
+		if (iEvents)
+		{
+			drawText(2, 80, "tracked: %u", pCur->iTracked);
 		}
 
-		/* TRX at InnoDB layer. */
-		mysql_query(pConn, "SELECT COUNT(*) FROM information_schema.INNODB_TRX"); /* Includes RUNNING, LOCK WAIT, ROLLING BACK, COMMITTING. */
-		MYSQL_RES* result_acttr = mysql_store_result(pConn);
+		if (iCaptureAge > 0 || iCaptureLocked > 0)
+		{
+			drawText(4, 100, "captures: %u", pCur->iCaptures);
+
+			if (pCur->iCaptureFailed > 0)
+			{
+				attrset(A_BOLD | COLOR_PAIR(4));
+				drawText(5, 100, "capture failed: %u", pCur->iCaptureFailed);
+				attrset(A_NORMAL);
+			}
+		}
 
-		if (mysql_errno(pConn) == 0)
+		if (pCur->iLogDropped > 0)
 		{
-			iAccess = 1;
-			MYSQL_ROW row_acttr = mysql_fetch_row(result_acttr);
 			attrset(A_BOLD | COLOR_PAIR(4));
-			mvprintw(iRow += 2, 1, "trx: %s", row_acttr[0]);
-			displayTRXStats(pConn, &iRow);
+			drawText(2, 100, "log dropped: %" PRIu64, pCur->iLogDropped);
+			attrset(A_NORMAL);
 		}
 
-		mysql_free_result(result_acttr);
+		if (pCur->iAccess)
+		{
+			attrset(A_BOLD | COLOR_PAIR(4));
+			drawText(iRow += 2, 1, "trx: %s", pCur->aTrx);
+			drawText(iRow += 1, 1, "lwa: %s", pCur->aLockWaits);
+			drawText(iRow += 1, 1, "hll: %s", pCur->aHll);
+			attrset(A_NORMAL);
+
+			/* Transactions passing the filters; rows locked and modified only when every one was streamed (no LIMIT). */
+			drawText(4, 60, "listed: %u of %s", pCur->iListed, pCur->aTrx);
+
+			if (pCur->iComplete)
+			{
+				drawText(5, 60, "rows locked: %" PRIu64 "  modified: %" PRIu64, pCur->iTotalLocked, pCur->iTotalModified);
+			}
+
+			if (aFilterText[0] != '\0')
+			{
+				drawText(6, 60, "filter:%s", aFilterText);
+			}
+		}
 
 		if (iPS == 0)
 		{
 			attrset(A_BOLD | COLOR_PAIR(4));
-			mvprintw(iRow += 2, 1, "performance schema disabled");
+			drawText(iRow += 2, 1, "performance schema disabled");
 			attrset(A_NORMAL);
 		}
-		else if (iAccess == 0)
+		else if (pCur->iAccess == 0)
 		{
 			attrset(A_BOLD | COLOR_PAIR(4));
-			mvprintw(iRow += 2, 1, "no user privilege access");
+			drawText(iRow += 2, 1, "no user privilege access");
+			attrset(A_NORMAL);
+		}
+		else if (trxQuery.pStmt == NULL)
+		{
+			attrset(A_BOLD | COLOR_PAIR(4));
+			drawText(iRow += 2, 1, "transaction query: %s", trxQuery.aError);
 			attrset(A_NORMAL);
 		}
 		else
 		{
-			iRow = 8;
-
-			mvprintw(iRow, 1, "thd");
-			mvprintw(iRow, 10, "ps");
-			mvprintw(iRow, 20, "exm");
-			mvprintw(iRow, 33, "lock");
-			mvprintw(iRow, 46, "mod");
-			mvprintw(iRow, 57, "afft");
-			mvprintw(iRow, 68, "tmpd");
-			mvprintw(iRow, 77, "tlk");
-			mvprintw(iRow, 85, "idx");
-			mvprintw(iRow, 93, "wait");
-			mvprintw(iRow, 107, "start");
-			mvprintw(iRow, 130, "sec");
-			mvprintw(iRow, 140, "user");
-
-			mysql_query(pConn, "\
-				SELECT \
-					trx.trx_id, thd.THREAD_ID, thd.PROCESSLIST_ID, stmt.ROWS_EXAMINED, trx.trx_rows_locked, trx.trx_rows_modified, stmt.ROWS_AFFECTED, stmt.CREATED_TMP_DISK_TABLES, trx.trx_tables_locked, stmt.NO_INDEX_USED, ROUND(stmt.TIMER_WAIT/1000000000000, 6), trx.trx_started, TO_SECONDS(NOW()) - TO_SECONDS(trx.trx_started) AS duration, thd.PROCESSLIST_USER, trx.trx_state, trx.trx_operation_state, stmt.SQL_TEXT, sca.ATTR_VALUE \
-				FROM \
-					information_schema.INNODB_TRX trx \
-				INNER JOIN \
-					performance_schema.threads thd ON thd.PROCESSLIST_ID = trx.trx_mysql_thread_id \
-				INNER JOIN \
-					performance_schema.events_statements_current stmt USING (THREAD_ID) \
-				LEFT JOIN \
-					performance_schema.session_connect_attrs sca ON sca.PROCESSLIST_ID = trx.trx_mysql_thread_id AND sca.ATTR_NAME = 'program_name' \
-				ORDER BY \
-					duration DESC \
-			");
-				/* LEFT JOIN for Aurora 2.10 */
-
-			MYSQL_RES* result_trx = mysql_store_result(pConn);
-			MYSQL_ROW row_trx;
-
-			iRow = 0;
-
-			while ((row_trx = mysql_fetch_row(result_trx)))
-			{
-				if (row_trx != NULL)
-				{
-					char idx = (strcmp("1", row_trx[9]) == 1) ? 'N' : 'Y'; // NO_INDEX_USED -> reversal
-					iRow++;
-
-					wattrset(pPad, A_BOLD | COLOR_PAIR(1));
-					mvwprintw(pPad, iRow, 1, "%s", row_trx[1]);
-					mvwprintw(pPad, iRow, 10, "%s", row_trx[2]);
-					mvwprintw(pPad, iRow, 20, "%s", row_trx[3]);
-					mvwprintw(pPad, iRow, 33, "%s", row_trx[4]);
-					mvwprintw(pPad, iRow, 46, "%s", row_trx[5]);
-					mvwprintw(pPad, iRow, 57, "%s", row_trx[6]);
-					mvwprintw(pPad, iRow, 68, "%s", row_trx[7]);
-					mvwprintw(pPad, iRow, 77, "%s", row_trx[8]);
-					mvwprintw(pPad, iRow, 85, "%c", idx);
-					mvwprintw(pPad, iRow, 93, "%s", row_trx[10]);
-					mvwprintw(pPad, iRow, 107, "%s", row_trx[11]);
-					mvwprintw(pPad, iRow, 130, "%s", row_trx[12]);
-					mvwprintw(pPad, iRow, 140, "%s", row_trx[13]);
-					wattrset(pPad, A_NORMAL);
-
-					iRow++;
-
-					if (row_trx[17] != NULL)
-					{
-						wattron(pPad, COLOR_PAIR(1));
-						mvwprintw(pPad, iRow += 1, 1, "%s", row_trx[17]);
-						wattroff(pPad, COLOR_PAIR(1));
-					}
-
-					wattron(pPad, COLOR_PAIR(5));
-					mvwprintw(pPad, iRow += 1, 1, "%s", row_trx[14]);
-					wattroff(pPad, COLOR_PAIR(5));
-
-					if (row_trx[15] != NULL)
-					{
-						wattrset(pPad, A_BOLD | COLOR_PAIR(3));
-						mvwprintw(pPad, iRow += 1, 1, "%s", row_trx[15]);
-						wattrset(pPad, A_NORMAL);
-					}
-
-					if (row_trx[16] != NULL)
-					{
-						/* Truncate SQL at ~2 lines. */
-						char aQuery[300];
-						unsigned int iQLen = sizeof(aQuery) - 1;
-						strncpy(aQuery, row_trx[16], iQLen);
-						aQuery[iQLen] = '\0';
-
-						/* Replace TABs and LFs. */
-						replaceChar(aQuery, '\t', ' ');
-						replaceChar(aQuery, '\n', ' ');
-
-						wattron(pPad, COLOR_PAIR(2));
-						mvwprintw(pPad, iRow += 1, 1, "%s", aQuery);
-						wattroff(pPad, COLOR_PAIR(2));
-					}
-
-					if (pLogfile != NULL)
-					{
-						fprintf
-						(
-							fp,
-							"%s|%s|%s|%s|%s|%s|%s|%s|%s|%c|%s|%s|%s|%s|%s|%s|%s|%s;\n",
-							row_trx[0], row_trx[1], row_trx[2], row_trx[3], row_trx[4], row_trx[5], row_trx[6], row_trx[7], row_trx[8],
-							idx,
-							row_trx[10], row_trx[11], row_trx[12], row_trx[13], row_trx[17], row_trx[14], row_trx[15], row_trx[16]
-						);
-
-						//fflush(fp); /* Prefer default OS buffering over immediate flushing of fflush() */
-					}
-				}
-
-				iRow += 2;
-			}
+			iRow = LIST_TOP - 1;
 
-			mysql_free_result(result_trx);
+			drawField(iRow, 1, "thd");
+			drawField(iRow, 10, "ps");
+			drawField(iRow, 20, "exm");
+			drawField(iRow, 33, "lock");
+			drawField(iRow, 46, "mod");
+			drawField(iRow, 57, "afft");
+			drawField(iRow, 68, "tmpd");
+			drawField(iRow, 77, "tlk");
+			drawField(iRow, 85, "idx");
+			drawField(iRow, 93, "wait");
+			drawField(iRow, 107, "start");
+			drawField(iRow, 130, "sec");
+			drawField(iRow, 140, "user");
 
-			/* ncurses pad scrolling. */
-			iCh = wgetch(pPad);
+			/* Only the transactions that fit are formatted, however many the snapshot holds. */
+			listView.iPage = drawTransactions(pCur, listView.iTop, LIST_TOP, LINES);
 
-			switch (iCh)
+			if (pCur->iListed > 0)
 			{
-				case KEY_UP:
-					iPadPos--;
-				break;
-
-				case KEY_DOWN:
-					iPadPos++;
-				break;
+				unsigned int iLast = listView.iTop + (listView.iPage > 0 ? listView.iPage : 1);
+				drawText(7, 60, "rows %u-%u of %u", listView.iTop + 1, (iLast < pCur->iListed ? iLast : pCur->iListed), pCur->iListed);
 			}
 		}
 
+		/* Overhead line in the blank row above the counts. */
+		monView = pCur->monStats;
+		monView.iFooter = iFooterOn;
+		monFooter(&monView, 3);
+
 		refresh();
 
-		prefresh(pPad, iPadPos, 1, 9, 1, iPadHeight, iPadWidth); /* (p, scrollY, scrollX, posY, posX, sizeY, sizeX) */
+		msSleep(FRAME_MS);
+	}
+
+	__atomic_store_n(&collector.iStop, 1, __ATOMIC_RELEASE);
+	pthread_join(tCollector, NULL);
+
+	monSample(pConn, 1);
 
-		msSleep(iTime);
+	if (pLog != NULL)
+	{
+		if (iEvents)
+		{
+			/* Still running at exit: record what was seen of them. */
+			trxTable.iGeneration++;
+			trxSweep(&trxTable, pLog, wallTime(), collector.iSeq, "open");
+			trxTableFree(&trxTable);
+		}
+
+		if (iBinary)
+		{
+			binFlush(&binLog, pLog);
+		}
+
+		logClose(pLog);
 	}
 
-	if (pLogfile != NULL)
+	for (i = 0; i < SNAP_POOL; i++)
 	{
-		fclose(fp);
+		snapshotFree(&aSnapPool[i]);
 	}
 
-	curs_set(1);
+	trxQueryFree(&trxQuery);
+	sessionCacheFree(&sessionCache);
+	rowStoreFree(&rowsPending);
+	free(trxOrder.aKeys);
+	trxTableFree(&capture.captured);
 
-	delwin(pPad);
+	curs_set(1);
 
 	endwin();
 
+	monSummary(APP_NAME);
+
+	if (pLog != NULL)
+	{
+		fprintf(stdout, "log: %" PRIu64 " records, %" PRIu64 " dropped, %u rotations, %u write errors\n\n", pLog->iRecords, pLog->iDropped, pLog->iRotations, pLog->iErrors);
+	}
+
+	if (iCaptureAge > 0 || iCaptureLocked > 0)
+	{
+		fprintf(stdout, "captures: %u written to %s, %u failed\n\n", capture.iWritten, pCaptureDir, capture.iFailed);
+	}
+
 	mysql_close(pConn);
 
 	return EXIT_SUCCESS;
@@ -377,137 +870,3248 @@ int main(int iArgCount, char* const aArgV[])
 
 
 /**
-	* Display TRX Lock Wait and HLL stats.
+	* Collector thread: sample on its own timer, log every sample, hand snapshots to the UI.
 	*
-	* @param   MYSQL* pConn, connection pointer
-	* @param   int* pRow, pointer to iRow
-	* @return  void
+	* @param   void* pArg, Collector*
+	* @return  void*, NULL
 */
 
-void displayTRXStats(MYSQL* pConn, int* pRow)
+void* collectorThread(void* pArg)
 {
-	/* TRX Lock Waits */
-	mysql_query(pConn, "SELECT COUNT(*) FROM information_schema.INNODB_TRX WHERE trx_state = 'LOCK WAIT'");
-	MYSQL_RES* result_trlk = mysql_store_result(pConn);
-	MYSQL_ROW row_trlk = mysql_fetch_row(result_trlk);
-	mvprintw(*pRow += 1, 1, "lwa: %s", row_trlk[0]);
-	mysql_free_result(result_trlk);
-
-	/* History List Length */
-	mysql_query(pConn, "SELECT COUNT FROM information_schema.INNODB_METRICS WHERE NAME = 'trx_rseg_history_len'");
-	MYSQL_RES* result_hll = mysql_store_result(pConn);
-	MYSQL_ROW row_hll = mysql_fetch_row(result_hll);
-	mvprintw(*pRow += 1, 1, "hll: %s", row_hll[0]);
-	attrset(A_NORMAL);
-	mysql_free_result(result_hll);
-}
-
+	Collector* pCol = (Collector*) pArg;
+	sigset_t sigSet;
 
-/**
-	* Process command-line switches using getopt()
-	*
-	* @param   integer iArgCount, number of arguments
-	* @param   char* aArgV, pointer to aArgV
-	* @return  unsigned integer
-*/
+	/* SIGINT is for the UI thread: keep it from interrupting client library calls here. */
+	sigemptyset(&sigSet);
+	sigaddset(&sigSet, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
 
-unsigned int options(int iArgCount, char* const aArgV[])
-{
-	int iOpts = 0;
-	int iOptsIdx = 0;
-	unsigned int iHelp = 0;
+	mysql_thread_init();
 
-	struct option aLongOpts[] =
+	while ( ! __atomic_load_n(&pCol->iStop, __ATOMIC_ACQUIRE))
 	{
-		{"help", no_argument, 0, 'i'},
-		{0, 0, 0, 0}
-	};
+		double dNow = monotonicTime();
 
-	while ((iOpts = getopt_long(iArgCount, aArgV, "ih:w:u:f:t:p:", aLongOpts, &iOptsIdx)) != -1)
-	{
-		switch (iOpts)
+		if ( ! cadenceDue(&cadTrx, dNow))
 		{
-			case 'i':
-				iHelp = 1;
-				break;
+			double dWait = cadTrx.dNext - dNow;
+			sleepSecs(dWait < (double) FRAME_MS / 1000 ? dWait : (double) FRAME_MS / 1000); /* Stay responsive to stop. */
+			continue;
+		}
 
-			case 'h':
-				pHost = optarg;
-				break;
+		monStats.iFooter = __atomic_load_n(&iFooterOn, __ATOMIC_RELAXED);
 
-			case 'u':
-				pUser = optarg;
-				break;
+		monTickStart();
 
-			case 'f':
-				pLogfile = optarg;
-				break;
+		monSample(pCol->pConn, 0);
 
-			case 't':
-				iTime = (unsigned int) atoi(optarg);
-				if (iTime < 100) {iTime = 100;} /* Breakdown in behaviour below 100ms. */
-				if (iTime > 2000) {iTime = 2000;}
-				break;
+		/* The sample's own latency: not the periodic server stats above, nor a capture below. */
+		double dQuery = monStats.dTickQuery;
+		double dFetch = monStats.dTickFetch;
 
-			case 'p':
-				iPort = (unsigned int) atoi(optarg);
-				break;
+		pCol->pWork->iSeq = ++pCol->iSeq;
 
-			case '?':
+		collectSample(pCol->pConn, pCol->pQuery, pCol->pLog, pCol->pWork, __atomic_load_n(&pCol->iWant, __ATOMIC_RELAXED));
 
-				if (optopt == 'h' || optopt == 'w' || optopt == 'u' || optopt == 'f' || optopt == 't' || optopt == 'p')
-				{
-					fprintf(stderr, "\nMissing switch arguments.\n\n");
-				}
-				else if (optopt == 0)
-				{
-					break;
-				}
-				else
-				{
-					fprintf(stderr, "\nUnknown option `-%c'.\n\n", optopt);
-				}
+		pCol->pWork->dQuery = monStats.dTickQuery - dQuery;
+		pCol->pWork->dFetch = monStats.dTickFetch - dFetch;
 
-				return 0;
-				break;
+		if (pCol->pLog != NULL)
+		{
+			logSample(pCol->pLog, pCol->pWork);
+		}
 
-			default:
-				return 0;
+		if (capture.iJobs > 0)
+		{
+			captureRun(pCol->pConn, &capture);
 		}
-	}
 
-	if (iHelp == 1)
-	{
-		menu(aArgV[0]);
-		return 0;
-	}
-	else if (pUser == NULL)
-	{
-		fprintf(stderr, "\n%s: use '%s -h' for help\n\n", APP_NAME, aArgV[0]);
-		return 0;
-	}
-	else
-	{
-		if (pHost == NULL)
+		monTickEnd();
+
+		/* Queries slow relative to the sampling period: stretch the interval. */
+		cadenceUpdate(&cadTrx, monotonicTime(), pCol->pWork->dQuery + pCol->pWork->dFetch, 0);
+
+		pCol->pWork->dInterval = cadTrx.dInterval;
+		pCol->pWork->iCaptures = capture.iWritten;
+		pCol->pWork->iCaptureFailed = capture.iFailed;
+		pCol->pWork->monStats = monStats;
+
+		if (pCol->pLog != NULL)
 		{
-			pHost = "localhost";
+			/* Part-filled binary block: complete it on the same schedule as part-filled log buffers. */
+			if (iBinary && (binLog.iRows > 0 || binLog.iSamples > 0) && monotonicTime() - binLog.dStart >= LOG_FLUSH_SECS)
+			{
+				binFlush(&binLog, pCol->pLog);
+			}
+
+			logTick(pCol->pLog, monotonicTime());
+			pCol->pWork->iLogDropped = pCol->pLog->iDropped;
 		}
 
-		return 1;
+		/* No spare snapshot: the UI is behind, keep collecting into the same one. */
+		TrxSnapshot* pSpare = queuePop(&pCol->qFree);
+
+		if (pSpare != NULL)
+		{
+			queuePush(&pCol->qFull, pCol->pWork);
+			pCol->pWork = pSpare;
+		}
 	}
+
+	mysql_thread_end();
+
+	return NULL;
 }
 
 
 /**
-	* Display program menu.
+	* Run the sample queries into a snapshot, logging the transaction rows.
 	*
-	* @param   char* pFName, filename from aArgV[0]
+	* @param   MYSQL* pConn, connection pointer
+	* @param   TrxQuery* pQuery, prepared transaction query
+	* @param   LogWriter* pLog, log writer (NULL if not logging)
+	* @param   TrxSnapshot* pSnap, snapshot to fill
+	* @param   unsigned int iWant, list position to keep rows from
 	* @return  void
 */
 
-void menu(char* const pFName)
+void collectSample(MYSQL* pConn, TrxQuery* pQuery, LogWriter* pLog, TrxSnapshot* pSnap, unsigned int iWant)
 {
-	fprintf(stdout, "\n%s v.%s\nby Tinram", APP_NAME, MB_VERSION);
-	fprintf(stdout, "\n\nUsage:\n");
-	fprintf(stdout, "\t%s -u <user> [-h <host>] [-f <logfile>] [-t <time (ms)>] [-p <port>]\n\n", pFName);
+	MYSQL_ROW row;
+	TrxKey floorKey;
+	TrxKey const* pFloor = NULL;
+	unsigned int i;
+
+	pSnap->dTime = wallTime();
+	formatTime(pSnap->dTime, pSnap->aTime, sizeof(pSnap->aTime));
+	pSnap->iRows = 0;
+	pSnap->iFirst = 0;
+	pSnap->iListed = 0;
+	pSnap->iComplete = 0;
+	pSnap->iTotal = 0;
+	pSnap->iTotalLocked = 0;
+	pSnap->iTotalModified = 0;
+	pSnap->iAccess = 0;
+
+	/* TRX at InnoDB layer. */
+	MYSQL_RES* result_acttr = monQuery(pConn, "SELECT COUNT(*) FROM information_schema.INNODB_TRX"); /* Includes RUNNING, LOCK WAIT, ROLLING BACK, COMMITTING. */
+
+	if (mysql_errno(pConn) != 0 || (row = mysql_fetch_row(result_acttr)) == NULL)
+	{
+		mysql_free_result(result_acttr);
+		return;
+	}
+
+	pSnap->iAccess = 1;
+	copyField(pSnap->aTrx, row[0], TRX_NUM_LEN);
+	mysql_free_result(result_acttr);
+
+	/* TRX Lock Waits */
+	MYSQL_RES* result_trlk = monQuery(pConn, "SELECT COUNT(*) FROM information_schema.INNODB_TRX WHERE trx_state = 'LOCK WAIT'");
+	row = mysql_fetch_row(result_trlk);
+	copyField(pSnap->aLockWaits, (row != NULL ? row[0] : NULL), TRX_NUM_LEN);
+	mysql_free_result(result_trlk);
+
+	/* History List Length */
+	MYSQL_RES* result_hll = monQuery(pConn, "SELECT COUNT FROM information_schema.INNODB_METRICS WHERE NAME = 'trx_rseg_history_len'");
+	row = mysql_fetch_row(result_hll);
+	copyField(pSnap->aHll, (row != NULL ? row[0] : NULL), TRX_NUM_LEN);
+	mysql_free_result(result_hll);
+
+	/* Streamed: SNAP_TOP rows are kept from the list position, however many transactions there are. Logging needs every row. */
+	if (pQuery->pStmt == NULL)
+	{
+		return;
+	}
+
+	/* The server skips to the position; otherwise the last sample's order gives the key there, and rows before it are only counted. */
+	if (pQuery->iWindowed)
+	{
+		pQuery->aWindow[0] = iWant;
+		pSnap->iFirst = iWant;
+	}
+	else if (iWant > 0 && trxOrder.iCount > 0)
+	{
+		floorKey = trxOrder.aKeys[(iWant < trxOrder.iCount) ? iWant : trxOrder.iCount - 1];
+		pFloor = &floorKey;
+	}
+
+	trxOrder.iCount = 0;
+
+	if (monStmtExecute(pQuery->pStmt) != 0)
+	{
+		return;
+	}
+
+	/* Rows of sessions not yet in the cache wait until the result is read: the connection is busy until then. */
+	while ((row = trxQueryFetch(pQuery)) != NULL)
+	{
+		if (sessionResolve(&sessionCache, row, pSnap->dTime))
+		{
+			collectRow(pSnap, row, pLog, pFloor);
+		}
+		else
+		{
+			rowStoreAdd(&rowsPending, row);
+		}
+	}
+
+	/* A streamed result reports a lost connection or server error only at the end. */
+	unsigned int iError = mysql_stmt_errno(pQuery->pStmt);
+
+	mysql_stmt_free_result(pQuery->pStmt);
+
+	if (rowsPending.iRows > 0)
+	{
+		sessionFill(pConn, &sessionCache);
+
+		for (i = 0; i < rowsPending.iRows; i++)
+		{
+			row = rowStoreRow(&rowsPending, i);
+			sessionResolve(&sessionCache, row, pSnap->dTime);
+			collectRow(pSnap, row, pLog, pFloor);
+		}
+
+		rowsPending.iRows = 0;
+		rowsPending.iTextLen = 0;
+	}
+
+	sessionSweep(&sessionCache, pSnap->dTime);
+	pSnap->iSessions = sessionCache.iCount;
+
+	snapshotFinish(pSnap);
+
+	/* The windowed query returns SNAP_TOP rows at most: the list length is counted separately. */
+	if (pQuery->iWindowed)
+	{
+		pSnap->iListed = pSnap->iFirst + pSnap->iRows;
+
+		if (iError == 0 && monStmtExecute(pQuery->pCount) == 0)
+		{
+			if (monStmtFetch(pQuery->pCount) == 0)
+			{
+				pSnap->iListed = (unsigned int) pQuery->iCounted;
+			}
+
+			mysql_stmt_free_result(pQuery->pCount);
+		}
+	}
+	else
+	{
+		pSnap->iListed = (unsigned int) pSnap->iTotal;
+		qsort(trxOrder.aKeys, trxOrder.iCount, sizeof(TrxKey), trxKeyCompare);
+	}
+
+	pSnap->iComplete = ((pLog != NULL || iCaptureAge > 0 || iCaptureLocked > 0 || pFilterProgram != NULL) && iError == 0);
+
+	if ((iCaptureAge > 0 || iCaptureLocked > 0) && iError == 0)
+	{
+		captureSweep(&capture);
+	}
+
+	/* Transactions missing from a complete snapshot have ended (not on a failed query). */
+	if (iEvents && iError == 0)
+	{
+		trxSweep(&trxTable, pLog, pSnap->dTime, pSnap->iSeq, "end");
+		pSnap->iTracked = trxTable.iCount;
+	}
+}
+
+
+/**
+	* Take one transaction row: totals, display selection, and the log in the chosen format.
+	* Rows not matching the client-side filters are skipped here (see trxQueryPrepare), once tracked for -e.
+	*
+	* @param   TrxSnapshot* pSnap, snapshot
+	* @param   MYSQL_ROW row, row with session metadata filled in
+	* @param   LogWriter* pLog, log writer (NULL if not logging)
+	* @param   TrxKey* pFloor, list order to keep rows from (NULL: from the first)
+	* @return  void
+*/
+
+void collectRow(TrxSnapshot* pSnap, MYSQL_ROW row, LogWriter* pLog, TrxKey const* pFloor)
+{
+	TrxKey key;
+	unsigned int iMatch = trxMatch(row);
+
+	/* Every transaction is tracked, so 'end' is only logged once it has gone, not when it stops matching. */
+	if (iEvents)
+	{
+		trxTrack(&trxTable, row, pLog, pSnap->dTime, pSnap->iSeq, iMatch);
+	}
+
+	if ( ! iMatch)
+	{
+		return;
+	}
+
+	pSnap->iTotal++;
+	pSnap->iTotalLocked += binNumber(row[4]);
+	pSnap->iTotalModified += binNumber(row[5]);
+
+	key.iStarted = binCivilSeconds(row[11]);
+	key.iTrxId = binNumber(row[0]);
+	trxOrderAdd(&trxOrder, &key);
+
+	snapshotOffer(pSnap, row, &key, pFloor);
+
+	if (iCaptureAge > 0 || iCaptureLocked > 0)
+	{
+		captureCheck(&capture, row);
+	}
+
+	if (iBinary && pLog != NULL)
+	{
+		binAddRow(&binLog, pLog, row, pSnap->dTime, pSnap->iSeq);
+	}
+	else if (pLog != NULL && ! iEvents)
+	{
+		char idx = (strcmp("1", row[9]) == 1) ? 'N' : 'Y'; // NO_INDEX_USED -> reversal
+
+		logPrintf
+		(
+			pLog,
+			"%s|%" PRIu64 "|%s|%s|%s|%s|%s|%s|%s|%s|%s|%c|%s|%s|%s|%s|%s|%s|%s|%s;\n",
+			row[0], pSnap->iSeq, pSnap->aTime, row[1], row[2], row[3], row[4], row[5], row[6], row[7], row[8],
+			idx,
+			row[10], row[11], row[12], row[13], row[17], row[14], row[15], row[16]
+		);
+	}
+}
+
+
+/**
+	* Whether a row passes the filters not applied by the server: the program filter,
+	* and with -e the state, age and row lock filters, which a transaction can stop matching while it is still open.
+	*
+	* @param   MYSQL_ROW row, row with session metadata filled in
+	* @return  unsigned integer, 1 if it matches
+*/
+
+unsigned int trxMatch(MYSQL_ROW row)
+{
+	if (pFilterProgram != NULL && (row[17] == NULL || strcmp(row[17], pFilterProgram) != 0))
+	{
+		return 0;
+	}
+
+	if ( ! iEvents)
+	{
+		return 1;
+	}
+
+	if (pFilterState != NULL && (row[14] == NULL || strcasecmp(row[14], pFilterState) != 0))
+	{
+		return 0;
+	}
+
+	return (binNumber(row[12]) >= iFilterAge && binNumber(row[4]) >= iFilterLocked);
+}
+
+
+/**
+	* Draw a snapshot's transactions from list position iTop down, until the screen is full.
+	* Positions outside the snapshot's window are left blank until a sample brings them.
+	*
+	* @param   TrxSnapshot* pSnap, snapshot
+	* @param   unsigned int iTop, list position of the first transaction
+	* @param   int iY, first screen line
+	* @param   int iBottom, screen line after the last
+	* @return  unsigned integer, transactions drawn in full
+*/
+
+unsigned int drawTransactions(TrxSnapshot const* pSnap, unsigned int iTop, int iY, int iBottom)
+{
+	char const* row_trx[TRX_COLUMNS];
+	char aQuery[SNAP_ROW_TEXT];
+	char aIdx[2] = {'\0', '\0'};
+	size_t iWidth = (COLS > 2) ? (size_t) COLS - 2 : 1; /* SQL from column 1, clear of the last column. */
+	unsigned int iDrawn = 0;
+	unsigned int i;
+
+	if (iTop < pSnap->iFirst)
+	{
+		return 0;
+	}
+
+	for (i = iTop - pSnap->iFirst; i < pSnap->iRows && iY < iBottom; i++)
+	{
+		snapshotRow(pSnap, i, row_trx);
+
+		aIdx[0] = (strcmp("1", row_trx[9]) == 1) ? 'N' : 'Y'; // NO_INDEX_USED -> reversal
+		iY++;
+
+		attrset(A_BOLD | COLOR_PAIR(1));
+		drawField(iY, 1, row_trx[1]);
+		drawField(iY, 10, row_trx[2]);
+		drawField(iY, 20, row_trx[3]);
+		drawField(iY, 33, row_trx[4]);
+		drawField(iY, 46, row_trx[5]);
+		drawField(iY, 57, row_trx[6]);
+		drawField(iY, 68, row_trx[7]);
+		drawField(iY, 77, row_trx[8]);
+		drawField(iY, 85, aIdx);
+		drawField(iY, 93, row_trx[10]);
+		drawField(iY, 107, row_trx[11]);
+		drawField(iY, 130, row_trx[12]);
+		drawField(iY, 140, row_trx[13]);
+		attrset(A_NORMAL);
+
+		iY++;
+
+		if (row_trx[17] != NULL)
+		{
+			attron(COLOR_PAIR(1));
+			drawField(iY += 1, 1, row_trx[17]);
+			attroff(COLOR_PAIR(1));
+		}
+
+		attron(COLOR_PAIR(5));
+		drawField(iY += 1, 1, row_trx[14]);
+		attroff(COLOR_PAIR(5));
+
+		if (row_trx[15] != NULL)
+		{
+			attrset(A_BOLD | COLOR_PAIR(3));
+			drawField(iY += 1, 1, row_trx[15]);
+			attrset(A_NORMAL);
+		}
+
+		if (row_trx[16] != NULL)
+		{
+			/* SQL on 2 lines at most, at the terminal width. */
+			size_t iQLen = strlen(row_trx[16]);
+
+			if (iQLen > 2 * iWidth)
+			{
+				iQLen = 2 * iWidth;
+			}
+
+			if (iQLen > sizeof(aQuery) - 1)
+			{
+				iQLen = sizeof(aQuery) - 1;
+			}
+
+			memcpy(aQuery, row_trx[16], iQLen);
+			aQuery[iQLen] = '\0';
+
+			/* Replace TABs and LFs. */
+			replaceChar(aQuery, '\t', ' ');
+			replaceChar(aQuery, '\n', ' ');
+
+			attron(COLOR_PAIR(2));
+			drawField(iY += 1, 1, aQuery);
+
+			if (iQLen > iWidth)
+			{
+				drawField(iY += 1, 1, aQuery + iWidth);
+			}
+
+			attroff(COLOR_PAIR(2));
+		}
+
+		if (iY < iBottom)
+		{
+			iDrawn++;
+		}
+
+		iY += 2;
+	}
+
+	return iDrawn;
+}
+
+
+/**
+	* Write text at a screen position, clipped at the right edge (never wrapped) and below the last line.
+	*
+	* @param   int iY, line
+	* @param   int iX, column
+	* @param   char* pText, text (NULL draws nothing)
+	* @return  void
+*/
+
+void drawField(int iY, int iX, char const* pText)
+{
+	if (pText != NULL && iY < LINES && iX < COLS - 1)
+	{
+		mvaddnstr(iY, iX, pText, COLS - 1 - iX);
+	}
+}
+
+
+/**
+	* Formatted drawField().
+	*
+	* @param   int iY, line
+	* @param   int iX, column
+	* @param   char* pFormat, printf format
+	* @return  void
+*/
+
+void drawText(int iY, int iX, char const* pFormat, ...)
+{
+	char aText[512];
+	va_list args;
+
+	va_start(args, pFormat);
+	vsnprintf(aText, sizeof(aText), pFormat, args);
+	va_end(args);
+
+	drawField(iY, iX, aText);
+}
+
+
+/**
+	* Allocate a snapshot's row storage (fixed: SNAP_TOP rows, whatever the transaction count).
+	*
+	* @param   TrxSnapshot* pSnap, snapshot
+	* @return  unsigned integer, 0 on allocation failure
+*/
+
+unsigned int snapshotInit(TrxSnapshot* pSnap)
+{
+	memset(pSnap, 0, sizeof(TrxSnapshot));
+
+	pSnap->aOffsets = malloc(sizeof(size_t) * TRX_COLUMNS * SNAP_TOP);
+	pSnap->pText = malloc((size_t) SNAP_TOP * SNAP_ROW_TEXT);
+
+	return (pSnap->aOffsets != NULL && pSnap->pText != NULL);
+}
+
+
+/**
+	* Release a snapshot's row storage.
+	*
+	* @param   TrxSnapshot* pSnap, snapshot
+	* @return  void
+*/
+
+void snapshotFree(TrxSnapshot* pSnap)
+{
+	free(pSnap->aOffsets);
+	free(pSnap->pText);
+	pSnap->aOffsets = NULL;
+	pSnap->pText = NULL;
+}
+
+
+/**
+	* Offer a streamed row: kept if it is among the first SNAP_TOP in list order from pFloor so far.
+	* Rows before pFloor only move the window's list position. Once full, the last kept row (heap root) is overwritten in place.
+	*
+	* @param   TrxSnapshot* pSnap, snapshot
+	* @param   MYSQL_ROW row, row of the transaction query
+	* @param   TrxKey* pKey, row's list order
+	* @param   TrxKey* pFloor, list order to keep rows from (NULL: from the first)
+	* @return  void
+*/
+
+void snapshotOffer(TrxSnapshot* pSnap, MYSQL_ROW row, TrxKey const* pKey, TrxKey const* pFloor)
+{
+	unsigned int iSlot;
+	unsigned int i;
+
+	if (pFloor != NULL && trxKeyCompare(pKey, pFloor) < 0)
+	{
+		pSnap->iFirst++;
+		return;
+	}
+
+	if (pSnap->iRows < SNAP_TOP)
+	{
+		iSlot = pSnap->iRows++;
+
+		for (i = iSlot; i > 0 && trxKeyCompare(&pSnap->aKey[pSnap->aRank[(i - 1) / 2]], pKey) < 0; i = (i - 1) / 2)
+		{
+			pSnap->aRank[i] = pSnap->aRank[(i - 1) / 2];
+		}
+
+		pSnap->aRank[i] = iSlot;
+	}
+	else if (trxKeyCompare(pKey, &pSnap->aKey[pSnap->aRank[0]]) < 0)
+	{
+		iSlot = pSnap->aRank[0];
+		snapshotSift(pSnap, iSlot, pKey, SNAP_TOP);
+	}
+	else
+	{
+		return;
+	}
+
+	pSnap->aKey[iSlot] = *pKey;
+	snapshotCopyRow(pSnap, iSlot, row);
+}
+
+
+/**
+	* Place a slot at the root of the max-heap and sift it down.
+	*
+	* @param   TrxSnapshot* pSnap, snapshot
+	* @param   unsigned int iSlot, slot
+	* @param   TrxKey* pKey, slot's list order
+	* @param   unsigned int iSize, heap size
+	* @return  void
+*/
+
+void snapshotSift(TrxSnapshot* pSnap, unsigned int iSlot, TrxKey const* pKey, unsigned int iSize)
+{
+	unsigned int i = 0;
+	unsigned int c;
+
+	while ((c = 2 * i + 1) < iSize)
+	{
+		if (c + 1 < iSize && trxKeyCompare(&pSnap->aKey[pSnap->aRank[c + 1]], &pSnap->aKey[pSnap->aRank[c]]) > 0)
+		{
+			c++;
+		}
+
+		if (trxKeyCompare(&pSnap->aKey[pSnap->aRank[c]], pKey) <= 0)
+		{
+			break;
+		}
+
+		pSnap->aRank[i] = pSnap->aRank[c];
+		i = c;
+	}
+
+	pSnap->aRank[i] = iSlot;
+}
+
+
+/**
+	* Copy a row into its slot's text region. Fields are clipped to TRX_NAME_LEN, the statement to what remains:
+	* at least 366 bytes (SNAP_ROW_TEXT less 18 full fields), which a wide terminal's 2 lines can exceed,
+	* so a clipped statement ends in '...'.
+	*
+	* @param   TrxSnapshot* pSnap, snapshot
+	* @param   unsigned int iSlot, slot
+	* @param   MYSQL_ROW row, row of the transaction query
+	* @return  void
+*/
+
+void snapshotCopyRow(TrxSnapshot* pSnap, unsigned int iSlot, MYSQL_ROW row)
+{
+	size_t* pOffsets = &pSnap->aOffsets[iSlot * TRX_COLUMNS];
+	size_t iBase = (size_t) iSlot * SNAP_ROW_TEXT;
+	size_t iUsed = 0;
+	unsigned int i;
+
+	for (i = 0; i < TRX_COLUMNS; i++)
+	{
+		unsigned int c = (i < TRX_COLUMNS - 1) ? ((i < 16) ? i : i + 1) : 16; /* SQL_TEXT last. */
+		size_t iMax = (c == 16) ? SNAP_ROW_TEXT - iUsed - 1 : TRX_NAME_LEN - 1;
+		size_t iLen;
+
+		if (row[c] == NULL)
+		{
+			pOffsets[c] = SNAP_NULL;
+			continue;
+		}
+
+		iLen = strnlen(row[c], iMax);
+		memcpy(pSnap->pText + iBase + iUsed, row[c], iLen);
+		pSnap->pText[iBase + iUsed + iLen] = '\0';
+
+		if (c == 16 && iLen == iMax && row[c][iLen] != '\0')
+		{
+			memcpy(pSnap->pText + iBase + iUsed + iLen - 3, "...", 3);
+		}
+		pOffsets[c] = iBase + iUsed;
+		iUsed += iLen + 1;
+	}
+}
+
+
+/**
+	* Turn the heap into list order, longest-running first (in-place heapsort).
+	*
+	* @param   TrxSnapshot* pSnap, snapshot
+	* @return  void
+*/
+
+void snapshotFinish(TrxSnapshot* pSnap)
+{
+	unsigned int iSize = pSnap->iRows;
+
+	while (iSize > 1)
+	{
+		unsigned int iMax = pSnap->aRank[0];
+		unsigned int iLast = pSnap->aRank[--iSize];
+
+		snapshotSift(pSnap, iLast, &pSnap->aKey[iLast], iSize);
+		pSnap->aRank[iSize] = iMax;
+	}
+}
+
+
+/**
+	* Resolve a snapshot row's fields.
+	*
+	* @param   TrxSnapshot* pSnap, snapshot
+	* @param   unsigned int iRow, display row (0: longest-running)
+	* @param   char** aRow, TRX_COLUMNS field pointers (NULL for SQL NULL)
+	* @return  void
+*/
+
+void snapshotRow(TrxSnapshot const* pSnap, unsigned int iRow, char const** aRow)
+{
+	size_t const* pOffsets = &pSnap->aOffsets[pSnap->aRank[iRow] * TRX_COLUMNS];
+	unsigned int c;
+
+	for (c = 0; c < TRX_COLUMNS; c++)
+	{
+		aRow[c] = (pOffsets[c] == SNAP_NULL) ? NULL : pSnap->pText + pOffsets[c];
+	}
+}
+
+
+/**
+	* Compare two rows' list order (qsort() comparator).
+	*
+	* @param   void* pA, TrxKey
+	* @param   void* pB, TrxKey
+	* @return  integer, < 0 if A is listed first, 0 if equal, > 0 if B is
+*/
+
+int trxKeyCompare(void const* pA, void const* pB)
+{
+	TrxKey const* pKeyA = (TrxKey const*) pA;
+	TrxKey const* pKeyB = (TrxKey const*) pB;
+
+	if (pKeyA->iStarted != pKeyB->iStarted)
+	{
+		return (pKeyA->iStarted < pKeyB->iStarted) ? -1 : 1;
+	}
+
+	if (pKeyA->iTrxId != pKeyB->iTrxId)
+	{
+		return (pKeyA->iTrxId < pKeyB->iTrxId) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+
+/**
+	* Append a row's list order (16 bytes a row: the index stays small with thousands of transactions).
+	* Out of memory, the row is left out, and the next sample's window starts nearby instead.
+	*
+	* @param   TrxOrder* pOrder, order
+	* @param   TrxKey* pKey, row's list order
+	* @return  void
+*/
+
+void trxOrderAdd(TrxOrder* pOrder, TrxKey const* pKey)
+{
+	if (pOrder->iCount == pOrder->iCap)
+	{
+		unsigned int iCap = (pOrder->iCap > 0) ? pOrder->iCap * 2 : SNAP_TOP;
+		TrxKey* pGrown = realloc(pOrder->aKeys, sizeof(TrxKey) * iCap);
+
+		if (pGrown == NULL)
+		{
+			return;
+		}
+
+		pOrder->aKeys = pGrown;
+		pOrder->iCap = iCap;
+	}
+
+	pOrder->aKeys[pOrder->iCount++] = *pKey;
+}
+
+
+/**
+	* Single-producer, single-consumer push (lock-free: each index is written by one side only).
+	*
+	* @param   SnapQueue* pQueue, queue
+	* @param   TrxSnapshot* pSnap, snapshot
+	* @return  unsigned integer, 0 if full
+*/
+
+unsigned int queuePush(SnapQueue* pQueue, TrxSnapshot* pSnap)
+{
+	unsigned int iTail = __atomic_load_n(&pQueue->iTail, __ATOMIC_RELAXED);
+
+	if (iTail - __atomic_load_n(&pQueue->iHead, __ATOMIC_ACQUIRE) == SNAP_POOL)
+	{
+		return 0;
+	}
+
+	pQueue->aItems[iTail % SNAP_POOL] = pSnap;
+	__atomic_store_n(&pQueue->iTail, iTail + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+
+/**
+	* Single-producer, single-consumer pop.
+	*
+	* @param   SnapQueue* pQueue, queue
+	* @return  TrxSnapshot*, NULL if empty
+*/
+
+TrxSnapshot* queuePop(SnapQueue* pQueue)
+{
+	unsigned int iHead = __atomic_load_n(&pQueue->iHead, __ATOMIC_RELAXED);
+	TrxSnapshot* pSnap;
+
+	if (iHead == __atomic_load_n(&pQueue->iTail, __ATOMIC_ACQUIRE))
+	{
+		return NULL;
+	}
+
+	pSnap = pQueue->aItems[iHead % SNAP_POOL];
+	__atomic_store_n(&pQueue->iHead, iHead + 1, __ATOMIC_RELEASE);
+
+	return pSnap;
+}
+
+
+/**
+	* Sleep for a fractional number of seconds.
+	*
+	* @param   double dSecs, seconds
+	* @return  void
+*/
+
+void sleepSecs(double dSecs)
+{
+	struct timespec req;
+
+	if (dSecs <= 0)
+	{
+		return;
+	}
+
+	req.tv_sec = (time_t) dSecs;
+	req.tv_nsec = (long) ((dSecs - (double) req.tv_sec) * 1e9);
+
+	nanosleep(&req, NULL);
+}
+
+
+/**
+	* Check for keypresses: list scrolling and the overhead line.
+	*
+	* @param   ListView* pView, list position
+	* @param   unsigned int iListed, transactions in the list
+	* @return  unsigned integer, 1 if the screen needs redrawing
+*/
+
+unsigned int listKeys(ListView* pView, unsigned int iListed)
+{
+	unsigned int iPage = (pView->iPage > 0) ? pView->iPage : 1;
+	int iCh = getch();
+
+	switch (iCh)
+	{
+		case KEY_UP:
+			pView->iTop = (pView->iTop > 0) ? pView->iTop - 1 : 0;
+		break;
+
+		case KEY_DOWN:
+			pView->iTop++;
+		break;
+
+		case KEY_PPAGE:
+			pView->iTop = (pView->iTop > iPage) ? pView->iTop - iPage : 0;
+		break;
+
+		case KEY_NPAGE:
+			pView->iTop += iPage;
+		break;
+
+		case KEY_HOME:
+			pView->iTop = 0;
+		break;
+
+		case KEY_END:
+			pView->iTop = (iListed > iPage) ? iListed - iPage : 0;
+		break;
+
+		case KEY_RESIZE: /* LINES and COLS already updated. */
+		break;
+
+		case 'f':
+			__atomic_store_n(&iFooterOn, ! iFooterOn, __ATOMIC_RELAXED);
+		break;
+
+		default:
+			return 0;
+	}
+
+	if (pView->iTop >= iListed)
+	{
+		pView->iTop = (iListed > 0) ? iListed - 1 : 0;
+	}
+
+	return 1;
+}
+
+
+/**
+	* Keep the list on the same transaction in a new snapshot, wherever it now ranks.
+	* At the top, the list stays at the top. A transaction that has ended, or is not in the window, leaves its position to the next.
+	*
+	* @param   ListView* pView, list position
+	* @param   TrxSnapshot* pSnap, new snapshot
+	* @return  void
+*/
+
+void listFollow(ListView* pView, TrxSnapshot const* pSnap)
+{
+	char const* aRow[TRX_COLUMNS];
+	unsigned int i;
+
+	if (pView->iTop > 0)
+	{
+		for (i = 0; i < pSnap->iRows; i++)
+		{
+			snapshotRow(pSnap, i, aRow);
+
+			if (aRow[0] != NULL && strcmp(aRow[0], pView->aTrxId) == 0)
+			{
+				pView->iTop = pSnap->iFirst + i;
+				break;
+			}
+		}
+	}
+
+	listAnchor(pView, pSnap);
+}
+
+
+/**
+	* Record the trx_id at the top of the list (none while the position is outside the snapshot's window).
+	*
+	* @param   ListView* pView, list position
+	* @param   TrxSnapshot* pSnap, displayed snapshot
+	* @return  void
+*/
+
+void listAnchor(ListView* pView, TrxSnapshot const* pSnap)
+{
+	char const* aRow[TRX_COLUMNS];
+
+	if (pView->iTop >= pSnap->iListed)
+	{
+		pView->iTop = (pSnap->iListed > 0) ? pSnap->iListed - 1 : 0;
+	}
+
+	if (pView->iTop < pSnap->iFirst || pView->iTop - pSnap->iFirst >= pSnap->iRows)
+	{
+		pView->aTrxId[0] = '\0';
+		return;
+	}
+
+	snapshotRow(pSnap, pView->iTop - pSnap->iFirst, aRow);
+	copyField(pView->aTrxId, aRow[0], TRX_NUM_LEN);
+}
+
+
+/**
+	* Process command-line switches using getopt()
+	*
+	* @param   integer iArgCount, number of arguments
+	* @param   char* aArgV, pointer to aArgV
+	* @return  unsigned integer
+*/
+
+unsigned int options(int iArgCount, char* const aArgV[])
+{
+	int iOpts = 0;
+	int iOptsIdx = 0;
+	unsigned int iHelp = 0;
+
+	struct option aLongOpts[] =
+	{
+		{"help", no_argument, 0, 'i'},
+		{"gzip", no_argument, 0, 'z'},
+		{"rotate-size", required_argument, 0, 'S'},
+		{"rotate-time", required_argument, 0, 'M'},
+		{"min-age", required_argument, 0, 'A'},
+		{"match-user", required_argument, 0, 'U'},
+		{"match-program", required_argument, 0, 'P'},
+		{"match-state", required_argument, 0, 'T'},
+		{"min-locked", required_argument, 0, 'L'},
+		{"capture-age", required_argument, 0, 'C'},
+		{"capture-locked", required_argument, 0, 'K'},
+		{"capture-dir", required_argument, 0, 'D'},
+		{0, 0, 0, 0}
+	};
+
+	while ((iOpts = getopt_long(iArgCount, aArgV, "ih:w:u:f:t:p:ebz", aLongOpts, &iOptsIdx)) != -1)
+	{
+		switch (iOpts)
+		{
+			case 'i':
+				iHelp = 1;
+				break;
+
+			case 'h':
+				pHost = optarg;
+				break;
+
+			case 'u':
+				pUser = optarg;
+				break;
+
+			case 'f':
+				pLogfile = optarg;
+				break;
+
+			case 't':
+				iTime = (unsigned int) atoi(optarg);
+				if (iTime < 10) {iTime = 10;} /* Sampled on the collector thread, independent of the UI frame rate. */
+				if (iTime > 2000) {iTime = 2000;}
+				break;
+
+			case 'p':
+				iPort = (unsigned int) atoi(optarg);
+				break;
+
+			case 'e':
+				iEvents = 1;
+				break;
+
+			case 'b':
+				iBinary = 1;
+				break;
+
+			case 'z':
+				iGzip = 1;
+				break;
+
+			case 'S':
+				iRotateMB = (unsigned int) atoi(optarg);
+				break;
+
+			case 'M':
+				iRotateMins = (unsigned int) atoi(optarg);
+				break;
+
+			case 'A':
+				iFilterAge = (unsigned int) atoi(optarg);
+				break;
+
+			case 'U':
+				pFilterUser = optarg;
+				break;
+
+			case 'P':
+				pFilterProgram = optarg;
+				break;
+
+			case 'T':
+				pFilterState = optarg;
+				break;
+
+			case 'L':
+				iFilterLocked = strtoull(optarg, NULL, 10);
+				break;
+
+			case 'C':
+				iCaptureAge = (unsigned int) atoi(optarg);
+				break;
+
+			case 'K':
+				iCaptureLocked = strtoull(optarg, NULL, 10);
+				break;
+
+			case 'D':
+				pCaptureDir = optarg;
+				break;
+
+			case '?':
+
+				if (optopt == 'h' || optopt == 'w' || optopt == 'u' || optopt == 'f' || optopt == 't' || optopt == 'p')
+				{
+					fprintf(stderr, "\nMissing switch arguments.\n\n");
+				}
+				else if (optopt == 0)
+				{
+					break;
+				}
+				else
+				{
+					fprintf(stderr, "\nUnknown option `-%c'.\n\n", optopt);
+				}
+
+				return 0;
+				break;
+
+			default:
+				return 0;
+		}
+	}
+
+	if (iHelp == 1)
+	{
+		menu(aArgV[0]);
+		return 0;
+	}
+	else if (pUser == NULL)
+	{
+		fprintf(stderr, "\n%s: use '%s -h' for help\n\n", APP_NAME, aArgV[0]);
+		return 0;
+	}
+	else if ((iEvents || iBinary || iGzip || iRotateMB || iRotateMins) && pLogfile == NULL)
+	{
+		fprintf(stderr, "\n%s: -e, -b, -z and rotation apply to the logfile given with -f\n\n", APP_NAME);
+		return 0;
+	}
+	else if (iEvents && iBinary)
+	{
+		fprintf(stderr, "\n%s: -e and -b are alternative log formats\n\n", APP_NAME);
+		return 0;
+	}
+	else if (pFilterState != NULL && strcasecmp(pFilterState, "RUNNING") != 0 && strcasecmp(pFilterState, "LOCK WAIT") != 0 && strcasecmp(pFilterState, "ROLLING BACK") != 0 && strcasecmp(pFilterState, "COMMITTING") != 0)
+	{
+		fprintf(stderr, "\n%s: --match-state is one of 'RUNNING', 'LOCK WAIT', 'ROLLING BACK', 'COMMITTING'\n\n", APP_NAME);
+		return 0;
+	}
+	else if ((iCaptureAge > 0 || iCaptureLocked > 0) && access(pCaptureDir, W_OK) != 0)
+	{
+		fprintf(stderr, "\n%s: --capture-dir '%s' is not a writable directory\n\n", APP_NAME, pCaptureDir);
+		return 0;
+	}
+	else
+	{
+		if (pHost == NULL)
+		{
+			pHost = "localhost";
+		}
+
+		return 1;
+	}
+}
+
+
+/**
+	* Display program menu.
+	*
+	* @param   char* pFName, filename from aArgV[0]
+	* @return  void
+*/
+
+void menu(char* const pFName)
+{
+	fprintf(stdout, "\n%s v.%s\nby Tinram", APP_NAME, MB_VERSION);
+	fprintf(stdout, "\n\nUsage:\n");
+	fprintf(stdout, "\t%s -u <user> [-h <host>] [-f <logfile> [-e | -b] [-z] [--rotate-size <MB>] [--rotate-time <mins>]] [-t <time (ms)>] [-p <port>] [filters] [capture]\n\n", pFName);
+	fprintf(stdout, "\t-e\tlog transaction lifecycle events (begin, stmt, state, end) instead of every row\n");
+	fprintf(stdout, "\t-b\tlog every row in the binary columnar format (read with utils/trxlogq)\n");
+	fprintf(stdout, "\t-z\tgzip the logfile\n");
+	fprintf(stdout, "\t--rotate-size, --rotate-time\trotate the logfile after this many MB (uncompressed) or minutes\n\n");
+	fprintf(stdout, "\tFilters (applied by the server; with -e, all but --match-user by %s):\n", APP_NAME);
+	fprintf(stdout, "\t--min-age <secs>\ttransactions running at least this long\n");
+	fprintf(stdout, "\t--match-user <user>\tof this user\n");
+	fprintf(stdout, "\t--match-state <state>\tin this trx_state ('RUNNING', 'LOCK WAIT', 'ROLLING BACK', 'COMMITTING')\n");
+	fprintf(stdout, "\t--min-locked <rows>\tholding at least this many row locks\n\n");
+	fprintf(stdout, "\tFilter (applied by %s, every transaction is fetched):\n", APP_NAME);
+	fprintf(stdout, "\t--match-program <name>\tfrom this program_name connection attribute\n\n");
+	fprintf(stdout, "\tCapture (statement history, locks, waiters and plan to a file, once per transaction):\n");
+	fprintf(stdout, "\t--capture-age <secs>\ttransactions running at least this long\n");
+	fprintf(stdout, "\t--capture-locked <rows>\tholding at least this many row locks\n");
+	fprintf(stdout, "\t--capture-dir <dir>\twhere capture files are written (default: current directory)\n\n");
+}
+
+
+/**
+	* Wall-clock time for log timestamps.
+	*
+	* @return  double, seconds since the epoch
+*/
+
+double wallTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+
+/**
+	* Format a wall-clock time as local 'YYYY-MM-DD HH:MM:SS.mmm'.
+	*
+	* @param   double dTime, seconds since the epoch
+	* @param   char* pBuf, output buffer
+	* @param   size_t iLen, buffer length
+	* @return  void
+*/
+
+void formatTime(double dTime, char* pBuf, size_t iLen)
+{
+	time_t tSecs = (time_t) dTime;
+	struct tm tmLocal;
+	size_t iUsed;
+
+	localtime_r(&tSecs, &tmLocal);
+	iUsed = strftime(pBuf, iLen, "%Y-%m-%d %H:%M:%S", &tmLocal);
+	snprintf(pBuf + iUsed, iLen - iUsed, ".%06d", (int) ((dTime - (double) tSecs) * 1e6));
+}
+
+
+/**
+	* Copy a result field into a fixed buffer: NULL becomes empty, long values are truncated.
+	*
+	* @param   char* pDest, destination
+	* @param   char* pSrc, field value (may be NULL)
+	* @param   size_t iLen, destination size
+	* @return  void
+*/
+
+void copyField(char* pDest, char const* pSrc, size_t iLen)
+{
+	if (pSrc == NULL)
+	{
+		pDest[0] = '\0';
+		return;
+	}
+
+	strncpy(pDest, pSrc, iLen - 1);
+	pDest[iLen - 1] = '\0';
+}
+
+
+/**
+	* Build and prepare the transaction query: the filters in effect become WHERE conditions with bound values.
+	*
+	* @param   TrxQuery* pQuery, query
+	* @param   MYSQL* pConn, connection pointer
+	* @param   unsigned int iLimit, rows to return from a list position bound at each execution (server-side ORDER BY ... LIMIT ?, ?),
+	*          counted by a second statement; 0 for all (ignored with the client-side program filter)
+	* @return  unsigned integer, 0 on failure (reason in aError)
+*/
+
+unsigned int trxQueryPrepare(TrxQuery* pQuery, MYSQL* pConn, unsigned int iLimit)
+{
+	char aSQL[2048];
+	char aWhere[1024] = "";
+	char const* pJoin = (iPsThreadId ? pTrxJoin : pTrxJoinThreads);
+	size_t iText = 0;
+	unsigned int c;
+
+	memset(pQuery, 0, sizeof(TrxQuery));
+
+	/* With -e, the filters a transaction can stop matching are applied by trxMatch(), so its whole lifecycle is seen. */
+	if (iFilterAge > 0)
+	{
+		if ( ! iEvents)
+		{
+			trxQueryFilter(pQuery, aWhere, sizeof(aWhere), "trx.trx_started <= NOW() - INTERVAL ? SECOND", MYSQL_TYPE_LONG, &iFilterAge, 0);
+		}
+
+		iText += (size_t) snprintf(aFilterText + iText, sizeof(aFilterText) - iText, " age>=%us", iFilterAge);
+	}
+
+	if (pFilterUser != NULL)
+	{
+		trxQueryFilter(pQuery, aWhere, sizeof(aWhere), "trx.trx_mysql_thread_id IN (SELECT PROCESSLIST_ID FROM performance_schema.threads WHERE PROCESSLIST_USER = ?)", MYSQL_TYPE_STRING, pFilterUser, strlen(pFilterUser));
+		iText += (size_t) snprintf(aFilterText + iText, sizeof(aFilterText) - iText, " user=%.48s", pFilterUser);
+	}
+
+	/* Matched on the client against the session cache: session_connect_attrs cannot be searched by value without a scan. */
+	if (pFilterProgram != NULL)
+	{
+		iText += (size_t) snprintf(aFilterText + iText, sizeof(aFilterText) - iText, " program=%.48s", pFilterProgram);
+	}
+
+	if (pFilterState != NULL)
+	{
+		if ( ! iEvents)
+		{
+			trxQueryFilter(pQuery, aWhere, sizeof(aWhere), "trx.trx_state = ?", MYSQL_TYPE_STRING, pFilterState, strlen(pFilterState));
+		}
+
+		iText += (size_t) snprintf(aFilterText + iText, sizeof(aFilterText) - iText, " state=%.16s", pFilterState);
+	}
+
+	if (iFilterLocked > 0)
+	{
+		if ( ! iEvents)
+		{
+			trxQueryFilter(pQuery, aWhere, sizeof(aWhere), "trx.trx_rows_locked >= ?", MYSQL_TYPE_LONGLONG, &iFilterLocked, 0);
+		}
+
+		snprintf(aFilterText + iText, sizeof(aFilterText) - iText, " locked>=%llu", iFilterLocked);
+	}
+
+	snprintf(aSQL, sizeof(aSQL), "%s%s%s", pTrxQuery, pJoin, aWhere);
+
+	/* Longest-running first from a position (bound at each execution), in the order the client keeps (TrxKey). */
+	if (iLimit > 0 && pFilterProgram == NULL)
+	{
+		size_t iLen = strlen(aSQL);
+		snprintf(aSQL + iLen, sizeof(aSQL) - iLen, " ORDER BY trx.trx_started, CAST(trx.trx_id AS UNSIGNED) LIMIT ?, ?");
+
+		pQuery->aWindow[1] = iLimit;
+
+		for (c = 0; c < 2; c++)
+		{
+			MYSQL_BIND* pBind = &pQuery->aParams[pQuery->iParams++];
+
+			pBind->buffer_type = MYSQL_TYPE_LONG;
+			pBind->buffer = &pQuery->aWindow[c];
+			pBind->is_unsigned = 1;
+		}
+
+		pQuery->iWindowed = 1;
+	}
+
+	pQuery->pStmt = mysql_stmt_init(pConn);
+
+	if (pQuery->pStmt == NULL)
+	{
+		snprintf(pQuery->aError, sizeof(pQuery->aError), "%s", mysql_error(pConn));
+		return 0;
+	}
+
+	if (mysql_stmt_prepare(pQuery->pStmt, aSQL, strlen(aSQL)) != 0 || (pQuery->iParams > 0 && mysql_stmt_bind_param(pQuery->pStmt, pQuery->aParams)))
+	{
+		snprintf(pQuery->aError, sizeof(pQuery->aError), "%s", mysql_stmt_error(pQuery->pStmt));
+		mysql_stmt_close(pQuery->pStmt);
+		pQuery->pStmt = NULL;
+		return 0;
+	}
+
+	/* Every column as text, as mysql_fetch_row() would return it. */
+	for (c = 0; c < TRX_COLUMNS; c++)
+	{
+		size_t iCap = (c == 16) ? TRX_SQL_MIN : TRX_FIELD_MIN;
+
+		pQuery->aBufs[c] = malloc(iCap);
+
+		if (pQuery->aBufs[c] == NULL)
+		{
+			snprintf(pQuery->aError, sizeof(pQuery->aError), "out of memory");
+			trxQueryFree(pQuery);
+			return 0;
+		}
+
+		pQuery->aResult[c].buffer_type = MYSQL_TYPE_STRING;
+		pQuery->aResult[c].buffer = pQuery->aBufs[c];
+		pQuery->aResult[c].buffer_length = iCap - 1; /* Room for the terminator. */
+		pQuery->aResult[c].length = &pQuery->aLens[c];
+		pQuery->aResult[c].is_null = &pQuery->aNull[c];
+		pQuery->aResult[c].error = &pQuery->aTruncated[c];
+	}
+
+	if (mysql_stmt_bind_result(pQuery->pStmt, pQuery->aResult))
+	{
+		snprintf(pQuery->aError, sizeof(pQuery->aError), "%s", mysql_stmt_error(pQuery->pStmt));
+		trxQueryFree(pQuery);
+		return 0;
+	}
+
+	/* The windowed query's list length: the same rows, counted. The window parameters follow the filters, so they are not bound here. */
+	if (pQuery->iWindowed)
+	{
+		snprintf(aSQL, sizeof(aSQL), "SELECT COUNT(*) FROM information_schema.INNODB_TRX trx %s%s", pJoin, aWhere);
+
+		pQuery->countResult.buffer_type = MYSQL_TYPE_LONGLONG;
+		pQuery->countResult.buffer = &pQuery->iCounted;
+		pQuery->countResult.is_unsigned = 1;
+		pQuery->pCount = mysql_stmt_init(pConn);
+
+		if (pQuery->pCount == NULL || mysql_stmt_prepare(pQuery->pCount, aSQL, strlen(aSQL)) != 0 || (pQuery->iParams > 2 && mysql_stmt_bind_param(pQuery->pCount, pQuery->aParams)) || mysql_stmt_bind_result(pQuery->pCount, &pQuery->countResult))
+		{
+			snprintf(pQuery->aError, sizeof(pQuery->aError), "%s", (pQuery->pCount != NULL ? mysql_stmt_error(pQuery->pCount) : mysql_error(pConn)));
+			trxQueryFree(pQuery);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+/**
+	* Add a WHERE condition with one bound parameter.
+	*
+	* @param   TrxQuery* pQuery, query
+	* @param   char* pSQL, statement text
+	* @param   size_t iSize, statement buffer size
+	* @param   char* pClause, condition with one '?'
+	* @param   enum enum_field_types iType, MYSQL_TYPE_LONG (unsigned int), MYSQL_TYPE_LONGLONG (unsigned long long) or MYSQL_TYPE_STRING
+	* @param   void* pValue, value (must outlive the statement)
+	* @param   unsigned long iLen, string length
+	* @return  void
+*/
+
+void trxQueryFilter(TrxQuery* pQuery, char* pSQL, size_t iSize, char const* pClause, enum enum_field_types iType, void* pValue, unsigned long iLen)
+{
+	MYSQL_BIND* pBind = &pQuery->aParams[pQuery->iParams];
+	size_t iEnd = strlen(pSQL);
+
+	snprintf(pSQL + iEnd, iSize - iEnd, " %s %s", (pQuery->iParams == 0 ? "WHERE" : "AND"), pClause);
+
+	pBind->buffer_type = iType;
+	pBind->buffer = pValue;
+	pBind->buffer_length = iLen;
+	pBind->is_unsigned = (iType != MYSQL_TYPE_STRING);
+
+	pQuery->iParams++;
+}
+
+
+/**
+	* Fetch the next row. A value longer than its buffer grows the buffer and is fetched again,
+	* so rows are never truncated and buffers settle at the workload's longest values.
+	*
+	* @param   TrxQuery* pQuery, executed query
+	* @return  MYSQL_ROW, NULL at the end of the rows or on error (mysql_stmt_errno)
+*/
+
+MYSQL_ROW trxQueryFetch(TrxQuery* pQuery)
+{
+	int iStatus = monStmtFetch(pQuery->pStmt);
+	unsigned int iRebind = 0;
+	unsigned int c;
+
+	if (iStatus != 0 && iStatus != MYSQL_DATA_TRUNCATED)
+	{
+		return NULL;
+	}
+
+	for (c = 0; c < TRX_COLUMNS; c++)
+	{
+		MYSQL_BIND* pBind = &pQuery->aResult[c];
+
+		if (pQuery->aNull[c])
+		{
+			pQuery->aRow[c] = NULL;
+			continue;
+		}
+
+		if (pQuery->aLens[c] > pBind->buffer_length)
+		{
+			char* pGrown = realloc(pQuery->aBufs[c], pQuery->aLens[c] + 1);
+
+			if (pGrown != NULL)
+			{
+				pQuery->aBufs[c] = pGrown;
+				pBind->buffer = pGrown;
+				pBind->buffer_length = pQuery->aLens[c];
+				mysql_stmt_fetch_column(pQuery->pStmt, pBind, c, 0);
+				iRebind = 1;
+			}
+			else
+			{
+				pQuery->aLens[c] = pBind->buffer_length; /* Truncated. */
+			}
+		}
+
+		pQuery->aBufs[c][pQuery->aLens[c]] = '\0';
+		pQuery->aRow[c] = pQuery->aBufs[c];
+	}
+
+	if (iRebind)
+	{
+		mysql_stmt_bind_result(pQuery->pStmt, pQuery->aResult);
+	}
+
+	return pQuery->aRow;
+}
+
+
+/**
+	* Close the statement and release its buffers.
+	*
+	* @param   TrxQuery* pQuery, query
+	* @return  void
+*/
+
+void trxQueryFree(TrxQuery* pQuery)
+{
+	unsigned int c;
+
+	if (pQuery->pStmt != NULL)
+	{
+		mysql_stmt_close(pQuery->pStmt);
+		pQuery->pStmt = NULL;
+	}
+
+	if (pQuery->pCount != NULL)
+	{
+		mysql_stmt_close(pQuery->pCount);
+		pQuery->pCount = NULL;
+	}
+
+	for (c = 0; c < TRX_COLUMNS; c++)
+	{
+		free(pQuery->aBufs[c]);
+		pQuery->aBufs[c] = NULL;
+	}
+}
+
+
+/**
+	* Hash a PROCESSLIST_ID (64-bit mix: IDs are sequential).
+	*
+	* @param   uint64_t iProcess, PROCESSLIST_ID
+	* @return  uint32_t
+*/
+
+uint32_t sessionHash(uint64_t iProcess)
+{
+	iProcess ^= iProcess >> 33;
+	iProcess *= 0xff51afd7ed558ccdULL;
+	iProcess ^= iProcess >> 33;
+
+	return (uint32_t) iProcess;
+}
+
+
+/**
+	* Allocate an empty session cache.
+	*
+	* @param   SessionCache* pCache, cache
+	* @param   unsigned int iSize, slots (power of 2)
+	* @return  unsigned integer, 0 on allocation failure
+*/
+
+unsigned int sessionCacheInit(SessionCache* pCache, unsigned int iSize)
+{
+	pCache->aSlots = calloc(iSize, sizeof(SessionEntry));
+
+	if (pCache->aSlots == NULL)
+	{
+		return 0;
+	}
+
+	pCache->iSize = iSize;
+	pCache->iCount = 0;
+
+	return 1;
+}
+
+
+/**
+	* Release the session cache.
+	*
+	* @param   SessionCache* pCache, cache
+	* @return  void
+*/
+
+void sessionCacheFree(SessionCache* pCache)
+{
+	free(pCache->aSlots);
+	pCache->aSlots = NULL;
+	pCache->iSize = 0;
+	pCache->iCount = 0;
+}
+
+
+/**
+	* Find a session, optionally inserting a pending entry if new.
+	* The table doubles once half full.
+	*
+	* @param   SessionCache* pCache, cache
+	* @param   uint64_t iProcess, PROCESSLIST_ID
+	* @param   unsigned int iInsert, 1 to insert if absent
+	* @param   unsigned int* pNew, set to 1 if inserted
+	* @return  SessionEntry*, NULL if absent (or the table could not grow)
+*/
+
+SessionEntry* sessionLookup(SessionCache* pCache, uint64_t iProcess, unsigned int iInsert, unsigned int* pNew)
+{
+	unsigned int iMask;
+	unsigned int i;
+
+	*pNew = 0;
+
+	if (iInsert && (pCache->iCount + 1) * 2 > pCache->iSize)
+	{
+		SessionCache cGrown;
+
+		if ( ! sessionCacheInit(&cGrown, pCache->iSize * 2))
+		{
+			return NULL;
+		}
+
+		for (i = 0; i < pCache->iSize; i++)
+		{
+			if (pCache->aSlots[i].iUsed)
+			{
+				unsigned int j = sessionHash(pCache->aSlots[i].iProcess) & (cGrown.iSize - 1);
+
+				while (cGrown.aSlots[j].iUsed)
+				{
+					j = (j + 1) & (cGrown.iSize - 1);
+				}
+
+				cGrown.aSlots[j] = pCache->aSlots[i];
+			}
+		}
+
+		cGrown.iCount = pCache->iCount;
+		cGrown.dLastSweep = pCache->dLastSweep;
+		free(pCache->aSlots);
+		*pCache = cGrown;
+	}
+
+	iMask = pCache->iSize - 1;
+
+	for (i = sessionHash(iProcess) & iMask; pCache->aSlots[i].iUsed; i = (i + 1) & iMask)
+	{
+		if (pCache->aSlots[i].iProcess == iProcess)
+		{
+			return &pCache->aSlots[i];
+		}
+	}
+
+	if ( ! iInsert)
+	{
+		return NULL;
+	}
+
+	memset(&pCache->aSlots[i], 0, sizeof(SessionEntry));
+	pCache->aSlots[i].iProcess = iProcess;
+	pCache->aSlots[i].iPending = 1;
+	pCache->aSlots[i].iUsed = 1;
+	pCache->iCount++;
+	*pNew = 1;
+
+	return &pCache->aSlots[i];
+}
+
+
+/**
+	* Remove a slot, shifting later members of its probe chain back into the hole.
+	*
+	* @param   SessionCache* pCache, cache
+	* @param   unsigned int iHole, slot to empty
+	* @return  void
+*/
+
+void sessionRemove(SessionCache* pCache, unsigned int iHole)
+{
+	unsigned int iMask = pCache->iSize - 1;
+	unsigned int i = iHole;
+
+	pCache->aSlots[iHole].iUsed = 0;
+	pCache->iCount--;
+
+	for (i = (i + 1) & iMask; pCache->aSlots[i].iUsed; i = (i + 1) & iMask)
+	{
+		unsigned int iHome = sessionHash(pCache->aSlots[i].iProcess) & iMask;
+
+		if (((i - iHome) & iMask) >= ((i - iHole) & iMask))
+		{
+			pCache->aSlots[iHole] = pCache->aSlots[i];
+			pCache->aSlots[i].iUsed = 0;
+			iHole = i;
+		}
+	}
+}
+
+
+/**
+	* Fill a row's user and program from the cache.
+	* The pointers stay valid until the cache is next modified: use the row straight away.
+	*
+	* @param   SessionCache* pCache, cache
+	* @param   MYSQL_ROW row, row of the transaction query
+	* @param   double dNow, snapshot wall-clock time
+	* @return  unsigned integer, 0 if the session is new (metadata pending: see sessionFill)
+*/
+
+unsigned int sessionResolve(SessionCache* pCache, MYSQL_ROW row, double dNow)
+{
+	unsigned int iNew;
+	SessionEntry* pSession = sessionLookup(pCache, binNumber(row[2]), 1, &iNew);
+
+	if (pSession == NULL)
+	{
+		return 1; /* No memory for the entry: no metadata either. */
+	}
+
+	pSession->dLastSeen = dNow;
+
+	if (pSession->iPending)
+	{
+		return 0;
+	}
+
+	row[13] = pSession->iUserNull ? NULL : pSession->aUser;
+	row[17] = pSession->iProgramNull ? NULL : pSession->aProgram;
+
+	return 1;
+}
+
+
+/**
+	* Fetch user and program for pending sessions, SESSION_FILL_IDS at a time.
+	* Sessions not found (disconnected) or not readable are left without metadata rather than retried.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   SessionCache* pCache, cache
+	* @return  void
+*/
+
+void sessionFill(MYSQL* pConn, SessionCache* pCache)
+{
+	char aSQL[1024 + SESSION_FILL_IDS * 22];
+	size_t iBase = (size_t) snprintf(aSQL, sizeof(aSQL), "%s", pSessionQuery);
+	size_t iLen = iBase;
+	unsigned int iIds = 0;
+	unsigned int i;
+
+	for (i = 0; i < pCache->iSize; i++)
+	{
+		if ( ! pCache->aSlots[i].iUsed || ! pCache->aSlots[i].iPending)
+		{
+			continue;
+		}
+
+		iLen += (size_t) snprintf(aSQL + iLen, sizeof(aSQL) - iLen, "%c%" PRIu64, (iIds == 0 ? '(' : ','), pCache->aSlots[i].iProcess);
+
+		if (++iIds == SESSION_FILL_IDS)
+		{
+			snprintf(aSQL + iLen, sizeof(aSQL) - iLen, ")");
+			sessionFillQuery(pConn, pCache, aSQL);
+			iLen = iBase;
+			iIds = 0;
+		}
+	}
+
+	if (iIds > 0)
+	{
+		snprintf(aSQL + iLen, sizeof(aSQL) - iLen, ")");
+		sessionFillQuery(pConn, pCache, aSQL);
+	}
+
+	for (i = 0; i < pCache->iSize; i++)
+	{
+		if (pCache->aSlots[i].iUsed && pCache->aSlots[i].iPending)
+		{
+			pCache->aSlots[i].iPending = 0;
+			pCache->aSlots[i].iUserNull = 1;
+			pCache->aSlots[i].iProgramNull = 1;
+		}
+	}
+}
+
+
+/**
+	* Run one metadata query and store its rows.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   SessionCache* pCache, cache
+	* @param   char* pSQL, pSessionQuery with its ID list
+	* @return  void
+*/
+
+void sessionFillQuery(MYSQL* pConn, SessionCache* pCache, char const* pSQL)
+{
+	MYSQL_RES* result_sess = monQuery(pConn, pSQL);
+	MYSQL_ROW row;
+
+	if (result_sess == NULL)
+	{
+		return;
+	}
+
+	while ((row = mysql_fetch_row(result_sess)) != NULL)
+	{
+		unsigned int iNew;
+		SessionEntry* pSession = sessionLookup(pCache, binNumber(row[0]), 0, &iNew);
+
+		if (pSession == NULL || ! pSession->iPending)
+		{
+			continue;
+		}
+
+		pSession->iUserNull = (row[1] == NULL);
+		pSession->iProgramNull = (row[2] == NULL);
+		copyField(pSession->aUser, row[1], TRX_NAME_LEN);
+		copyField(pSession->aProgram, row[2], SESSION_ATTR_LEN);
+		pSession->iPending = 0;
+	}
+
+	mysql_free_result(result_sess);
+}
+
+
+/**
+	* Evict sessions not seen in a transaction for SESSION_IDLE_SECS (checked once a second).
+	* Pooled connections keep their entries between transactions; closed ones age out.
+	*
+	* @param   SessionCache* pCache, cache
+	* @param   double dNow, snapshot wall-clock time
+	* @return  void
+*/
+
+void sessionSweep(SessionCache* pCache, double dNow)
+{
+	unsigned int i = 0;
+
+	if (dNow - pCache->dLastSweep < 1)
+	{
+		return;
+	}
+
+	pCache->dLastSweep = dNow;
+
+	while (i < pCache->iSize)
+	{
+		if (pCache->aSlots[i].iUsed && dNow - pCache->aSlots[i].dLastSeen > SESSION_IDLE_SECS)
+		{
+			sessionRemove(pCache, i); /* Re-examine i: a chain member may have shifted into it. */
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+
+/**
+	* Copy a row aside (fields packed into one text buffer, stored as offsets). Storage only grows.
+	*
+	* @param   RowStore* pStore, store
+	* @param   MYSQL_ROW row, row of the transaction query
+	* @return  void
+*/
+
+void rowStoreAdd(RowStore* pStore, MYSQL_ROW row)
+{
+	size_t* pOffsets;
+	unsigned int c;
+
+	if (pStore->iRows == pStore->iRowCap)
+	{
+		unsigned int iCap = (pStore->iRowCap == 0) ? 16 : pStore->iRowCap * 2;
+		size_t* aGrown = realloc(pStore->aOffsets, sizeof(size_t) * TRX_COLUMNS * iCap);
+
+		if (aGrown == NULL)
+		{
+			return;
+		}
+
+		pStore->aOffsets = aGrown;
+		pStore->iRowCap = iCap;
+	}
+
+	pOffsets = &pStore->aOffsets[pStore->iRows * TRX_COLUMNS];
+
+	for (c = 0; c < TRX_COLUMNS; c++)
+	{
+		size_t iLen;
+
+		if (row[c] == NULL)
+		{
+			pOffsets[c] = SNAP_NULL;
+			continue;
+		}
+
+		iLen = strlen(row[c]) + 1;
+
+		if (pStore->iTextLen + iLen > pStore->iTextCap)
+		{
+			size_t iCap = (pStore->iTextCap == 0) ? 8192 : pStore->iTextCap * 2;
+			char* pGrown;
+
+			while (pStore->iTextLen + iLen > iCap)
+			{
+				iCap *= 2;
+			}
+
+			pGrown = realloc(pStore->pText, iCap);
+
+			if (pGrown == NULL)
+			{
+				return; /* Row dropped: not counted. */
+			}
+
+			pStore->pText = pGrown;
+			pStore->iTextCap = iCap;
+		}
+
+		memcpy(pStore->pText + pStore->iTextLen, row[c], iLen);
+		pOffsets[c] = pStore->iTextLen;
+		pStore->iTextLen += iLen;
+	}
+
+	pStore->iRows++;
+}
+
+
+/**
+	* A stored row, as a MYSQL_ROW (valid until the next call).
+	*
+	* @param   RowStore* pStore, store
+	* @param   unsigned int iRow, row index
+	* @return  MYSQL_ROW
+*/
+
+MYSQL_ROW rowStoreRow(RowStore* pStore, unsigned int iRow)
+{
+	size_t const* pOffsets = &pStore->aOffsets[iRow * TRX_COLUMNS];
+	unsigned int c;
+
+	for (c = 0; c < TRX_COLUMNS; c++)
+	{
+		pStore->aRow[c] = (pOffsets[c] == SNAP_NULL) ? NULL : pStore->pText + pOffsets[c];
+	}
+
+	return pStore->aRow;
+}
+
+
+/**
+	* Release a row store.
+	*
+	* @param   RowStore* pStore, store
+	* @return  void
+*/
+
+void rowStoreFree(RowStore* pStore)
+{
+	free(pStore->aOffsets);
+	free(pStore->pText);
+	memset(pStore, 0, sizeof(RowStore));
+}
+
+
+/**
+	* Queue a transaction for deep capture the first time it crosses a threshold.
+	* Captured transactions are remembered (and marked seen) until they end, so each is captured once.
+	*
+	* @param   Capture* pCap, capture state
+	* @param   MYSQL_ROW row, row of the transaction query
+	* @return  void
+*/
+
+void captureCheck(Capture* pCap, MYSQL_ROW row)
+{
+	uint64_t iSecs = binNumber(row[12]);
+	uint64_t iLocked = binNumber(row[4]);
+	unsigned int iNew = 0;
+	TrxEntry* pTrx = trxFind(&pCap->captured, row[0]);
+	CaptureJob* pJob;
+
+	if (pTrx != NULL)
+	{
+		pTrx->iGeneration = pCap->captured.iGeneration;
+		return;
+	}
+
+	if ( ! ((iCaptureAge > 0 && iSecs >= iCaptureAge) || (iCaptureLocked > 0 && iLocked >= iCaptureLocked)))
+	{
+		return;
+	}
+
+	/* Queue full: still over the threshold next sample, captured then. trx_id goes into SQL text. */
+	if (pCap->iJobs == CAPTURE_PER_TICK || ! captureNumeric(row[0]))
+	{
+		return;
+	}
+
+	pTrx = trxLookup(&pCap->captured, row[0], &iNew);
+
+	if (pTrx == NULL)
+	{
+		return;
+	}
+
+	pTrx->iGeneration = pCap->captured.iGeneration;
+
+	pJob = &pCap->aJobs[pCap->iJobs++];
+	copyField(pJob->aTrxId, row[0], TRX_NUM_LEN);
+	copyField(pJob->aThread, row[1], TRX_NUM_LEN);
+	copyField(pJob->aProcess, row[2], TRX_NUM_LEN);
+	copyField(pJob->aStarted, row[11], TRX_NUM_LEN);
+	copyField(pJob->aUser, row[13], TRX_NAME_LEN);
+	copyField(pJob->aProgram, row[17], TRX_NAME_LEN);
+	copyField(pJob->aState, row[14], TRX_NAME_LEN);
+	pJob->iSecs = iSecs;
+	pJob->iLocked = iLocked;
+}
+
+
+/**
+	* Forget captured transactions not seen in a complete sample: they have ended.
+	*
+	* @param   Capture* pCap, capture state
+	* @return  void
+*/
+
+void captureSweep(Capture* pCap)
+{
+	TrxTable* pTable = &pCap->captured;
+	unsigned int i = 0;
+
+	while (i < pTable->iSize)
+	{
+		if (pTable->aSlots[i].iUsed && pTable->aSlots[i].iGeneration != pTable->iGeneration)
+		{
+			trxRemove(pTable, i); /* Re-examine i: a chain member may have shifted into it. */
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	pTable->iGeneration++;
+}
+
+
+/**
+	* Write the queued captures, one file each, on the collector connection.
+	* Run between samples: a capture is a rare event and its queries must see the transaction still open.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   Capture* pCap, capture state
+	* @return  void
+*/
+
+void captureRun(MYSQL* pConn, Capture* pCap)
+{
+	unsigned int i;
+
+	for (i = 0; i < pCap->iJobs; i++)
+	{
+		CaptureJob const* pJob = &pCap->aJobs[i];
+		char aPath[1024];
+		char aStamp[20];
+		time_t tNow = time(NULL);
+		struct tm tmNow;
+		FILE* fp;
+
+		localtime_r(&tNow, &tmNow);
+		strftime(aStamp, sizeof(aStamp), "%Y%m%d-%H%M%S", &tmNow);
+		snprintf(aPath, sizeof(aPath), "%s/trx-%s-%s.txt", pCaptureDir, pJob->aTrxId, aStamp);
+
+		fp = fopen(aPath, "w");
+
+		if (fp == NULL)
+		{
+			pCap->iFailed++;
+			continue;
+		}
+
+		captureWrite(pConn, pJob, fp);
+
+		if (fclose(fp) != 0)
+		{
+			pCap->iFailed++;
+		}
+		else
+		{
+			pCap->iWritten++;
+		}
+	}
+
+	pCap->iJobs = 0;
+}
+
+
+/**
+	* Write one capture: what triggered it, then each diagnostic query's rows.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   CaptureJob* pJob, transaction to capture
+	* @param   FILE* fp, capture file
+	* @return  void
+*/
+
+void captureWrite(MYSQL* pConn, CaptureJob const* pJob, FILE* fp)
+{
+	char aSQL[1024];
+	char aTime[32];
+	unsigned int iThread = captureNumeric(pJob->aThread);
+	unsigned int iProcess = captureNumeric(pJob->aProcess);
+
+	formatTime(wallTime(), aTime, sizeof(aTime));
+
+	fprintf(fp, "%s v.%s capture at %s\n\n", APP_NAME, MB_VERSION, aTime);
+
+	if (iCaptureAge > 0 && pJob->iSecs >= iCaptureAge)
+	{
+		fprintf(fp, "trigger: running %" PRIu64 " secs (--capture-age %u)\n", pJob->iSecs, iCaptureAge);
+	}
+
+	if (iCaptureLocked > 0 && pJob->iLocked >= iCaptureLocked)
+	{
+		fprintf(fp, "trigger: %" PRIu64 " rows locked (--capture-locked %llu)\n", pJob->iLocked, iCaptureLocked);
+	}
+
+	fprintf(fp, "trx: %s\nthd: %s\nps: %s\nuser: %s\nprogram: %s\nstate: %s\nstarted: %s\n", pJob->aTrxId, pJob->aThread, pJob->aProcess, pJob->aUser, pJob->aProgram, pJob->aState, pJob->aStarted);
+
+	snprintf(aSQL, sizeof(aSQL), "SELECT * FROM information_schema.INNODB_TRX WHERE trx_id = '%s'", pJob->aTrxId);
+	captureSection(pConn, fp, "transaction", aSQL);
+
+	if (iThread)
+	{
+		snprintf(aSQL, sizeof(aSQL), "SELECT PROCESSLIST_COMMAND, PROCESSLIST_TIME, PROCESSLIST_STATE, PROCESSLIST_DB, PROCESSLIST_INFO FROM performance_schema.threads WHERE THREAD_ID = %s", pJob->aThread);
+		captureSection(pConn, fp, "thread (full statement)", aSQL);
+
+		snprintf(aSQL, sizeof(aSQL), "SELECT EVENT_ID, CURRENT_SCHEMA, ROUND(TIMER_WAIT/1000000000000, 6) AS secs, ROUND(LOCK_TIME/1000000000000, 6) AS lock_secs, ROWS_EXAMINED, ROWS_SENT, ROWS_AFFECTED, CREATED_TMP_DISK_TABLES, NO_INDEX_USED, ERRORS, WARNINGS, SQL_TEXT FROM performance_schema.events_statements_current WHERE THREAD_ID = %s", pJob->aThread);
+		captureSection(pConn, fp, "current statement", aSQL);
+
+		snprintf(aSQL, sizeof(aSQL), "SELECT EVENT_ID, CURRENT_SCHEMA, ROUND(TIMER_WAIT/1000000000000, 6) AS secs, ROUND(LOCK_TIME/1000000000000, 6) AS lock_secs, ROWS_EXAMINED, ROWS_SENT, ROWS_AFFECTED, CREATED_TMP_DISK_TABLES, NO_INDEX_USED, ERRORS, WARNINGS, SQL_TEXT FROM performance_schema.events_statements_history WHERE THREAD_ID = %s ORDER BY EVENT_ID", pJob->aThread);
+		captureSection(pConn, fp, "statement history", aSQL);
+	}
+	else
+	{
+		fprintf(fp, "\n-- thread\n(thread not known)\n");
+	}
+
+	/* MySQL 8.0 lock tables: on earlier servers the sections hold the error. */
+	snprintf(aSQL, sizeof(aSQL), "SELECT OBJECT_SCHEMA, OBJECT_NAME, INDEX_NAME, LOCK_TYPE, LOCK_MODE, LOCK_STATUS, COUNT(*) AS locks FROM performance_schema.data_locks WHERE ENGINE_TRANSACTION_ID = %s GROUP BY OBJECT_SCHEMA, OBJECT_NAME, INDEX_NAME, LOCK_TYPE, LOCK_MODE, LOCK_STATUS ORDER BY locks DESC", pJob->aTrxId);
+	captureSection(pConn, fp, "locks held, summary", aSQL);
+
+	snprintf(aSQL, sizeof(aSQL), "SELECT OBJECT_SCHEMA, OBJECT_NAME, INDEX_NAME, LOCK_TYPE, LOCK_MODE, LOCK_STATUS, LOCK_DATA FROM performance_schema.data_locks WHERE ENGINE_TRANSACTION_ID = %s LIMIT %d", pJob->aTrxId, CAPTURE_LOCK_ROWS);
+	captureSection(pConn, fp, "locks held, detail", aSQL);
+
+	snprintf(aSQL, sizeof(aSQL), "SELECT w.REQUESTING_ENGINE_TRANSACTION_ID AS waiting_trx, r.trx_mysql_thread_id AS waiting_ps, TIMESTAMPDIFF(SECOND, r.trx_wait_started, NOW()) AS wait_secs, l.OBJECT_SCHEMA, l.OBJECT_NAME, l.INDEX_NAME, l.LOCK_MODE, l.LOCK_DATA, r.trx_query AS waiting_query FROM performance_schema.data_lock_waits w INNER JOIN information_schema.INNODB_TRX r ON r.trx_id = w.REQUESTING_ENGINE_TRANSACTION_ID INNER JOIN performance_schema.data_locks l ON l.ENGINE_LOCK_ID = w.REQUESTING_ENGINE_LOCK_ID WHERE w.BLOCKING_ENGINE_TRANSACTION_ID = %s LIMIT %d", pJob->aTrxId, CAPTURE_ROWS_MAX);
+	captureSection(pConn, fp, "transactions waiting on this one", aSQL);
+
+	if (iProcess)
+	{
+		snprintf(aSQL, sizeof(aSQL), "EXPLAIN FOR CONNECTION %s", pJob->aProcess);
+		captureSection(pConn, fp, "plan of the running statement", aSQL);
+	}
+}
+
+
+/**
+	* Run one diagnostic query into the capture file, a name: value line per column.
+	*
+	* @param   MYSQL* pConn, connection pointer
+	* @param   FILE* fp, capture file
+	* @param   char* pTitle, section title
+	* @param   char* pSQL, query
+	* @return  void
+*/
+
+void captureSection(MYSQL* pConn, FILE* fp, char const* pTitle, char const* pSQL)
+{
+	MYSQL_RES* pResult;
+	MYSQL_FIELD* aFields;
+	MYSQL_ROW row;
+	unsigned int iFields;
+	unsigned int iRows = 0;
+	unsigned int c;
+
+	fprintf(fp, "\n-- %s\n", pTitle);
+
+	pResult = monQuery(pConn, pSQL);
+
+	if (mysql_errno(pConn) != 0)
+	{
+		fprintf(fp, "(error %u: %s)\n", mysql_errno(pConn), mysql_error(pConn));
+		mysql_free_result(pResult);
+		return;
+	}
+
+	if (pResult == NULL)
+	{
+		fprintf(fp, "(none)\n");
+		return;
+	}
+
+	iFields = mysql_num_fields(pResult);
+	aFields = mysql_fetch_fields(pResult);
+
+	while ((row = mysql_fetch_row(pResult)) != NULL)
+	{
+		if (++iRows > CAPTURE_ROWS_MAX)
+		{
+			fprintf(fp, "(more rows not written)\n");
+			break;
+		}
+
+		fprintf(fp, "[%u]\n", iRows);
+
+		for (c = 0; c < iFields; c++)
+		{
+			fprintf(fp, "%s: %s\n", aFields[c].name, (row[c] != NULL ? row[c] : "NULL"));
+		}
+	}
+
+	if (iRows == 0)
+	{
+		fprintf(fp, "(none)\n");
+	}
+
+	mysql_free_result(pResult);
+}
+
+
+/**
+	* Check a value is a plain unsigned number before it is written into SQL.
+	*
+	* @param   char* pValue, field value (may be NULL)
+	* @return  unsigned integer, 1 if all digits
+*/
+
+unsigned int captureNumeric(char const* pValue)
+{
+	size_t iLen = 0;
+
+	if (pValue == NULL || *pValue == '\0')
+	{
+		return 0;
+	}
+
+	for (; pValue[iLen] != '\0'; iLen++)
+	{
+		if (pValue[iLen] < '0' || pValue[iLen] > '9' || iLen == TRX_NUM_LEN - 1)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+/**
+	* FNV-1a hash of a trx_id.
+	*
+	* @param   char* pTrxId, trx_id text
+	* @return  uint32_t
+*/
+
+uint32_t trxHash(char const* pTrxId)
+{
+	uint32_t iHash = 2166136261u;
+
+	while (*pTrxId)
+	{
+		iHash ^= (unsigned char) *pTrxId++;
+		iHash *= 16777619u;
+	}
+
+	return iHash;
+}
+
+
+/**
+	* Allocate an empty tracker table.
+	*
+	* @param   TrxTable* pTable, table
+	* @param   unsigned int iSize, slots (power of 2)
+	* @return  unsigned integer, 0 on allocation failure
+*/
+
+unsigned int trxTableInit(TrxTable* pTable, unsigned int iSize)
+{
+	pTable->aSlots = calloc(iSize, sizeof(TrxEntry));
+
+	if (pTable->aSlots == NULL)
+	{
+		return 0;
+	}
+
+	pTable->iSize = iSize;
+	pTable->iCount = 0;
+
+	return 1;
+}
+
+
+/**
+	* Release the tracker table.
+	*
+	* @param   TrxTable* pTable, table
+	* @return  void
+*/
+
+void trxTableFree(TrxTable* pTable)
+{
+	free(pTable->aSlots);
+	pTable->aSlots = NULL;
+	pTable->iSize = 0;
+	pTable->iCount = 0;
+}
+
+
+/**
+	* Find a transaction, inserting an empty entry if new.
+	* The table doubles once half full, keeping probe chains short.
+	*
+	* @param   TrxTable* pTable, table
+	* @param   char* pTrxId, trx_id text
+	* @param   unsigned int* pNew, set to 1 if inserted
+	* @return  TrxEntry*, NULL if the table could not grow
+*/
+
+TrxEntry* trxLookup(TrxTable* pTable, char const* pTrxId, unsigned int* pNew)
+{
+	uint32_t iHash = trxHash(pTrxId);
+	unsigned int iMask;
+	unsigned int i;
+
+	if ((pTable->iCount + 1) * 2 > pTable->iSize)
+	{
+		TrxTable tGrown;
+
+		if ( ! trxTableInit(&tGrown, pTable->iSize * 2))
+		{
+			return NULL;
+		}
+
+		for (i = 0; i < pTable->iSize; i++)
+		{
+			if (pTable->aSlots[i].iUsed)
+			{
+				unsigned int j = pTable->aSlots[i].iHash & (tGrown.iSize - 1);
+
+				while (tGrown.aSlots[j].iUsed)
+				{
+					j = (j + 1) & (tGrown.iSize - 1);
+				}
+
+				tGrown.aSlots[j] = pTable->aSlots[i];
+			}
+		}
+
+		tGrown.iCount = pTable->iCount;
+		tGrown.iGeneration = pTable->iGeneration;
+		free(pTable->aSlots);
+		*pTable = tGrown;
+	}
+
+	iMask = pTable->iSize - 1;
+
+	for (i = iHash & iMask; pTable->aSlots[i].iUsed; i = (i + 1) & iMask)
+	{
+		if (pTable->aSlots[i].iHash == iHash && strcmp(pTable->aSlots[i].aTrxId, pTrxId) == 0)
+		{
+			*pNew = 0;
+			return &pTable->aSlots[i];
+		}
+	}
+
+	memset(&pTable->aSlots[i], 0, sizeof(TrxEntry));
+	copyField(pTable->aSlots[i].aTrxId, pTrxId, TRX_NUM_LEN);
+	pTable->aSlots[i].iHash = iHash;
+	pTable->aSlots[i].iUsed = 1;
+	pTable->iCount++;
+	*pNew = 1;
+
+	return &pTable->aSlots[i];
+}
+
+
+/**
+	* Find a transaction without inserting.
+	*
+	* @param   TrxTable* pTable, table
+	* @param   char* pTrxId, trx_id text
+	* @return  TrxEntry*, NULL if not present
+*/
+
+TrxEntry* trxFind(TrxTable* pTable, char const* pTrxId)
+{
+	uint32_t iHash = trxHash(pTrxId);
+	unsigned int iMask = pTable->iSize - 1;
+	unsigned int i;
+
+	for (i = iHash & iMask; pTable->aSlots[i].iUsed; i = (i + 1) & iMask)
+	{
+		if (pTable->aSlots[i].iHash == iHash && strcmp(pTable->aSlots[i].aTrxId, pTrxId) == 0)
+		{
+			return &pTable->aSlots[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+	* Remove a slot, shifting later members of its probe chain back into the hole.
+	*
+	* @param   TrxTable* pTable, table
+	* @param   unsigned int iHole, slot to empty
+	* @return  void
+*/
+
+void trxRemove(TrxTable* pTable, unsigned int iHole)
+{
+	unsigned int iMask = pTable->iSize - 1;
+	unsigned int i = iHole;
+
+	pTable->aSlots[iHole].iUsed = 0;
+	pTable->iCount--;
+
+	for (i = (i + 1) & iMask; pTable->aSlots[i].iUsed; i = (i + 1) & iMask)
+	{
+		unsigned int iHome = pTable->aSlots[i].iHash & iMask;
+
+		/* Movable if the hole lies between the entry's home slot and its current slot. */
+		if (((i - iHome) & iMask) >= ((i - iHole) & iMask))
+		{
+			pTable->aSlots[iHole] = pTable->aSlots[i];
+			pTable->aSlots[i].iUsed = 0;
+			iHole = i;
+		}
+	}
+}
+
+
+/**
+	* Diff one snapshot row against the tracked transaction, logging begin, statement and state changes.
+	* Nothing is logged until the transaction first matches the filters: its begin then carries the first-seen time
+	* and peaks from when it was first tracked, and it is logged until it ends, whether it still matches or not.
+	*
+	* @param   TrxTable* pTable, table
+	* @param   MYSQL_ROW row, row of the transaction query
+	* @param   LogWriter* pLog, log writer
+	* @param   double dNow, snapshot wall-clock time
+	* @param   uint64_t iSeq, sample sequence number
+	* @param   unsigned int iMatch, 1 if the row matches the filters (trxMatch)
+	* @return  void
+*/
+
+void trxTrack(TrxTable* pTable, MYSQL_ROW row, LogWriter* pLog, double dNow, uint64_t iSeq, unsigned int iMatch)
+{
+	unsigned int iNew = 0;
+	uint64_t iEventId = (row[18] != NULL) ? strtoull(row[18], NULL, 10) : 0;
+	char aStmt[TRX_STMT_LEN];
+	TrxEntry* pTrx;
+
+	if (row[0] == NULL)
+	{
+		return;
+	}
+
+	pTrx = trxLookup(pTable, row[0], &iNew);
+
+	if (pTrx == NULL)
+	{
+		return;
+	}
+
+	copyField(aStmt, row[16], sizeof(aStmt));
+	replaceChar(aStmt, '\t', ' ');
+	replaceChar(aStmt, '\n', ' ');
+
+	pTrx->iGeneration = pTable->iGeneration;
+	pTrx->dLastSeen = dNow;
+	pTrx->iLocked = (row[4] != NULL) ? strtoull(row[4], NULL, 10) : 0;
+	pTrx->iModified = (row[5] != NULL) ? strtoull(row[5], NULL, 10) : 0;
+	copyField(pTrx->aSecs, row[12], TRX_NUM_LEN);
+	copyField(pTrx->aOpState, row[15], TRX_NAME_LEN);
+
+	if (pTrx->iLocked > pTrx->iPeakLocked)
+	{
+		pTrx->iPeakLocked = pTrx->iLocked;
+	}
+
+	if (pTrx->iModified > pTrx->iPeakModified)
+	{
+		pTrx->iPeakModified = pTrx->iModified;
+	}
+
+	if (iNew)
+	{
+		pTrx->dFirstSeen = dNow;
+		pTrx->iEventId = iEventId;
+		copyField(pTrx->aThread, row[1], TRX_NUM_LEN);
+		copyField(pTrx->aProcess, row[2], TRX_NUM_LEN);
+		copyField(pTrx->aStarted, row[11], TRX_NUM_LEN);
+		copyField(pTrx->aUser, row[13], TRX_NAME_LEN);
+		copyField(pTrx->aProgram, row[17], TRX_NAME_LEN);
+		copyField(pTrx->aState, row[14], TRX_NAME_LEN);
+		memcpy(pTrx->aStmt, aStmt, sizeof(aStmt));
+		pTrx->iMatched = 0;
+	}
+	else
+	{
+		if (iEventId != pTrx->iEventId || strcmp(aStmt, pTrx->aStmt) != 0)
+		{
+			pTrx->iEventId = iEventId;
+			memcpy(pTrx->aStmt, aStmt, sizeof(aStmt));
+
+			if (pTrx->iMatched)
+			{
+				trxEvent(pLog, "stmt", pTrx, dNow, iSeq);
+			}
+		}
+
+		if (row[14] != NULL && strcmp(row[14], pTrx->aState) != 0)
+		{
+			copyField(pTrx->aState, row[14], TRX_NAME_LEN);
+
+			if (pTrx->iMatched)
+			{
+				trxEvent(pLog, "state", pTrx, dNow, iSeq);
+			}
+		}
+	}
+
+	if (iMatch && ! pTrx->iMatched)
+	{
+		pTrx->iMatched = 1;
+		trxEvent(pLog, "begin", pTrx, dNow, iSeq);
+	}
+}
+
+
+/**
+	* Log and drop transactions not seen in the current generation (logged only if they matched the filters).
+	*
+	* @param   TrxTable* pTable, table
+	* @param   LogWriter* pLog, log writer
+	* @param   double dNow, snapshot wall-clock time
+	* @param   uint64_t iSeq, sample sequence number
+	* @param   char* pEvent, event name to log ('end', or 'open' at exit)
+	* @return  void
+*/
+
+void trxSweep(TrxTable* pTable, LogWriter* pLog, double dNow, uint64_t iSeq, char const* pEvent)
+{
+	unsigned int i = 0;
+
+	while (i < pTable->iSize)
+	{
+		if (pTable->aSlots[i].iUsed && pTable->aSlots[i].iGeneration != pTable->iGeneration)
+		{
+			if (pTable->aSlots[i].iMatched)
+			{
+				trxEvent(pLog, pEvent, &pTable->aSlots[i], dNow, iSeq);
+			}
+
+			trxRemove(pTable, i); /* Re-examine i: a chain member may have shifted into it. */
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	pTable->iGeneration++;
+}
+
+
+/**
+	* Write one lifecycle event row.
+	*
+	* @param   LogWriter* pLog, log writer
+	* @param   char* pEvent, event name
+	* @param   TrxEntry* pTrx, transaction
+	* @param   double dNow, event wall-clock time
+	* @param   uint64_t iSeq, sample sequence number
+	* @return  void
+*/
+
+void trxEvent(LogWriter* pLog, char const* pEvent, TrxEntry const* pTrx, double dNow, uint64_t iSeq)
+{
+	char aNow[32];
+	char aFirst[32];
+	char aLast[32];
+
+	formatTime(dNow, aNow, sizeof(aNow));
+	formatTime(pTrx->dFirstSeen, aFirst, sizeof(aFirst));
+	formatTime(pTrx->dLastSeen, aLast, sizeof(aLast));
+
+	logPrintf
+	(
+		pLog,
+		"%s|%s|%" PRIu64 "|%s|%s|%s|%s|%s|%s|%s|%s|%.3f|%s|%" PRIu64 "|%" PRIu64 "|%" PRIu64 "|%" PRIu64 "|%s|%s|%s;\n",
+		pEvent, aNow, iSeq, pTrx->aTrxId, pTrx->aThread, pTrx->aProcess, pTrx->aUser, pTrx->aProgram, pTrx->aStarted,
+		aFirst, aLast, pTrx->dLastSeen - pTrx->dFirstSeen, pTrx->aSecs,
+		pTrx->iLocked, pTrx->iModified, pTrx->iPeakLocked, pTrx->iPeakModified,
+		pTrx->aState, pTrx->aOpState, pTrx->aStmt
+	);
+}
+
+
+/**
+	* Open the logfile and start the writer thread.
+	*
+	* @param   LogWriter* pLog, log writer (options already set)
+	* @param   char* pPath, logfile path
+	* @param   void* pHeader, header (text row or binary) written at the top of each file
+	* @param   size_t iHeaderLen, header length
+	* @return  unsigned integer, 0 on failure
+*/
+
+unsigned int logOpen(LogWriter* pLog, char const* pPath, void const* pHeader, size_t iHeaderLen)
+{
+	unsigned int i;
+
+	pLog->pPath = pPath;
+	pLog->pHeader = pHeader;
+	pLog->iHeaderLen = iHeaderLen;
+	pLog->iActive = -1;
+	pLog->iFreeCount = 0;
+
+	if ( ! logSinkOpen(pLog))
+	{
+		return 0;
+	}
+
+	for (i = 0; i < LOG_BUFFERS; i++)
+	{
+		pLog->aBufs[i] = malloc(LOG_BUF_LEN);
+
+		if (pLog->aBufs[i] != NULL)
+		{
+			pLog->aFree[pLog->iFreeCount++] = i;
+		}
+	}
+
+	pthread_mutex_init(&pLog->mLock, NULL);
+	pthread_cond_init(&pLog->cReady, NULL);
+
+	if (pLog->iFreeCount == 0 || pthread_create(&pLog->tWriter, NULL, logWriterThread, pLog) != 0)
+	{
+		logSinkClose(pLog);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/**
+	* Hand over the last buffer, let the writer drain and close the file.
+	*
+	* @param   LogWriter* pLog, log writer
+	* @return  void
+*/
+
+void logClose(LogWriter* pLog)
+{
+	unsigned int i;
+
+	logSubmit(pLog);
+
+	pthread_mutex_lock(&pLog->mLock);
+	pLog->iStop = 1;
+	pthread_cond_signal(&pLog->cReady);
+	pthread_mutex_unlock(&pLog->mLock);
+
+	pthread_join(pLog->tWriter, NULL);
+
+	logSinkClose(pLog);
+
+	for (i = 0; i < LOG_BUFFERS; i++)
+	{
+		free(pLog->aBufs[i]);
+	}
+
+	pthread_mutex_destroy(&pLog->mLock);
+	pthread_cond_destroy(&pLog->cReady);
+}
+
+
+/**
+	* Format one record into the active buffer (producer thread).
+	* Never blocks on I/O: if no buffer is free, or the record is larger than a buffer, it is dropped and counted.
+	*
+	* @param   LogWriter* pLog, log writer
+	* @param   char* pFormat, printf format
+	* @return  void
+*/
+
+void logPrintf(LogWriter* pLog, char const* pFormat, ...)
+{
+	unsigned int iTry;
+
+	for (iTry = 0; iTry < 2; iTry++)
+	{
+		va_list args;
+		size_t iRoom;
+		int iLen;
+
+		if (pLog->iActive < 0 && ! logTake(pLog))
+		{
+			break;
+		}
+
+		iRoom = LOG_BUF_LEN - pLog->aLens[pLog->iActive];
+
+		va_start(args, pFormat);
+		iLen = vsnprintf(pLog->aBufs[pLog->iActive] + pLog->aLens[pLog->iActive], iRoom, pFormat, args);
+		va_end(args);
+
+		if (iLen < 0)
+		{
+			break;
+		}
+
+		if ((size_t) iLen < iRoom)
+		{
+			pLog->aLens[pLog->iActive] += (size_t) iLen;
+			pLog->iRecords++;
+			return;
+		}
+
+		if (pLog->aLens[pLog->iActive] == 0)
+		{
+			break; /* Larger than an empty buffer. */
+		}
+
+		logSubmit(pLog); /* Full: retry in a fresh buffer. */
+	}
+
+	pLog->iDropped++;
+}
+
+
+/**
+	* Copy preformatted bytes (a binary block) into the active buffer (producer thread), same drop policy as logPrintf().
+	*
+	* @param   LogWriter* pLog, log writer
+	* @param   void* pData, bytes
+	* @param   size_t iLen, length (at most LOG_BUF_LEN)
+	* @param   uint64_t iRecords, rows contained, for the record and drop counts
+	* @return  void
+*/
+
+void logWrite(LogWriter* pLog, void const* pData, size_t iLen, uint64_t iRecords)
+{
+	if (pLog->iActive >= 0 && LOG_BUF_LEN - pLog->aLens[pLog->iActive] < iLen)
+	{
+		logSubmit(pLog);
+	}
+
+	if (iLen > LOG_BUF_LEN || (pLog->iActive < 0 && ! logTake(pLog)))
+	{
+		pLog->iDropped += iRecords;
+		return;
+	}
+
+	memcpy(pLog->aBufs[pLog->iActive] + pLog->aLens[pLog->iActive], pData, iLen);
+	pLog->aLens[pLog->iActive] += iLen;
+	pLog->iRecords += iRecords;
+}
+
+
+/**
+	* Take an empty buffer as the active buffer.
+	*
+	* @param   LogWriter* pLog, log writer
+	* @return  unsigned integer, 0 if none free (writer behind)
+*/
+
+unsigned int logTake(LogWriter* pLog)
+{
+	pthread_mutex_lock(&pLog->mLock);
+
+	if (pLog->iFreeCount > 0)
+	{
+		pLog->iActive = (int) pLog->aFree[--pLog->iFreeCount];
+		pLog->aLens[pLog->iActive] = 0;
+		pLog->dActiveStart = monotonicTime();
+	}
+
+	pthread_mutex_unlock(&pLog->mLock);
+
+	return (pLog->iActive >= 0);
+}
+
+
+/**
+	* Queue the active buffer for writing.
+	*
+	* @param   LogWriter* pLog, log writer
+	* @return  void
+*/
+
+void logSubmit(LogWriter* pLog)
+{
+	if (pLog->iActive < 0 || pLog->aLens[pLog->iActive] == 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&pLog->mLock);
+	pLog->aPending[(pLog->iPendHead + pLog->iPendCount) % LOG_BUFFERS] = (unsigned int) pLog->iActive;
+	pLog->iPendCount++;
+	pthread_cond_signal(&pLog->cReady);
+	pthread_mutex_unlock(&pLog->mLock);
+
+	pLog->iActive = -1;
+}
+
+
+/**
+	* Once per sample: hand over a part-filled buffer once it is LOG_FLUSH_SECS old, so the file stays current.
+	*
+	* @param   LogWriter* pLog, log writer
+	* @param   double dNow, monotonic time
+	* @return  void
+*/
+
+void logTick(LogWriter* pLog, double dNow)
+{
+	if (pLog->iActive >= 0 && dNow - pLog->dActiveStart >= LOG_FLUSH_SECS)
+	{
+		logSubmit(pLog);
+	}
+}
+
+
+/**
+	* Writer thread: write queued buffers in order, rotating between them.
+	*
+	* @param   void* pArg, LogWriter*
+	* @return  void*, NULL
+*/
+
+void* logWriterThread(void* pArg)
+{
+	LogWriter* pLog = (LogWriter*) pArg;
+	sigset_t sigSet;
+
+	sigemptyset(&sigSet);
+	sigaddset(&sigSet, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+
+	pthread_mutex_lock(&pLog->mLock);
+
+	for (;;)
+	{
+		unsigned int iBuf;
+
+		while (pLog->iPendCount == 0 && ! pLog->iStop)
+		{
+			pthread_cond_wait(&pLog->cReady, &pLog->mLock);
+		}
+
+		if (pLog->iPendCount == 0)
+		{
+			break; /* Stopped and drained. */
+		}
+
+		iBuf = pLog->aPending[pLog->iPendHead];
+		pLog->iPendHead = (pLog->iPendHead + 1) % LOG_BUFFERS;
+		pLog->iPendCount--;
+
+		pthread_mutex_unlock(&pLog->mLock);
+
+		logSinkWrite(pLog, pLog->aBufs[iBuf], pLog->aLens[iBuf]);
+
+		if ((pLog->iRotateBytes > 0 && pLog->iFileBytes >= pLog->iRotateBytes) || (pLog->dRotateSecs > 0 && monotonicTime() - pLog->dFileStart >= pLog->dRotateSecs))
+		{
+			logRotate(pLog);
+		}
+
+		pthread_mutex_lock(&pLog->mLock);
+		pLog->aFree[pLog->iFreeCount++] = iBuf;
+	}
+
+	pthread_mutex_unlock(&pLog->mLock);
+
+	return NULL;
+}
+
+
+/**
+	* Open (append) the logfile, plain or gzip, and write the header row.
+	*
+	* @param   LogWriter* pLog, log writer
+	* @return  unsigned integer, 0 on failure
+*/
+
+unsigned int logSinkOpen(LogWriter* pLog)
+{
+	if (pLog->iGzip)
+	{
+		pLog->gz = gzopen(pLog->pPath, "ab"); /* Appending adds a gzip member: still one valid stream. */
+
+		if (pLog->gz == NULL)
+		{
+			return 0;
+		}
+	}
+	else
+	{
+		pLog->fp = fopen(pLog->pPath, "a");
+
+		if (pLog->fp == NULL)
+		{
+			return 0;
+		}
+	}
+
+	pLog->iFileBytes = 0;
+	pLog->dFileStart = monotonicTime();
+
+	logSinkWrite(pLog, pLog->pHeader, pLog->iHeaderLen);
+
+	return 1;
+}
+
+
+/**
+	* Write to the logfile.
+	*
+	* @param   LogWriter* pLog, log writer
+	* @param   void* pData, bytes
+	* @param   size_t iLen, length
+	* @return  void
+*/
+
+void logSinkWrite(LogWriter* pLog, void const* pData, size_t iLen)
+{
+	size_t iWritten = 0;
+
+	if (pLog->gz != NULL)
+	{
+		iWritten = (size_t) gzwrite(pLog->gz, pData, (unsigned int) iLen);
+	}
+	else if (pLog->fp != NULL)
+	{
+		iWritten = fwrite(pData, 1, iLen, pLog->fp);
+	}
+
+	if (iWritten != iLen)
+	{
+		pLog->iErrors++;
+	}
+
+	pLog->iFileBytes += iWritten;
+}
+
+
+/**
+	* Close the logfile.
+	*
+	* @param   LogWriter* pLog, log writer
+	* @return  void
+*/
+
+void logSinkClose(LogWriter* pLog)
+{
+	if (pLog->gz != NULL)
+	{
+		gzclose(pLog->gz);
+		pLog->gz = NULL;
+	}
+
+	if (pLog->fp != NULL)
+	{
+		fclose(pLog->fp);
+		pLog->fp = NULL;
+	}
+}
+
+
+/**
+	* Rotate: rename the current file with a timestamp (before any .gz suffix) and start a new one.
+	*
+	* @param   LogWriter* pLog, log writer
+	* @return  void
+*/
+
+void logRotate(LogWriter* pLog)
+{
+	char aRotated[512];
+	char aStamp[20];
+	time_t tNow = time(NULL);
+	struct tm tmLocal;
+	size_t iBase = strlen(pLog->pPath);
+	char const* pExt = "";
+
+	if (iBase > 3 && strcmp(pLog->pPath + iBase - 3, ".gz") == 0)
+	{
+		iBase -= 3;
+		pExt = ".gz";
+	}
+
+	localtime_r(&tNow, &tmLocal);
+	strftime(aStamp, sizeof(aStamp), "%Y%m%d-%H%M%S", &tmLocal);
+	snprintf(aRotated, sizeof(aRotated), "%.*s.%s%s", (int) iBase, pLog->pPath, aStamp, pExt);
+
+	/* Several rotations within a second (small size limit): keep them apart. */
+	if (access(aRotated, F_OK) == 0)
+	{
+		snprintf(aRotated, sizeof(aRotated), "%.*s.%s-%u%s", (int) iBase, pLog->pPath, aStamp, pLog->iRotations, pExt);
+	}
+
+	logSinkClose(pLog);
+
+	if (rename(pLog->pPath, aRotated) != 0)
+	{
+		pLog->iErrors++;
+	}
+
+	pLog->iRotations++;
+
+	if ( ! logSinkOpen(pLog))
+	{
+		pLog->iErrors++; /* Buffers are still recycled; records are lost until the process restarts. */
+	}
+}
+
+
+/**
+	* Log the sample record (after the sample's rows): sequence, time, collection latency and row count.
+	* Called before the cadence is updated, so the interval is the one the sample was taken at.
+	*
+	* @param   LogWriter* pLog, log writer
+	* @param   TrxSnapshot* pSnap, sample
+	* @return  void
+*/
+
+void logSample(LogWriter* pLog, TrxSnapshot const* pSnap)
+{
+	if (iBinary)
+	{
+		binAddSample(&binLog, pLog, pSnap);
+		return;
+	}
+
+	logPrintf
+	(
+		pLog,
+		"#sample|%" PRIu64 "|%s|%.3f|%.3f|%" PRIu64 "|%.0f|%u\n",
+		pSnap->iSeq, pSnap->aTime, pSnap->dQuery * 1000, pSnap->dFetch * 1000, pSnap->iTotal, cadTrx.dInterval * 1000, pSnap->iComplete
+	);
+}
+
+
+/**
+	* Numeric field for the binary log.
+	*
+	* @param   char* pValue, field value (may be NULL)
+	* @return  uint64_t, 0 for NULL
+*/
+
+uint64_t binNumber(char const* pValue)
+{
+	return (pValue != NULL) ? strtoull(pValue, NULL, 10) : 0;
+}
+
+
+/**
+	* 'YYYY-MM-DD HH:MM:SS' as secs since 1970-01-01 00:00:00, without applying any time zone,
+	* so the reader can print back exactly what the server returned.
+	* Days from civil date: Howard Hinnant's algorithm.
+	*
+	* @param   char* pDateTime, DATETIME text (may be NULL)
+	* @return  uint64_t, 0 for NULL or unparsable
+*/
+
+uint64_t binCivilSeconds(char const* pDateTime)
+{
+	int iY, iM, iD, iHr, iMin, iSec;
+	int iEra;
+	unsigned int iYoe, iDoy, iDoe;
+	int64_t iDays;
+
+	if (pDateTime == NULL || sscanf(pDateTime, "%d-%d-%d %d:%d:%d", &iY, &iM, &iD, &iHr, &iMin, &iSec) != 6)
+	{
+		return 0;
+	}
+
+	iY -= (iM <= 2);
+	iEra = (iY >= 0 ? iY : iY - 399) / 400;
+	iYoe = (unsigned int) (iY - iEra * 400);
+	iDoy = (unsigned int) ((153 * (iM + (iM > 2 ? -3 : 9)) + 2) / 5 + iD - 1);
+	iDoe = iYoe * 365 + iYoe / 4 - iYoe / 100 + iDoy;
+	iDays = (int64_t) iEra * 146097 + (int64_t) iDoe - 719468;
+
+	return (uint64_t) (iDays * 86400 + iHr * 3600 + iMin * 60 + iSec);
+}
+
+
+/**
+	* Dictionary index of a string within the current block, adding it if new.
+	* The caller guarantees room (binAddRow() completes a full block first).
+	*
+	* @param   BinLog* pBin, block
+	* @param   char* pValue, string (may be NULL)
+	* @return  uint32_t, dictionary index, TRXLOG_NULL for NULL
+*/
+
+uint32_t binIntern(BinLog* pBin, char const* pValue)
+{
+	uint32_t iHash = 2166136261u;
+	uint32_t iLen = 0;
+	unsigned int i;
+
+	if (pValue == NULL)
+	{
+		return TRXLOG_NULL;
+	}
+
+	while (pValue[iLen] != '\0' && iLen < TRXLOG_MAX_STRING)
+	{
+		iHash ^= (unsigned char) pValue[iLen++];
+		iHash *= 16777619u;
+	}
+
+	for (i = iHash & (BIN_DICT_SLOTS - 1); pBin->aSlots[i] != 0; i = (i + 1) & (BIN_DICT_SLOTS - 1))
+	{
+		uint32_t iIdx = pBin->aSlots[i] - 1;
+		uint32_t iStored;
+
+		memcpy(&iStored, pBin->aDict + pBin->aDictOffset[iIdx], sizeof(iStored));
+
+		if (pBin->aDictHash[iIdx] == iHash && iStored == iLen && memcmp(pBin->aDict + pBin->aDictOffset[iIdx] + sizeof(iStored), pValue, iLen) == 0)
+		{
+			return iIdx;
+		}
+	}
+
+	pBin->aSlots[i] = pBin->iDict + 1;
+	pBin->aDictHash[pBin->iDict] = iHash;
+	pBin->aDictOffset[pBin->iDict] = (uint32_t) pBin->iDictLen;
+	memcpy(pBin->aDict + pBin->iDictLen, &iLen, sizeof(iLen));
+	memcpy(pBin->aDict + pBin->iDictLen + sizeof(iLen), pValue, iLen);
+	pBin->iDictLen += sizeof(iLen) + iLen;
+
+	return pBin->iDict++;
+}
+
+
+/**
+	* Append one transaction row to the binary block, completing the block first if it is full.
+	*
+	* @param   BinLog* pBin, block
+	* @param   LogWriter* pLog, log writer
+	* @param   MYSQL_ROW row, row of the transaction query
+	* @param   double dTime, sample wall-clock time
+	* @param   uint64_t iSeq, sample sequence number
+	* @return  void
+*/
+
+void binAddRow(BinLog* pBin, LogWriter* pLog, MYSQL_ROW row, double dTime, uint64_t iSeq)
+{
+	uint32_t n;
+
+	if (pBin->iRows == TRXLOG_MAX_ROWS || pBin->iDict + TL_STRINGS > TRXLOG_MAX_DICT || pBin->iDictLen > TRXLOG_MAX_DICT_BYTES)
+	{
+		binFlush(pBin, pLog);
+	}
+
+	if (pBin->iRows == 0 && pBin->iSamples == 0)
+	{
+		pBin->dStart = monotonicTime();
+	}
+
+	n = pBin->iRows++;
+
+	pBin->aNumeric[TL_TIME][n] = (uint64_t) (dTime * 1e6);
+	pBin->aNumeric[TL_SEQ][n] = iSeq;
+	pBin->aNumeric[TL_TRX][n] = binNumber(row[0]);
+	pBin->aNumeric[TL_THREAD][n] = binNumber(row[1]);
+	pBin->aNumeric[TL_PROCESS][n] = binNumber(row[2]);
+	pBin->aNumeric[TL_EXAMINED][n] = binNumber(row[3]);
+	pBin->aNumeric[TL_LOCKED][n] = binNumber(row[4]);
+	pBin->aNumeric[TL_MODIFIED][n] = binNumber(row[5]);
+	pBin->aNumeric[TL_AFFECTED][n] = binNumber(row[6]);
+	pBin->aNumeric[TL_TMPDISK][n] = binNumber(row[7]);
+	pBin->aNumeric[TL_TABLES][n] = binNumber(row[8]);
+	pBin->aNumeric[TL_NOINDEX][n] = binNumber(row[9]);
+	pBin->aNumeric[TL_WAIT][n] = (row[10] != NULL) ? (uint64_t) (strtod(row[10], NULL) * 1e6) : 0;
+	pBin->aNumeric[TL_STARTED][n] = binCivilSeconds(row[11]);
+	pBin->aNumeric[TL_SECS][n] = binNumber(row[12]);
+
+	pBin->aStrings[TL_USER][n] = binIntern(pBin, row[13]);
+	pBin->aStrings[TL_PROGRAM][n] = binIntern(pBin, row[17]);
+	pBin->aStrings[TL_STATE][n] = binIntern(pBin, row[14]);
+	pBin->aStrings[TL_OPSTATE][n] = binIntern(pBin, row[15]);
+	pBin->aStrings[TL_QUERY][n] = binIntern(pBin, row[16]);
+}
+
+
+/**
+	* Append a sample record to the binary block, completing the block first if it is full.
+	*
+	* @param   BinLog* pBin, block
+	* @param   LogWriter* pLog, log writer
+	* @param   TrxSnapshot* pSnap, sample
+	* @return  void
+*/
+
+void binAddSample(BinLog* pBin, LogWriter* pLog, TrxSnapshot const* pSnap)
+{
+	TrxLogSample* pSample;
+
+	if (pBin->iSamples == TRXLOG_MAX_SAMPLES)
+	{
+		binFlush(pBin, pLog);
+	}
+
+	if (pBin->iRows == 0 && pBin->iSamples == 0)
+	{
+		pBin->dStart = monotonicTime();
+	}
+
+	pSample = &pBin->aSamples[pBin->iSamples++];
+	pSample->iSeq = pSnap->iSeq;
+	pSample->iTime = (uint64_t) (pSnap->dTime * 1e6);
+	pSample->iQuery = (uint64_t) (pSnap->dQuery * 1e6);
+	pSample->iFetch = (uint64_t) (pSnap->dFetch * 1e6);
+	pSample->iInterval = (uint64_t) (cadTrx.dInterval * 1e6);
+	pSample->iRows = (uint32_t) pSnap->iTotal;
+	pSample->iComplete = pSnap->iComplete;
+}
+
+
+/**
+	* Lay out the block (header, dictionary, columns, samples) and hand it to the log writer.
+	*
+	* @param   BinLog* pBin, block
+	* @param   LogWriter* pLog, log writer
+	* @return  void
+*/
+
+void binFlush(BinLog* pBin, LogWriter* pLog)
+{
+	TrxLogBlock blk;
+	size_t iDictPadded = (pBin->iDictLen + 7) & ~(size_t) 7;
+	size_t iColumns = ((size_t) pBin->iRows * (TL_NUMERIC * sizeof(uint64_t) + TL_STRINGS * sizeof(uint32_t)) + 7) & ~(size_t) 7; /* Blocks stay 8-byte aligned. */
+	char* p = pBin->aBlock;
+	unsigned int c;
+
+	if (pBin->iRows == 0 && pBin->iSamples == 0)
+	{
+		return;
+	}
+
+	blk.iMagic = TRXLOG_BLOCK_MAGIC;
+	blk.iRows = pBin->iRows;
+	blk.iDict = pBin->iDict;
+	blk.iBytes = (uint32_t) (sizeof(blk) + iDictPadded + iColumns + pBin->iSamples * sizeof(TrxLogSample));
+	blk.iSamples = pBin->iSamples;
+	blk.iReserved = 0;
+
+	memset(p, 0, blk.iBytes);
+	memcpy(p, &blk, sizeof(blk));
+	p += sizeof(blk);
+	memcpy(p, pBin->aDict, pBin->iDictLen);
+	p += iDictPadded;
+
+	for (c = 0; c < TL_NUMERIC; c++)
+	{
+		memcpy(p, pBin->aNumeric[c], pBin->iRows * sizeof(uint64_t));
+		p += pBin->iRows * sizeof(uint64_t);
+	}
+
+	for (c = 0; c < TL_STRINGS; c++)
+	{
+		memcpy(p, pBin->aStrings[c], pBin->iRows * sizeof(uint32_t));
+		p += pBin->iRows * sizeof(uint32_t);
+	}
+
+	p = pBin->aBlock + sizeof(blk) + iDictPadded + iColumns;
+	memcpy(p, pBin->aSamples, pBin->iSamples * sizeof(TrxLogSample));
+
+	logWrite(pLog, pBin->aBlock, blk.iBytes, pBin->iRows);
+
+	pBin->iRows = 0;
+	pBin->iSamples = 0;
+	pBin->iDict = 0;
+	pBin->iDictLen = 0;
+	memset(pBin->aSlots, 0, sizeof(pBin->aSlots));
 }
@@ -0,0 +1,104 @@
+
+/**
+	* trxlog.h
+	*
+	* Binary transaction log format, shared by mysqltrxmon (writer) and utils/trxlogq (reader).
+	*
+	* @author        Martin Latter
+	* @copyright     Martin Latter, 03/05/2022
+	* @version       0.02
+	* @license       GNU GPL version 3.0 (GPL v3); https://www.gnu.org/licenses/gpl-3.0.html
+	* @link          https://github.com/Tinram/MySQL.git
+	*
+	* Layout (native byte order, little-endian on all supported platforms):
+	*
+	*     TrxLogHeader                           once per file (again after rotation)
+	*     block, block, ...
+	*
+	* Block:
+	*
+	*     TrxLogBlock
+	*     dictionary: iDict x (uint32_t length, bytes), padded to 8 bytes
+	*     numeric columns: TL_NUMERIC x iRows x uint64_t
+	*     string columns: TL_STRINGS x iRows x uint32_t (dictionary index, TRXLOG_NULL for SQL NULL), padded to 8 bytes
+	*     samples: iSamples x TrxLogSample
+	*
+	* Each block carries its own dictionary, so any block can be read (or a file rotated) independently.
+	* Repeated strings (user, program, state, statement text across samples) are stored once per block.
+	* A sample's record follows its rows (in the same or a later block): rows and samples are matched on TL_SEQ.
+*/
+
+
+#define TRXLOG_MAGIC "MYTRXLOG"
+#define TRXLOG_FORMAT 2
+#define TRXLOG_BLOCK_MAGIC 0x4B4C4254u /* "TBLK" */
+#define TRXLOG_NULL UINT32_MAX
+#define TRXLOG_MAX_ROWS 512
+#define TRXLOG_MAX_DICT 1024 /* Entries per block. */
+#define TRXLOG_MAX_DICT_BYTES (96 * 1024)
+#define TRXLOG_MAX_STRING 8192 /* Longer strings (statement text) are truncated. */
+#define TRXLOG_MAX_SAMPLES 512
+
+
+/* Fixed-width columns, all uint64_t. */
+typedef enum
+{
+	TL_TIME, /* Sample wall-clock time, microsecs since the epoch. */
+	TL_SEQ, /* Sample sequence number. */
+	TL_TRX,
+	TL_THREAD,
+	TL_PROCESS,
+	TL_EXAMINED,
+	TL_LOCKED,
+	TL_MODIFIED,
+	TL_AFFECTED,
+	TL_TMPDISK,
+	TL_TABLES,
+	TL_NOINDEX,
+	TL_WAIT, /* Statement wait, microsecs. */
+	TL_STARTED, /* trx_started as written by the server, as secs since 1970-01-01 00:00:00 (no time zone applied). */
+	TL_SECS,
+	TL_NUMERIC
+} TrxLogNumeric;
+
+/* Dictionary-encoded columns. */
+typedef enum
+{
+	TL_USER,
+	TL_PROGRAM,
+	TL_STATE,
+	TL_OPSTATE,
+	TL_QUERY,
+	TL_STRINGS
+} TrxLogString;
+
+typedef struct
+{
+	char aMagic[8];
+	uint32_t iFormat;
+	uint32_t iNumeric; /* TL_NUMERIC: readers check the column counts they were built for. */
+	uint32_t iStrings;
+	uint32_t iReserved;
+} TrxLogHeader;
+
+typedef struct
+{
+	uint32_t iMagic;
+	uint32_t iRows;
+	uint32_t iDict;
+	uint32_t iBytes; /* Whole block, including this header. */
+	uint32_t iSamples;
+	uint32_t iReserved;
+} TrxLogBlock;
+
+/* One per sample, with or without transactions. */
+typedef struct
+{
+	uint64_t iSeq; /* From 1, consecutive within a run: a gap is a sample lost to a full log. */
+	uint64_t iTime; /* Wall-clock time at the start of the sample, microsecs since the epoch. */
+	uint64_t iQuery; /* Client-side time in the sample's queries, microsecs. */
+	uint64_t iFetch; /* Client-side time reading their results, microsecs. */
+	uint64_t iInterval; /* Sampling interval in effect, microsecs. */
+	uint32_t iRows; /* Transactions in the sample. */
+	uint32_t iComplete; /* 0: the sample failed part-way. */
+} TrxLogSample;
@@ -7,7 +7,7 @@
 
     Author         Martin Latter
     Copyright      Martin Latter 16/08/2022
-    Version        0.03
+    Version        0.04
     License        GNU GPL version 3.0 (GPL v3); https://www.gnu.org/licenses/gpl-3.0.html
     Link           https://github.com/Tinram/MySQL.git
 """
@@ -39,12 +39,12 @@ if ARGS.filename == '':
 TRXS = []
 
 with open(ARGS.filename, encoding='utf-8', mode='r') as f:
-    READER = csv.DictReader(f, delimiter='|')
+    READER = csv.DictReader((line for line in f if not line.startswith('#')), delimiter='|') # skip sample records
     for row in READER:
         TRXS.append(row)
 
 
-# CSV: trx|thd|ps|exm|lock|mod|afft|tmpd|tlock|noidx|wait|start|secs|user|program|trxstate|trxopstate|query
+# CSV: trx|sample|time|thd|ps|exm|lock|mod|afft|tmpd|tlock|noidx|wait|start|secs|user|program|trxstate|trxopstate|query
 
 # sort by trx id
 TRXS = sorted(TRXS, key=itemgetter('trx'))
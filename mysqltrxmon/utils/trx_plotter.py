@@ -5,7 +5,7 @@
 
     Author         Martin Latter
     Copyright      Martin Latter 11/05/2022
-    Version        0.02
+    Version        0.03
     License        GNU GPL version 3.0 (GPL v3); https://www.gnu.org/licenses/gpl-3.0.html
     Link           https://github.com/Tinram/MySQL.git
 """
@@ -20,7 +20,7 @@ DATA = []
 
 with open(CSV_FILE, encoding='utf-8', mode='r') as f:
 
-    READER = csv.DictReader(f, delimiter='|')
+    READER = csv.DictReader((line for line in f if not line.startswith('#')), delimiter='|') # skip sample records
     #print(READER.fieldnames)
 
     for row in READER:
@@ -0,0 +1,1212 @@
+
+/**
+	* Transaction Log Query
+	* trxlogq.c
+	*
+	* Aggregate binary transaction logs written by mysqltrxmon -b in a single streaming pass:
+	* sampling timeline, top-N longest transactions, per-user and per-table contention.
+	*
+	* @author        Martin Latter
+	* @copyright     Martin Latter, 03/05/2022
+	* @version       0.02
+	* @license       GNU GPL version 3.0 (GPL v3); https://www.gnu.org/licenses/gpl-3.0.html
+	* @link          https://github.com/Tinram/MySQL.git
+	*
+	* Compile:
+	*                gcc trxlogq.c -o trxlogq -I../ -O2 -Wall -Wextra -std=gnu99 -s
+	*
+	* Usage:
+	*                ./trxlogq [-n <top>] <logfile> [<logfile> ...]
+	*                zcat trx.bin.gz > trx.bin && ./trxlogq trx.bin
+*/
+
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <trxlog.h>
+
+
+#define APP_NAME "TrxLogQ"
+#define MB_VERSION "0.02"
+
+#define NONE UINT32_MAX /* Interned id for SQL NULL. */
+#define TABLE_LEN 128
+#define ARENA_CHUNK (1024 * 1024)
+
+
+/* Strings interned across blocks (a block's dictionary indexes only mean something within the block). */
+typedef struct
+{
+	uint32_t* aSlots; /* Id + 1, 0 for empty. */
+	uint32_t iSlots;
+	char const** aStr;
+	uint32_t* aLen;
+	uint32_t* aHash;
+	uint32_t iCount;
+	uint32_t iCap;
+	char* pArena;
+	size_t iArenaLeft;
+} Interns;
+
+typedef struct
+{
+	uint64_t iTrxId;
+	uint64_t iThread;
+	uint64_t iProcess;
+	uint64_t iStarted;
+	uint64_t iFirst; /* Microsecs. */
+	uint64_t iLast;
+	uint64_t iMaxSecs;
+	uint64_t iPeakLocked;
+	uint64_t iPeakModified;
+	uint64_t iSamples;
+	uint64_t iLockWaits;
+	uint32_t iUser;
+	uint32_t iProgram;
+	uint32_t iQuery;
+	uint32_t iTable;
+	unsigned int iUsed;
+} TrxAgg;
+
+typedef struct
+{
+	uint32_t iKey; /* Interned user or table. */
+	uint64_t iTrx;
+	uint64_t iSamples;
+	uint64_t iLockWaits;
+	uint64_t iMaxSecs;
+	uint64_t iPeakLocked;
+	unsigned int iUsed;
+} GroupAgg;
+
+/* Sampling timeline, from the sample records. */
+typedef struct
+{
+	uint64_t iCount;
+	uint64_t iLost; /* Sequence numbers missing within a run. */
+	uint64_t iRuns;
+	uint64_t iIncomplete;
+	uint64_t iStalls; /* Gaps of more than twice the interval in effect. */
+	uint64_t iGaps;
+	uint64_t iGapSum;
+	uint64_t iMaxGap;
+	uint64_t iMaxGapAt;
+	uint64_t iIntervalSum;
+	uint64_t iQuerySum;
+	uint64_t iQueryMax;
+	uint64_t iFetchSum;
+	uint64_t iFetchMax;
+	uint64_t iLastSeq;
+	uint64_t iLastTime;
+} Timeline;
+
+typedef struct
+{
+	void* aSlots;
+	size_t iSlotSize;
+	uint32_t iSize;
+	uint32_t iCount;
+} Map;
+
+
+uint32_t hashBytes(char const* p, uint32_t iLen);
+uint32_t hashInt(uint64_t iKey);
+uint32_t intern(Interns* pIn, char const* p, uint32_t iLen);
+unsigned int mapInit(Map* pMap, size_t iSlotSize, uint32_t iSize);
+void* mapSlot(Map* pMap, uint32_t i);
+TrxAgg* trxFind(Map* pMap, uint64_t iTrxId);
+GroupAgg* groupFind(Map* pMap, uint32_t iKey);
+uint32_t tableOf(Interns* pIn, char const* pSQL, uint32_t iLen);
+int processFile(char const* pFile);
+int processBlock(char const* pBlock, uint64_t iAvail);
+void addRow(uint64_t const* aNum[], uint32_t const* aStr[], uint32_t r, uint32_t const* aIds, uint32_t* aTables, char const* pDict, uint32_t const* aOffsets);
+void addSample(TrxLogSample const* pSample);
+int compareTrx(void const* pA, void const* pB);
+int compareGroup(void const* pA, void const* pB);
+void printGroups(Map* pMap, char const* pTitle);
+void printReport(unsigned int iTop);
+void printTimeline(void);
+void formatMicros(uint64_t iMicros, char* pBuf, size_t iLen);
+void formatCivil(uint64_t iSecs, char* pBuf, size_t iLen);
+char const* name(uint32_t iId);
+void menu(char* const pFName);
+
+
+Interns interns;
+Map mapTrx;
+Map mapUser;
+Map mapTable;
+Timeline timeline;
+uint32_t iLockWait = NONE;
+uint64_t iBlocks = 0;
+uint64_t iRows = 0;
+uint64_t iFirstSample = UINT64_MAX;
+uint64_t iLastSample = 0;
+
+
+int main(int iArgCount, char* aArgV[])
+{
+	int iOpt;
+	unsigned int iTop = 10;
+	int iStatus = EXIT_SUCCESS;
+
+	while ((iOpt = getopt(iArgCount, aArgV, "n:h")) != -1)
+	{
+		switch (iOpt)
+		{
+			case 'n':
+				iTop = (unsigned int) atoi(optarg);
+				break;
+
+			default:
+				menu(aArgV[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= iArgCount)
+	{
+		menu(aArgV[0]);
+		return EXIT_FAILURE;
+	}
+
+	if ( ! mapInit(&mapTrx, sizeof(TrxAgg), 1024) || ! mapInit(&mapUser, sizeof(GroupAgg), 64) || ! mapInit(&mapTable, sizeof(GroupAgg), 256))
+	{
+		fprintf(stderr, "\nCannot allocate memory.\n\n");
+		return EXIT_FAILURE;
+	}
+
+	iLockWait = intern(&interns, "LOCK WAIT", 9);
+
+	for ( ; optind < iArgCount; optind++)
+	{
+		if (processFile(aArgV[optind]) != 0)
+		{
+			iStatus = EXIT_FAILURE;
+		}
+	}
+
+	printReport(iTop);
+
+	return iStatus;
+}
+
+
+/**
+	* Map a logfile and aggregate its blocks in order.
+	* Concatenated files (cat trx.bin.*) are accepted: a file header may appear between blocks.
+	*
+	* @param   char* pFile, filename
+	* @return  integer, 0 on success
+*/
+
+int processFile(char const* pFile)
+{
+	struct stat st;
+	char const* pMap;
+	uint64_t iPos = 0;
+	int iFd = open(pFile, O_RDONLY);
+	int iResult = 0;
+
+	if (iFd < 0 || fstat(iFd, &st) != 0)
+	{
+		fprintf(stderr, "%s: cannot open\n", pFile);
+		return 1;
+	}
+
+	if (st.st_size < (off_t) sizeof(TrxLogHeader))
+	{
+		fprintf(stderr, "%s: not a mysqltrxmon binary log\n", pFile);
+		close(iFd);
+		return 1;
+	}
+
+	pMap = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, iFd, 0);
+	close(iFd);
+
+	if (pMap == MAP_FAILED)
+	{
+		fprintf(stderr, "%s: cannot map\n", pFile);
+		return 1;
+	}
+
+	madvise((void*) pMap, (size_t) st.st_size, MADV_SEQUENTIAL); /* Read-ahead at disk speed, pages dropped behind. */
+
+	if ((unsigned char) pMap[0] == 0x1f && (unsigned char) pMap[1] == 0x8b)
+	{
+		fprintf(stderr, "%s: gzip-compressed, decompress first (zcat)\n", pFile);
+		munmap((void*) pMap, (size_t) st.st_size);
+		return 1;
+	}
+
+	while (iPos + sizeof(TrxLogBlock) <= (uint64_t) st.st_size)
+	{
+		if (memcmp(pMap + iPos, TRXLOG_MAGIC, 8) == 0)
+		{
+			TrxLogHeader hdr;
+
+			memcpy(&hdr, pMap + iPos, sizeof(hdr));
+
+			if (hdr.iFormat != TRXLOG_FORMAT || hdr.iNumeric != TL_NUMERIC || hdr.iStrings != TL_STRINGS)
+			{
+				fprintf(stderr, "%s: unsupported format %u\n", pFile, hdr.iFormat);
+				iResult = 1;
+				break;
+			}
+
+			iPos += sizeof(TrxLogHeader);
+			continue;
+		}
+
+		int iUsed = processBlock(pMap + iPos, (uint64_t) st.st_size - iPos);
+
+		if (iUsed <= 0)
+		{
+			fprintf(stderr, "%s: corrupt or truncated block at offset %" PRIu64 "\n", pFile, iPos);
+			iResult = 1;
+			break;
+		}
+
+		iPos += (uint64_t) iUsed;
+	}
+
+	munmap((void*) pMap, (size_t) st.st_size);
+
+	return iResult;
+}
+
+
+/**
+	* Aggregate one block: intern its dictionary once, then walk the rows column by column.
+	*
+	* @param   char* pBlock, block start
+	* @param   uint64_t iAvail, bytes left in the file
+	* @return  integer, block size, 0 if invalid
+*/
+
+int processBlock(char const* pBlock, uint64_t iAvail)
+{
+	TrxLogBlock blk;
+	uint32_t* aIds;
+	uint32_t* aTables;
+	uint32_t* aOffsets;
+	uint64_t const* aNum[TL_NUMERIC];
+	uint32_t const* aStr[TL_STRINGS];
+	char const* p;
+	char const* pDict;
+	char const* pSamples;
+	uint64_t iDictLen = 0;
+	uint64_t iColumns;
+	uint32_t i;
+
+	memcpy(&blk, pBlock, sizeof(blk));
+
+	if (blk.iMagic != TRXLOG_BLOCK_MAGIC || blk.iBytes > iAvail || blk.iBytes < sizeof(blk) || blk.iDict > TRXLOG_MAX_DICT || blk.iSamples > TRXLOG_MAX_SAMPLES)
+	{
+		return 0;
+	}
+
+	aIds = malloc(sizeof(uint32_t) * (blk.iDict + 1));
+	aTables = malloc(sizeof(uint32_t) * (blk.iDict + 1));
+	aOffsets = malloc(sizeof(uint32_t) * (blk.iDict + 1));
+
+	if (aIds == NULL || aTables == NULL || aOffsets == NULL)
+	{
+		free(aIds);
+		free(aTables);
+		free(aOffsets);
+		return 0;
+	}
+
+	pDict = pBlock + sizeof(blk);
+
+	for (i = 0; i < blk.iDict; i++)
+	{
+		uint32_t iLen;
+
+		if (sizeof(blk) + iDictLen + sizeof(iLen) > blk.iBytes)
+		{
+			break;
+		}
+
+		memcpy(&iLen, pDict + iDictLen, sizeof(iLen));
+
+		if (sizeof(blk) + iDictLen + sizeof(iLen) + iLen > blk.iBytes)
+		{
+			break;
+		}
+
+		aOffsets[i] = (uint32_t) iDictLen;
+		aIds[i] = intern(&interns, pDict + iDictLen + sizeof(iLen), iLen);
+		aTables[i] = NONE - 1; /* Table name worked out on first use as a statement. */
+		iDictLen += sizeof(iLen) + iLen;
+	}
+
+	p = pDict + ((iDictLen + 7) & ~(uint64_t) 7);
+	iColumns = ((uint64_t) blk.iRows * (TL_NUMERIC * 8 + TL_STRINGS * 4) + 7) & ~(uint64_t) 7;
+	pSamples = p + iColumns;
+
+	if (i < blk.iDict || (uint64_t) (pSamples - pBlock) + (uint64_t) blk.iSamples * sizeof(TrxLogSample) > blk.iBytes)
+	{
+		free(aIds);
+		free(aTables);
+		free(aOffsets);
+		return 0;
+	}
+
+	for (i = 0; i < TL_NUMERIC; i++)
+	{
+		aNum[i] = (uint64_t const*) p;
+		p += (size_t) blk.iRows * sizeof(uint64_t);
+	}
+
+	for (i = 0; i < TL_STRINGS; i++)
+	{
+		aStr[i] = (uint32_t const*) p;
+		p += (size_t) blk.iRows * sizeof(uint32_t);
+	}
+
+	for (i = 0; i < blk.iRows; i++)
+	{
+		uint32_t c;
+
+		for (c = 0; c < TL_STRINGS; c++)
+		{
+			if (aStr[c][i] != TRXLOG_NULL && aStr[c][i] >= blk.iDict)
+			{
+				break;
+			}
+		}
+
+		if (c == TL_STRINGS)
+		{
+			addRow(aNum, aStr, i, aIds, aTables, pDict, aOffsets);
+		}
+	}
+
+	for (i = 0; i < blk.iSamples; i++)
+	{
+		TrxLogSample sample;
+
+		memcpy(&sample, pSamples + (size_t) i * sizeof(sample), sizeof(sample));
+		addSample(&sample);
+	}
+
+	free(aIds);
+	free(aTables);
+	free(aOffsets);
+
+	iBlocks++;
+	iRows += blk.iRows;
+
+	return (int) blk.iBytes;
+}
+
+
+/**
+	* Fold one sampled row into the per-transaction, per-user and per-table aggregates.
+	*
+	* @param   uint64_t** aNum, numeric columns
+	* @param   uint32_t** aStr, string columns
+	* @param   uint32_t r, row
+	* @param   uint32_t* aIds, block dictionary -> interned id
+	* @param   uint32_t* aTables, block dictionary -> interned table (lazily filled)
+	* @param   char* pDict, block dictionary
+	* @param   uint32_t* aOffsets, dictionary entry offsets
+	* @return  void
+*/
+
+void addRow(uint64_t const* aNum[], uint32_t const* aStr[], uint32_t r, uint32_t const* aIds, uint32_t* aTables, char const* pDict, uint32_t const* aOffsets)
+{
+	uint32_t iQueryIdx = aStr[TL_QUERY][r];
+	uint32_t iUser = (aStr[TL_USER][r] == TRXLOG_NULL) ? NONE : aIds[aStr[TL_USER][r]];
+	uint32_t iState = (aStr[TL_STATE][r] == TRXLOG_NULL) ? NONE : aIds[aStr[TL_STATE][r]];
+	uint32_t iTable = NONE;
+	uint64_t iTime = aNum[TL_TIME][r];
+	uint64_t iSecs = aNum[TL_SECS][r];
+	uint64_t iLocked = aNum[TL_LOCKED][r];
+	unsigned int iWait = (iState == iLockWait && iLockWait != NONE);
+	TrxAgg* pTrx = trxFind(&mapTrx, aNum[TL_TRX][r]);
+	GroupAgg* pGroup;
+
+	if (iQueryIdx != TRXLOG_NULL)
+	{
+		if (aTables[iQueryIdx] == NONE - 1)
+		{
+			uint32_t iLen;
+
+			memcpy(&iLen, pDict + aOffsets[iQueryIdx], sizeof(iLen));
+			aTables[iQueryIdx] = tableOf(&interns, pDict + aOffsets[iQueryIdx] + sizeof(iLen), iLen);
+		}
+
+		iTable = aTables[iQueryIdx];
+	}
+
+	if (iTime < iFirstSample)
+	{
+		iFirstSample = iTime;
+	}
+
+	if (iTime > iLastSample)
+	{
+		iLastSample = iTime;
+	}
+
+	if (pTrx == NULL)
+	{
+		return;
+	}
+
+	if (pTrx->iSamples == 0)
+	{
+		pTrx->iThread = aNum[TL_THREAD][r];
+		pTrx->iProcess = aNum[TL_PROCESS][r];
+		pTrx->iStarted = aNum[TL_STARTED][r];
+		pTrx->iFirst = iTime;
+		pTrx->iUser = iUser;
+		pTrx->iProgram = (aStr[TL_PROGRAM][r] == TRXLOG_NULL) ? NONE : aIds[aStr[TL_PROGRAM][r]];
+		pTrx->iTable = NONE - 1;
+
+		if ((pGroup = groupFind(&mapUser, iUser)) != NULL)
+		{
+			pGroup->iTrx++;
+		}
+	}
+
+	/* A transaction counts towards each table as its statements move onto it. */
+	if (iTable != pTrx->iTable && iTable != NONE)
+	{
+		if ((pGroup = groupFind(&mapTable, iTable)) != NULL)
+		{
+			pGroup->iTrx++;
+		}
+
+		pTrx->iTable = iTable;
+	}
+
+	pTrx->iSamples++;
+	pTrx->iLockWaits += iWait;
+	pTrx->iLast = iTime;
+	pTrx->iQuery = (iQueryIdx == TRXLOG_NULL) ? pTrx->iQuery : aIds[iQueryIdx];
+
+	if (iSecs > pTrx->iMaxSecs)
+	{
+		pTrx->iMaxSecs = iSecs;
+	}
+
+	if (iLocked > pTrx->iPeakLocked)
+	{
+		pTrx->iPeakLocked = iLocked;
+	}
+
+	if (aNum[TL_MODIFIED][r] > pTrx->iPeakModified)
+	{
+		pTrx->iPeakModified = aNum[TL_MODIFIED][r];
+	}
+
+	pGroup = groupFind(&mapUser, iUser);
+
+	if (pGroup != NULL)
+	{
+		pGroup->iSamples++;
+		pGroup->iLockWaits += iWait;
+		pGroup->iMaxSecs = (iSecs > pGroup->iMaxSecs) ? iSecs : pGroup->iMaxSecs;
+		pGroup->iPeakLocked = (iLocked > pGroup->iPeakLocked) ? iLocked : pGroup->iPeakLocked;
+	}
+
+	pGroup = (iTable != NONE) ? groupFind(&mapTable, iTable) : NULL;
+
+	if (pGroup != NULL)
+	{
+		pGroup->iSamples++;
+		pGroup->iLockWaits += iWait;
+		pGroup->iMaxSecs = (iSecs > pGroup->iMaxSecs) ? iSecs : pGroup->iMaxSecs;
+		pGroup->iPeakLocked = (iLocked > pGroup->iPeakLocked) ? iLocked : pGroup->iPeakLocked;
+	}
+}
+
+
+/**
+	* First table a statement references: the identifier after FROM, UPDATE, INTO or JOIN.
+	* A heuristic, but computed once per distinct statement per block.
+	*
+	* @param   Interns* pIn, interned strings
+	* @param   char* pSQL, statement text (not terminated)
+	* @param   uint32_t iLen, length
+	* @return  uint32_t, interned table name, NONE if not found
+*/
+
+uint32_t tableOf(Interns* pIn, char const* pSQL, uint32_t iLen)
+{
+	static char const* const aKeywords[] = {"FROM", "UPDATE", "INTO", "JOIN"};
+	char aTable[TABLE_LEN];
+	uint32_t i = 0;
+	unsigned int iAfterKeyword = 0;
+
+	while (i < iLen)
+	{
+		uint32_t iStart;
+		uint32_t iWordLen;
+		unsigned int k;
+
+		while (i < iLen && (pSQL[i] == ' ' || pSQL[i] == '\t' || pSQL[i] == '\n' || pSQL[i] == '\r' || pSQL[i] == '(' || pSQL[i] == ','))
+		{
+			i++;
+		}
+
+		iStart = i;
+
+		while (i < iLen && pSQL[i] != ' ' && pSQL[i] != '\t' && pSQL[i] != '\n' && pSQL[i] != '\r' && pSQL[i] != '(' && pSQL[i] != ',' && pSQL[i] != ';')
+		{
+			i++;
+		}
+
+		iWordLen = i - iStart;
+
+		if (iWordLen == 0)
+		{
+			i++;
+			continue;
+		}
+
+		if (iAfterKeyword)
+		{
+			uint32_t iOut = 0;
+			uint32_t j;
+
+			for (j = iStart; j < i && iOut < sizeof(aTable) - 1; j++)
+			{
+				if (pSQL[j] != '`')
+				{
+					aTable[iOut++] = pSQL[j];
+				}
+			}
+
+			return (iOut > 0) ? intern(pIn, aTable, iOut) : NONE;
+		}
+
+		for (k = 0; k < sizeof(aKeywords) / sizeof(aKeywords[0]); k++)
+		{
+			if (strlen(aKeywords[k]) == iWordLen && strncasecmp(pSQL + iStart, aKeywords[k], iWordLen) == 0)
+			{
+				iAfterKeyword = 1;
+			}
+		}
+	}
+
+	return NONE;
+}
+
+
+/**
+	* FNV-1a hash.
+	*
+	* @param   char* p, bytes
+	* @param   uint32_t iLen, length
+	* @return  uint32_t
+*/
+
+uint32_t hashBytes(char const* p, uint32_t iLen)
+{
+	uint32_t iHash = 2166136261u;
+	uint32_t i;
+
+	for (i = 0; i < iLen; i++)
+	{
+		iHash ^= (unsigned char) p[i];
+		iHash *= 16777619u;
+	}
+
+	return iHash;
+}
+
+
+/**
+	* Integer hash (64 to 32-bit mix).
+	*
+	* @param   uint64_t iKey, key
+	* @return  uint32_t
+*/
+
+uint32_t hashInt(uint64_t iKey)
+{
+	iKey ^= iKey >> 33;
+	iKey *= 0xff51afd7ed558ccdULL;
+	iKey ^= iKey >> 33;
+
+	return (uint32_t) iKey;
+}
+
+
+/**
+	* Intern a string: equal strings get the same id across all blocks and files.
+	*
+	* @param   Interns* pIn, interned strings
+	* @param   char* p, bytes
+	* @param   uint32_t iLen, length
+	* @return  uint32_t, id (NONE if out of memory)
+*/
+
+uint32_t intern(Interns* pIn, char const* p, uint32_t iLen)
+{
+	uint32_t iHash = hashBytes(p, iLen);
+	uint32_t i;
+
+	if ((pIn->iCount + 1) * 2 > pIn->iSlots)
+	{
+		uint32_t iSlots = (pIn->iSlots == 0) ? 1024 : pIn->iSlots * 2;
+		uint32_t* aSlots = calloc(iSlots, sizeof(uint32_t));
+
+		if (aSlots == NULL)
+		{
+			return NONE;
+		}
+
+		for (i = 0; i < pIn->iCount; i++)
+		{
+			uint32_t j = pIn->aHash[i] & (iSlots - 1);
+
+			while (aSlots[j] != 0)
+			{
+				j = (j + 1) & (iSlots - 1);
+			}
+
+			aSlots[j] = i + 1;
+		}
+
+		free(pIn->aSlots);
+		pIn->aSlots = aSlots;
+		pIn->iSlots = iSlots;
+	}
+
+	for (i = iHash & (pIn->iSlots - 1); pIn->aSlots[i] != 0; i = (i + 1) & (pIn->iSlots - 1))
+	{
+		uint32_t iId = pIn->aSlots[i] - 1;
+
+		if (pIn->aHash[iId] == iHash && pIn->aLen[iId] == iLen && memcmp(pIn->aStr[iId], p, iLen) == 0)
+		{
+			return iId;
+		}
+	}
+
+	if (pIn->iCount == pIn->iCap)
+	{
+		uint32_t iCap = (pIn->iCap == 0) ? 1024 : pIn->iCap * 2;
+		char const** aStr = realloc(pIn->aStr, sizeof(char*) * iCap);
+		uint32_t* aLen = realloc(pIn->aLen, sizeof(uint32_t) * iCap);
+		uint32_t* aHash = realloc(pIn->aHash, sizeof(uint32_t) * iCap);
+
+		if (aStr != NULL) { pIn->aStr = aStr; }
+		if (aLen != NULL) { pIn->aLen = aLen; }
+		if (aHash != NULL) { pIn->aHash = aHash; }
+
+		if (aStr == NULL || aLen == NULL || aHash == NULL)
+		{
+			return NONE;
+		}
+
+		pIn->iCap = iCap;
+	}
+
+	if (pIn->iArenaLeft < (size_t) iLen + 1)
+	{
+		size_t iChunk = ((size_t) iLen + 1 > ARENA_CHUNK) ? (size_t) iLen + 1 : ARENA_CHUNK;
+
+		pIn->pArena = malloc(iChunk); /* Chunks live until exit. */
+
+		if (pIn->pArena == NULL)
+		{
+			pIn->iArenaLeft = 0;
+			return NONE;
+		}
+
+		pIn->iArenaLeft = iChunk;
+	}
+
+	memcpy(pIn->pArena, p, iLen);
+	pIn->pArena[iLen] = '\0';
+	pIn->aStr[pIn->iCount] = pIn->pArena;
+	pIn->aLen[pIn->iCount] = iLen;
+	pIn->aHash[pIn->iCount] = iHash;
+	pIn->pArena += iLen + 1;
+	pIn->iArenaLeft -= iLen + 1;
+	pIn->aSlots[i] = pIn->iCount + 1;
+
+	return pIn->iCount++;
+}
+
+
+/**
+	* Allocate an open-addressing map of fixed-size slots (first member the key, iUsed flag last).
+	*
+	* @param   Map* pMap, map
+	* @param   size_t iSlotSize, slot struct size
+	* @param   uint32_t iSize, slots (power of 2)
+	* @return  unsigned integer, 0 on allocation failure
+*/
+
+unsigned int mapInit(Map* pMap, size_t iSlotSize, uint32_t iSize)
+{
+	pMap->aSlots = calloc(iSize, iSlotSize);
+	pMap->iSlotSize = iSlotSize;
+	pMap->iSize = iSize;
+	pMap->iCount = 0;
+
+	return (pMap->aSlots != NULL);
+}
+
+
+/**
+	* Slot address.
+	*
+	* @param   Map* pMap, map
+	* @param   uint32_t i, slot
+	* @return  void*
+*/
+
+void* mapSlot(Map* pMap, uint32_t i)
+{
+	return (char*) pMap->aSlots + (size_t) i * pMap->iSlotSize;
+}
+
+
+/**
+	* Find or add a transaction aggregate; the map doubles once half full.
+	*
+	* @param   Map* pMap, map of TrxAgg
+	* @param   uint64_t iTrxId, trx_id
+	* @return  TrxAgg*, NULL if out of memory
+*/
+
+TrxAgg* trxFind(Map* pMap, uint64_t iTrxId)
+{
+	uint32_t i;
+	TrxAgg* pSlot;
+
+	if ((pMap->iCount + 1) * 2 > pMap->iSize)
+	{
+		Map grown;
+
+		if ( ! mapInit(&grown, sizeof(TrxAgg), pMap->iSize * 2))
+		{
+			return NULL;
+		}
+
+		for (i = 0; i < pMap->iSize; i++)
+		{
+			TrxAgg* pOld = mapSlot(pMap, i);
+
+			if (pOld->iUsed)
+			{
+				uint32_t j = hashInt(pOld->iTrxId) & (grown.iSize - 1);
+
+				while (((TrxAgg*) mapSlot(&grown, j))->iUsed)
+				{
+					j = (j + 1) & (grown.iSize - 1);
+				}
+
+				*(TrxAgg*) mapSlot(&grown, j) = *pOld;
+			}
+		}
+
+		grown.iCount = pMap->iCount;
+		free(pMap->aSlots);
+		*pMap = grown;
+	}
+
+	for (i = hashInt(iTrxId) & (pMap->iSize - 1); (pSlot = mapSlot(pMap, i))->iUsed; i = (i + 1) & (pMap->iSize - 1))
+	{
+		if (pSlot->iTrxId == iTrxId)
+		{
+			return pSlot;
+		}
+	}
+
+	pSlot->iTrxId = iTrxId;
+	pSlot->iUsed = 1;
+	pMap->iCount++;
+
+	return pSlot;
+}
+
+
+/**
+	* Find or add a user or table aggregate.
+	*
+	* @param   Map* pMap, map of GroupAgg
+	* @param   uint32_t iKey, interned name
+	* @return  GroupAgg*, NULL if out of memory
+*/
+
+GroupAgg* groupFind(Map* pMap, uint32_t iKey)
+{
+	uint32_t i;
+	GroupAgg* pSlot;
+
+	if ((pMap->iCount + 1) * 2 > pMap->iSize)
+	{
+		Map grown;
+
+		if ( ! mapInit(&grown, sizeof(GroupAgg), pMap->iSize * 2))
+		{
+			return NULL;
+		}
+
+		for (i = 0; i < pMap->iSize; i++)
+		{
+			GroupAgg* pOld = mapSlot(pMap, i);
+
+			if (pOld->iUsed)
+			{
+				uint32_t j = hashInt(pOld->iKey) & (grown.iSize - 1);
+
+				while (((GroupAgg*) mapSlot(&grown, j))->iUsed)
+				{
+					j = (j + 1) & (grown.iSize - 1);
+				}
+
+				*(GroupAgg*) mapSlot(&grown, j) = *pOld;
+			}
+		}
+
+		grown.iCount = pMap->iCount;
+		free(pMap->aSlots);
+		*pMap = grown;
+	}
+
+	for (i = hashInt(iKey) & (pMap->iSize - 1); (pSlot = mapSlot(pMap, i))->iUsed; i = (i + 1) & (pMap->iSize - 1))
+	{
+		if (pSlot->iKey == iKey)
+		{
+			return pSlot;
+		}
+	}
+
+	pSlot->iKey = iKey;
+	pSlot->iUsed = 1;
+	pMap->iCount++;
+
+	return pSlot;
+}
+
+
+/**
+	* Fold one sample record into the timeline. A sequence number that does not follow on starts a new run.
+	*
+	* @param   TrxLogSample* pSample, sample record
+	* @return  void
+*/
+
+void addSample(TrxLogSample const* pSample)
+{
+	Timeline* t = &timeline;
+
+	if (t->iCount == 0 || pSample->iSeq <= t->iLastSeq)
+	{
+		t->iRuns++;
+	}
+	else
+	{
+		uint64_t iGap = (pSample->iTime > t->iLastTime) ? pSample->iTime - t->iLastTime : 0;
+
+		t->iLost += pSample->iSeq - t->iLastSeq - 1;
+
+		/* Consecutive samples only: across a lost record, the gap is not the sampler's. */
+		if (pSample->iSeq == t->iLastSeq + 1)
+		{
+			t->iGaps++;
+			t->iGapSum += iGap;
+			t->iIntervalSum += pSample->iInterval;
+
+			if (iGap > t->iMaxGap)
+			{
+				t->iMaxGap = iGap;
+				t->iMaxGapAt = t->iLastTime;
+			}
+
+			if (iGap > 2 * pSample->iInterval)
+			{
+				t->iStalls++;
+			}
+		}
+	}
+
+	t->iCount++;
+	t->iIncomplete += (pSample->iComplete == 0);
+	t->iQuerySum += pSample->iQuery;
+	t->iFetchSum += pSample->iFetch;
+	t->iQueryMax = (pSample->iQuery > t->iQueryMax) ? pSample->iQuery : t->iQueryMax;
+	t->iFetchMax = (pSample->iFetch > t->iFetchMax) ? pSample->iFetch : t->iFetchMax;
+	t->iLastSeq = pSample->iSeq;
+	t->iLastTime = pSample->iTime;
+}
+
+
+/**
+	* Sort: longest transaction first (server-reported secs, then observed span).
+	*
+	* @param   void* pA, TrxAgg*
+	* @param   void* pB, TrxAgg*
+	* @return  integer
+*/
+
+int compareTrx(void const* pA, void const* pB)
+{
+	TrxAgg const* a = *(TrxAgg const* const*) pA;
+	TrxAgg const* b = *(TrxAgg const* const*) pB;
+
+	if (a->iMaxSecs != b->iMaxSecs)
+	{
+		return (a->iMaxSecs < b->iMaxSecs) ? 1 : -1;
+	}
+
+	if (a->iLast - a->iFirst != b->iLast - b->iFirst)
+	{
+		return (a->iLast - a->iFirst < b->iLast - b->iFirst) ? 1 : -1;
+	}
+
+	return 0;
+}
+
+
+/**
+	* Sort: most lock-wait samples first, then most samples.
+	*
+	* @param   void* pA, GroupAgg*
+	* @param   void* pB, GroupAgg*
+	* @return  integer
+*/
+
+int compareGroup(void const* pA, void const* pB)
+{
+	GroupAgg const* a = *(GroupAgg const* const*) pA;
+	GroupAgg const* b = *(GroupAgg const* const*) pB;
+
+	if (a->iLockWaits != b->iLockWaits)
+	{
+		return (a->iLockWaits < b->iLockWaits) ? 1 : -1;
+	}
+
+	if (a->iSamples != b->iSamples)
+	{
+		return (a->iSamples < b->iSamples) ? 1 : -1;
+	}
+
+	return 0;
+}
+
+
+/**
+	* Print a per-user or per-table summary.
+	*
+	* @param   Map* pMap, map of GroupAgg
+	* @param   char* pTitle, column title
+	* @return  void
+*/
+
+void printGroups(Map* pMap, char const* pTitle)
+{
+	GroupAgg** aSorted = malloc(sizeof(GroupAgg*) * (pMap->iCount + 1));
+	uint32_t i;
+	uint32_t n = 0;
+
+	if (aSorted == NULL)
+	{
+		return;
+	}
+
+	for (i = 0; i < pMap->iSize; i++)
+	{
+		GroupAgg* pGroup = mapSlot(pMap, i);
+
+		if (pGroup->iUsed)
+		{
+			aSorted[n++] = pGroup;
+		}
+	}
+
+	qsort(aSorted, n, sizeof(GroupAgg*), compareGroup);
+
+	fprintf(stdout, "%-40s %10s %12s %12s %10s %12s\n", pTitle, "trx", "samples", "lockwait", "maxsecs", "peaklock");
+
+	for (i = 0; i < n; i++)
+	{
+		fprintf(stdout, "%-40.40s %10" PRIu64 " %12" PRIu64 " %12" PRIu64 " %10" PRIu64 " %12" PRIu64 "\n", name(aSorted[i]->iKey), aSorted[i]->iTrx, aSorted[i]->iSamples, aSorted[i]->iLockWaits, aSorted[i]->iMaxSecs, aSorted[i]->iPeakLocked);
+	}
+
+	fprintf(stdout, "\n");
+
+	free(aSorted);
+}
+
+
+/**
+	* Print the report.
+	*
+	* @param   unsigned int iTop, number of longest transactions to list
+	* @return  void
+*/
+
+void printReport(unsigned int iTop)
+{
+	TrxAgg** aSorted = malloc(sizeof(TrxAgg*) * (mapTrx.iCount + 1));
+	char aFirst[32];
+	char aLast[32];
+	char aStarted[32];
+	uint32_t i;
+	uint32_t n = 0;
+
+	if (aSorted == NULL)
+	{
+		return;
+	}
+
+	for (i = 0; i < mapTrx.iSize; i++)
+	{
+		TrxAgg* pTrx = mapSlot(&mapTrx, i);
+
+		if (pTrx->iUsed)
+		{
+			aSorted[n++] = pTrx;
+		}
+	}
+
+	formatMicros(iFirstSample == UINT64_MAX ? 0 : iFirstSample, aFirst, sizeof(aFirst));
+	formatMicros(iLastSample, aLast, sizeof(aLast));
+
+	fprintf(stdout, "\n%s v.%s\n\n", APP_NAME, MB_VERSION);
+	fprintf(stdout, "blocks: %" PRIu64 "  rows: %" PRIu64 "  transactions: %u  span: %s to %s\n\n", iBlocks, iRows, n, aFirst, aLast);
+
+	printTimeline();
+
+	qsort(aSorted, n, sizeof(TrxAgg*), compareTrx);
+
+	fprintf(stdout, "Longest transactions\n\n");
+	fprintf(stdout, "%-20s %10s %10s %-16s %-16s %-19s %8s %9s %8s %10s %10s  %s\n", "trx", "thd", "ps", "user", "program", "start", "secs", "observed", "samples", "lockwait", "peaklock", "last query");
+
+	for (i = 0; i < n && i < iTop; i++)
+	{
+		TrxAgg const* t = aSorted[i];
+
+		formatCivil(t->iStarted, aStarted, sizeof(aStarted));
+
+		fprintf(stdout, "%-20" PRIu64 " %10" PRIu64 " %10" PRIu64 " %-16.16s %-16.16s %-19s %8" PRIu64 " %9.3f %8" PRIu64 " %10" PRIu64 " %10" PRIu64 "  %.80s\n",
+			t->iTrxId, t->iThread, t->iProcess, name(t->iUser), name(t->iProgram), aStarted, t->iMaxSecs, (double) (t->iLast - t->iFirst) / 1e6, t->iSamples, t->iLockWaits, t->iPeakLocked, name(t->iQuery));
+	}
+
+	fprintf(stdout, "\nPer user\n\n");
+	printGroups(&mapUser, "user");
+
+	fprintf(stdout, "Per table (first table referenced by each statement)\n\n");
+	printGroups(&mapTable, "table");
+
+	free(aSorted);
+}
+
+
+/**
+	* Print the sampling timeline: true sampling rate, lost samples, stalls and collection latency.
+	*
+	* @return  void
+*/
+
+void printTimeline(void)
+{
+	Timeline const* t = &timeline;
+	char aAt[32];
+
+	if (t->iCount == 0)
+	{
+		return;
+	}
+
+	formatMicros(t->iMaxGapAt, aAt, sizeof(aAt));
+
+	fprintf(stdout, "Sampling\n\n");
+	fprintf(stdout, "samples: %" PRIu64 "  runs: %" PRIu64 "  lost: %" PRIu64 "  incomplete: %" PRIu64 "\n", t->iCount, t->iRuns, t->iLost, t->iIncomplete);
+
+	if (t->iGaps > 0)
+	{
+		fprintf(stdout, "interval: mean %.3fms (set %.3fms)  max %.3fms after %s  stalls (over twice the interval): %" PRIu64 "\n",
+			(double) t->iGapSum / t->iGaps / 1000, (double) t->iIntervalSum / t->iGaps / 1000, (double) t->iMaxGap / 1000, aAt, t->iStalls);
+	}
+
+	fprintf(stdout, "query: mean %.3fms  max %.3fms    fetch: mean %.3fms  max %.3fms\n\n",
+		(double) t->iQuerySum / t->iCount / 1000, (double) t->iQueryMax / 1000, (double) t->iFetchSum / t->iCount / 1000, (double) t->iFetchMax / 1000);
+}
+
+
+/**
+	* Format a microsecond wall-clock time as local time.
+	*
+	* @param   uint64_t iMicros, microsecs since the epoch
+	* @param   char* pBuf, output buffer
+	* @param   size_t iLen, buffer length
+	* @return  void
+*/
+
+void formatMicros(uint64_t iMicros, char* pBuf, size_t iLen)
+{
+	time_t tSecs = (time_t) (iMicros / 1000000);
+	struct tm tmLocal;
+
+	localtime_r(&tSecs, &tmLocal);
+	strftime(pBuf, iLen, "%Y-%m-%d %H:%M:%S", &tmLocal);
+}
+
+
+/**
+	* Format a zone-less DATETIME (see TL_STARTED) back to its original text.
+	*
+	* @param   uint64_t iSecs, secs since 1970-01-01 00:00:00
+	* @param   char* pBuf, output buffer
+	* @param   size_t iLen, buffer length
+	* @return  void
+*/
+
+void formatCivil(uint64_t iSecs, char* pBuf, size_t iLen)
+{
+	time_t tSecs = (time_t) iSecs;
+	struct tm tmUTC;
+
+	gmtime_r(&tSecs, &tmUTC);
+	strftime(pBuf, iLen, "%Y-%m-%d %H:%M:%S", &tmUTC);
+}
+
+
+/**
+	* Interned string for display.
+	*
+	* @param   uint32_t iId, interned id
+	* @return  char*, '-' for NULL
+*/
+
+char const* name(uint32_t iId)
+{
+	return (iId >= interns.iCount) ? "-" : interns.aStr[iId];
+}
+
+
+/**
+	* Display program menu.
+	*
+	* @param   char* pFName, filename from aArgV[0]
+	* @return  void
+*/
+
+void menu(char* const pFName)
+{
+	fprintf(stdout, "\n%s v.%s\nby Tinram", APP_NAME, MB_VERSION);
+	fprintf(stdout, "\n\nUsage:\n");
+	fprintf(stdout, "\t%s [-n <top>] <logfile> [<logfile> ...]\n\n", pFName);
+	fprintf(stdout, "\tReads binary logs written by mysqltrxmon -b (decompress -z logs first).\n\n");
+}